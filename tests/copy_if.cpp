@@ -0,0 +1,70 @@
+#define BOOST_TEST_MODULE CopyIf
+#include <algorithm>
+#include <boost/test/unit_test.hpp>
+#include <vexcl/vector.hpp>
+#include <vexcl/copy_if.hpp>
+#include "context_setup.hpp"
+
+BOOST_AUTO_TEST_CASE(copy_if)
+{
+    const size_t n = 1024 * 1024;
+
+    std::vector<int> x = random_vector<int>(n);
+
+    vex::vector<int> X(ctx, x);
+    vex::vector<int> Y;
+
+    size_t m = vex::copy_if(2 * X, X > 50, Y);
+
+    std::vector<int> y;
+    for(auto v = x.begin(); v != x.end(); ++v)
+        if (*v > 50) y.push_back(2 * *v);
+
+    BOOST_REQUIRE_EQUAL(m, y.size());
+    BOOST_REQUIRE_EQUAL(Y.size(), y.size());
+
+    check_sample(Y, [&](size_t idx, int a) {
+            BOOST_CHECK_EQUAL(a, y[idx]);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(remove_if)
+{
+    const size_t n = 1024 * 1024;
+
+    std::vector<int> x = random_vector<int>(n);
+
+    vex::vector<int> X(ctx, x);
+
+    size_t m = vex::remove_if(X, X < 30);
+
+    x.erase(std::remove_if(x.begin(), x.end(), [](int v) { return v < 30; }), x.end());
+
+    BOOST_REQUIRE_EQUAL(m, x.size());
+    BOOST_REQUIRE_EQUAL(X.size(), x.size());
+
+    check_sample(X, [&](size_t idx, int a) {
+            BOOST_CHECK_EQUAL(a, x[idx]);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(stable_partition)
+{
+    const size_t n = 1024 * 1024;
+
+    std::vector<int> x = random_vector<int>(n);
+
+    vex::vector<int> X(ctx, x);
+
+    size_t m = vex::partition(X, X % 3 == 0);
+
+    auto mid = std::stable_partition(x.begin(), x.end(), [](int v) { return v % 3 == 0; });
+
+    BOOST_REQUIRE_EQUAL(m, static_cast<size_t>(mid - x.begin()));
+
+    check_sample(X, [&](size_t idx, int a) {
+            BOOST_CHECK_EQUAL(a, x[idx]);
+            });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
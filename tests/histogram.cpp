@@ -0,0 +1,65 @@
+#define BOOST_TEST_MODULE Histogram
+#include <boost/test/unit_test.hpp>
+#include <vexcl/vector.hpp>
+#include <vexcl/histogram.hpp>
+#include "context_setup.hpp"
+
+BOOST_AUTO_TEST_CASE(histogram)
+{
+    const size_t n     = 1024 * 1024;
+    const size_t nbins = 10;
+
+    std::vector<double> x = random_vector<double>(n);
+    vex::vector<double> X(ctx, x);
+
+    std::vector<size_t> h = vex::histogram(2 * X - 0.5, nbins, 0.0, 1.0);
+
+    std::vector<size_t> hh(nbins, 0);
+    for(auto v = x.begin(); v != x.end(); ++v) {
+        double y = 2 * *v - 0.5;
+        if (y >= 0 && y < 1) hh[static_cast<size_t>(y * nbins)]++;
+    }
+
+    // Values on the bin boundaries may land in either bin due to rounding.
+    for(size_t i = 0; i < nbins; ++i)
+        BOOST_CHECK_CLOSE(static_cast<double>(h[i]), static_cast<double>(hh[i]), 0.1);
+
+    // Integer bounds are converted to the value type of the expression.
+    std::vector<size_t> hi = vex::histogram(4 * X, nbins, 0, 4);
+
+    std::vector<size_t> hhi(nbins, 0);
+    for(auto v = x.begin(); v != x.end(); ++v) {
+        double y = 4 * *v;
+        if (y >= 0 && y < 4) hhi[static_cast<size_t>(y * nbins / 4)]++;
+    }
+
+    for(size_t i = 0; i < nbins; ++i)
+        BOOST_CHECK_CLOSE(static_cast<double>(hi[i]), static_cast<double>(hhi[i]), 0.1);
+}
+
+BOOST_AUTO_TEST_CASE(histogram_of_keys)
+{
+    const size_t n     = 1024 * 1024;
+    const size_t nbins = 64;
+
+    std::vector<int> k = random_vector<int>(n);
+    vex::vector<int> K(ctx, k);
+
+    std::vector<size_t> hh(nbins, 0);
+    for(auto v = k.begin(); v != k.end(); ++v)
+        if (*v < static_cast<int>(nbins)) hh[*v]++;
+
+    std::vector<size_t> h = vex::histogram(K, nbins);
+
+    vex::vector<cl_uint> H;
+    vex::histogram(K, nbins, H);
+
+    BOOST_REQUIRE_EQUAL(H.size(), nbins);
+
+    for(size_t i = 0; i < nbins; ++i) {
+        BOOST_CHECK_EQUAL(h[i], hh[i]);
+        BOOST_CHECK_EQUAL(static_cast<size_t>(H[i]), hh[i]);
+    }
+}
+
+BOOST_AUTO_TEST_SUITE_END()
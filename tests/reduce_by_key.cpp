@@ -0,0 +1,101 @@
+#define BOOST_TEST_MODULE ReduceByKey
+#include <boost/test/unit_test.hpp>
+#include <vexcl/vector.hpp>
+#include <vexcl/reduce_by_key.hpp>
+#include "context_setup.hpp"
+
+template <class Op>
+void host_reduce_by_key(
+        const std::vector<int> &k, const std::vector<double> &v,
+        std::vector<int> &ok, std::vector<double> &ov, Op op)
+{
+    ok.clear();
+    ov.clear();
+
+    for(size_t i = 0; i < k.size(); ++i) {
+        if (i == 0 || k[i] != k[i - 1]) {
+            ok.push_back(k[i]);
+            ov.push_back(v[i]);
+        } else {
+            ov.back() = op(ov.back(), v[i]);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(reduce_by_key_sum)
+{
+    const size_t n = 1024 * 1024;
+
+    std::vector<int> k = random_vector<int>(n);
+    std::sort(k.begin(), k.end());
+
+    std::vector<double> v = random_vector<double>(n);
+
+    vex::vector<int>    K(ctx, k);
+    vex::vector<double> V(ctx, v);
+
+    vex::vector<int>    OK;
+    vex::vector<double> OV;
+
+    size_t nseg = vex::reduce_by_key(K, 2 * V, OK, OV);
+
+    std::vector<int>    ok;
+    std::vector<double> ov;
+    host_reduce_by_key(k, v, ok, ov, [](double a, double b) { return a + b; });
+
+    BOOST_REQUIRE_EQUAL(nseg, ok.size());
+    BOOST_REQUIRE_EQUAL(OK.size(), ok.size());
+
+    check_sample(OK, OV, [&](size_t idx, int key, double val) {
+            BOOST_CHECK_EQUAL(key, ok[idx]);
+            BOOST_CHECK_CLOSE(val, 2 * ov[idx], 1e-6);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(reduce_by_key_max)
+{
+    const size_t n = 1024 * 1024;
+
+    std::vector<int> k = random_vector<int>(n);
+    std::sort(k.begin(), k.end());
+
+    std::vector<double> v = random_vector<double>(n);
+
+    vex::vector<int>    K(ctx, k);
+    vex::vector<double> V(ctx, v);
+
+    vex::vector<int>    OK;
+    vex::vector<double> OV;
+
+    size_t nseg = vex::reduce_by_key(K, V, OK, OV, vex::MAX());
+
+    std::vector<int>    ok;
+    std::vector<double> ov;
+    host_reduce_by_key(k, v, ok, ov, [](double a, double b) { return std::max(a, b); });
+
+    BOOST_REQUIRE_EQUAL(nseg, ok.size());
+
+    check_sample(OK, OV, [&](size_t idx, int key, double val) {
+            BOOST_CHECK_EQUAL(key, ok[idx]);
+            BOOST_CHECK_EQUAL(val, ov[idx]);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(reduce_by_key_single_segment)
+{
+    const size_t n = 1024;
+
+    vex::vector<int> K(ctx, n);
+    K = 42;
+
+    vex::vector<int>    OK;
+    vex::vector<size_t> OV;
+
+    size_t nseg = vex::reduce_by_key(K, 1, OK, OV);
+
+    BOOST_REQUIRE_EQUAL(nseg, 1U);
+    BOOST_CHECK_EQUAL(static_cast<int>(OK[0]), 42);
+    BOOST_CHECK_EQUAL(static_cast<size_t>(OV[0]), n);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
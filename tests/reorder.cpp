@@ -0,0 +1,173 @@
+#define BOOST_TEST_MODULE MatrixReordering
+#include <random>
+#include <boost/test/unit_test.hpp>
+#include <vexcl/vector.hpp>
+#include <vexcl/spmat.hpp>
+#include "context_setup.hpp"
+
+// 2D Poisson problem on a square grid with randomly shuffled unknowns.
+void shuffled_poisson(size_t m,
+        std::vector<size_t> &row, std::vector<size_t> &col, std::vector<double> &val)
+{
+    const size_t n = m * m;
+
+    std::vector<size_t> shuffle(n);
+    for(size_t i = 0; i < n; ++i) shuffle[i] = i;
+    std::mt19937 rng(static_cast<unsigned>(m));
+    std::shuffle(shuffle.begin(), shuffle.end(), rng);
+
+    row.assign(1, 0);
+    col.clear();
+    val.clear();
+
+    {
+        std::vector<size_t> unshuffle(n);
+        for(size_t i = 0; i < n; ++i) unshuffle[shuffle[i]] = i;
+
+        for(size_t k = 0; k < n; ++k) {
+            size_t idx = unshuffle[k];
+            size_t i = idx % m;
+            size_t j = idx / m;
+
+            std::vector< std::pair<size_t, double> > r;
+
+            r.push_back(std::make_pair(shuffle[idx], 4.0));
+            if (i > 0)     r.push_back(std::make_pair(shuffle[idx - 1], -1.0));
+            if (i + 1 < m) r.push_back(std::make_pair(shuffle[idx + 1], -1.0));
+            if (j > 0)     r.push_back(std::make_pair(shuffle[idx - m], -1.0));
+            if (j + 1 < m) r.push_back(std::make_pair(shuffle[idx + m], -1.0));
+
+            std::sort(r.begin(), r.end());
+
+            for(auto e = r.begin(); e != r.end(); ++e) {
+                col.push_back(e->first);
+                val.push_back(e->second);
+            }
+
+            row.push_back(col.size());
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(rcm_reordering)
+{
+    const size_t m = 64;
+    const size_t n = m * m;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    shuffled_poisson(m, row, col, val);
+
+    vex::reorder<double> R(ctx, n, row.data(), col.data(), val.data());
+
+    BOOST_CHECK_EQUAL(R.permutation().size(), n);
+    BOOST_CHECK(R.reordered().bandwidth < R.original().bandwidth);
+    BOOST_CHECK(R.reordered().bandwidth <= 2 * m);
+    BOOST_CHECK(R.reordered().ghosts <= R.original().ghosts);
+
+    vex::SpMat<double> A(ctx, n, n, R.row(), R.col(), R.val());
+
+    std::vector<double> x = random_vector<double>(n);
+
+    vex::vector<double> X(ctx, x);
+    vex::vector<double> Xr(ctx, n);
+    vex::vector<double> Yr(ctx, n);
+    vex::vector<double> Y(ctx, n);
+
+    Xr = R.forward(X);
+
+    check_sample(Xr, [&](size_t idx, double a) {
+            BOOST_CHECK_EQUAL(a, x[R.permutation()[idx]]);
+            });
+
+    Yr = A * Xr;
+    Y  = R.inverse(Yr);
+
+    check_sample(Y, [&](size_t idx, double a) {
+            double sum = 0;
+            for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                sum += val[j] * x[col[j]];
+
+            BOOST_CHECK_CLOSE(a, sum, 1e-8);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(graph_partitioning)
+{
+    const size_t m = 64;
+    const size_t n = m * m;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    shuffled_poisson(m, row, col, val);
+
+    vex::reorder<double> R(ctx, n, row.data(), col.data(), val.data(),
+            vex::reorder_graph);
+
+    BOOST_CHECK_EQUAL(R.partition().size(), n);
+    BOOST_CHECK(R.reordered().ghosts <= R.original().ghosts);
+
+    vex::SpMat<double> A(ctx, n, n, R.row(), R.col(), R.val(), R.partition());
+
+    std::vector<double> x = random_vector<double>(n);
+
+    vex::vector<double> X(ctx, x);
+    vex::vector<double> Xr(ctx, R.partition());
+    vex::vector<double> Yr(ctx, R.partition());
+    vex::vector<double> Y(ctx, n);
+
+    Xr = R.forward(X);
+    Yr = A * Xr;
+    Y  = R.inverse(Yr);
+
+    check_sample(Y, [&](size_t idx, double a) {
+            double sum = 0;
+            for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                sum += val[j] * x[col[j]];
+
+            BOOST_CHECK_CLOSE(a, sum, 1e-8);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(reordered_matrix)
+{
+    const size_t m = 64;
+    const size_t n = m * m;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    shuffled_poisson(m, row, col, val);
+
+    vex::SpMat<double> A(ctx, n, row.data(), col.data(), val.data(),
+            vex::reorder_rcm);
+
+    const std::vector<size_t> &perm = A.permutation();
+    BOOST_REQUIRE_EQUAL(perm.size(), n);
+
+    std::vector<double> x = random_vector<double>(n);
+    std::vector<double> xr(n);
+    for(size_t i = 0; i < n; ++i) xr[i] = x[perm[i]];
+
+    vex::vector<double> X(ctx, A.row_partition(), xr.data());
+    vex::vector<double> Y(ctx, A.row_partition());
+
+    Y = A * X;
+
+    check_sample(Y, [&](size_t idx, double a) {
+            size_t i = perm[idx];
+
+            double sum = 0;
+            for(size_t j = row[i]; j < row[i + 1]; j++)
+                sum += val[j] * x[col[j]];
+
+            BOOST_CHECK_CLOSE(a, sum, 1e-8);
+            });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,77 @@
+#define BOOST_TEST_MODULE Scan
+#include <algorithm>
+#include <numeric>
+#include <boost/test/unit_test.hpp>
+#include <vexcl/vector.hpp>
+#include <vexcl/scan.hpp>
+#include "context_setup.hpp"
+
+BOOST_AUTO_TEST_CASE(inclusive_scan)
+{
+    const size_t n = 1024 * 1024;
+
+    std::vector<int> x = random_vector<int>(n);
+
+    vex::vector<int> X(ctx, x);
+    vex::vector<int> Y(ctx, n);
+
+    vex::inclusive_scan(X, Y);
+
+    std::partial_sum(x.begin(), x.end(), x.begin());
+
+    check_sample(Y, [&](size_t idx, int a) {
+            BOOST_CHECK_EQUAL(a, x[idx]);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(exclusive_scan)
+{
+    const size_t n = 1024 * 1024;
+
+    std::vector<int> x = random_vector<int>(n);
+
+    vex::vector<int> X(ctx, x);
+    vex::vector<int> Y(ctx, n);
+
+    vex::exclusive_scan(2 * X + 1, Y);
+
+    std::vector<int> y(n);
+    y[0] = 0;
+    for(size_t i = 1; i < n; ++i) y[i] = y[i - 1] + 2 * x[i - 1] + 1;
+
+    check_sample(Y, [&](size_t idx, int a) {
+            BOOST_CHECK_EQUAL(a, y[idx]);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(inplace_max_scan)
+{
+    const size_t n = 1024 * 1024;
+
+    std::vector<double> x = random_vector<double>(n);
+
+    vex::vector<double> X(ctx, x);
+
+    vex::inclusive_scan(X, X, vex::MAX());
+
+    for(size_t i = 1; i < n; ++i) x[i] = std::max(x[i], x[i - 1]);
+
+    check_sample(X, [&](size_t idx, double a) {
+            BOOST_CHECK_EQUAL(a, x[idx]);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(exclusive_scan_with_init)
+{
+    const size_t n = 1000;
+
+    vex::vector<size_t> Y(ctx, n);
+
+    vex::exclusive_scan(1, Y, vex::SUM(), static_cast<size_t>(42));
+
+    check_sample(Y, [&](size_t idx, size_t a) {
+            BOOST_CHECK_EQUAL(a, idx + 42);
+            });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,212 @@
+#define BOOST_TEST_MODULE IterativeSolvers
+#include <boost/test/unit_test.hpp>
+#include <vexcl/vector.hpp>
+#include <vexcl/spmat.hpp>
+#include <vexcl/solver.hpp>
+#include "context_setup.hpp"
+
+// Convection-diffusion problem on a m x m grid. The matrix is symmetric
+// when b == 0.
+void poisson(size_t m, double b,
+        std::vector<size_t> &row, std::vector<size_t> &col, std::vector<double> &val)
+{
+    const size_t n = m * m;
+
+    row.clear();
+    col.clear();
+    val.clear();
+
+    row.reserve(n + 1);
+    row.push_back(0);
+
+    for(size_t j = 0, i = 0; j < m; ++j) {
+        for(size_t k = 0; k < m; ++k, ++i) {
+            if (j > 0)     { col.push_back(i - m); val.push_back(-1); }
+            if (k > 0)     { col.push_back(i - 1); val.push_back(-1 - b); }
+
+            col.push_back(i);
+            val.push_back(4);
+
+            if (k + 1 < m) { col.push_back(i + 1); val.push_back(-1 + b); }
+            if (j + 1 < m) { col.push_back(i + m); val.push_back(-1); }
+
+            row.push_back(col.size());
+        }
+    }
+}
+
+// Relative residual of the solution computed on host.
+double residual(
+        const std::vector<size_t> &row, const std::vector<size_t> &col,
+        const std::vector<double> &val, const std::vector<double> &rhs,
+        const vex::vector<double> &X)
+{
+    const size_t n = rhs.size();
+
+    std::vector<double> x(n);
+    vex::copy(X, x);
+
+    double norm_r = 0, norm_f = 0;
+    for(size_t i = 0; i < n; ++i) {
+        double r = rhs[i];
+        for(size_t j = row[i]; j < row[i + 1]; ++j)
+            r -= val[j] * x[col[j]];
+
+        norm_r += r * r;
+        norm_f += rhs[i] * rhs[i];
+    }
+
+    return sqrt(norm_r / norm_f);
+}
+
+template <class Solver>
+void test_solver(const vex::Context &ctx, double b, Solver &solve)
+{
+    const size_t m = 32;
+    const size_t n = m * m;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    poisson(m, b, row, col, val);
+
+    std::vector<double> rhs = random_vector<double>(n);
+
+    vex::SpMat<double> A(ctx, n, n, row.data(), col.data(), val.data());
+    vex::solver::jacobi<double> jacobi(ctx, n, row.data(), col.data(), val.data());
+
+    vex::vector<double> F(ctx, rhs);
+    vex::vector<double> X(ctx, n);
+
+    size_t iters;
+    double resid;
+
+    X = 0;
+    std::tie(iters, resid) = solve(A, vex::solver::identity(), F, X);
+
+    BOOST_CHECK(iters < 1000);
+    BOOST_CHECK_SMALL(resid, 1e-6);
+    BOOST_CHECK_SMALL(residual(row, col, val, rhs, X), 1e-5);
+
+    X = 0;
+    std::tie(iters, resid) = solve(A, jacobi, F, X);
+
+    BOOST_CHECK(iters < 1000);
+    BOOST_CHECK_SMALL(resid, 1e-6);
+    BOOST_CHECK_SMALL(residual(row, col, val, rhs, X), 1e-5);
+}
+
+BOOST_AUTO_TEST_CASE(conjugate_gradient)
+{
+    vex::solver::cg<double> solve(ctx, 32 * 32, 1000, 1e-6);
+    test_solver(ctx, 0, solve);
+}
+
+BOOST_AUTO_TEST_CASE(bicgstab)
+{
+    vex::solver::bicgstab<double> solve(ctx, 32 * 32, 1000, 1e-6);
+    test_solver(ctx, 0.5, solve);
+}
+
+BOOST_AUTO_TEST_CASE(gmres)
+{
+    vex::solver::gmres<double> solve(ctx, 32 * 32, 1000, 1e-6, 30);
+    test_solver(ctx, 0.5, solve);
+}
+
+BOOST_AUTO_TEST_CASE(explicit_partitioning)
+{
+    const size_t m = 32;
+    const size_t n = m * m;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    poisson(m, 0.5, row, col, val);
+
+    std::vector<double> rhs = random_vector<double>(n);
+
+    // Uneven split, as with a reordered matrix.
+    const size_t ndev = ctx.size();
+    std::vector<size_t> part(ndev + 1);
+    for(size_t d = 0; d <= ndev; ++d)
+        part[d] = n * d * d / (ndev * ndev);
+
+    vex::partitioning p(part);
+
+    vex::SpMat<double> A(ctx, n, n, row.data(), col.data(), val.data(), p);
+
+    vex::vector<double> F(ctx, p, rhs.data());
+    vex::vector<double> X(ctx, p);
+
+    size_t iters;
+    double resid;
+
+    // Work vectors are allocated with the given partitioning.
+    vex::solver::gmres<double> gmres(ctx, p, 1000, 1e-6, 30);
+
+    X = 0;
+    std::tie(iters, resid) = gmres(A, vex::solver::identity(), F, X);
+
+    BOOST_CHECK_SMALL(resid, 1e-6);
+    BOOST_CHECK_SMALL(residual(row, col, val, rhs, X), 1e-5);
+
+    // Work vectors are reallocated to match the right-hand side.
+    vex::solver::bicgstab<double> bicgstab(ctx, n, 1000, 1e-6);
+
+    X = 0;
+    std::tie(iters, resid) = bicgstab(A, vex::solver::identity(), F, X);
+
+    BOOST_CHECK_SMALL(resid, 1e-6);
+    BOOST_CHECK_SMALL(residual(row, col, val, rhs, X), 1e-5);
+}
+
+BOOST_AUTO_TEST_CASE(amg_preconditioner)
+{
+    const size_t m = 64;
+    const size_t n = m * m;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    poisson(m, 0, row, col, val);
+
+    std::vector<double> rhs = random_vector<double>(n);
+
+    vex::SpMat<double> A(ctx, n, n, row.data(), col.data(), val.data());
+
+    vex::vector<double> F(ctx, rhs);
+    vex::vector<double> X(ctx, n);
+
+    vex::solver::cg<double> solve(ctx, n, 100, 1e-6);
+
+    vex::solver::amg<double>::params prm;
+
+    prm.relax = vex::solver::amg<double>::damped_jacobi;
+    vex::solver::amg<double> jacobi(ctx, n, row.data(), col.data(), val.data(), prm);
+
+    prm.relax = vex::solver::amg<double>::spai0;
+    vex::solver::amg<double> spai0(ctx, n, row.data(), col.data(), val.data(), prm);
+
+    BOOST_CHECK(spai0.depth() > 1);
+
+    size_t iters;
+    double resid;
+
+    X = 0;
+    std::tie(iters, resid) = solve(A, jacobi, F, X);
+
+    BOOST_CHECK(iters < 30);
+    BOOST_CHECK_SMALL(residual(row, col, val, rhs, X), 1e-5);
+
+    X = 0;
+    std::tie(iters, resid) = solve(A, spai0, F, X);
+
+    BOOST_CHECK(iters < 30);
+    BOOST_CHECK_SMALL(residual(row, col, val, rhs, X), 1e-5);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,70 @@
+#define BOOST_TEST_MODULE Sort
+#include <algorithm>
+#include <boost/test/unit_test.hpp>
+#include <vexcl/vector.hpp>
+#include <vexcl/sort.hpp>
+#include "context_setup.hpp"
+
+BOOST_AUTO_TEST_CASE(sort_keys)
+{
+    const size_t n = 1000 * 1000;
+
+    std::vector<float> k = random_vector<float>(n);
+    for(auto i = k.begin(); i != k.end(); ++i) *i = 2 * *i - 1;
+
+    vex::vector<float> K(ctx, k);
+
+    vex::sort(K);
+
+    std::sort(k.begin(), k.end());
+
+    check_sample(K, [&](size_t idx, float a) {
+            BOOST_CHECK_EQUAL(a, k[idx]);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(sort_signed_keys)
+{
+    const size_t n = 1000 * 1000;
+
+    std::vector<int> k = random_vector<int>(n);
+    for(auto i = k.begin(); i != k.end(); ++i) *i = 50 - *i;
+
+    vex::vector<int> K(ctx, k);
+
+    vex::sort(K);
+
+    std::sort(k.begin(), k.end());
+
+    check_sample(K, [&](size_t idx, int a) {
+            BOOST_CHECK_EQUAL(a, k[idx]);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(sort_narrow_keys_by_key)
+{
+    const size_t n = 1000 * 1000;
+
+    std::vector<cl_uint> k = random_vector<cl_uint>(n);
+    std::vector<double>  v = random_vector<double>(n);
+
+    vex::vector<cl_uint> K(ctx, k);
+    vex::vector<double>  V(ctx, v);
+
+    // Random integers are below 2^7.
+    vex::sort_by_key<7>(K, V);
+
+    std::vector<size_t> perm(n);
+    for(size_t i = 0; i < n; ++i) perm[i] = i;
+
+    std::stable_sort(perm.begin(), perm.end(), [&](size_t a, size_t b) {
+            return k[a] < k[b];
+            });
+
+    check_sample(K, V, [&](size_t idx, cl_uint key, double val) {
+            BOOST_CHECK_EQUAL(key, k[perm[idx]]);
+            BOOST_CHECK_EQUAL(val, v[perm[idx]]);
+            });
+}
+
+BOOST_AUTO_TEST_SUITE_END()
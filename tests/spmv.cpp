@@ -2,7 +2,9 @@
 #include <boost/test/unit_test.hpp>
 #include <vexcl/vector.hpp>
 #include <vexcl/multivector.hpp>
+#include <vexcl/reductor.hpp>
 #include <vexcl/spmat.hpp>
+#include <vexcl/spmat/io.hpp>
 #include "context_setup.hpp"
 
 template <typename RT, typename CT, typename VT>
@@ -90,6 +92,78 @@ BOOST_AUTO_TEST_CASE(vector_product)
             });
 }
 
+BOOST_AUTO_TEST_CASE(fused_additive_transforms)
+{
+    const size_t n = 1024;
+
+    std::vector<size_t> arow, brow;
+    std::vector<size_t> acol, bcol;
+    std::vector<double> aval, bval;
+
+    random_matrix(n, n, 16, arow, acol, aval);
+    random_matrix(n, n, 16, brow, bcol, bval);
+
+    std::vector<double> x = random_vector<double>(n);
+    std::vector<double> u = random_vector<double>(n);
+
+    vex::SpMat <double> A(ctx, n, n, arow.data(), acol.data(), aval.data());
+    vex::SpMat <double> B(ctx, n, n, brow.data(), bcol.data(), bval.data(),
+            vex::spmat_csr_scalar);
+
+    vex::vector<double> X(ctx, x);
+    vex::vector<double> U(ctx, u);
+    vex::vector<double> Y(ctx, n);
+
+    auto Ax = [&](size_t i) {
+        double sum = 0;
+        for(size_t j = arow[i]; j < arow[i + 1]; j++) sum += aval[j] * x[acol[j]];
+        return sum;
+    };
+
+    auto Au = [&](size_t i) {
+        double sum = 0;
+        for(size_t j = arow[i]; j < arow[i + 1]; j++) sum += aval[j] * u[acol[j]];
+        return sum;
+    };
+
+    auto Bu = [&](size_t i) {
+        double sum = 0;
+        for(size_t j = brow[i]; j < brow[i + 1]; j++) sum += bval[j] * u[bcol[j]];
+        return sum;
+    };
+
+    Y = 2 * X + A * X - 3 * (B * U);
+
+    check_sample(Y, [&](size_t idx, double a) {
+            BOOST_CHECK_CLOSE(a, 2 * x[idx] + Ax(idx) - 3 * Bu(idx), 1e-8);
+            });
+
+    Y -= A * X - B * U;
+
+    check_sample(Y, [&](size_t idx, double a) {
+            BOOST_CHECK_CLOSE(a, 2 * x[idx] - 2 * Bu(idx), 1e-8);
+            });
+
+    // Same matrix in several terms.
+    Y = A * X + A * U;
+
+    check_sample(Y, [&](size_t idx, double a) {
+            BOOST_CHECK_CLOSE(a, Ax(idx) + Au(idx), 1e-8);
+            });
+
+    // Vector CSR matrix keeps its own kernel.
+    vex::SpMat <double> C(ctx, n, n, brow.data(), bcol.data(), bval.data(),
+            vex::spmat_csr_vector);
+
+    BOOST_CHECK(!C.inline_is_efficient());
+
+    Y = X - C * U;
+
+    check_sample(Y, [&](size_t idx, double a) {
+            BOOST_CHECK_CLOSE(a, x[idx] - Bu(idx), 1e-8);
+            });
+}
+
 BOOST_AUTO_TEST_CASE(non_square_matrix)
 {
     const size_t n = 1024;
@@ -118,6 +192,271 @@ BOOST_AUTO_TEST_CASE(non_square_matrix)
             });
 }
 
+BOOST_AUTO_TEST_CASE(transposed_product)
+{
+    const size_t n = 1024;
+    const size_t m = 2 * n;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    random_matrix(n, m, 16, row, col, val);
+
+    std::vector<double> x = random_vector<double>(n);
+    std::vector<double> y(m, 0.0);
+
+    for(size_t i = 0; i < n; ++i)
+        for(size_t j = row[i]; j < row[i + 1]; ++j)
+            y[col[j]] += val[j] * x[i];
+
+    vex::spmat_format format[] = {
+        vex::spmat_hybrid_ell, vex::spmat_sell, vex::spmat_csr_scalar
+    };
+
+    vex::transpose_method method[] = {
+        vex::transpose_cached, vex::transpose_atomic
+    };
+
+    for(int f = 0; f < 3; ++f) {
+        vex::SpMat <double> A(ctx, n, m, row.data(), col.data(), val.data(), format[f]);
+        vex::vector<double> X(ctx, x);
+        vex::vector<double> Y(ctx, m);
+
+        for(int k = 0; k < 2; ++k) {
+            Y = vex::transp(A, method[k]) * X;
+
+            check_sample(Y, [&](size_t idx, double a) {
+                    BOOST_CHECK_CLOSE(a, y[idx], 1e-8);
+                    });
+
+            Y -= 2 * (vex::transp(A, method[k]) * X);
+
+            check_sample(Y, [&](size_t idx, double a) {
+                    BOOST_CHECK_CLOSE(a, -y[idx], 1e-8);
+                    });
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(update_values)
+{
+    const size_t n = 1024;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    random_matrix(n, n, 16, row, col, val);
+
+    std::vector<double> x = random_vector<double>(n);
+    std::vector<double> v = random_vector<double>(val.size());
+
+    vex::spmat_format format[] = {
+        vex::spmat_hybrid_ell, vex::spmat_sell, vex::spmat_csr_scalar
+    };
+
+    for(int f = 0; f < 3; ++f) {
+        vex::SpMat <double> A(ctx, n, n, row.data(), col.data(), val.data(), format[f]);
+        vex::vector<double> X(ctx, x);
+        vex::vector<double> Y(ctx, n);
+
+        A.update_values(v.data());
+
+        Y = A * X;
+
+        check_sample(Y, [&](size_t idx, double a) {
+                double sum = 0;
+                for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                    sum += v[j] * x[col[j]];
+
+                BOOST_CHECK_CLOSE(a, sum, 1e-8);
+                });
+    }
+}
+
+BOOST_AUTO_TEST_CASE(sparse_matrix_product)
+{
+    const size_t n = 1024;
+    const size_t m = 512;
+
+    std::vector<cl::CommandQueue> queue(1, ctx.queue(0));
+
+    std::vector<size_t> arow, brow;
+    std::vector<size_t> acol, bcol;
+    std::vector<double> aval, bval;
+
+    random_matrix(n, n, 16, arow, acol, aval);
+    random_matrix(n, m, 16, brow, bcol, bval);
+
+    std::vector<double> x = random_vector<double>(m);
+
+    vex::spmat_format format[] = {
+        vex::spmat_hybrid_ell, vex::spmat_sell, vex::spmat_csr_scalar
+    };
+
+    for(int f = 0; f < 3; ++f) {
+        vex::SpMat <double> A(queue, n, n, arow.data(), acol.data(), aval.data(), format[f]);
+        vex::SpMat <double> B(queue, n, m, brow.data(), bcol.data(), bval.data(), format[2 - f]);
+
+        vex::SpMat <double> C(A, B);
+
+        BOOST_CHECK_EQUAL(C.rows(), n);
+        BOOST_CHECK_EQUAL(C.cols(), m);
+
+        vex::vector<double> X(queue, x);
+        vex::vector<double> Y(queue, n);
+
+        for(int pass = 0; pass < 2; ++pass) {
+            // Second pass reuses the pattern with new values of A.
+            if (pass) {
+                aval = random_vector<double>(aval.size());
+                A.update_values(aval.data());
+                C.update_product(A, B);
+            }
+
+            std::vector<double> bx(n, 0.0);
+            for(size_t i = 0; i < n; ++i)
+                for(size_t j = brow[i]; j < brow[i + 1]; ++j)
+                    bx[i] += bval[j] * x[bcol[j]];
+
+            Y = C * X;
+
+            check_sample(Y, [&](size_t idx, double a) {
+                    double sum = 0;
+                    for(size_t j = arow[idx]; j < arow[idx + 1]; j++)
+                        sum += aval[j] * bx[acol[j]];
+
+                    BOOST_CHECK_CLOSE(a, sum, 1e-8);
+                    });
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(assemble_from_triplets)
+{
+    const size_t n = 1024;
+    const size_t m = 512;
+
+    std::vector<cl::CommandQueue> queue(1, ctx.queue(0));
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    random_matrix(n, m, 16, row, col, val);
+
+    // Each nonzero is split into two shuffled triplets.
+    std::vector<size_t> tr, tc;
+    for(size_t i = 0; i < n; ++i) {
+        for(size_t j = row[i]; j < row[i + 1]; ++j) {
+            tr.push_back(i); tc.push_back(col[j]);
+            tr.push_back(i); tc.push_back(col[j]);
+        }
+    }
+
+    std::vector<size_t> order(tr.size());
+    for(size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::random_shuffle(order.begin(), order.end());
+
+    std::vector<size_t> r(tr.size()), c(tr.size());
+    for(size_t i = 0; i < order.size(); ++i) {
+        r[i] = tr[order[i]];
+        c[i] = tc[order[i]];
+    }
+
+    vex::vector<size_t> R(queue, r);
+    vex::vector<size_t> C(queue, c);
+    vex::vector<double> V(queue, r.size());
+
+    std::vector<double> x = random_vector<double>(m);
+
+    vex::vector<double> X(queue, x);
+    vex::vector<double> Y(queue, n);
+
+    V = 0.5;
+
+    vex::SpMat<double> A(n, m, R, C, V);
+
+    BOOST_CHECK_EQUAL(A.nonzeros(), row[n]);
+
+    for(int pass = 0; pass < 2; ++pass) {
+        if (pass) {
+            V = 1.5;
+            A.reassemble(V);
+        }
+
+        double scale = pass ? 3.0 : 1.0;
+
+        Y = A * X;
+
+        check_sample(Y, [&](size_t idx, double a) {
+                double sum = 0;
+                for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                    sum += scale * x[col[j]];
+
+                BOOST_CHECK_CLOSE(a, sum, 1e-8);
+                });
+    }
+}
+
+BOOST_AUTO_TEST_CASE(read_matrix_file)
+{
+    const size_t n = 1024;
+    const size_t m = 512;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    random_matrix(n, m, 16, row, col, val);
+
+    std::vector<double> x = random_vector<double>(m);
+
+    // MatrixMarket file with entries in reversed order.
+    {
+        std::ofstream f("spmv_test.mtx");
+        f << "%%MatrixMarket matrix coordinate real general\n"
+             "% test matrix\n"
+          << n << " " << m << " " << row[n] << "\n";
+        f.precision(20);
+
+        for(size_t i = n; i-- > 0; )
+            for(size_t j = row[i + 1]; j-- > row[i]; )
+                f << i + 1 << " " << col[j] + 1 << " " << val[j] << "\n";
+    }
+
+    vex::write_binary_csr("spmv_test.bin", n, m, row.data(), col.data(), val.data());
+
+    const char *fname[] = {"spmv_test.mtx", "spmv_test.bin"};
+
+    for(int k = 0; k < 2; ++k) {
+        vex::spmat_reader<double> f(fname[k]);
+
+        BOOST_REQUIRE_EQUAL(f.rows(), n);
+        BOOST_REQUIRE_EQUAL(f.cols(), m);
+        BOOST_REQUIRE_EQUAL(f.nonzeros(), row[n]);
+
+        vex::SpMat<double> A(ctx, f.rows(), f.cols(), f.row(), f.col(), f.val());
+
+        vex::vector<double> X(ctx, x);
+        vex::vector<double> Y(ctx, n);
+
+        Y = A * X;
+
+        check_sample(Y, [&](size_t idx, double a) {
+                double sum = 0;
+                for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                    sum += val[j] * x[col[j]];
+
+                BOOST_CHECK_CLOSE(a, sum, 1e-8);
+                });
+    }
+
+    std::remove("spmv_test.mtx");
+    std::remove("spmv_test.bin");
+}
+
 BOOST_AUTO_TEST_CASE(non_default_types)
 {
     const size_t n = 1024;
@@ -145,6 +484,42 @@ BOOST_AUTO_TEST_CASE(non_default_types)
             });
 }
 
+BOOST_AUTO_TEST_CASE(mixed_precision)
+{
+    const size_t n = 1024;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    random_matrix(n, n, 16, row, col, val);
+
+    std::vector<double> x = random_vector<double>(n);
+
+    vex::spmat_format format[] = {
+        vex::spmat_hybrid_ell, vex::spmat_sell, vex::spmat_csr_scalar
+    };
+
+    for(int f = 0; f < 3; ++f) {
+        vex::SpMat <double, size_t, size_t, float> A(
+                ctx, n, n, row.data(), col.data(), val.data(), format[f]);
+        vex::vector<double> X(ctx, x);
+        vex::vector<double> Y(ctx, n);
+
+        Y = A * X;
+
+        // Values are rounded to single precision, products are summed in
+        // double precision.
+        check_sample(Y, [&](size_t idx, double a) {
+                double sum = 0;
+                for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                    sum += static_cast<float>(val[j]) * x[col[j]];
+
+                BOOST_CHECK_CLOSE(a, sum, 1e-8);
+                });
+    }
+}
+
 BOOST_AUTO_TEST_CASE(empty_rows)
 {
     const size_t n = 1024;
@@ -262,6 +637,172 @@ BOOST_AUTO_TEST_CASE(ccsr_vector_product)
             });
 }
 
+BOOST_AUTO_TEST_CASE(ccsr_multi_device)
+{
+    const size_t n = 32;
+    const double h2i = (n - 1) * (n - 1);
+
+    // Unique rows: identity for boundary points, 7-point Laplace stencil
+    // for internal points.
+    std::vector<size_t> row(3);
+    std::vector<int>    col(8);
+    std::vector<double> val(8);
+
+    row[0] = 0;
+    row[1] = 1;
+    row[2] = 8;
+
+    int    c[] = {0, -static_cast<int>(n * n), -static_cast<int>(n), -1, 0, 1,
+                  static_cast<int>(n), static_cast<int>(n * n)};
+    double v[] = {1, -h2i, -h2i, -h2i, 6 * h2i, -h2i, -h2i, -h2i};
+
+    std::copy(c, c + 8, col.begin());
+    std::copy(v, v + 8, val.begin());
+
+    std::vector<size_t> idx;
+    idx.reserve(n * n * n);
+
+    for(size_t k = 0; k < n; k++)
+        for(size_t j = 0; j < n; j++)
+            for(size_t i = 0; i < n; i++)
+                idx.push_back(
+                        i == 0 || i == (n - 1) ||
+                        j == 0 || j == (n - 1) ||
+                        k == 0 || k == (n - 1) ? 0 : 1);
+
+    std::vector<double> x = random_vector<double>(n * n * n);
+
+    vex::SpMatCCSR<double,int> A(ctx, x.size(), row.size() - 1,
+            idx.data(), row.data(), col.data(), val.data());
+
+    vex::vector<double> X(ctx, x);
+    vex::vector<double> Y(ctx, x.size());
+
+    Y = X - A * X;
+
+    check_sample(Y, [&](size_t ii, double a) {
+            double sum = 0;
+            size_t i = idx[ii];
+            for(size_t j = row[i]; j < row[i + 1]; j++)
+                sum += val[j] * x[ii + col[j]];
+
+            BOOST_CHECK_CLOSE(a, x[ii] - sum, 1e-8);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(dia_vector_product)
+{
+    const size_t m = 64;
+    const size_t n = m * m;
+
+    // 2D Poisson problem on a m x m grid.
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    row.reserve(n + 1);
+    row.push_back(0);
+
+    for(size_t j = 0, i = 0; j < m; ++j) {
+        for(size_t k = 0; k < m; ++k, ++i) {
+            if (j > 0)     { col.push_back(i - m); val.push_back(-1); }
+            if (k > 0)     { col.push_back(i - 1); val.push_back(-1); }
+
+            col.push_back(i);
+            val.push_back(4);
+
+            if (k + 1 < m) { col.push_back(i + 1); val.push_back(-1); }
+            if (j + 1 < m) { col.push_back(i + m); val.push_back(-1); }
+
+            row.push_back(col.size());
+        }
+    }
+
+    std::vector<double> x = random_vector<double>(n);
+
+    vex::SpMatDIA<double, int> A(ctx, n, row.data(), col.data(), val.data());
+
+    BOOST_CHECK_EQUAL(A.diagonals(), 5U);
+
+    vex::vector<double> X(ctx, x);
+    vex::vector<double> Y(ctx, n);
+
+    Y = X + A * X;
+
+    check_sample(Y, [&](size_t idx, double a) {
+            double sum = x[idx];
+            for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                sum += val[j] * x[col[j]];
+
+            BOOST_CHECK_CLOSE(a, sum, 1e-8);
+            });
+
+    // Two products with the same matrix in one expression.
+    std::vector<double> z = random_vector<double>(n);
+    vex::vector<double> Z(ctx, z);
+
+    Y = A * X + A * Z;
+
+    check_sample(Y, [&](size_t idx, double a) {
+            double sum = 0;
+            for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                sum += val[j] * (x[col[j]] + z[col[j]]);
+
+            BOOST_CHECK_CLOSE(a, sum, 1e-8);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(matrix_powers)
+{
+    const size_t m = 64;
+    const size_t n = m * m;
+
+    // 2D Poisson problem on a m x m grid.
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    row.reserve(n + 1);
+    row.push_back(0);
+
+    for(size_t j = 0, i = 0; j < m; ++j) {
+        for(size_t k = 0; k < m; ++k, ++i) {
+            if (j > 0)     { col.push_back(i - m); val.push_back(-0.25); }
+            if (k > 0)     { col.push_back(i - 1); val.push_back(-0.25); }
+
+            col.push_back(i);
+            val.push_back(1);
+
+            if (k + 1 < m) { col.push_back(i + 1); val.push_back(-0.25); }
+            if (j + 1 < m) { col.push_back(i + m); val.push_back(-0.25); }
+
+            row.push_back(col.size());
+        }
+    }
+
+    std::vector<double> x = random_vector<double>(n);
+
+    vex::SpMatPowers<double> A(ctx, n, row.data(), col.data(), val.data(), 3);
+
+    vex::vector<double> X(ctx, x);
+    vex::multivector<double, 4> Y(ctx, n);
+
+    A(X, Y);
+
+    std::vector<double> y = x;
+    for(size_t p = 0; p < 4; ++p) {
+        check_sample(Y(p), [&](size_t idx, double a) {
+                BOOST_CHECK_CLOSE(a, y[idx], 1e-8);
+                });
+
+        std::vector<double> t(n, 0);
+        for(size_t i = 0; i < n; ++i)
+            for(size_t j = row[i]; j < row[i + 1]; ++j)
+                t[i] += val[j] * y[col[j]];
+        y.swap(t);
+    }
+}
+
 BOOST_AUTO_TEST_CASE(inline_spmv)
 {
     const size_t n = 1024;
@@ -291,6 +832,190 @@ BOOST_AUTO_TEST_CASE(inline_spmv)
             });
 }
 
+BOOST_AUTO_TEST_CASE(inline_spmv_multi_device)
+{
+    const size_t n = 1024;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    random_matrix(n, n, 16, row, col, val);
+
+    std::vector<double> x = random_vector<double>(n);
+    std::vector<double> f = random_vector<double>(n);
+
+    vex::SpMat <double> A(ctx, n, n, row.data(), col.data(), val.data());
+    vex::vector<double> X(ctx, x);
+    vex::vector<double> F(ctx, f);
+    vex::vector<double> Y(ctx, n);
+
+    vex::Reductor<double, vex::SUM> sum(ctx);
+
+    Y = sin(vex::make_inline(A * X));
+
+    check_sample(Y, [&](size_t idx, double a) {
+            double s = 0;
+            for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                s += val[j] * x[col[j]];
+
+            BOOST_CHECK_CLOSE(a, sin(s), 1e-8);
+            });
+
+    double res = sum(pow(F - vex::make_inline(A * X), 2));
+
+    double ref = 0;
+    for(size_t i = 0; i < n; ++i) {
+        double s = f[i];
+        for(size_t j = row[i]; j < row[i + 1]; j++)
+            s -= val[j] * x[col[j]];
+        ref += s * s;
+    }
+
+    BOOST_CHECK_CLOSE(res, ref, 1e-6);
+
+    // Two inlined products with the same matrix need separate ghost copies.
+    Y = vex::make_inline(A * X) - vex::make_inline(A * F);
+
+    check_sample(Y, [&](size_t idx, double a) {
+            double s = 0;
+            for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                s += val[j] * (x[col[j]] - f[col[j]]);
+
+            BOOST_CHECK_CLOSE(a, s, 1e-8);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(storage_formats)
+{
+    const size_t n = 4096;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    random_matrix(n, n, 16, row, col, val);
+
+    // Make a few rows much longer than the rest.
+    {
+        std::vector<size_t> r(1, 0), c;
+        std::vector<double> v;
+
+        for(size_t i = 0; i < n; ++i) {
+            for(size_t j = row[i]; j < row[i + 1]; ++j) {
+                c.push_back(col[j]);
+                v.push_back(val[j]);
+            }
+
+            if (i % 512 == 0) {
+                for(size_t j = 0; j < n; j += 2) {
+                    c.push_back(j);
+                    v.push_back(1.0 / (j + 1));
+                }
+            }
+
+            r.push_back(c.size());
+        }
+
+        row.swap(r);
+        col.swap(c);
+        val.swap(v);
+    }
+
+    std::vector<double> x = random_vector<double>(n);
+
+    vex::vector<double> X(ctx, x);
+    vex::vector<double> Y(ctx, n);
+
+    const vex::spmat_format format[] = {
+        vex::spmat_auto,
+        vex::spmat_hybrid_ell,
+        vex::spmat_csr_scalar,
+        vex::spmat_csr_vector,
+        vex::spmat_csr_adaptive,
+        vex::spmat_sell
+    };
+
+    for(size_t f = 0; f < sizeof(format) / sizeof(format[0]); ++f) {
+        vex::SpMat<double> A(ctx, n, n, row.data(), col.data(), val.data(), format[f]);
+
+        if (format[f] != vex::spmat_auto)
+            for(unsigned d = 0; d < ctx.size(); ++d)
+                if (A.format(d) != vex::spmat_auto)
+                    BOOST_CHECK_EQUAL(A.format(d), format[f]);
+
+        Y = 1;
+        Y += A * X;
+
+        check_sample(Y, [&](size_t idx, double a) {
+                double sum = 1;
+                for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                    sum += val[j] * x[col[j]];
+
+                BOOST_CHECK_CLOSE(a, sum, 1e-8);
+                });
+
+        if (ctx.size() == 1) {
+            Y = 2 * vex::make_inline(A * X);
+
+            check_sample(Y, [&](size_t idx, double a) {
+                    double sum = 0;
+                    for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                        sum += val[j] * x[col[j]];
+
+                    BOOST_CHECK_CLOSE(a, 2 * sum, 1e-8);
+                    });
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(nonzero_partitioning)
+{
+    const size_t n = 4096;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    // First quarter of the matrix is much denser than the rest.
+    {
+        std::vector<size_t> r1, c1, r2, c2;
+        std::vector<double> v1, v2;
+
+        random_matrix(n / 4,     n, 64, r1, c1, v1);
+        random_matrix(n - n / 4, n, 4,  r2, c2, v2);
+
+        row = r1;
+        for(size_t i = 1; i < r2.size(); ++i) row.push_back(r1.back() + r2[i]);
+
+        col = c1; col.insert(col.end(), c2.begin(), c2.end());
+        val = v1; val.insert(val.end(), v2.begin(), v2.end());
+    }
+
+    vex::partitioning p = vex::nonzero_partitioning(ctx, n, row.data());
+
+    BOOST_CHECK_EQUAL(p.size(), n);
+
+    std::vector<double> x = random_vector<double>(n);
+
+    vex::SpMat<double>  A(ctx, n, n, row.data(), col.data(), val.data(), p);
+    vex::vector<double> X(ctx, p, x.data());
+    vex::vector<double> Y(ctx, p);
+
+    BOOST_CHECK(A.row_partition().part == p.part);
+    BOOST_CHECK(X.partition() == p.part);
+
+    Y = 2 * X - A * X;
+
+    check_sample(Y, [&](size_t idx, double a) {
+            double sum = 2 * x[idx];
+            for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                sum -= val[j] * x[col[j]];
+
+            BOOST_CHECK_CLOSE(a, sum, 1e-8);
+            });
+}
+
 BOOST_AUTO_TEST_CASE(multivector_product)
 {
     const size_t n = 1024;
@@ -338,6 +1063,116 @@ BOOST_AUTO_TEST_CASE(multivector_product)
             });
 }
 
+BOOST_AUTO_TEST_CASE(interleaved_multivector_product)
+{
+    const size_t n = 1024;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    random_matrix(n, n, 16, row, col, val);
+
+    std::vector<double>     xs = random_vector<double>(4 * n);
+    std::vector<cl_double4> x(n);
+    for(size_t i = 0; i < n; ++i)
+        for(int k = 0; k < 4; ++k)
+            x[i].s[k] = xs[4 * i + k];
+
+    vex::SpMat <double>     A(ctx, n, n, row.data(), col.data(), val.data());
+    vex::vector<cl_double4> X(ctx, x);
+    vex::vector<cl_double4> Y(ctx, n);
+
+    A.mul(X, Y);
+
+    check_sample(Y, [&](size_t idx, cl_double4 a) {
+            cl_double4 sum = {{0, 0, 0, 0}};
+            for(size_t j = row[idx]; j < row[idx + 1]; j++)
+                for(int k = 0; k < 4; ++k)
+                    sum.s[k] += val[j] * x[col[j]].s[k];
+
+            for(int k = 0; k < 4; ++k)
+                BOOST_CHECK_CLOSE(a.s[k], sum.s[k], 1e-8);
+            });
+
+    A.mul(X, Y, -1, true);
+
+    check_sample(Y, [&](size_t, cl_double4 a) {
+            for(int k = 0; k < 4; ++k)
+                BOOST_CHECK_SMALL(a.s[k], 1e-8);
+            });
+}
+
+BOOST_AUTO_TEST_CASE(block_matrix_product)
+{
+    const size_t   n = 1024;
+    const unsigned B = 4;
+
+    typedef std::array<double, B> elem_t;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<double> val;
+
+    random_matrix(n, n, 16, row, col, val);
+    val = random_vector<double>(B * B * col.size());
+
+    std::vector<double> x = random_vector<double>(B * n);
+
+    auto y = [&](size_t i, unsigned r) {
+        double sum = 0;
+        for(size_t j = row[i]; j < row[i + 1]; j++)
+            for(unsigned k = 0; k < B; ++k)
+                sum += val[B * B * j + B * r + k] * x[B * col[j] + k];
+        return sum;
+    };
+
+    vex::SpMatBSR<double, B> A(ctx, n, n, row.data(), col.data(), val.data());
+
+    // Vectors of scalar type.
+    vex::vector<double> X(ctx, A.point_col_partition(), x.data());
+    vex::vector<double> Y(ctx, A.point_row_partition());
+
+    Y = A * X;
+
+    check_sample(Y, [&](size_t idx, double a) {
+            BOOST_CHECK_CLOSE(a, y(idx / B, idx % B), 1e-8);
+            });
+
+    // Interleaved vectors.
+    std::vector<cl_double4> xi(n);
+    for(size_t i = 0; i < n; ++i)
+        for(unsigned k = 0; k < B; ++k)
+            xi[i].s[k] = x[B * i + k];
+
+    vex::vector<cl_double4> Xi(ctx, xi);
+    vex::vector<cl_double4> Yi(ctx, n);
+
+    Yi = 2 * (A * Xi);
+
+    check_sample(Yi, [&](size_t idx, cl_double4 a) {
+            for(unsigned k = 0; k < B; ++k)
+                BOOST_CHECK_CLOSE(a.s[k], 2 * y(idx, k), 1e-8);
+            });
+
+    // Multivectors.
+    std::vector<double> xm(B * n);
+    for(size_t i = 0; i < n; ++i)
+        for(unsigned k = 0; k < B; ++k)
+            xm[k * n + i] = x[B * i + k];
+
+    vex::multivector<double, B> Xm(ctx, xm);
+    vex::multivector<double, B> Ym(ctx, n);
+
+    Ym = A * Xm;
+    Ym -= A * Xm;
+
+    check_sample(Ym, [&](size_t, elem_t a) {
+            for(unsigned k = 0; k < B; ++k)
+                BOOST_CHECK_SMALL(a[k], 1e-8);
+            });
+}
+
 BOOST_AUTO_TEST_CASE(inline_multivector_product)
 {
     const size_t n = 1024;
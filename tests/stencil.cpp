@@ -75,6 +75,38 @@ BOOST_AUTO_TEST_CASE(two_stencils)
 }
 #endif
 
+BOOST_AUTO_TEST_CASE(fused_stencils)
+{
+    const size_t n = 1024;
+
+    std::vector<double> s1 = random_vector<double>(rand() % 16 + 1);
+    std::vector<double> s2 = random_vector<double>(rand() % 16 + 1);
+
+    int c1 = rand() % s1.size();
+    int c2 = rand() % s2.size();
+
+    vex::stencil<double> S1(ctx, s1, c1);
+    vex::stencil<double> S2(ctx, s2, c2);
+
+    std::vector<double> x = random_vector<double>(n);
+
+    vex::vector<double> X(ctx, x);
+    vex::vector<double> Y(ctx, n);
+
+    Y = 2 * X - X * S1 + 3 * (X * S2);
+
+    index idx(n);
+
+    check_sample(Y, [&](size_t i, double a) {
+        double sum1 = 0, sum2 = 0;
+        for(int j = 0; j < static_cast<int>(s1.size()); j++)
+            sum1 += s1[j] * x[idx(i, j - c1)];
+        for(int j = 0; j < static_cast<int>(s2.size()); j++)
+            sum2 += s2[j] * x[idx(i, j - c2)];
+        BOOST_CHECK_CLOSE(a, 2 * x[i] - sum1 + 3 * sum2, 1e-8);
+    });
+}
+
 BOOST_AUTO_TEST_CASE(small_vector)
 {
     const size_t n = 128;
@@ -0,0 +1,274 @@
+#ifndef VEXCL_COPY_IF_HPP
+#define VEXCL_COPY_IF_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/copy_if.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Stream compaction: copy_if, remove_if, and stable partition.
+ */
+
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <vexcl/operations.hpp>
+#include <vexcl/vector.hpp>
+#include <vexcl/scan.hpp>
+
+namespace vex {
+
+/// \cond INTERNAL
+namespace detail {
+
+// Inclusive scan of the predicate gives global positions of the selected
+// elements. Each device compacts its part of the input into a local buffer,
+// which is then copied to its global position in the output.
+template <typename T, class Expr, class Pred>
+class compactor {
+    public:
+        compactor(const Expr &expr, const Pred &pred) : expr(expr) {
+            get_expression_properties prop;
+            extract_terminals()(boost::proto::as_child(expr), prop);
+            extract_terminals()(boost::proto::as_child(pred), prop);
+
+            precondition(!prop.queue.empty(),
+                    "Stream compaction needs at least one vector in the input");
+
+            queue = prop.queue;
+            n     = prop.size;
+
+            offset.resize(queue, n);
+            inclusive_scan(boost::proto::as_child(pred) != 0, offset);
+
+            before.resize(queue.size() + 1, 0);
+            for(unsigned d = 0; d < queue.size(); d++) {
+                size_t end = offset.part_start(d + 1);
+                before[d + 1] = end ? static_cast<size_t>(offset[end - 1]) : 0;
+            }
+        }
+
+        // Number of elements for which the predicate holds.
+        size_t count() const {
+            return before.back();
+        }
+
+        const std::vector<cl::CommandQueue>& queue_list() const {
+            return queue;
+        }
+
+        // Writes the elements for which the predicate equals keep to out,
+        // starting at position start.
+        void write(bool keep, vector<T> &out, size_t start) const {
+            static kernel_cache cache;
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                cl::Context context = qctx(queue[d]);
+                cl::Device  device  = qdev(queue[d]);
+
+                auto kernel = cache.find(context());
+
+                if (kernel == cache.end()) {
+                    std::ostringstream source;
+
+                    source << standard_kernel_header(device) <<
+                        "typedef " << type_name<T>() << " real;\n";
+
+                    output_terminal_preamble termpream(source, device, "prm", empty_state());
+                    boost::proto::eval(boost::proto::as_child(expr), termpream);
+
+                    source <<
+                        "kernel void vexcl_copy_if(\n"
+                        "\t" << type_name<size_t>() << " n,\n"
+                        "\t" << type_name<size_t>() << " before,\n"
+                        "\tchar keep";
+
+                    extract_terminals()( boost::proto::as_child(expr),
+                            declare_expression_parameter(source, device, "prm", empty_state()) );
+
+                    source << ",\n"
+                        "\tglobal const " << type_name<size_t>() << " *offset,\n"
+                        "\tglobal real *out\n"
+                        "\t)\n"
+                        "{\n";
+
+                    if ( is_cpu(device) ) {
+                        source <<
+                            "\tsize_t chunk_size  = (n + get_global_size(0) - 1) / get_global_size(0);\n"
+                            "\tsize_t chunk_start = get_global_id(0) * chunk_size;\n"
+                            "\tsize_t chunk_end   = min(n, chunk_start + chunk_size);\n"
+                            "\tfor(size_t idx = chunk_start; idx < chunk_end; ++idx) {\n";
+                    } else {
+                        source <<
+                            "\tfor(size_t idx = get_global_id(0); idx < n; idx += get_global_size(0)) {\n";
+                    }
+
+                    source <<
+                        "\t\tsize_t p = offset[idx];\n"
+                        "\t\tsize_t q = idx ? offset[idx - 1] : before;\n"
+                        "\t\tif ((p != q) == keep) {\n";
+
+                    output_local_preamble loc_init(source, device, "prm", empty_state());
+                    boost::proto::eval(boost::proto::as_child(expr), loc_init);
+
+                    source << "\t\t\tout[keep ? p - 1 - before : idx + before - p] = ";
+
+                    vector_expr_context expr_ctx(source, device, "prm", empty_state());
+                    boost::proto::eval(boost::proto::as_child(expr), expr_ctx);
+
+                    source << ";\n\t\t}\n\t}\n}\n";
+
+                    auto program = build_sources(context, source.str());
+
+                    cl::Kernel krn(program, "vexcl_copy_if");
+                    size_t wgs = kernel_workgroup_size(krn, device);
+
+                    kernel = cache.insert(std::make_pair(
+                                context(), kernel_cache_entry(krn, wgs)
+                                )).first;
+                }
+
+                size_t psize = offset.part_size(d);
+                size_t ntrue = before[d + 1] - before[d];
+                size_t nout  = keep ? ntrue : psize - ntrue;
+
+                if (!nout) continue;
+
+                cl::Buffer buf(context, CL_MEM_READ_WRITE, nout * sizeof(T));
+
+                size_t w_size = kernel->second.wgsize;
+                size_t g_size = num_workgroups(device) * w_size;
+
+                cl::Kernel &krn = kernel->second.kernel;
+
+                unsigned pos = 0;
+                krn.setArg(pos++, psize);
+                krn.setArg(pos++, before[d]);
+                krn.setArg(pos++, static_cast<char>(keep));
+
+                extract_terminals()( boost::proto::as_child(expr),
+                        set_expression_argument(krn, d, pos, offset.part_start(d), empty_state()) );
+
+                krn.setArg(pos++, offset(d));
+                krn.setArg(pos++, buf);
+
+                queue[d].enqueueNDRangeKernel(krn, cl::NullRange, g_size, w_size);
+
+                copy_buffer_to_vector(queue[d], buf, 0, nout, out,
+                        start + (keep ? before[d] : offset.part_start(d) - before[d]));
+            }
+        }
+
+    private:
+        const Expr &expr;
+
+        std::vector<cl::CommandQueue> queue;
+        size_t n;
+
+        vector<size_t>      offset;
+        std::vector<size_t> before;
+};
+
+} // namespace detail
+/// \endcond
+
+/// Copies the elements of a vector expression for which the predicate holds.
+/**
+ * The relative order of the copied elements is preserved. The output vector
+ * is resized to the number of copied elements, which is also returned. Both
+ * the expression and the predicate should refer to at least one vector, and
+ * all vectors should have the same size and partitioning.
+ *
+ * Example:
+ * \code
+ * // Coordinates of the particles that are still inside the domain:
+ * size_t n = vex::copy_if(x, x * x + y * y < 1, x_inside);
+ * \endcode
+ */
+template <class Expr, class Pred, typename T>
+size_t copy_if(const Expr &expr, const Pred &pred, vector<T> &out) {
+    detail::compactor<T, Expr, Pred> c(expr, pred);
+
+    size_t n = c.count();
+
+    if (out.size() != n || out.nparts() != c.queue_list().size())
+        out.resize(c.queue_list(), n);
+
+    c.write(true, out, 0);
+
+    return n;
+}
+
+/// Removes the elements of the vector for which the predicate holds.
+/**
+ * The relative order of the remaining elements is preserved. The vector is
+ * resized to the number of the remaining elements, which is also returned.
+ */
+template <typename T, class Pred>
+size_t remove_if(vector<T> &x, const Pred &pred) {
+    detail::compactor<T, vector<T>, Pred> c(x, pred);
+
+    size_t n = x.size() - c.count();
+
+    vector<T> y(c.queue_list(), n);
+    c.write(false, y, 0);
+
+    x.swap(y);
+
+    return n;
+}
+
+/// Stable partition of the vector.
+/**
+ * The elements for which the predicate holds precede the rest. The relative
+ * order of elements is preserved in both groups. Returns the number of
+ * elements in the first group.
+ *
+ * Example:
+ * \code
+ * vex::vector<int> active(ctx, n);
+ * ...
+ * size_t nactive = vex::partition(particle, active[particle] != 0);
+ * \endcode
+ */
+template <typename T, class Pred>
+size_t partition(vector<T> &x, const Pred &pred) {
+    detail::compactor<T, vector<T>, Pred> c(x, pred);
+
+    size_t n = c.count();
+
+    vector<T> y(c.queue_list(), x.size());
+    c.write(true,  y, 0);
+    c.write(false, y, n);
+
+    x = y;
+
+    return n;
+}
+
+} // namespace vex
+
+#endif
@@ -42,8 +42,8 @@ namespace viennacl {
             return sum(v1 * v2);
         }
 
-        template <typename T, typename C, typename I>
-        auto prod(const vex::SpMat<T, C, I> &A, const vex::vector<T> &x)
+        template <typename T, typename C, typename I, typename M>
+        auto prod(const vex::SpMat<T, C, I, M> &A, const vex::vector<T> &x)
             -> decltype(A * x)
         {
             return A * x;
@@ -0,0 +1,350 @@
+#ifndef VEXCL_HISTOGRAM_HPP
+#define VEXCL_HISTOGRAM_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/histogram.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Histograms of vector expressions.
+ */
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <limits>
+#include <type_traits>
+
+#include <vexcl/operations.hpp>
+#include <vexcl/vector.hpp>
+
+namespace vex {
+
+/// \cond INTERNAL
+namespace detail {
+
+// The range of a histogram is given in the value type of the expression, or
+// in double precision when the expression is not floating point.
+template <class Expr>
+struct histogram_real {
+    typedef typename return_type<Expr>::type value_type;
+
+    typedef typename std::conditional<
+        std::is_floating_point<value_type>::value, value_type, double
+        >::type type;
+};
+
+// Computes partial histogram on each device. Every workgroup accumulates its
+// own copy of the bins in local memory (when the bins fit there) and merges
+// it into the device histogram with atomics. When Integral is set, the
+// expression values are bin indices; otherwise values from [lo, hi) are
+// split into nbins equal bins. Values outside of the range are ignored.
+template <bool Integral, typename real, class Expr>
+std::vector<cl::Buffer> histogram_partials(const Expr &expr, size_t nbins,
+        real lo, real hi, std::vector<cl::CommandQueue> &queue,
+        std::vector<size_t> &part)
+{
+    static kernel_cache cache;
+
+    get_expression_properties prop;
+    extract_terminals()(boost::proto::as_child(expr), prop);
+
+    precondition(!prop.queue.empty(),
+            "Histogram needs at least one vector in the input");
+    precondition(nbins > 0, "Histogram needs at least one bin");
+
+    queue = prop.queue;
+    part.resize(queue.size() + 1);
+    for(unsigned d = 0; d <= queue.size(); d++)
+        part[d] = prop.part_start(d);
+
+    std::vector<cl::Buffer> hist(queue.size());
+    std::vector<cl_uint>    zero(nbins, 0);
+
+    for(unsigned d = 0; d < queue.size(); d++) {
+        cl::Context context = qctx(queue[d]);
+        cl::Device  device  = qdev(queue[d]);
+
+        auto kernel = cache.find(context());
+
+        if (kernel == cache.end()) {
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<real>() << " real;\n";
+
+            output_terminal_preamble termpream(source, device, "prm", empty_state());
+            boost::proto::eval(boost::proto::as_child(expr), termpream);
+
+            source <<
+                "kernel void vexcl_histogram(\n"
+                "\t" << type_name<size_t>() << " n,\n"
+                "\t" << type_name<size_t>() << " nbins,\n"
+                "\treal lo,\n"
+                "\treal scale,\n"
+                "\tchar use_local";
+
+            extract_terminals()( boost::proto::as_child(expr),
+                    declare_expression_parameter(source, device, "prm", empty_state()) );
+
+            source << ",\n"
+                "\tglobal uint *hist,\n"
+                "\tlocal  uint *lhist\n"
+                "\t)\n"
+                "{\n"
+                "\tsize_t lid = get_local_id(0);\n"
+                "\tsize_t wgs = get_local_size(0);\n"
+                "\tglobal uint *gbins = hist;\n"
+                "\tlocal  uint *lbins = lhist;\n"
+                "\tif (use_local) {\n"
+                "\t\tfor(size_t i = lid; i < nbins; i += wgs) lhist[i] = 0;\n"
+                "\t\tbarrier(CLK_LOCAL_MEM_FENCE);\n"
+                "\t}\n";
+
+            if ( is_cpu(device) ) {
+                source <<
+                    "\tsize_t chunk_size  = (n + get_global_size(0) - 1) / get_global_size(0);\n"
+                    "\tsize_t chunk_start = get_global_id(0) * chunk_size;\n"
+                    "\tsize_t chunk_end   = min(n, chunk_start + chunk_size);\n"
+                    "\tfor(size_t idx = chunk_start; idx < chunk_end; ++idx) {\n";
+            } else {
+                source <<
+                    "\tfor(size_t idx = get_global_id(0); idx < n; idx += get_global_size(0)) {\n";
+            }
+
+            output_local_preamble loc_init(source, device, "prm", empty_state());
+            boost::proto::eval(boost::proto::as_child(expr), loc_init);
+
+            vector_expr_context expr_ctx(source, device, "prm", empty_state());
+
+            if (Integral) {
+                source << "\t\tlong bin = ";
+                boost::proto::eval(boost::proto::as_child(expr), expr_ctx);
+                source << ";\n"
+                    "\t\tif (bin >= 0 && bin < (long)nbins) {\n";
+            } else {
+                source << "\t\treal val = ";
+                boost::proto::eval(boost::proto::as_child(expr), expr_ctx);
+                source << ";\n"
+                    "\t\tif (val >= lo && (val - lo) * scale < nbins) {\n"
+                    "\t\t\tsize_t bin = (val - lo) * scale;\n";
+            }
+
+            source <<
+                "\t\t\tif (use_local) atomic_inc(lbins + bin); else atomic_inc(gbins + bin);\n"
+                "\t\t}\n"
+                "\t}\n"
+                "\tif (use_local) {\n"
+                "\t\tbarrier(CLK_LOCAL_MEM_FENCE);\n"
+                "\t\tfor(size_t i = lid; i < nbins; i += wgs)\n"
+                "\t\t\tif (lhist[i]) atomic_add(hist + i, lhist[i]);\n"
+                "\t}\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel krn(program, "vexcl_histogram");
+            size_t wgs = is_cpu(device) ? 1 : kernel_workgroup_size(krn, device);
+
+            kernel = cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(krn, wgs)
+                        )).first;
+        }
+
+        if (size_t psize = part[d + 1] - part[d]) {
+            precondition(psize <= std::numeric_limits<cl_uint>::max(),
+                    "Histogram bins are 32-bit: device partition is too large");
+
+            size_t w_size = kernel->second.wgsize;
+            size_t g_size = num_workgroups(device) * w_size;
+
+            size_t smem = static_cast<size_t>(device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>())
+                        - static_cast<size_t>(kernel->second.kernel.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device));
+
+            bool use_local = !is_cpu(device) && nbins * sizeof(cl_uint) <= smem;
+
+            hist[d] = cl::Buffer(context, CL_MEM_READ_WRITE, nbins * sizeof(cl_uint));
+            queue[d].enqueueWriteBuffer(hist[d], CL_TRUE, 0,
+                    nbins * sizeof(cl_uint), zero.data());
+
+            cl::Kernel &krn = kernel->second.kernel;
+
+            unsigned pos = 0;
+            krn.setArg(pos++, psize);
+            krn.setArg(pos++, nbins);
+            krn.setArg(pos++, lo);
+            krn.setArg(pos++, Integral ? real() : static_cast<real>(nbins / (hi - lo)));
+            krn.setArg(pos++, static_cast<char>(use_local));
+
+            extract_terminals()( boost::proto::as_child(expr),
+                    set_expression_argument(krn, d, pos, part[d], empty_state()) );
+
+            krn.setArg(pos++, hist[d]);
+            krn.setArg(pos++, vex::Local(use_local ? nbins * sizeof(cl_uint) : 1));
+
+            queue[d].enqueueNDRangeKernel(krn, cl::NullRange, g_size, w_size);
+        }
+    }
+
+    return hist;
+}
+
+// Combines the partial histograms on host.
+inline std::vector<size_t> histogram_combine(
+        const std::vector<cl::Buffer> &hist, size_t nbins,
+        const std::vector<cl::CommandQueue> &queue,
+        const std::vector<size_t> &part)
+{
+    std::vector<size_t>  h(nbins, 0);
+    std::vector<cl_uint> p(nbins);
+
+    for(unsigned d = 0; d < queue.size(); d++) {
+        if (part[d + 1] == part[d]) continue;
+
+        queue[d].enqueueReadBuffer(hist[d], CL_TRUE, 0,
+                nbins * sizeof(cl_uint), p.data());
+
+        for(size_t i = 0; i < nbins; ++i) h[i] += p[i];
+    }
+
+    return h;
+}
+
+// Combines the partial histograms into a device vector. When there is only
+// one partial histogram, it is copied without a trip to host.
+inline void histogram_combine(
+        const std::vector<cl::Buffer> &hist, size_t nbins,
+        const std::vector<cl::CommandQueue> &queue,
+        const std::vector<size_t> &part,
+        vector<cl_uint> &out)
+{
+    if (out.size() != nbins) out.resize(queue, nbins);
+
+    unsigned nparts = 0, last = 0;
+    for(unsigned d = 0; d < queue.size(); d++)
+        if (part[d + 1] > part[d]) { ++nparts; last = d; }
+
+    if (nparts == 1) {
+        copy_buffer_to_vector(queue[last], hist[last], 0, nbins, out, 0);
+    } else {
+        std::vector<size_t>  h = histogram_combine(hist, nbins, queue, part);
+        std::vector<cl_uint> c(nbins);
+
+        for(size_t i = 0; i < nbins; ++i) {
+            precondition(h[i] <= std::numeric_limits<cl_uint>::max(),
+                    "Histogram bin count does not fit into cl_uint");
+            c[i] = static_cast<cl_uint>(h[i]);
+        }
+
+        vex::copy(c, out);
+    }
+}
+
+} // namespace detail
+/// \endcond
+
+/// Histogram of a vector expression.
+/**
+ * Values from the range [lo, hi) are split into nbins equal bins. Values
+ * outside of the range are ignored. The range is converted to the value type
+ * of the expression (or to double for integral expressions). Returns the bin
+ * counts on host.
+ *
+ * Each device counts its partition in 32-bit bins, so a device partition may
+ * not hold more than 2^32 - 1 elements. The counts of several devices are
+ * summed on host in size_t.
+ *
+ * Example:
+ * \code
+ * std::vector<size_t> h = vex::histogram(sqrt(u * u + v * v), 100, 0, umax);
+ * \endcode
+ */
+template <class Expr>
+std::vector<size_t> histogram(const Expr &expr, size_t nbins,
+        typename detail::histogram_real<Expr>::type lo,
+        typename detail::histogram_real<Expr>::type hi)
+{
+    std::vector<cl::CommandQueue> queue;
+    std::vector<size_t> part;
+
+    auto hist = detail::histogram_partials<false>(expr, nbins, lo, hi, queue, part);
+    return detail::histogram_combine(hist, nbins, queue, part);
+}
+
+/// Histogram of a vector expression.
+/**
+ * Same as above, but stores the result in a device vector (which is resized
+ * to nbins if necessary). The combined counts should fit into cl_uint.
+ */
+template <class Expr>
+void histogram(const Expr &expr, size_t nbins,
+        typename detail::histogram_real<Expr>::type lo,
+        typename detail::histogram_real<Expr>::type hi,
+        vector<cl_uint> &out)
+{
+    std::vector<cl::CommandQueue> queue;
+    std::vector<size_t> part;
+
+    auto hist = detail::histogram_partials<false>(expr, nbins, lo, hi, queue, part);
+    detail::histogram_combine(hist, nbins, queue, part, out);
+}
+
+/// Histogram of integer keys.
+/**
+ * Counts the number of occurrences of each integer value from [0, nbins) in
+ * the vector expression (e.g. number of particles in each cell). Values
+ * outside of the range are ignored.
+ *
+ * Example:
+ * \code
+ * std::vector<size_t> particles_in_cell = vex::histogram(cell, ncells);
+ * \endcode
+ */
+template <class Expr>
+std::vector<size_t> histogram(const Expr &expr, size_t nbins) {
+    std::vector<cl::CommandQueue> queue;
+    std::vector<size_t> part;
+
+    auto hist = detail::histogram_partials<true>(expr, nbins, 0, 0, queue, part);
+    return detail::histogram_combine(hist, nbins, queue, part);
+}
+
+/// Histogram of integer keys.
+/**
+ * Same as above, but stores the result in a device vector (which is resized
+ * to nbins if necessary).
+ */
+template <class Expr>
+void histogram(const Expr &expr, size_t nbins, vector<cl_uint> &out) {
+    std::vector<cl::CommandQueue> queue;
+    std::vector<size_t> part;
+
+    auto hist = detail::histogram_partials<true>(expr, nbins, 0, 0, queue, part);
+    detail::histogram_combine(hist, nbins, queue, part, out);
+}
+
+} // namespace vex
+
+#endif
@@ -406,6 +406,23 @@ struct terminal_is_value :
  */
 template <class T> struct is_scalable : std::false_type {};
 
+/* Type trait to determine if an additive transform may be fused into a
+ * vector expression kernel.
+ *
+ * Specializations should derive from std::true_type and provide:
+ *   type       -- vector expression computing device-local part of the
+ *                 transform (including the scale);
+ *   get(t)     -- returns the expression;
+ *   owner(t)   -- address of the object holding buffers used for data
+ *                 exchange between devices, or NULL when none is needed;
+ *   fusable(t) -- false when the term is better computed by its own
+ *                 specialized kernel (e.g. a vector CSR SpMV);
+ *   start(t, y)          -- starts exchange of remote data;
+ *   finish(t, y, negate) -- adds remote contribution to y.
+ */
+template <class T, class Enable = void>
+struct local_transform : std::false_type {};
+
 } // namespace traits
 
 //---------------------------------------------------------------------------
@@ -1788,27 +1805,6 @@ typename std::enable_if<
     (additive_applicator<append, Vector>(dest))(expr);
 }
 
-template <bool append, class Vector, class Expr>
-typename std::enable_if<
-    !boost::proto::matches<
-        typename boost::proto::result_of::as_expr<Expr>::type,
-        boost::proto::terminal<boost::proto::_>
-    >::value &&
-    !boost::proto::matches<
-        typename boost::proto::result_of::as_expr<Expr>::type,
-        boost::proto::negate<boost::proto::_>
-    >::value,
-    void
->::type apply_additive_transform(Vector &dest, const Expr &expr) {
-    auto flat_expr = boost::proto::flatten(expr);
-
-    (additive_applicator<append, Vector>(dest))(boost::fusion::front(flat_expr));
-
-    boost::fusion::for_each(boost::fusion::pop_front(flat_expr),
-            additive_applicator</*append=*/true, Vector>(dest)
-            );
-}
-
 //---------------------------------------------------------------------------
 // Multiexpression component extractor
 //---------------------------------------------------------------------------
@@ -2119,6 +2115,53 @@ void cache_register<dummy>::erase(cl_context key) {
         (*c)->erase(key);
 }
 
+// Default workgroup size for kernels of a multi-kernel program.
+struct max_workgroup_size {
+    size_t operator()(const cl::Kernel &krn, const cl::Device &device, unsigned) const {
+        return kernel_workgroup_size(krn, device);
+    }
+};
+
+// Returns kernel k of a program holding n kernels with the given names. The
+// program is built once for each context, and all of its kernels are put
+// into cache[0], ..., cache[n - 1] at once. source(device) generates the
+// program source; wgsize(kernel, device, k) selects the workgroup size of
+// each kernel.
+template <class Source, class WorkGroupSize>
+kernel_cache_entry& program_kernel(const cl::CommandQueue &queue,
+        kernel_cache *cache, const char * const *name, unsigned n, unsigned k,
+        Source source, WorkGroupSize wgsize)
+{
+    cl::Context context = qctx(queue);
+
+    auto kernel = cache[k].find(context());
+
+    if (kernel == cache[k].end()) {
+        cl::Device device = qdev(queue);
+
+        auto program = build_sources(context, source(device));
+
+        for(unsigned i = 0; i < n; ++i) {
+            cl::Kernel krn(program, name[i]);
+
+            cache[i].insert(std::make_pair(context(),
+                        kernel_cache_entry(krn, wgsize(krn, device, i))));
+        }
+
+        kernel = cache[k].find(context());
+    }
+
+    return kernel->second;
+}
+
+template <class Source>
+kernel_cache_entry& program_kernel(const cl::CommandQueue &queue,
+        kernel_cache *cache, const char * const *name, unsigned n, unsigned k,
+        Source source)
+{
+    return program_kernel(queue, cache, name, n, k, source, max_workgroup_size());
+}
+
 //---------------------------------------------------------------------------
 // Assign expression to lhs
 //---------------------------------------------------------------------------
@@ -2210,6 +2253,300 @@ void assign_expression(LHS &lhs, const RHS &rhs,
     }
 }
 
+//---------------------------------------------------------------------------
+// Fused evaluation of additive transforms
+//---------------------------------------------------------------------------
+// Additive terms (SpMV, stencil convolution, ...) that are able to compute
+// their device-local part inside of a vector expression are evaluated in a
+// single kernel together with the rest of the expression. Remote parts (if
+// any) are added afterwards.
+// Replaces terms of a simplified additive expression (terms, negated terms,
+// and their sums) with their local parts.
+template <class Expr,
+          class Tag = typename boost::proto::tag_of<Expr>::type,
+          class Enable = void>
+struct local_additive_transform : std::false_type {};
+
+template <class Expr>
+struct local_additive_transform<Expr, boost::proto::tag::terminal,
+    typename std::enable_if< traits::local_transform<Expr>::value >::type
+    > : std::true_type
+{
+    typedef typename traits::local_transform<Expr>::type type;
+
+    static type get(const Expr &expr) {
+        return traits::local_transform<Expr>::get(expr);
+    }
+};
+
+template <class Expr>
+struct local_additive_transform<Expr, boost::proto::tag::negate,
+    typename std::enable_if<
+        local_additive_transform<
+            typename std::decay<typename boost::proto::result_of::child_c<Expr, 0>::type>::type
+        >::value
+    >::type
+    > : std::true_type
+{
+    typedef local_additive_transform<
+        typename std::decay<typename boost::proto::result_of::child_c<Expr, 0>::type>::type
+        > C;
+
+    typedef typename boost::proto::result_of::make_expr<
+        boost::proto::tag::negate, vector_domain, typename C::type
+        >::type type;
+
+    static type get(const Expr &expr) {
+        return boost::proto::make_expr<boost::proto::tag::negate, vector_domain>(
+                C::get(boost::proto::child_c<0>(expr)));
+    }
+};
+
+template <class Expr>
+struct local_additive_transform<Expr, boost::proto::tag::plus,
+    typename std::enable_if<
+        local_additive_transform<
+            typename std::decay<typename boost::proto::result_of::child_c<Expr, 0>::type>::type
+        >::value &&
+        local_additive_transform<
+            typename std::decay<typename boost::proto::result_of::child_c<Expr, 1>::type>::type
+        >::value
+    >::type
+    > : std::true_type
+{
+    typedef local_additive_transform<
+        typename std::decay<typename boost::proto::result_of::child_c<Expr, 0>::type>::type
+        > L;
+
+    typedef local_additive_transform<
+        typename std::decay<typename boost::proto::result_of::child_c<Expr, 1>::type>::type
+        > R;
+
+    typedef typename boost::proto::result_of::make_expr<
+        boost::proto::tag::plus, vector_domain, typename L::type, typename R::type
+        >::type type;
+
+    static type get(const Expr &expr) {
+        return boost::proto::make_expr<boost::proto::tag::plus, vector_domain>(
+                L::get(boost::proto::child_c<0>(expr)),
+                R::get(boost::proto::child_c<1>(expr)));
+    }
+};
+
+template <class Expr>
+struct is_local_additive_expression
+    : std::integral_constant<bool,
+        local_additive_transform<typename std::decay<Expr>::type>::value
+      >
+{};
+
+// Calls f(term, negate) for each term of a simplified additive expression.
+template <class F>
+struct additive_term_applicator {
+    F f;
+
+    additive_term_applicator(const F &f) : f(f) {}
+
+    template <typename Expr>
+    typename std::enable_if<
+        boost::proto::matches<
+            typename boost::proto::result_of::as_expr<Expr>::type,
+            boost::proto::terminal<boost::proto::_>
+        >::value,
+        void
+    >::type
+    operator()(const Expr &expr) const {
+        f(expr, false);
+    }
+
+    template <typename Expr>
+    typename std::enable_if<
+        boost::proto::matches<
+            typename boost::proto::result_of::as_expr<Expr>::type,
+            boost::proto::negate<boost::proto::_>
+        >::value,
+        void
+    >::type
+    operator()(const Expr &expr) const {
+        f(boost::proto::child(expr), true);
+    }
+};
+
+template <class F, class Expr>
+typename std::enable_if<
+    boost::proto::matches<
+        typename boost::proto::result_of::as_expr<Expr>::type,
+        boost::proto::terminal<boost::proto::_>
+    >::value ||
+    boost::proto::matches<
+        typename boost::proto::result_of::as_expr<Expr>::type,
+        boost::proto::negate<boost::proto::_>
+    >::value,
+    void
+>::type for_each_additive_term(const Expr &expr, const F &f) {
+    (additive_term_applicator<F>(f))(expr);
+}
+
+template <class F, class Expr>
+typename std::enable_if<
+    !boost::proto::matches<
+        typename boost::proto::result_of::as_expr<Expr>::type,
+        boost::proto::terminal<boost::proto::_>
+    >::value &&
+    !boost::proto::matches<
+        typename boost::proto::result_of::as_expr<Expr>::type,
+        boost::proto::negate<boost::proto::_>
+    >::value,
+    void
+>::type for_each_additive_term(const Expr &expr, const F &f) {
+    boost::fusion::for_each(boost::proto::flatten(expr),
+            additive_term_applicator<F>(f));
+}
+
+struct local_transform_owners {
+    std::vector<const void*> &owners;
+    bool &fusable;
+
+    local_transform_owners(std::vector<const void*> &owners, bool &fusable)
+        : owners(owners), fusable(fusable) {}
+
+    template <class T>
+    void operator()(const T &t, bool) const {
+        if (!traits::local_transform<T>::fusable(t))
+            fusable = false;
+
+        if (const void *p = traits::local_transform<T>::owner(t))
+            owners.push_back(p);
+    }
+};
+
+template <class Vector>
+struct start_local_transform {
+    const Vector &y;
+
+    start_local_transform(const Vector &y) : y(y) {}
+
+    template <class T>
+    void operator()(const T &t, bool) const {
+        traits::local_transform<T>::start(t, y);
+    }
+};
+
+template <class Vector>
+struct finish_local_transform {
+    Vector &y;
+    bool negate;
+
+    finish_local_transform(Vector &y, bool negate) : y(y), negate(negate) {}
+
+    template <class T>
+    void operator()(const T &t, bool neg) const {
+        traits::local_transform<T>::finish(t, y, neg != negate);
+    }
+};
+
+// Terms exchanging remote data may not be fused when they share transfer
+// buffers (e.g. A * x + A * y on several devices). Terms that have a faster
+// kernel of their own than the inlined one are not fused either.
+template <class Expr>
+bool local_transforms_are_fusable(const Expr &expr) {
+    std::vector<const void*> owners;
+    bool fusable = true;
+    for_each_additive_term(expr, local_transform_owners(owners, fusable));
+
+    if (!fusable) return false;
+
+    std::sort(owners.begin(), owners.end());
+    return std::adjacent_find(owners.begin(), owners.end()) == owners.end();
+}
+
+template <class OP, class Vector, class Expr>
+void assign_local_transforms(Vector &dest, const Expr &expr) {
+    for_each_additive_term(expr, start_local_transform<Vector>(dest));
+
+    auto local = local_additive_transform<Expr>::get(expr);
+    assign_expression<OP>(dest, local, dest.queue_list(), dest.partition());
+
+    for_each_additive_term(expr, finish_local_transform<Vector>(dest,
+                std::is_same<OP, assign::SUB>::value));
+}
+
+template <class OP, class Vector, class VecExpr, class Expr>
+void assign_local_transforms(Vector &dest, const VecExpr &vexpr, const Expr &expr) {
+    for_each_additive_term(expr, start_local_transform<Vector>(dest));
+
+    auto local = local_additive_transform<Expr>::get(expr);
+    assign_expression<OP>(dest, vexpr + local, dest.queue_list(), dest.partition());
+
+    for_each_additive_term(expr, finish_local_transform<Vector>(dest,
+                std::is_same<OP, assign::SUB>::value));
+}
+
+template <bool append, class Vector, class Expr>
+void apply_additive_terms(Vector &dest, const Expr &expr, std::false_type) {
+    auto flat_expr = boost::proto::flatten(expr);
+
+    (additive_applicator<append, Vector>(dest))(boost::fusion::front(flat_expr));
+
+    boost::fusion::for_each(boost::fusion::pop_front(flat_expr),
+            additive_applicator</*append=*/true, Vector>(dest)
+            );
+}
+
+template <bool append, class Vector, class Expr>
+void apply_additive_terms(Vector &dest, const Expr &expr, std::true_type) {
+    typedef typename std::conditional<append, assign::ADD, assign::SET>::type OP;
+
+    if (local_transforms_are_fusable(expr))
+        assign_local_transforms<OP>(dest, expr);
+    else
+        apply_additive_terms<append>(dest, expr, std::false_type());
+}
+
+template <bool append, class Vector, class Expr>
+typename std::enable_if<
+    !boost::proto::matches<
+        typename boost::proto::result_of::as_expr<Expr>::type,
+        boost::proto::terminal<boost::proto::_>
+    >::value &&
+    !boost::proto::matches<
+        typename boost::proto::result_of::as_expr<Expr>::type,
+        boost::proto::negate<boost::proto::_>
+    >::value,
+    void
+>::type apply_additive_transform(Vector &dest, const Expr &expr) {
+    apply_additive_terms<append>(dest, expr, is_local_additive_expression<Expr>());
+}
+
+template <class Vector, class Expr>
+void append_additive_transform(Vector &dest, const Expr &expr, std::false_type) {
+    apply_additive_transform</*append=*/true>(dest, expr);
+}
+
+template <class Vector, class Expr>
+void append_additive_transform(Vector &dest, const Expr &expr, std::true_type) {
+    apply_additive_transform</*append=*/true>(dest, simplify_additive_transform()( -expr ));
+}
+
+// Assigns sum of a vector expression and a simplified additive expression.
+template <class OP, class Vector, class VecExpr, class Expr>
+typename std::enable_if<is_local_additive_expression<Expr>::value, void>::type
+assign_mixed_expression(Vector &dest, const VecExpr &vexpr, const Expr &expr) {
+    if (local_transforms_are_fusable(expr)) {
+        assign_local_transforms<OP>(dest, vexpr, expr);
+    } else {
+        assign_expression<OP>(dest, vexpr, dest.queue_list(), dest.partition());
+        append_additive_transform(dest, expr, std::is_same<OP, assign::SUB>());
+    }
+}
+
+template <class OP, class Vector, class VecExpr, class Expr>
+typename std::enable_if<!is_local_additive_expression<Expr>::value, void>::type
+assign_mixed_expression(Vector &dest, const VecExpr &vexpr, const Expr &expr) {
+    assign_expression<OP>(dest, vexpr, dest.queue_list(), dest.partition());
+    append_additive_transform(dest, expr, std::is_same<OP, assign::SUB>());
+}
+
 // Static for loop
 template <size_t Begin, size_t End>
 class static_for {
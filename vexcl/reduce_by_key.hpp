@@ -0,0 +1,411 @@
+#ifndef VEXCL_REDUCE_BY_KEY_HPP
+#define VEXCL_REDUCE_BY_KEY_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/reduce_by_key.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Segmented reduction of a vector expression by a sorted key vector.
+ */
+
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <vexcl/operations.hpp>
+#include <vexcl/vector.hpp>
+#include <vexcl/reductor.hpp>
+
+namespace vex {
+
+/// Reduces consecutive elements of a vector expression with equal keys.
+/**
+ * keys should be sorted (or, at least, grouped), so that each segment of
+ * equal keys is contiguous. For each segment, its key is written to
+ * out_keys, and the reduction (with reduction kind RDC, the same as accepted
+ * by vex::Reductor) of the corresponding values is written to out_vals. The
+ * output vectors are resized to the number of segments, which is also
+ * returned.
+ *
+ * The reduction is done in two passes over the input. The first pass counts
+ * segment heads and partial reductions of the trailing segment in each chunk
+ * of the input; the partials are combined on host (this is where segments
+ * spanning chunk or device boundaries are merged); the second pass writes
+ * the results.
+ *
+ * Example:
+ * \code
+ * // Number of particles in each cell:
+ * size_t ncells = vex::reduce_by_key(cell, 1, cell_id, cell_count);
+ *
+ * // Maximum velocity in each cell:
+ * vex::reduce_by_key(cell, sqrt(u * u + v * v), cell_id, umax, vex::MAX());
+ * \endcode
+ */
+template <typename K, class Expr, typename V, class RDC>
+size_t reduce_by_key(const vector<K> &keys, const Expr &expr,
+        vector<K> &out_keys, vector<V> &out_vals, RDC)
+{
+    using namespace detail;
+
+    static kernel_cache count_cache;
+    static kernel_cache write_cache;
+
+    const std::vector<cl::CommandQueue> &queue = keys.queue_list();
+    const size_t n = keys.size();
+
+    {
+        get_expression_properties prop;
+        extract_terminals()(boost::proto::as_child(expr), prop);
+
+        precondition(prop.queue.empty() || prop.size == n,
+                "Keys and values have different sizes in reduce_by_key");
+    }
+
+    if (!n) {
+        out_keys = vector<K>();
+        out_vals = vector<V>();
+        return 0;
+    }
+
+    // Keys on both sides of each device boundary.
+    std::vector<char> has_prev(queue.size(), 0), has_next(queue.size(), 0);
+    std::vector<K>    prev_key(queue.size(), K()), next_key(queue.size(), K());
+    std::vector<char> open_start(queue.size(), 0);
+
+    for(unsigned d = 0; d < queue.size(); d++) {
+        if (!keys.part_size(d)) continue;
+
+        size_t beg = keys.part_start(d);
+        size_t end = keys.part_start(d + 1);
+
+        if (beg > 0) {
+            has_prev[d]   = 1;
+            prev_key[d]   = keys[beg - 1];
+            open_start[d] = (static_cast<K>(keys[beg]) == prev_key[d]);
+        }
+
+        if (end < n) {
+            has_next[d] = 1;
+            next_key[d] = keys[end];
+        }
+    }
+
+    std::vector<size_t>     nchunks(queue.size(), 0);
+    std::vector<size_t>     chunk_size(queue.size(), 0);
+    std::vector<cl::Buffer> dcount(queue.size());
+    std::vector<cl::Buffer> dcarry(queue.size());
+
+    // First pass: count segment heads and reduce trailing segment of each chunk.
+    for(unsigned d = 0; d < queue.size(); d++) {
+        cl::Context context = qctx(queue[d]);
+        cl::Device  device  = qdev(queue[d]);
+
+        auto kernel = count_cache.find(context());
+
+        if (kernel == count_cache.end()) {
+            std::ostringstream increment_line;
+
+            output_local_preamble loc_init(increment_line, device, "prm", empty_state());
+            boost::proto::eval(boost::proto::as_child(expr), loc_init);
+
+            vector_expr_context expr_ctx(increment_line, device, "prm", empty_state());
+
+            increment_line << "\t\tmySum = reduce_operation(mySum, ";
+            boost::proto::eval(boost::proto::as_child(expr), expr_ctx);
+            increment_line << ");\n";
+
+            std::ostringstream params;
+            extract_terminals()( boost::proto::as_child(expr),
+                    declare_expression_parameter(params, device, "prm", empty_state()) );
+
+            std::ostringstream source;
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<K>() << " key_t;\n"
+                "typedef " << type_name<V>() << " val_t;\n";
+
+            typedef typename RDC::template function<V> fun;
+            fun::define(source, "reduce_operation");
+
+            output_terminal_preamble termpream(source, device, "prm", empty_state());
+            boost::proto::eval(boost::proto::as_child(expr), termpream);
+
+            source <<
+                "#define IS_HEAD(i) ((i) ? keys[i] != keys[(i) - 1] : (!has_prev || keys[0] != prev_key))\n"
+                "kernel void vexcl_rbk_count(\n"
+                "\t" << type_name<size_t>() << " n,\n"
+                "\t" << type_name<size_t>() << " chunk_size,\n"
+                "\t" << type_name<size_t>() << " nchunks,\n"
+                "\tchar has_prev,\n"
+                "\tkey_t prev_key,\n"
+                "\tglobal const key_t *keys"
+                << params.str() << ",\n"
+                "\tglobal " << type_name<size_t>() << " *count,\n"
+                "\tglobal val_t *carry\n"
+                "\t)\n"
+                "{\n"
+                "    size_t chunk_id = get_global_id(0);\n"
+                "    if (chunk_id >= nchunks) return;\n"
+                "    size_t start    = min(n, chunk_size * chunk_id);\n"
+                "    size_t stop     = min(n, start + chunk_size);\n"
+                "    size_t heads    = 0;\n"
+                "    val_t  mySum    = " << RDC::template initial<V>() << ";\n"
+                "    for(size_t idx = start; idx < stop; ++idx) {\n"
+                "        if (IS_HEAD(idx)) {\n"
+                "            ++heads;\n"
+                "            mySum = " << RDC::template initial<V>() << ";\n"
+                "        }\n"
+                << increment_line.str() <<
+                "    }\n"
+                "    count[chunk_id] = heads;\n"
+                "    carry[chunk_id] = mySum;\n"
+                "}\n"
+                "kernel void vexcl_rbk_write(\n"
+                "\t" << type_name<size_t>() << " n,\n"
+                "\t" << type_name<size_t>() << " chunk_size,\n"
+                "\t" << type_name<size_t>() << " nchunks,\n"
+                "\tchar has_prev,\n"
+                "\tkey_t prev_key,\n"
+                "\tchar has_next,\n"
+                "\tkey_t next_key,\n"
+                "\tglobal const key_t *keys"
+                << params.str() << ",\n"
+                "\tglobal const " << type_name<size_t>() << " *start_seg,\n"
+                "\tglobal const val_t *carry_in,\n"
+                "\tglobal key_t *out_keys,\n"
+                "\tglobal val_t *out_vals\n"
+                "\t)\n"
+                "{\n"
+                "    size_t chunk_id = get_global_id(0);\n"
+                "    if (chunk_id >= nchunks) return;\n"
+                "    size_t start    = min(n, chunk_size * chunk_id);\n"
+                "    size_t stop     = min(n, start + chunk_size);\n"
+                "    size_t seg      = start_seg[chunk_id];\n"
+                "    val_t  mySum    = carry_in[chunk_id];\n"
+                "    for(size_t idx = start; idx < stop; ++idx) {\n"
+                "        key_t key = keys[idx];\n"
+                "        if (IS_HEAD(idx)) {\n"
+                "            ++seg;\n"
+                "            mySum = " << RDC::template initial<V>() << ";\n"
+                "        }\n"
+                << increment_line.str() <<
+                "        if (idx + 1 < n ? keys[idx + 1] != key : (!has_next || next_key != key)) {\n"
+                "            out_keys[seg - 1] = key;\n"
+                "            out_vals[seg - 1] = mySum;\n"
+                "        }\n"
+                "    }\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel count_krn(program, "vexcl_rbk_count");
+            cl::Kernel write_krn(program, "vexcl_rbk_write");
+
+            size_t wgs = is_cpu(device) ? 1 : std::min(
+                    kernel_workgroup_size(count_krn, device),
+                    kernel_workgroup_size(write_krn, device)
+                    );
+
+            kernel = count_cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(count_krn, wgs)
+                        )).first;
+
+            write_cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(write_krn, wgs)
+                        ));
+        }
+
+        if (size_t psize = keys.part_size(d)) {
+            size_t w_size = kernel->second.wgsize;
+
+            nchunks[d]    = std::min(psize, num_workgroups(device) * w_size);
+            chunk_size[d] = (psize + nchunks[d] - 1) / nchunks[d];
+            nchunks[d]    = (psize + chunk_size[d] - 1) / chunk_size[d];
+
+            dcount[d] = cl::Buffer(context, CL_MEM_READ_WRITE, nchunks[d] * sizeof(size_t));
+            dcarry[d] = cl::Buffer(context, CL_MEM_READ_WRITE, nchunks[d] * sizeof(V));
+
+            cl::Kernel &krn = kernel->second.kernel;
+
+            unsigned pos = 0;
+            krn.setArg(pos++, psize);
+            krn.setArg(pos++, chunk_size[d]);
+            krn.setArg(pos++, nchunks[d]);
+            krn.setArg(pos++, has_prev[d]);
+            krn.setArg(pos++, prev_key[d]);
+            krn.setArg(pos++, keys(d));
+
+            extract_terminals()( boost::proto::as_child(expr),
+                    set_expression_argument(krn, d, pos, keys.part_start(d), empty_state()) );
+
+            krn.setArg(pos++, dcount[d]);
+            krn.setArg(pos++, dcarry[d]);
+
+            queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                    alignup(nchunks[d], w_size), w_size);
+        }
+    }
+
+    // Combine chunk partials on host. Segments that span chunk (and device)
+    // boundaries are merged here.
+    std::vector< std::vector<size_t> > count(queue.size());
+    std::vector< std::vector<V> >      carry(queue.size());
+
+    for(unsigned d = 0; d < queue.size(); d++) {
+        if (!nchunks[d]) continue;
+
+        count[d].resize(nchunks[d]);
+        carry[d].resize(nchunks[d]);
+
+        queue[d].enqueueReadBuffer(dcount[d], CL_FALSE, 0,
+                nchunks[d] * sizeof(size_t), count[d].data());
+        queue[d].enqueueReadBuffer(dcarry[d], CL_FALSE, 0,
+                nchunks[d] * sizeof(V), carry[d].data());
+    }
+
+    for(unsigned d = 0; d < queue.size(); d++)
+        if (nchunks[d]) queue[d].finish();
+
+    std::vector<size_t> base(queue.size(), 0);
+    std::vector<size_t> nout(queue.size(), 0);
+
+    size_t nseg = 0;
+    V run = RDC::template initial<V>();
+
+    for(unsigned d = 0; d < queue.size(); d++) {
+        if (!nchunks[d]) continue;
+
+        size_t seg = open_start[d];
+        base[d] = nseg - seg;
+
+        for(size_t c = 0; c < nchunks[d]; ++c) {
+            size_t heads = count[d][c];
+            V      part  = carry[d][c];
+
+            count[d][c] = seg;
+            carry[d][c] = run;
+
+            run = heads ? part : rdc_combine<RDC>(run, part);
+            seg += heads;
+        }
+
+        nseg   += seg - open_start[d];
+        nout[d] = seg;
+    }
+
+    // The host partials are local to this function, so the writes block.
+    for(unsigned d = 0; d < queue.size(); d++) {
+        if (!nchunks[d]) continue;
+
+        queue[d].enqueueWriteBuffer(dcount[d], CL_TRUE, 0,
+                nchunks[d] * sizeof(size_t), count[d].data());
+        queue[d].enqueueWriteBuffer(dcarry[d], CL_TRUE, 0,
+                nchunks[d] * sizeof(V), carry[d].data());
+    }
+
+    // Second pass: write reduced segments to device-local buffers.
+    std::vector<cl::Buffer> okeys(queue.size());
+    std::vector<cl::Buffer> ovals(queue.size());
+
+    for(unsigned d = 0; d < queue.size(); d++) {
+        if (!nout[d]) continue;
+
+        cl::Context context = qctx(queue[d]);
+
+        auto kernel = write_cache.find(context());
+
+        okeys[d] = cl::Buffer(context, CL_MEM_READ_WRITE, nout[d] * sizeof(K));
+        ovals[d] = cl::Buffer(context, CL_MEM_READ_WRITE, nout[d] * sizeof(V));
+
+        cl::Kernel &krn   = kernel->second.kernel;
+        size_t     w_size = kernel->second.wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, keys.part_size(d));
+        krn.setArg(pos++, chunk_size[d]);
+        krn.setArg(pos++, nchunks[d]);
+        krn.setArg(pos++, has_prev[d]);
+        krn.setArg(pos++, prev_key[d]);
+        krn.setArg(pos++, has_next[d]);
+        krn.setArg(pos++, next_key[d]);
+        krn.setArg(pos++, keys(d));
+
+        extract_terminals()( boost::proto::as_child(expr),
+                set_expression_argument(krn, d, pos, keys.part_start(d), empty_state()) );
+
+        krn.setArg(pos++, dcount[d]);
+        krn.setArg(pos++, dcarry[d]);
+        krn.setArg(pos++, okeys[d]);
+        krn.setArg(pos++, ovals[d]);
+
+        queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                alignup(nchunks[d], w_size), w_size);
+    }
+
+    if (out_keys.size() != nseg || out_keys.nparts() != queue.size())
+        out_keys.resize(queue, nseg);
+
+    if (out_vals.size() != nseg || out_vals.nparts() != queue.size())
+        out_vals.resize(queue, nseg);
+
+    // Move the results to their global positions. The segment that continues
+    // to the next device is written by that device.
+    for(unsigned d = 0; d < queue.size(); d++) {
+        if (!nout[d]) continue;
+
+        size_t first = base[d];
+        size_t last  = std::min(base[d] + nout[d], nseg);
+
+        for(unsigned e = d + 1; e < queue.size(); e++) {
+            if (!nchunks[e]) continue;
+            if (open_start[e]) --last;
+            break;
+        }
+
+        if (last > first) {
+            copy_buffer_to_vector(queue[d], okeys[d], 0, last - first, out_keys, first);
+            copy_buffer_to_vector(queue[d], ovals[d], 0, last - first, out_vals, first);
+        }
+    }
+
+    return nseg;
+}
+
+/// Reduces consecutive elements of a vector expression with equal keys.
+/**
+ * Sums the values of each segment (same as reduce_by_key() with vex::SUM
+ * reduction kind).
+ */
+template <typename K, class Expr, typename V>
+size_t reduce_by_key(const vector<K> &keys, const Expr &expr,
+        vector<K> &out_keys, vector<V> &out_vals)
+{
+    return reduce_by_key(keys, expr, out_keys, out_vals, SUM());
+}
+
+} // namespace vex
+
+#endif
@@ -117,6 +117,19 @@ struct MIN {
     }
 };
 
+/// \cond INTERNAL
+namespace detail {
+
+// Combines two values on host with reduction kind RDC.
+template <class RDC, typename T>
+T rdc_combine(const T &a, const T &b) {
+    T v[2] = {a, b};
+    return RDC::reduce(v, v + 2);
+}
+
+} // namespace detail
+/// \endcond
+
 /// Parallel reduction of arbitrary expression.
 /**
  * Reduction uses small temporary buffer on each device present in the queue
@@ -0,0 +1,344 @@
+#ifndef VEXCL_SCAN_HPP
+#define VEXCL_SCAN_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/scan.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Inclusive and exclusive scans of vector expressions.
+ */
+
+#include <vector>
+#include <string>
+#include <sstream>
+
+#include <vexcl/operations.hpp>
+#include <vexcl/vector.hpp>
+#include <vexcl/reductor.hpp>
+
+namespace vex {
+
+/// \cond INTERNAL
+namespace detail {
+
+// Reduce-then-scan. Each workgroup owns a contiguous block of a device
+// partition. The first kernel reduces the blocks; the block sums are scanned
+// on host in global order (this propagates carries across devices); the
+// second kernel scans each block tile by tile, starting from its carry.
+template <class OP, class Expr, typename T>
+void scan(const Expr &expr, vector<T> &dst, const T &init, bool exclusive) {
+    static kernel_cache reduce_cache;
+    static kernel_cache scan_cache;
+
+    const std::vector<cl::CommandQueue> &queue = dst.queue_list();
+
+    {
+        get_expression_properties prop;
+        extract_terminals()(boost::proto::as_child(expr), prop);
+
+        precondition(prop.queue.empty() || prop.size == dst.size(),
+                "Input and output have different sizes in scan");
+    }
+
+    std::vector<size_t>     ngroups(queue.size(), 0);
+    std::vector<size_t>     block(queue.size(), 0);
+    std::vector<cl::Buffer> dsum(queue.size());
+
+    // First pass: reduce each block.
+    for(unsigned d = 0; d < queue.size(); d++) {
+        cl::Context context = qctx(queue[d]);
+        cl::Device  device  = qdev(queue[d]);
+
+        auto kernel = reduce_cache.find(context());
+
+        if (kernel == reduce_cache.end()) {
+            std::ostringstream load_value;
+
+            output_local_preamble loc_init(load_value, device, "prm", empty_state());
+            boost::proto::eval(boost::proto::as_child(expr), loc_init);
+
+            vector_expr_context expr_ctx(load_value, device, "prm", empty_state());
+
+            load_value << "\t\t\tmyVal = ";
+            boost::proto::eval(boost::proto::as_child(expr), expr_ctx);
+            load_value << ";\n";
+
+            std::ostringstream params;
+            extract_terminals()( boost::proto::as_child(expr),
+                    declare_expression_parameter(params, device, "prm", empty_state()) );
+
+            std::ostringstream source;
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<T>() << " real;\n";
+
+            typedef typename OP::template function<T> fun;
+            fun::define(source, "scan_operation");
+
+            output_terminal_preamble termpream(source, device, "prm", empty_state());
+            boost::proto::eval(boost::proto::as_child(expr), termpream);
+
+            source <<
+                "kernel void vexcl_scan_reduce(\n"
+                "\t" << type_name<size_t>() << " n,\n"
+                "\t" << type_name<size_t>() << " block_size"
+                << params.str() << ",\n"
+                "\tglobal real *block_sum,\n"
+                "\tlocal  real *shared\n"
+                "\t)\n"
+                "{\n"
+                "    size_t lid   = get_local_id(0);\n"
+                "    size_t wgs   = get_local_size(0);\n"
+                "    size_t start = min(n, block_size * get_group_id(0));\n"
+                "    size_t stop  = min(n, start + block_size);\n"
+                "    real   mySum = " << OP::template initial<T>() << ";\n"
+                "    for(size_t tile = start; tile < stop; tile += wgs) {\n"
+                "        size_t idx   = tile + lid;\n"
+                "        real   myVal = " << OP::template initial<T>() << ";\n"
+                "        if (idx < stop) {\n"
+                << load_value.str() <<
+                "        }\n"
+                "        shared[lid] = myVal;\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        for(size_t s = 1; s < wgs; s *= 2) {\n"
+                "            if (lid % (2 * s) == 0 && lid + s < wgs)\n"
+                "                shared[lid] = scan_operation(shared[lid], shared[lid + s]);\n"
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        }\n"
+                "        if (lid == 0) mySum = scan_operation(mySum, shared[0]);\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "    }\n"
+                "    if (lid == 0) block_sum[get_group_id(0)] = mySum;\n"
+                "}\n"
+                "kernel void vexcl_scan_write(\n"
+                "\t" << type_name<size_t>() << " n,\n"
+                "\t" << type_name<size_t>() << " block_size,\n"
+                "\tchar exclusive"
+                << params.str() << ",\n"
+                "\tglobal const real *carry,\n"
+                "\tglobal real *out,\n"
+                "\tlocal  real *shared\n"
+                "\t)\n"
+                "{\n"
+                "    size_t lid   = get_local_id(0);\n"
+                "    size_t wgs   = get_local_size(0);\n"
+                "    size_t start = min(n, block_size * get_group_id(0));\n"
+                "    size_t stop  = min(n, start + block_size);\n"
+                "    real   mySum = carry[get_group_id(0)];\n"
+                "    for(size_t tile = start; tile < stop; tile += wgs) {\n"
+                "        size_t idx   = tile + lid;\n"
+                "        real   myVal = " << OP::template initial<T>() << ";\n"
+                "        if (idx < stop) {\n"
+                << load_value.str() <<
+                "        }\n"
+                "        shared[lid] = myVal;\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        for(size_t s = 1; s < wgs; s *= 2) {\n"
+                "            if (lid >= s) myVal = scan_operation(shared[lid - s], myVal);\n"
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "            shared[lid] = myVal;\n"
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        }\n"
+                "        if (idx < stop) {\n"
+                "            if (!exclusive)\n"
+                "                out[idx] = scan_operation(mySum, myVal);\n"
+                "            else if (lid)\n"
+                "                out[idx] = scan_operation(mySum, shared[lid - 1]);\n"
+                "            else\n"
+                "                out[idx] = mySum;\n"
+                "        }\n"
+                "        mySum = scan_operation(mySum, shared[wgs - 1]);\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "    }\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel reduce_krn(program, "vexcl_scan_reduce");
+            cl::Kernel scan_krn  (program, "vexcl_scan_write");
+
+            size_t wgs;
+            if (is_cpu(device)) {
+                wgs = 1;
+            } else {
+                wgs = std::min(
+                        kernel_workgroup_size(reduce_krn, device),
+                        kernel_workgroup_size(scan_krn,   device)
+                        );
+
+                size_t smem = static_cast<size_t>(device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>())
+                            - static_cast<size_t>(scan_krn.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device));
+                while(wgs * sizeof(T) > smem)
+                    wgs /= 2;
+            }
+
+            kernel = reduce_cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(reduce_krn, wgs)
+                        )).first;
+
+            scan_cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(scan_krn, wgs)
+                        ));
+        }
+
+        if (size_t psize = dst.part_size(d)) {
+            size_t w_size = kernel->second.wgsize;
+
+            ngroups[d] = std::min(num_workgroups(device), (psize + w_size - 1) / w_size);
+            block[d]   = alignup((psize + ngroups[d] - 1) / ngroups[d], w_size);
+            ngroups[d] = (psize + block[d] - 1) / block[d];
+
+            dsum[d] = cl::Buffer(context, CL_MEM_READ_WRITE, ngroups[d] * sizeof(T));
+
+            cl::Kernel &krn = kernel->second.kernel;
+
+            unsigned pos = 0;
+            krn.setArg(pos++, psize);
+            krn.setArg(pos++, block[d]);
+
+            extract_terminals()( boost::proto::as_child(expr),
+                    set_expression_argument(krn, d, pos, dst.part_start(d), empty_state()) );
+
+            krn.setArg(pos++, dsum[d]);
+            krn.setArg(pos++, vex::Local(w_size * sizeof(T)));
+
+            queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                    ngroups[d] * w_size, w_size);
+        }
+    }
+
+    // Exclusive scan of block sums in global order gives each block its
+    // carry, including the carry from the preceding devices.
+    std::vector< std::vector<T> > sum(queue.size());
+
+    for(unsigned d = 0; d < queue.size(); d++) {
+        if (!ngroups[d]) continue;
+
+        sum[d].resize(ngroups[d]);
+        queue[d].enqueueReadBuffer(dsum[d], CL_FALSE, 0,
+                ngroups[d] * sizeof(T), sum[d].data());
+    }
+
+    for(unsigned d = 0; d < queue.size(); d++)
+        if (ngroups[d]) queue[d].finish();
+
+    T run = init;
+    for(unsigned d = 0; d < queue.size(); d++) {
+        for(size_t g = 0; g < ngroups[d]; ++g) {
+            T s = sum[d][g];
+            sum[d][g] = run;
+            run = rdc_combine<OP>(run, s);
+        }
+    }
+
+    // Second pass: scan each block.
+    for(unsigned d = 0; d < queue.size(); d++) {
+        if (!ngroups[d]) continue;
+
+        // Block offsets live in host memory local to this function.
+        queue[d].enqueueWriteBuffer(dsum[d], CL_TRUE, 0,
+                ngroups[d] * sizeof(T), sum[d].data());
+
+        auto kernel = scan_cache.find(qctx(queue[d])());
+
+        cl::Kernel &krn   = kernel->second.kernel;
+        size_t     w_size = kernel->second.wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, dst.part_size(d));
+        krn.setArg(pos++, block[d]);
+        krn.setArg(pos++, static_cast<char>(exclusive));
+
+        extract_terminals()( boost::proto::as_child(expr),
+                set_expression_argument(krn, d, pos, dst.part_start(d), empty_state()) );
+
+        krn.setArg(pos++, dsum[d]);
+        krn.setArg(pos++, dst(d));
+        krn.setArg(pos++, vex::Local(w_size * sizeof(T)));
+
+        queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                ngroups[d] * w_size, w_size);
+    }
+}
+
+} // namespace detail
+/// \endcond
+
+/// Inclusive scan of a vector expression.
+/**
+ * dst[i] = expr[0] op expr[1] op ... op expr[i], where op is an associative
+ * operation given by OP. OP has the same form as reduction kinds accepted by
+ * vex::Reductor (vex::SUM, vex::MAX, vex::MIN, or a user-defined one), and
+ * its initial value should be the identity of the operation.
+ *
+ * The scan works across all devices in the output vector's queue list. The
+ * expression may refer to dst itself as long as each element of the output
+ * depends only on the same element of dst (e.g. inclusive_scan(x, x)).
+ *
+ * Example:
+ * \code
+ * vex::inclusive_scan(x, y);                // Prefix sums.
+ * vex::inclusive_scan(fabs(x), y, MAX());   // Running maximum.
+ * \endcode
+ */
+template <class Expr, typename T, class OP>
+void inclusive_scan(const Expr &expr, vector<T> &dst, OP) {
+    detail::scan<OP>(expr, dst, OP::template initial<T>(), false);
+}
+
+/// Inclusive prefix sum of a vector expression.
+template <class Expr, typename T>
+void inclusive_scan(const Expr &expr, vector<T> &dst) {
+    inclusive_scan(expr, dst, SUM());
+}
+
+/// Exclusive scan of a vector expression.
+/**
+ * dst[0] = init, dst[i] = init op expr[0] op ... op expr[i - 1]. See
+ * inclusive_scan() for the requirements on OP.
+ */
+template <class Expr, typename T, class OP>
+void exclusive_scan(const Expr &expr, vector<T> &dst, OP, const T &init) {
+    detail::scan<OP>(expr, dst, init, true);
+}
+
+/// Exclusive scan of a vector expression.
+/**
+ * The operation identity (OP::initial()) is used as the initial value.
+ */
+template <class Expr, typename T, class OP>
+void exclusive_scan(const Expr &expr, vector<T> &dst, OP op) {
+    exclusive_scan(expr, dst, op, OP::template initial<T>());
+}
+
+/// Exclusive prefix sum of a vector expression.
+template <class Expr, typename T>
+void exclusive_scan(const Expr &expr, vector<T> &dst) {
+    exclusive_scan(expr, dst, SUM());
+}
+
+} // namespace vex
+
+#endif
@@ -0,0 +1,722 @@
+#ifndef VEXCL_SOLVER_AMG_HPP
+#define VEXCL_SOLVER_AMG_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/solver/amg.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Smoothed aggregation algebraic multigrid preconditioner.
+ */
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <numeric>
+#include <cmath>
+
+#include <vexcl/vector.hpp>
+#include <vexcl/spmat.hpp>
+
+namespace vex {
+
+/// \cond INTERNAL
+namespace detail {
+
+// Host-side matrix in CSR format used during AMG setup.
+template <typename real>
+struct amg_matrix {
+    size_t nrows, ncols;
+
+    std::vector<size_t> row;
+    std::vector<size_t> col;
+    std::vector<real>   val;
+
+    amg_matrix() : nrows(0), ncols(0) {}
+
+    template <typename col_t, typename idx_t>
+    amg_matrix(size_t n, size_t m, const idx_t *r, const col_t *c, const real *v)
+        : nrows(n), ncols(m), row(n + 1), col(r[n] - r[0]), val(r[n] - r[0])
+    {
+        for(size_t i = 0; i <= n; ++i)
+            row[i] = static_cast<size_t>(r[i] - r[0]);
+
+        for(size_t j = 0; j < row[n]; ++j) {
+            col[j] = static_cast<size_t>(c[r[0] + j]);
+            val[j] = v[r[0] + j];
+        }
+    }
+
+    void swap(amg_matrix &A) {
+        std::swap(nrows, A.nrows);
+        std::swap(ncols, A.ncols);
+        row.swap(A.row);
+        col.swap(A.col);
+        val.swap(A.val);
+    }
+};
+
+template <typename real>
+std::vector<real> amg_diagonal(const amg_matrix<real> &A) {
+    std::vector<real> d(A.nrows, real());
+
+#ifdef _OPENMP
+#  pragma omp parallel for
+#endif
+    for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(A.nrows); ++i) {
+        for(size_t j = A.row[i]; j < A.row[i + 1]; ++j) {
+            if (A.col[j] == static_cast<size_t>(i)) {
+                d[i] = A.val[j];
+                break;
+            }
+        }
+    }
+
+    return d;
+}
+
+// Sorts columns (and values) of a matrix row. Rows are short, so insertion
+// sort is used.
+template <typename real>
+void amg_sort_row(size_t *col, real *val, size_t n) {
+    for(size_t j = 1; j < n; ++j) {
+        size_t c = col[j];
+        real   v = val[j];
+
+        size_t i = j;
+        for(; i > 0 && col[i - 1] > c; --i) {
+            col[i] = col[i - 1];
+            val[i] = val[i - 1];
+        }
+
+        col[i] = c;
+        val[i] = v;
+    }
+}
+
+template <typename real>
+amg_matrix<real> amg_transpose(const amg_matrix<real> &A) {
+    amg_matrix<real> T;
+
+    T.nrows = A.ncols;
+    T.ncols = A.nrows;
+
+    T.row.resize(T.nrows + 1, 0);
+    T.col.resize(A.row[A.nrows]);
+    T.val.resize(A.row[A.nrows]);
+
+    for(size_t j = 0; j < A.row[A.nrows]; ++j)
+        ++T.row[A.col[j] + 1];
+
+    std::partial_sum(T.row.begin(), T.row.end(), T.row.begin());
+
+    for(size_t i = 0; i < A.nrows; ++i) {
+        for(size_t j = A.row[i]; j < A.row[i + 1]; ++j) {
+            size_t pos = T.row[A.col[j]]++;
+
+            T.col[pos] = i;
+            T.val[pos] = A.val[j];
+        }
+    }
+
+    std::rotate(T.row.begin(), T.row.end() - 1, T.row.end());
+    T.row[0] = 0;
+
+    return T;
+}
+
+// Sparse matrix product (Gustavson algorithm). Rows are processed in two
+// passes: the first one counts nonzeros of the result, the second one fills
+// them in.
+template <typename real>
+amg_matrix<real> amg_product(const amg_matrix<real> &A, const amg_matrix<real> &B) {
+    amg_matrix<real> C;
+
+    C.nrows = A.nrows;
+    C.ncols = B.ncols;
+    C.row.resize(C.nrows + 1, 0);
+
+#ifdef _OPENMP
+#  pragma omp parallel
+#endif
+    {
+        std::vector<ptrdiff_t> marker(B.ncols, -1);
+
+#ifdef _OPENMP
+#  pragma omp for
+#endif
+        for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(A.nrows); ++i) {
+            size_t cnt = 0;
+
+            for(size_t j = A.row[i]; j < A.row[i + 1]; ++j) {
+                size_t c = A.col[j];
+                for(size_t k = B.row[c]; k < B.row[c + 1]; ++k) {
+                    if (marker[B.col[k]] != i) {
+                        marker[B.col[k]] = i;
+                        ++cnt;
+                    }
+                }
+            }
+
+            C.row[i + 1] = cnt;
+        }
+    }
+
+    std::partial_sum(C.row.begin(), C.row.end(), C.row.begin());
+
+    C.col.resize(C.row.back());
+    C.val.resize(C.row.back());
+
+#ifdef _OPENMP
+#  pragma omp parallel
+#endif
+    {
+        // Position of a column in the current row of C, or anything less
+        // than the row start if the column has not been met yet. Each
+        // thread processes its rows in increasing order.
+        std::vector<ptrdiff_t> marker(B.ncols, -1);
+
+#ifdef _OPENMP
+#  pragma omp for schedule(static)
+#endif
+        for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(A.nrows); ++i) {
+            ptrdiff_t beg  = C.row[i];
+            ptrdiff_t head = beg;
+
+            for(size_t j = A.row[i]; j < A.row[i + 1]; ++j) {
+                size_t c = A.col[j];
+                real   a = A.val[j];
+
+                for(size_t k = B.row[c]; k < B.row[c + 1]; ++k) {
+                    size_t cc = B.col[k];
+
+                    if (marker[cc] < beg) {
+                        marker[cc] = head;
+                        C.col[head] = cc;
+                        C.val[head] = a * B.val[k];
+                        ++head;
+                    } else {
+                        C.val[marker[cc]] += a * B.val[k];
+                    }
+                }
+            }
+
+            amg_sort_row(&C.col[beg], &C.val[beg], head - beg);
+        }
+    }
+
+    return C;
+}
+
+// Plain aggregation. Connection between i and j is strong if
+// a_ij^2 > eps^2 * |a_ii * a_jj|. Points without strong connections are
+// left out of aggregates (agg[i] < 0); those are taken care of by the
+// smoother. Returns the number of aggregates.
+template <typename real>
+size_t amg_aggregates(const amg_matrix<real> &A, real eps,
+        std::vector<char> &strong, std::vector<ptrdiff_t> &agg)
+{
+    const ptrdiff_t undefined = -1;
+    const ptrdiff_t removed   = -2;
+
+    const size_t n = A.nrows;
+
+    std::vector<real> dia = amg_diagonal(A);
+
+    strong.resize(A.row[n]);
+    agg.resize(n);
+
+    real eps2 = eps * eps;
+
+#ifdef _OPENMP
+#  pragma omp parallel for
+#endif
+    for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+        bool isolated = true;
+
+        for(size_t j = A.row[i]; j < A.row[i + 1]; ++j) {
+            size_t c = A.col[j];
+            real   v = A.val[j];
+
+            strong[j] = c != static_cast<size_t>(i) &&
+                v * v > eps2 * std::fabs(dia[i] * dia[c]);
+
+            if (strong[j]) isolated = false;
+        }
+
+        agg[i] = isolated ? removed : undefined;
+    }
+
+    // First pass: points whose strong neighbours are all free become roots
+    // of new aggregates.
+    size_t nagg = 0;
+
+    for(size_t i = 0; i < n; ++i) {
+        if (agg[i] != undefined) continue;
+
+        bool free = true;
+        for(size_t j = A.row[i]; j < A.row[i + 1]; ++j) {
+            if (strong[j] && agg[A.col[j]] != undefined && agg[A.col[j]] != removed) {
+                free = false;
+                break;
+            }
+        }
+
+        if (!free) continue;
+
+        ptrdiff_t id = static_cast<ptrdiff_t>(nagg++);
+
+        agg[i] = id;
+        for(size_t j = A.row[i]; j < A.row[i + 1]; ++j)
+            if (strong[j] && agg[A.col[j]] == undefined) agg[A.col[j]] = id;
+    }
+
+    // Second pass: remaining points join an aggregate of a strong neighbour.
+    // Such a neighbour exists, or the point would have become a root.
+    for(size_t i = 0; i < n; ++i) {
+        if (agg[i] != undefined) continue;
+
+        for(size_t j = A.row[i]; j < A.row[i + 1]; ++j) {
+            if (strong[j] && agg[A.col[j]] >= 0) {
+                agg[i] = agg[A.col[j]];
+                break;
+            }
+        }
+    }
+
+    return nagg;
+}
+
+// Smoothed interpolation P = (I - omega * D_F^-1 * A_F) * P_tent, where
+// P_tent is the piecewise constant interpolation from aggregates and A_F is
+// the filtered matrix: its weak connections are lumped into the diagonal.
+// omega = 4/3 / rho(D_F^-1 A_F), with the spectral radius estimated by
+// Gershgorin theorem.
+template <typename real>
+amg_matrix<real> amg_interpolation(const amg_matrix<real> &A,
+        const std::vector<char> &strong, const std::vector<ptrdiff_t> &agg,
+        size_t nagg)
+{
+    const size_t n = A.nrows;
+
+    std::vector<real> dia(n);
+    std::vector<real> rho(n);
+
+#ifdef _OPENMP
+#  pragma omp parallel for
+#endif
+    for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+        real d = 0;
+        for(size_t j = A.row[i]; j < A.row[i + 1]; ++j)
+            if (A.col[j] == static_cast<size_t>(i) || !strong[j]) d += A.val[j];
+
+        real s = std::fabs(d);
+        for(size_t j = A.row[i]; j < A.row[i + 1]; ++j)
+            if (strong[j]) s += std::fabs(A.val[j]);
+
+        dia[i] = d;
+        rho[i] = s / std::fabs(d);
+    }
+
+    real omega = static_cast<real>(4) / 3 / *std::max_element(rho.begin(), rho.end());
+
+    amg_matrix<real> P;
+
+    P.nrows = n;
+    P.ncols = nagg;
+    P.row.resize(n + 1, 0);
+
+#ifdef _OPENMP
+#  pragma omp parallel
+#endif
+    {
+        std::vector<ptrdiff_t> marker(nagg, -1);
+
+#ifdef _OPENMP
+#  pragma omp for
+#endif
+        for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+            size_t cnt = 0;
+
+            for(size_t j = A.row[i]; j < A.row[i + 1]; ++j) {
+                size_t c = A.col[j];
+                if (c != static_cast<size_t>(i) && !strong[j]) continue;
+
+                ptrdiff_t g = agg[c];
+                if (g >= 0 && marker[g] != i) {
+                    marker[g] = i;
+                    ++cnt;
+                }
+            }
+
+            P.row[i + 1] = cnt;
+        }
+    }
+
+    std::partial_sum(P.row.begin(), P.row.end(), P.row.begin());
+
+    P.col.resize(P.row.back());
+    P.val.resize(P.row.back());
+
+#ifdef _OPENMP
+#  pragma omp parallel
+#endif
+    {
+        std::vector<ptrdiff_t> marker(nagg, -1);
+
+#ifdef _OPENMP
+#  pragma omp for schedule(static)
+#endif
+        for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+            ptrdiff_t beg  = P.row[i];
+            ptrdiff_t head = beg;
+
+            for(size_t j = A.row[i]; j < A.row[i + 1]; ++j) {
+                size_t c = A.col[j];
+
+                real v;
+                if (c == static_cast<size_t>(i))
+                    v = 1 - omega;
+                else if (strong[j])
+                    v = -omega * A.val[j] / dia[i];
+                else
+                    continue;
+
+                ptrdiff_t g = agg[c];
+                if (g < 0) continue;
+
+                if (marker[g] < beg) {
+                    marker[g] = head;
+                    P.col[head] = g;
+                    P.val[head] = v;
+                    ++head;
+                } else {
+                    P.val[marker[g]] += v;
+                }
+            }
+
+            amg_sort_row(&P.col[beg], &P.val[beg], head - beg);
+        }
+    }
+
+    return P;
+}
+
+// Inverse of a small matrix (Gauss-Jordan elimination with partial
+// pivoting). The result is returned as a dense matrix in CSR format.
+template <typename real>
+amg_matrix<real> amg_inverse(const amg_matrix<real> &A) {
+    const size_t n = A.nrows;
+
+    std::vector<real> a(n * n, real());
+    std::vector<real> b(n * n, real());
+
+    for(size_t i = 0; i < n; ++i) {
+        for(size_t j = A.row[i]; j < A.row[i + 1]; ++j)
+            a[i * n + A.col[j]] = A.val[j];
+        b[i * n + i] = 1;
+    }
+
+    for(size_t k = 0; k < n; ++k) {
+        size_t p = k;
+        for(size_t i = k + 1; i < n; ++i)
+            if (std::fabs(a[i * n + k]) > std::fabs(a[p * n + k])) p = i;
+
+        if (p != k) {
+            std::swap_ranges(&a[k * n], &a[k * n] + n, &a[p * n]);
+            std::swap_ranges(&b[k * n], &b[k * n] + n, &b[p * n]);
+        }
+
+        real d = 1 / a[k * n + k];
+        for(size_t j = 0; j < n; ++j) {
+            a[k * n + j] *= d;
+            b[k * n + j] *= d;
+        }
+
+#ifdef _OPENMP
+#  pragma omp parallel for
+#endif
+        for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+            if (static_cast<size_t>(i) == k) continue;
+
+            real c = a[i * n + k];
+            if (c == 0) continue;
+
+            for(size_t j = 0; j < n; ++j) {
+                a[i * n + j] -= c * a[k * n + j];
+                b[i * n + j] -= c * b[k * n + j];
+            }
+        }
+    }
+
+    amg_matrix<real> B;
+
+    B.nrows = n;
+    B.ncols = n;
+    B.row.resize(n + 1);
+    B.col.resize(n * n);
+    B.val.swap(b);
+
+    for(size_t i = 0; i <= n; ++i) B.row[i] = i * n;
+    for(size_t j = 0; j < n * n; ++j) B.col[j] = j % n;
+
+    return B;
+}
+
+} // namespace detail
+/// \endcond
+
+namespace solver {
+
+/// Smoothed aggregation algebraic multigrid preconditioner.
+/**
+ * The hierarchy of coarse grids is built on the host: points are grouped
+ * into aggregates over strong connections, and the piecewise constant
+ * interpolation from aggregates is smoothed with one damped Jacobi step.
+ * Coarse operators are computed as Galerkin products R * A * P with
+ * R = P^T. The setup is parallelized with OpenMP where possible.
+ *
+ * The operators of every level are stored as vex::SpMat, so that the
+ * V-cycle runs entirely on the compute devices: relaxation with damped
+ * Jacobi or SPAI-0 smoother on each level, and multiplication by the
+ * precomputed inverse of the coarsest operator. The class satisfies the
+ * preconditioner interface of vex::solver (see vex::solver::identity).
+ *
+ * Usage:
+ * \code
+ * vex::solver::amg<double> P(ctx, n, row.data(), col.data(), val.data());
+ * vex::solver::cg<double> solve(ctx, n);
+ * std::tie(iters, resid) = solve(A, P, rhs, x);
+ * \endcode
+ */
+template <typename real>
+class amg {
+    public:
+        /// Smoother kinds.
+        enum relaxation {
+            damped_jacobi, ///< Damped Jacobi, M = omega * D^-1.
+            spai0          ///< Sparse approximate inverse, m_i = a_ii / ||a_i||^2.
+        };
+
+        /// AMG parameters.
+        struct params {
+            /// Smoother.
+            relaxation relax;
+
+            /// Number of pre-relaxation sweeps.
+            unsigned npre;
+
+            /// Number of post-relaxation sweeps.
+            unsigned npost;
+
+            /// Coarsening stops when a level has at most this many rows.
+            /**
+             * The coarsest level is solved by multiplication with its
+             * inverse, stored as a dense matrix.
+             */
+            size_t coarse_enough;
+
+            /// Strong connection threshold on the finest level.
+            /** The threshold is halved on each subsequent level. */
+            real eps_strong;
+
+            /// Damping factor for damped Jacobi smoother.
+            real jacobi_damping;
+
+            params()
+                : relax(spai0), npre(1), npost(1), coarse_enough(500),
+                  eps_strong(static_cast<real>(0.08)),
+                  jacobi_damping(static_cast<real>(0.72))
+            {}
+        };
+
+        /// Constructor.
+        /**
+         * \param queue vector of queues. Each queue represents one
+         *            compute device.
+         * \param n   number of rows in the matrix.
+         * \param row row index into col and val vectors.
+         * \param col column numbers of nonzero elements of the matrix.
+         * \param val values of nonzero elements of the matrix.
+         * \param prm AMG parameters.
+         */
+        template <typename col_t, typename idx_t>
+        amg(const std::vector<cl::CommandQueue> &queue, size_t n,
+                const idx_t *row, const col_t *col, const real *val,
+                const params &prm = params()
+           ) : prm(prm)
+        {
+            detail::amg_matrix<real> A(n, n, row, col, val);
+
+            real eps = prm.eps_strong;
+
+            while(A.nrows > prm.coarse_enough) {
+                std::vector<char>      strong;
+                std::vector<ptrdiff_t> agg;
+
+                size_t nagg = detail::amg_aggregates(A, eps, strong, agg);
+
+                // No further coarsening is possible.
+                if (nagg == 0 || nagg >= A.nrows) break;
+
+                detail::amg_matrix<real> P = detail::amg_interpolation(A, strong, agg, nagg);
+                detail::amg_matrix<real> R = detail::amg_transpose(P);
+                detail::amg_matrix<real> C = detail::amg_product(R, detail::amg_product(A, P));
+
+                levels.push_back(std::unique_ptr<level>(
+                            new level(queue, A, &P, &R, prm, levels.empty())));
+
+                A.swap(C);
+                eps *= static_cast<real>(0.5);
+            }
+
+            levels.push_back(std::unique_ptr<level>(
+                        new level(queue, A, 0, 0, prm, levels.empty())));
+        }
+
+        /// Number of levels in the hierarchy.
+        size_t depth() const {
+            return levels.size();
+        }
+
+        /// Applies one V-cycle to r with zero initial approximation.
+        void apply(const vex::vector<real> &r, vex::vector<real> &u) const {
+            cycle(0, r, u);
+        }
+    private:
+        struct level {
+            size_t n;
+            bool   direct;
+
+            std::unique_ptr< SpMat<real> > A, P, R;
+
+            vex::vector<real> M, f, u, t;
+
+            level(const std::vector<cl::CommandQueue> &queue,
+                    const detail::amg_matrix<real> &a,
+                    const detail::amg_matrix<real> *p,
+                    const detail::amg_matrix<real> *r,
+                    const params &prm, bool fine
+                 )
+                : n(a.nrows), direct(!p && a.nrows <= prm.coarse_enough)
+            {
+                if (direct) {
+                    detail::amg_matrix<real> ainv = detail::amg_inverse(a);
+
+                    A.reset(new SpMat<real>(queue, n, n,
+                                ainv.row.data(), ainv.col.data(), ainv.val.data()));
+                } else {
+                    A.reset(new SpMat<real>(queue, n, n,
+                                a.row.data(), a.col.data(), a.val.data()));
+
+                    M.resize(queue, smoother(a, prm));
+                    t.resize(queue, n);
+                }
+
+                if (p) {
+                    P.reset(new SpMat<real>(queue, p->nrows, p->ncols,
+                                p->row.data(), p->col.data(), p->val.data()));
+                    R.reset(new SpMat<real>(queue, r->nrows, r->ncols,
+                                r->row.data(), r->col.data(), r->val.data()));
+                }
+
+                // The finest level works with vectors of the caller.
+                if (!fine) {
+                    f.resize(queue, n);
+                    u.resize(queue, n);
+                }
+            }
+
+            static std::vector<real> smoother(
+                    const detail::amg_matrix<real> &a, const params &prm)
+            {
+                std::vector<real> m(a.nrows);
+
+#ifdef _OPENMP
+#  pragma omp parallel for
+#endif
+                for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(a.nrows); ++i) {
+                    real d = 0, s = 0;
+
+                    for(size_t j = a.row[i]; j < a.row[i + 1]; ++j) {
+                        if (a.col[j] == static_cast<size_t>(i)) d = a.val[j];
+                        s += a.val[j] * a.val[j];
+                    }
+
+                    m[i] = (prm.relax == spai0) ? d / s : prm.jacobi_damping / d;
+                }
+
+                return m;
+            }
+
+            // u += M * (f - A * u).
+            void relax(const vex::vector<real> &rhs, vex::vector<real> &x) {
+                t = rhs - (*A) * x;
+                x += M * t;
+            }
+        };
+
+        params prm;
+        std::vector< std::unique_ptr<level> > levels;
+
+        void cycle(size_t l, const vex::vector<real> &rhs, vex::vector<real> &x) const {
+            level &L = *levels[l];
+
+            if (L.direct) {
+                x = (*L.A) * rhs;
+                return;
+            }
+
+            // Relaxation from zero initial approximation.
+            if (prm.npre) {
+                x = L.M * rhs;
+                for(unsigned k = 1; k < prm.npre; ++k) L.relax(rhs, x);
+            } else {
+                x = 0;
+            }
+
+            if (l + 1 < levels.size()) {
+                level &C = *levels[l + 1];
+
+                L.t = rhs - (*L.A) * x;
+                C.f = (*L.R) * L.t;
+
+                cycle(l + 1, C.f, C.u);
+
+                x += (*L.P) * C.u;
+            } else {
+                // Coarsening stalled: relax once more instead.
+                L.relax(rhs, x);
+            }
+
+            for(unsigned k = 0; k < prm.npost; ++k) L.relax(rhs, x);
+        }
+};
+
+} // namespace solver
+
+} // namespace vex
+
+#endif
@@ -0,0 +1,377 @@
+#ifndef VEXCL_SOLVER_BICGSTAB_HPP
+#define VEXCL_SOLVER_BICGSTAB_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/solver/bicgstab.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  BiCGStab method with fused kernels.
+ */
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <tuple>
+#include <cmath>
+
+#include <vexcl/vector.hpp>
+#include <vexcl/reductor.hpp>
+#include <vexcl/solver/fused.hpp>
+
+namespace vex {
+
+namespace solver {
+
+/// Preconditioned BiCGStab method.
+/**
+ * Solves general nonsymmetric systems with right preconditioning. Inner
+ * products are fused either with each other or with the vector updates
+ * they depend on, so that an iteration costs three host synchronizations
+ * instead of five. The last of them also provides the residual norm for
+ * the convergence check.
+ *
+ * Usage:
+ * \code
+ * vex::solver::bicgstab<double> solve(ctx, n);
+ * size_t iters;
+ * double resid;
+ * std::tie(iters, resid) = solve(A, vex::solver::identity(), rhs, x);
+ * \endcode
+ */
+template <typename real>
+class bicgstab {
+    public:
+        /// Constructor.
+        /**
+         * \param queue   vector of queues. Each queue represents one
+         *                compute device.
+         * \param n       size of the system.
+         * \param maxiter maximum number of iterations.
+         * \param tol     target relative residual.
+         */
+        bicgstab(const std::vector<cl::CommandQueue> &queue, size_t n,
+                size_t maxiter = 100, real tol = 1e-8)
+            : queue(queue), maxiter(maxiter), tol(tol), red(queue, 2)
+        {
+            allocate(partitioning(vex::partition(n, queue)));
+        }
+
+        /// Constructor with explicit partitioning.
+        /**
+         * Same as above, but the work vectors are split across devices
+         * according to part (e.g. SpMat::row_partition() of a reordered
+         * matrix).
+         */
+        bicgstab(const std::vector<cl::CommandQueue> &queue, const partitioning &part,
+                size_t maxiter = 100, real tol = 1e-8)
+            : queue(queue), maxiter(maxiter), tol(tol), red(queue, 2)
+        {
+            allocate(part);
+        }
+
+        /// Solves the system Ax = rhs.
+        /**
+         * x is used as the initial approximation. Returns the number of
+         * iterations made and the relative residual achieved. The work
+         * vectors are reallocated if rhs is partitioned differently.
+         */
+        template <class Matrix, class Precond>
+        std::tuple<size_t, real> operator()(const Matrix &A, const Precond &P,
+                const vex::vector<real> &rhs, vex::vector<real> &x)
+        {
+            precondition(x.partition() == rhs.partition(),
+                    "Incompatible vector partitioning in bicgstab solver");
+
+            if (rhs.partition() != r.partition())
+                allocate(partitioning(rhs.partition()));
+
+            const Reductor<real, SUM> &sum = get_reductor<real, SUM>(queue);
+
+            real nb = std::sqrt(sum(rhs * rhs));
+            if (nb == 0) {
+                x = 0;
+                return std::make_tuple(static_cast<size_t>(0), real());
+            }
+
+            r  = rhs - A * x;
+            rh = r;
+            p  = 0;
+            v  = 0;
+
+            real rho, res;
+            dot2(rh, r, r, r, rho, res);
+            res = std::sqrt(res) / nb;
+
+            real alpha = 1, omega = 1, rho_old = 1;
+
+            size_t iter = 0;
+            while(iter < maxiter && res > tol) {
+                update_p((rho / rho_old) * (alpha / omega), omega);
+
+                P.apply(p, ph);
+                v = A * ph;
+
+                alpha = rho / dot(rh, v);
+
+                update_s(alpha);
+
+                P.apply(s, sh);
+                t = A * sh;
+
+                real ts, tt;
+                dot2(t, s, t, t, ts, tt);
+                omega = tt ? ts / tt : real();
+
+                rho_old = rho;
+                update_x(x, alpha, omega, rho, res);
+                res = std::sqrt(res) / nb;
+
+                ++iter;
+
+                // Breakdown: the method can not make further progress.
+                if (rho == 0 || omega == 0) break;
+            }
+
+            return std::make_tuple(iter, res);
+        }
+    private:
+        enum stage {
+            bicgstab_p, bicgstab_dot, bicgstab_dot2, bicgstab_s, bicgstab_x
+        };
+
+        std::vector<cl::CommandQueue> queue;
+
+        size_t maxiter;
+        real   tol;
+
+        vex::vector<real> r, rh, p, v, s, t, ph, sh;
+
+        detail::fused_reductor<real> red;
+
+        void allocate(const partitioning &part) {
+            r  = vex::vector<real>(queue, part);
+            rh = vex::vector<real>(queue, part);
+            p  = vex::vector<real>(queue, part);
+            v  = vex::vector<real>(queue, part);
+            s  = vex::vector<real>(queue, part);
+            t  = vex::vector<real>(queue, part);
+            ph = vex::vector<real>(queue, part);
+            sh = vex::vector<real>(queue, part);
+        }
+
+        static std::string kernel_source(const cl::Device &device) {
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<real>() << " real;\n" <<
+                detail::fused_kernel_source(device, "bicgstab_p",
+                        ",\n"
+                        "    real beta,\n"
+                        "    real omega,\n"
+                        "    global const real * r,\n"
+                        "    global const real * v,\n"
+                        "    global real * p",
+                        "",
+                        "        p[idx] = r[idx] + beta * (p[idx] - omega * v[idx]);\n",
+                        0) <<
+                detail::fused_kernel_source(device, "bicgstab_dot",
+                        ",\n"
+                        "    global const real * a,\n"
+                        "    global const real * b",
+                        "",
+                        "        s0 += a[idx] * b[idx];\n",
+                        1) <<
+                detail::fused_kernel_source(device, "bicgstab_dot2",
+                        ",\n"
+                        "    global const real * a0,\n"
+                        "    global const real * b0,\n"
+                        "    global const real * a1,\n"
+                        "    global const real * b1",
+                        "",
+                        "        s0 += a0[idx] * b0[idx];\n"
+                        "        s1 += a1[idx] * b1[idx];\n",
+                        2) <<
+                detail::fused_kernel_source(device, "bicgstab_s",
+                        ",\n"
+                        "    real alpha,\n"
+                        "    global const real * r,\n"
+                        "    global const real * v,\n"
+                        "    global real * s",
+                        "",
+                        "        s[idx] = r[idx] - alpha * v[idx];\n",
+                        0) <<
+                detail::fused_kernel_source(device, "bicgstab_x",
+                        ",\n"
+                        "    real alpha,\n"
+                        "    real omega,\n"
+                        "    global const real * ph,\n"
+                        "    global const real * sh,\n"
+                        "    global const real * s,\n"
+                        "    global const real * t,\n"
+                        "    global const real * rh,\n"
+                        "    global real * x,\n"
+                        "    global real * r",
+                        "",
+                        "        x[idx] += alpha * ph[idx] + omega * sh[idx];\n"
+                        "        real ri = s[idx] - omega * t[idx];\n"
+                        "        r[idx] = ri;\n"
+                        "        s0 += rh[idx] * ri;\n"
+                        "        s1 += ri * ri;\n",
+                        2);
+
+            return source.str();
+        }
+
+        // Kernels of all stages are built at once for each context.
+        static detail::kernel_cache_entry& kernel(
+                const cl::CommandQueue &q, stage s)
+        {
+            static detail::kernel_cache cache[5];
+
+            static const char *name[] = {
+                "bicgstab_p", "bicgstab_dot", "bicgstab_dot2",
+                "bicgstab_s", "bicgstab_x"
+            };
+
+            static const unsigned nsum[] = {0, 1, 2, 0, 2};
+
+            return detail::program_kernel(q, cache, name, 5, s, kernel_source,
+                    detail::fused_workgroup_size<real>(nsum));
+        }
+
+        // p = r + beta * (p - omega * v).
+        void update_p(real beta, real omega) {
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (size_t np = r.part_size(d)) {
+                    detail::kernel_cache_entry &k = kernel(queue[d], bicgstab_p);
+
+                    unsigned pos = 1;
+                    k.kernel.setArg(pos++, beta);
+                    k.kernel.setArg(pos++, omega);
+                    k.kernel.setArg(pos++, r(d));
+                    k.kernel.setArg(pos++, v(d));
+                    k.kernel.setArg(pos++, p(d));
+
+                    red.launch(d, k, pos, np, 0);
+                }
+            }
+        }
+
+        // (a, b).
+        real dot(const vex::vector<real> &a, const vex::vector<real> &b) {
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (size_t np = r.part_size(d)) {
+                    detail::kernel_cache_entry &k = kernel(queue[d], bicgstab_dot);
+
+                    unsigned pos = 1;
+                    k.kernel.setArg(pos++, a(d));
+                    k.kernel.setArg(pos++, b(d));
+
+                    red.launch(d, k, pos, np, 1);
+                }
+            }
+
+            return red.sums()[0];
+        }
+
+        // (a0, b0) and (a1, b1) in a single pass.
+        void dot2(const vex::vector<real> &a0, const vex::vector<real> &b0,
+                  const vex::vector<real> &a1, const vex::vector<real> &b1,
+                  real &s0, real &s1)
+        {
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (size_t np = r.part_size(d)) {
+                    detail::kernel_cache_entry &k = kernel(queue[d], bicgstab_dot2);
+
+                    unsigned pos = 1;
+                    k.kernel.setArg(pos++, a0(d));
+                    k.kernel.setArg(pos++, b0(d));
+                    k.kernel.setArg(pos++, a1(d));
+                    k.kernel.setArg(pos++, b1(d));
+
+                    red.launch(d, k, pos, np, 2);
+                }
+            }
+
+            const std::vector<real> &sum = red.sums();
+
+            s0 = sum[0];
+            s1 = sum[1];
+        }
+
+        // s = r - alpha * v.
+        void update_s(real alpha) {
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (size_t np = r.part_size(d)) {
+                    detail::kernel_cache_entry &k = kernel(queue[d], bicgstab_s);
+
+                    unsigned pos = 1;
+                    k.kernel.setArg(pos++, alpha);
+                    k.kernel.setArg(pos++, r(d));
+                    k.kernel.setArg(pos++, v(d));
+                    k.kernel.setArg(pos++, s(d));
+
+                    red.launch(d, k, pos, np, 0);
+                }
+            }
+        }
+
+        // x += alpha * ph + omega * sh; r = s - omega * t;
+        // rho = (rh, r); rr = (r, r).
+        void update_x(vex::vector<real> &x, real alpha, real omega,
+                real &rho, real &rr)
+        {
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (size_t np = r.part_size(d)) {
+                    detail::kernel_cache_entry &k = kernel(queue[d], bicgstab_x);
+
+                    unsigned pos = 1;
+                    k.kernel.setArg(pos++, alpha);
+                    k.kernel.setArg(pos++, omega);
+                    k.kernel.setArg(pos++, ph(d));
+                    k.kernel.setArg(pos++, sh(d));
+                    k.kernel.setArg(pos++, s(d));
+                    k.kernel.setArg(pos++, t(d));
+                    k.kernel.setArg(pos++, rh(d));
+                    k.kernel.setArg(pos++, x(d));
+                    k.kernel.setArg(pos++, r(d));
+
+                    red.launch(d, k, pos, np, 2);
+                }
+            }
+
+            const std::vector<real> &sum = red.sums();
+
+            rho = sum[0];
+            rr  = sum[1];
+        }
+};
+
+} // namespace solver
+
+} // namespace vex
+
+#endif
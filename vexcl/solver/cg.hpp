@@ -0,0 +1,277 @@
+#ifndef VEXCL_SOLVER_CG_HPP
+#define VEXCL_SOLVER_CG_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/solver/cg.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Conjugate gradient method with fused kernels.
+ */
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <tuple>
+#include <cmath>
+
+#include <vexcl/vector.hpp>
+#include <vexcl/reductor.hpp>
+#include <vexcl/solver/fused.hpp>
+
+namespace vex {
+
+namespace solver {
+
+/// Preconditioned conjugate gradient method.
+/**
+ * Solves symmetric positive definite systems. This is the Chronopoulos-Gear
+ * variant of the method: the recurrences are rearranged so that all inner
+ * products of an iteration are computed by a single fused kernel. Each
+ * iteration costs one matrix-vector product, one preconditioner application,
+ * one kernel for the vector updates and one host synchronization, which also
+ * serves as the convergence check.
+ *
+ * Usage:
+ * \code
+ * vex::solver::cg<double> solve(ctx, n);
+ * size_t iters;
+ * double resid;
+ * std::tie(iters, resid) = solve(A, vex::solver::identity(), rhs, x);
+ * \endcode
+ * The matrix may be of any type for which A * x is a vector expression.
+ */
+template <typename real>
+class cg {
+    public:
+        /// Constructor.
+        /**
+         * \param queue   vector of queues. Each queue represents one
+         *                compute device.
+         * \param n       size of the system.
+         * \param maxiter maximum number of iterations.
+         * \param tol     target relative residual.
+         */
+        cg(const std::vector<cl::CommandQueue> &queue, size_t n,
+                size_t maxiter = 100, real tol = 1e-8)
+            : queue(queue), maxiter(maxiter), tol(tol), red(queue, 3)
+        {
+            allocate(partitioning(vex::partition(n, queue)));
+        }
+
+        /// Constructor with explicit partitioning.
+        /**
+         * Same as above, but the work vectors are split across devices
+         * according to part (e.g. SpMat::row_partition() of a reordered
+         * matrix).
+         */
+        cg(const std::vector<cl::CommandQueue> &queue, const partitioning &part,
+                size_t maxiter = 100, real tol = 1e-8)
+            : queue(queue), maxiter(maxiter), tol(tol), red(queue, 3)
+        {
+            allocate(part);
+        }
+
+        /// Solves the system Ax = rhs.
+        /**
+         * x is used as the initial approximation. Returns the number of
+         * iterations made and the relative residual achieved. The work
+         * vectors are reallocated if rhs is partitioned differently.
+         */
+        template <class Matrix, class Precond>
+        std::tuple<size_t, real> operator()(const Matrix &A, const Precond &P,
+                const vex::vector<real> &rhs, vex::vector<real> &x)
+        {
+            precondition(x.partition() == rhs.partition(),
+                    "Incompatible vector partitioning in cg solver");
+
+            if (rhs.partition() != r.partition())
+                allocate(partitioning(rhs.partition()));
+
+            const Reductor<real, SUM> &sum = get_reductor<real, SUM>(queue);
+
+            real nb = std::sqrt(sum(rhs * rhs));
+            if (nb == 0) {
+                x = 0;
+                return std::make_tuple(static_cast<size_t>(0), real());
+            }
+
+            r = rhs - A * x;
+            P.apply(r, u);
+            w = A * u;
+            p = 0;
+            s = 0;
+
+            real gamma, delta, res;
+            dots(gamma, delta, res);
+            res /= nb;
+
+            real alpha = 0, beta = 0, gamma_old = 0;
+
+            size_t iter = 0;
+            for(; iter < maxiter && res > tol; ++iter) {
+                if (iter) {
+                    beta  = gamma / gamma_old;
+                    alpha = gamma / (delta - beta * gamma / alpha);
+                } else {
+                    alpha = gamma / delta;
+                }
+
+                update(x, alpha, beta);
+
+                P.apply(r, u);
+                w = A * u;
+
+                gamma_old = gamma;
+                dots(gamma, delta, res);
+                res /= nb;
+            }
+
+            return std::make_tuple(iter, res);
+        }
+    private:
+        enum stage { cg_update, cg_dots };
+
+        std::vector<cl::CommandQueue> queue;
+
+        size_t maxiter;
+        real   tol;
+
+        vex::vector<real> r, u, w, p, s;
+
+        detail::fused_reductor<real> red;
+
+        void allocate(const partitioning &part) {
+            r = vex::vector<real>(queue, part);
+            u = vex::vector<real>(queue, part);
+            w = vex::vector<real>(queue, part);
+            p = vex::vector<real>(queue, part);
+            s = vex::vector<real>(queue, part);
+        }
+
+        static std::string kernel_source(const cl::Device &device) {
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<real>() << " real;\n" <<
+                detail::fused_kernel_source(device, "cg_update",
+                        ",\n"
+                        "    real alpha,\n"
+                        "    real beta,\n"
+                        "    global const real * u,\n"
+                        "    global const real * w,\n"
+                        "    global real * p,\n"
+                        "    global real * s,\n"
+                        "    global real * x,\n"
+                        "    global real * r",
+                        "",
+                        "        real pi = u[idx] + beta * p[idx];\n"
+                        "        real si = w[idx] + beta * s[idx];\n"
+                        "        p[idx] = pi;\n"
+                        "        s[idx] = si;\n"
+                        "        x[idx] += alpha * pi;\n"
+                        "        r[idx] -= alpha * si;\n",
+                        0) <<
+                detail::fused_kernel_source(device, "cg_dots",
+                        ",\n"
+                        "    global const real * r,\n"
+                        "    global const real * u,\n"
+                        "    global const real * w",
+                        "",
+                        "        real ri = r[idx];\n"
+                        "        real ui = u[idx];\n"
+                        "        s0 += ri * ui;\n"
+                        "        s1 += w[idx] * ui;\n"
+                        "        s2 += ri * ri;\n",
+                        3);
+
+            return source.str();
+        }
+
+        // Kernels of both stages are built at once for each context.
+        static detail::kernel_cache_entry& kernel(
+                const cl::CommandQueue &q, stage s)
+        {
+            static detail::kernel_cache cache[2];
+
+            static const char *name[] = {
+                "cg_update", "cg_dots"
+            };
+
+            static const unsigned nsum[] = {0, 3};
+
+            return detail::program_kernel(q, cache, name, 2, s, kernel_source,
+                    detail::fused_workgroup_size<real>(nsum));
+        }
+
+        // p = u + beta * p; s = w + beta * s; x += alpha * p; r -= alpha * s.
+        void update(vex::vector<real> &x, real alpha, real beta) {
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (size_t np = r.part_size(d)) {
+                    detail::kernel_cache_entry &k = kernel(queue[d], cg_update);
+
+                    unsigned pos = 1;
+                    k.kernel.setArg(pos++, alpha);
+                    k.kernel.setArg(pos++, beta);
+                    k.kernel.setArg(pos++, u(d));
+                    k.kernel.setArg(pos++, w(d));
+                    k.kernel.setArg(pos++, p(d));
+                    k.kernel.setArg(pos++, s(d));
+                    k.kernel.setArg(pos++, x(d));
+                    k.kernel.setArg(pos++, r(d));
+
+                    red.launch(d, k, pos, np, 0);
+                }
+            }
+        }
+
+        // gamma = (r, u), delta = (w, u), rr = ||r||.
+        void dots(real &gamma, real &delta, real &rr) {
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (size_t np = r.part_size(d)) {
+                    detail::kernel_cache_entry &k = kernel(queue[d], cg_dots);
+
+                    unsigned pos = 1;
+                    k.kernel.setArg(pos++, r(d));
+                    k.kernel.setArg(pos++, u(d));
+                    k.kernel.setArg(pos++, w(d));
+
+                    red.launch(d, k, pos, np, 3);
+                }
+            }
+
+            const std::vector<real> &sum = red.sums();
+
+            gamma = sum[0];
+            delta = sum[1];
+            rr    = std::sqrt(sum[2]);
+        }
+};
+
+} // namespace solver
+
+} // namespace vex
+
+#endif
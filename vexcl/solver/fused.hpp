@@ -0,0 +1,250 @@
+#ifndef VEXCL_SOLVER_FUSED_HPP
+#define VEXCL_SOLVER_FUSED_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/solver/fused.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Fused vector update and reduction kernels for iterative solvers.
+ */
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+
+#include <vexcl/util.hpp>
+#include <vexcl/operations.hpp>
+
+namespace vex {
+
+/// \cond INTERNAL
+namespace detail {
+
+// Source of a kernel that walks n vector elements, executes body for each
+// element idx, and accumulates nsum scalar sums s0, s1, ... along the way.
+// Statements in pre are executed once before the element loop. Workgroup
+// partial sums are written to partial[(k * rows + row) * ngroups + group],
+// where row is get_global_id(1). This allows to compute several batches of
+// sums (e.g. dot products with a set of vectors) in a single 2D launch.
+// The kernel expects the scalar type to be typedefed as real.
+inline std::string fused_kernel_source(
+        const cl::Device &device, const std::string &name,
+        const std::string &params, const std::string &pre,
+        const std::string &body, unsigned nsum
+        )
+{
+    std::ostringstream source;
+
+    source <<
+        "kernel void " << name << "(\n"
+        "    " << type_name<size_t>() << " n" << params << ",\n"
+        "    global real * partial,\n"
+        "    local  real * sdata\n"
+        "    )\n"
+        "{\n"
+        << pre;
+
+    for(unsigned k = 0; k < nsum; ++k)
+        source << "    real s" << k << " = 0;\n";
+
+    if (is_cpu(device)) {
+        source <<
+            "    size_t grid_size  = get_global_size(0);\n"
+            "    size_t chunk_size = (n + grid_size - 1) / grid_size;\n"
+            "    size_t chunk_id   = get_global_id(0);\n"
+            "    size_t start      = min(n, chunk_size * chunk_id);\n"
+            "    size_t stop       = min(n, chunk_size * (chunk_id + 1));\n"
+            "    for(size_t idx = start; idx < stop; ++idx) {\n"
+            << body <<
+            "    }\n";
+    } else {
+        source <<
+            "    for(size_t idx = get_global_id(0); idx < n; idx += get_global_size(0)) {\n"
+            << body <<
+            "    }\n";
+    }
+
+    if (nsum) {
+        source <<
+            "    size_t tid = get_local_id(0);\n"
+            "    size_t wgs = get_local_size(0);\n";
+
+        for(unsigned k = 0; k < nsum; ++k)
+            source << "    sdata[" << k << " * wgs + tid] = s" << k << ";\n";
+
+        source <<
+            "    for(size_t h = wgs / 2; h > 0; h /= 2) {\n"
+            "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+            "        if (tid < h) {\n";
+
+        for(unsigned k = 0; k < nsum; ++k)
+            source <<
+                "            sdata[" << k << " * wgs + tid] += sdata[" << k << " * wgs + tid + h];\n";
+
+        source <<
+            "        }\n"
+            "    }\n"
+            "    if (tid == 0) {\n"
+            "        size_t rows = get_global_size(1);\n"
+            "        size_t row  = get_global_id(1);\n"
+            "        size_t ng   = get_num_groups(0);\n"
+            "        size_t g    = get_group_id(0);\n";
+
+        for(unsigned k = 0; k < nsum; ++k)
+            source <<
+                "        partial[(" << k << " * rows + row) * ng + g] = sdata[" << k << " * wgs];\n";
+
+        source << "    }\n";
+    }
+
+    source << "}\n";
+
+    return source.str();
+}
+
+// Workgroup size for the fused kernels of a program (see program_kernel()),
+// where kernel k computes nsum[k] sums. The size is a power of two (required
+// by the tree reduction) that fits the sums into local memory.
+template <typename real>
+struct fused_workgroup_size {
+    const unsigned *nsum;
+
+    fused_workgroup_size(const unsigned *nsum) : nsum(nsum) {}
+
+    size_t operator()(const cl::Kernel &krn, const cl::Device &device, unsigned k) const {
+        if (is_cpu(device)) return 1;
+
+        size_t wgs = kernel_workgroup_size(krn, device);
+
+        size_t smem = static_cast<size_t>(device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>())
+                    - static_cast<size_t>(krn.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device));
+        while(wgs * std::max(nsum[k], 1U) * sizeof(real) > smem)
+            wgs /= 2;
+
+        return wgs;
+    }
+};
+
+// Launches fused kernels and collects their sums. Each device gets a small
+// buffer for workgroup partial sums; all devices are read back in one go, so
+// that a fused kernel costs a single host synchronization.
+template <typename real>
+class fused_reductor {
+    public:
+        // maxsum is the largest number of sums (times rows) per launch.
+        fused_reductor(const std::vector<cl::CommandQueue> &queue, unsigned maxsum)
+            : queue(queue), maxsum(maxsum), nsum(0),
+              active(queue.size(), false), event(queue.size())
+        {
+            idx.reserve(queue.size() + 1);
+            idx.push_back(0);
+
+            for(auto q = queue.begin(); q != queue.end(); ++q) {
+                size_t ng = num_workgroups(qdev(*q));
+
+                ngroups.push_back(ng);
+                idx.push_back(idx.back() + maxsum * ng);
+
+                dbuf.push_back(cl::Buffer(qctx(*q), CL_MEM_READ_WRITE,
+                            maxsum * ng * sizeof(real)));
+            }
+
+            hbuf.resize(idx.back());
+            result.resize(maxsum);
+        }
+
+        // Launches the kernel over np elements on device d. Kernel parameters
+        // between n and partial have to be set already; pos is the position
+        // of the partial sums parameter. The kernel should compute ns sums
+        // per each of the rows. Kernels without sums are just enqueued.
+        void launch(unsigned d, const kernel_cache_entry &k, unsigned pos,
+                size_t np, unsigned ns, size_t rows = 1)
+        {
+            precondition(ns * rows <= maxsum, "Too many sums in fused kernel");
+
+            cl::Kernel krn = k.kernel;
+
+            krn.setArg(0, np);
+            krn.setArg(pos++, dbuf[d]);
+            krn.setArg(pos++, vex::Local(std::max(ns, 1U) * k.wgsize * sizeof(real)));
+
+            queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                    cl::NDRange(ngroups[d] * k.wgsize, rows),
+                    cl::NDRange(k.wgsize, 1));
+
+            if (ns) {
+                nsum = static_cast<unsigned>(ns * rows);
+                active[d] = true;
+            }
+        }
+
+        // Waits for the launched kernels and returns their sums.
+        const std::vector<real>& sums() {
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (active[d] && nsum)
+                    queue[d].enqueueReadBuffer(dbuf[d], CL_FALSE, 0,
+                            nsum * ngroups[d] * sizeof(real), &hbuf[idx[d]],
+                            0, &event[d]);
+            }
+
+            std::fill(result.begin(), result.end(), real());
+
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (!active[d]) continue;
+
+                if (nsum) event[d].wait();
+
+                for(unsigned k = 0; k < nsum; ++k) {
+                    const real *p = &hbuf[idx[d] + k * ngroups[d]];
+                    for(size_t g = 0; g < ngroups[d]; ++g)
+                        result[k] += p[g];
+                }
+
+                active[d] = false;
+            }
+
+            return result;
+        }
+    private:
+        std::vector<cl::CommandQueue> queue;
+        unsigned maxsum, nsum;
+
+        std::vector<size_t>     ngroups;
+        std::vector<size_t>     idx;
+        std::vector<cl::Buffer> dbuf;
+        std::vector<real>       hbuf;
+        std::vector<real>       result;
+        std::vector<bool>       active;
+        std::vector<cl::Event>  event;
+};
+
+} // namespace detail
+/// \endcond
+
+} // namespace vex
+
+#endif
@@ -0,0 +1,355 @@
+#ifndef VEXCL_SOLVER_GMRES_HPP
+#define VEXCL_SOLVER_GMRES_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/solver/gmres.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Restarted GMRES method with fused kernels.
+ */
+
+#include <vector>
+#include <map>
+#include <array>
+#include <string>
+#include <sstream>
+#include <tuple>
+#include <cmath>
+
+#include <vexcl/vector.hpp>
+#include <vexcl/reductor.hpp>
+#include <vexcl/solver/fused.hpp>
+
+namespace vex {
+
+namespace solver {
+
+/// Preconditioned restarted GMRES method.
+/**
+ * Solves general nonsymmetric systems with right preconditioning. The
+ * Krylov basis is orthogonalized with classical Gram-Schmidt, which allows
+ * to batch the inner products: all projections of a new basis vector are
+ * computed by a single 2D kernel, and the subtraction of the projections is
+ * fused with computation of the norm of the result. An iteration thus costs
+ * two host synchronizations regardless of the basis size. Givens rotations
+ * are applied on the host.
+ *
+ * Kernels take the whole basis as parameters, so the restart parameter
+ * should stay well below the device limit on kernel parameters (at least
+ * 128 buffers are supported by any OpenCL device).
+ *
+ * Usage:
+ * \code
+ * vex::solver::gmres<double> solve(ctx, n);
+ * size_t iters;
+ * double resid;
+ * std::tie(iters, resid) = solve(A, vex::solver::identity(), rhs, x);
+ * \endcode
+ */
+template <typename real>
+class gmres {
+    public:
+        /// Constructor.
+        /**
+         * \param queue   vector of queues. Each queue represents one
+         *                compute device.
+         * \param n       size of the system.
+         * \param maxiter maximum number of iterations.
+         * \param tol     target relative residual.
+         * \param M       number of iterations before restart.
+         */
+        gmres(const std::vector<cl::CommandQueue> &queue, size_t n,
+                size_t maxiter = 100, real tol = 1e-8, unsigned M = 30)
+            : queue(queue), maxiter(maxiter), tol(tol), M(M),
+              H((M + 1) * M), cs(M), sn(M), g(M + 1), y(M),
+              red(queue, M)
+        {
+            precondition(M > 0, "GMRES restart parameter should be positive");
+
+            allocate(partitioning(vex::partition(n, queue)));
+
+            for(auto q = queue.begin(); q != queue.end(); ++q)
+                hbuf.push_back(cl::Buffer(qctx(*q), CL_MEM_READ_ONLY, M * sizeof(real)));
+        }
+
+        /// Constructor with explicit partitioning.
+        /**
+         * Same as above, but the work vectors are split across devices
+         * according to part (e.g. SpMat::row_partition() of a reordered
+         * matrix).
+         */
+        gmres(const std::vector<cl::CommandQueue> &queue, const partitioning &part,
+                size_t maxiter = 100, real tol = 1e-8, unsigned M = 30)
+            : queue(queue), maxiter(maxiter), tol(tol), M(M),
+              H((M + 1) * M), cs(M), sn(M), g(M + 1), y(M),
+              red(queue, M)
+        {
+            precondition(M > 0, "GMRES restart parameter should be positive");
+
+            allocate(part);
+
+            for(auto q = queue.begin(); q != queue.end(); ++q)
+                hbuf.push_back(cl::Buffer(qctx(*q), CL_MEM_READ_ONLY, M * sizeof(real)));
+        }
+
+        /// Solves the system Ax = rhs.
+        /**
+         * x is used as the initial approximation. Returns the number of
+         * iterations made and the relative residual achieved. The work
+         * vectors are reallocated if rhs is partitioned differently.
+         */
+        template <class Matrix, class Precond>
+        std::tuple<size_t, real> operator()(const Matrix &A, const Precond &P,
+                const vex::vector<real> &rhs, vex::vector<real> &x)
+        {
+            precondition(x.partition() == rhs.partition(),
+                    "Incompatible vector partitioning in gmres solver");
+
+            if (rhs.partition() != z.partition())
+                allocate(partitioning(rhs.partition()));
+
+            const Reductor<real, SUM> &sum = get_reductor<real, SUM>(queue);
+
+            real nb = std::sqrt(sum(rhs * rhs));
+            if (nb == 0) {
+                x = 0;
+                return std::make_tuple(static_cast<size_t>(0), real());
+            }
+
+            V[0] = rhs - A * x;
+            real beta = std::sqrt(sum(V[0] * V[0]));
+            real res  = beta / nb;
+
+            size_t iter = 0;
+            while(iter < maxiter && res > tol) {
+                V[0] = V[0] / beta;
+
+                std::fill(g.begin(), g.end(), real());
+                g[0] = beta;
+
+                unsigned j = 0;
+                while(j < M && iter < maxiter && res > tol) {
+                    P.apply(V[j], z);
+                    V[j + 1] = A * z;
+
+                    orthogonalize(j);
+
+                    // Apply previous rotations to the new column of H.
+                    for(unsigned k = 0; k < j; ++k) {
+                        real h0 = h(k, j), h1 = h(k + 1, j);
+
+                        h(k,     j) =  cs[k] * h0 + sn[k] * h1;
+                        h(k + 1, j) = -sn[k] * h0 + cs[k] * h1;
+                    }
+
+                    real hn = h(j + 1, j);
+
+                    // Eliminate the subdiagonal element with a new rotation.
+                    real r = std::sqrt(h(j, j) * h(j, j) + hn * hn);
+
+                    cs[j] = h(j, j) / r;
+                    sn[j] = hn / r;
+
+                    h(j,     j) = r;
+                    h(j + 1, j) = 0;
+
+                    g[j + 1] = -sn[j] * g[j];
+                    g[j]     =  cs[j] * g[j];
+
+                    res = std::fabs(g[j + 1]) / nb;
+
+                    if (hn != 0) V[j + 1] = V[j + 1] / hn;
+
+                    ++j;
+                    ++iter;
+                }
+
+                // Solve the triangular system and update the solution.
+                for(unsigned i = j; i-- > 0; ) {
+                    real s = g[i];
+                    for(unsigned k = i + 1; k < j; ++k)
+                        s -= h(i, k) * y[k];
+                    y[i] = s / h(i, i);
+                }
+
+                for(unsigned i = 0; i < j; ++i) y[i] = -y[i];
+
+                z = 0;
+                subtract(z, &y[0], j);
+
+                P.apply(z, V[0]);
+                x += V[0];
+
+                V[0] = rhs - A * x;
+                beta = std::sqrt(sum(V[0] * V[0]));
+                res  = beta / nb;
+            }
+
+            return std::make_tuple(iter, res);
+        }
+    private:
+        enum stage { gmres_dots, gmres_subtract };
+
+        std::vector<cl::CommandQueue> queue;
+
+        size_t   maxiter;
+        real     tol;
+        unsigned M;
+
+        std::vector< vex::vector<real> > V;
+        vex::vector<real> z;
+
+        std::vector<real> H, cs, sn, g, y;
+        std::vector<cl::Buffer> hbuf;
+
+        detail::fused_reductor<real> red;
+
+        void allocate(const partitioning &part) {
+            z = vex::vector<real>(queue, part);
+
+            V.clear();
+            V.reserve(M + 1);
+            for(unsigned k = 0; k <= M; ++k)
+                V.push_back(vex::vector<real>(queue, part));
+        }
+
+        real& h(unsigned i, unsigned j) {
+            return H[j * (M + 1) + i];
+        }
+
+        static std::string kernel_source(const cl::Device &device, unsigned M) {
+            std::ostringstream basis;
+            for(unsigned i = 0; i < M; ++i)
+                basis << ",\n    global const real * v" << i;
+
+            // Each row of the 2D range computes projection onto its
+            // basis vector.
+            std::ostringstream select;
+            select <<
+                "    size_t k = get_global_id(1);\n"
+                "    global const real * v = v0;\n";
+            for(unsigned i = 1; i < M; ++i)
+                select << "    if (k == " << i << ") v = v" << i << ";\n";
+
+            std::ostringstream update;
+            update << "        real wi = w[idx];\n";
+            for(unsigned i = 0; i < M; ++i)
+                update << "        if (" << i << " < m) wi -= h[" << i << "] * v" << i << "[idx];\n";
+            update <<
+                "        w[idx] = wi;\n"
+                "        s0 += wi * wi;\n";
+
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<real>() << " real;\n" <<
+                detail::fused_kernel_source(device, "gmres_dots",
+                        ",\n    global const real * w" + basis.str(),
+                        select.str(),
+                        "        s0 += w[idx] * v[idx];\n",
+                        1) <<
+                detail::fused_kernel_source(device, "gmres_subtract",
+                        ",\n"
+                        "    " + type_name<size_t>() + " m,\n"
+                        "    global const real * h,\n"
+                        "    global real * w" + basis.str(),
+                        "",
+                        update.str(),
+                        1);
+
+            return source.str();
+        }
+
+        // Kernels of both stages are built at once for each context and
+        // restart parameter.
+        static detail::kernel_cache_entry& kernel(
+                const cl::CommandQueue &q, unsigned M, stage s)
+        {
+            static std::map< unsigned, std::array<detail::kernel_cache, 2> > caches;
+
+            static const char *name[] = {"gmres_dots", "gmres_subtract"};
+
+            static const unsigned nsum[] = {1, 1};
+
+            return detail::program_kernel(q, caches[M].data(), name, 2, s,
+                    [M](const cl::Device &device) { return kernel_source(device, M); },
+                    detail::fused_workgroup_size<real>(nsum));
+        }
+
+        // Orthogonalizes V[j + 1] against V[0..j] and fills column j of H.
+        void orthogonalize(unsigned j) {
+            // Projections onto the basis.
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (size_t np = z.part_size(d)) {
+                    detail::kernel_cache_entry &k = kernel(queue[d], M, gmres_dots);
+
+                    unsigned pos = 1;
+                    k.kernel.setArg(pos++, V[j + 1](d));
+                    for(unsigned i = 0; i < M; ++i)
+                        k.kernel.setArg(pos++, V[i](d));
+
+                    red.launch(d, k, pos, np, 1, j + 1);
+                }
+            }
+
+            const std::vector<real> &p = red.sums();
+            std::copy(p.begin(), p.begin() + j + 1, &h(0, j));
+
+            // Subtraction of the projections.
+            h(j + 1, j) = std::sqrt(subtract(V[j + 1], &h(0, j), j + 1));
+        }
+
+        // w -= sum_{i < m} c_i V_i. Returns ||w||^2.
+        real subtract(vex::vector<real> &w, const real *c, unsigned m) {
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                if (size_t np = z.part_size(d)) {
+                    // The coefficients have just been read back from the
+                    // device, so the blocking write does not stall the queue.
+                    if (m) queue[d].enqueueWriteBuffer(
+                            hbuf[d], CL_TRUE, 0, m * sizeof(real), c);
+
+                    detail::kernel_cache_entry &k = kernel(queue[d], M, gmres_subtract);
+
+                    unsigned pos = 1;
+                    k.kernel.setArg(pos++, static_cast<size_t>(m));
+                    k.kernel.setArg(pos++, hbuf[d]);
+                    k.kernel.setArg(pos++, w(d));
+                    for(unsigned i = 0; i < M; ++i)
+                        k.kernel.setArg(pos++, V[i](d));
+
+                    red.launch(d, k, pos, np, 1);
+                }
+            }
+
+            return red.sums()[0];
+        }
+};
+
+} // namespace solver
+
+} // namespace vex
+
+#endif
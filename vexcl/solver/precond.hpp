@@ -0,0 +1,100 @@
+#ifndef VEXCL_SOLVER_PRECOND_HPP
+#define VEXCL_SOLVER_PRECOND_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/solver/precond.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Preconditioners for iterative solvers.
+ */
+
+#include <vector>
+
+#include <vexcl/vector.hpp>
+
+namespace vex {
+
+/// Iterative solvers for sparse linear systems.
+namespace solver {
+
+/// Identity preconditioner.
+/**
+ * Any class with the same apply() method may be used as a preconditioner
+ * with the solvers in vex::solver. apply(r, u) should approximately solve
+ * \f$Au = r\f$.
+ */
+struct identity {
+    template <typename real>
+    void apply(const vex::vector<real> &r, vex::vector<real> &u) const {
+        u = r;
+    }
+};
+
+/// Jacobi (diagonal) preconditioner.
+template <typename real>
+class jacobi {
+    public:
+        /// Constructor.
+        /**
+         * \param queue vector of queues. Each queue represents one
+         *            compute device.
+         * \param n   number of rows in the matrix.
+         * \param row row index into col and val vectors.
+         * \param col column numbers of nonzero elements.
+         * \param val values of nonzero elements.
+         */
+        template <typename col_t, typename idx_t>
+        jacobi(const std::vector<cl::CommandQueue> &queue, size_t n,
+                const idx_t *row, const col_t *col, const real *val)
+            : dinv(queue, n)
+        {
+            std::vector<real> d(n, static_cast<real>(1));
+
+            for(size_t i = 0; i < n; ++i) {
+                for(idx_t j = row[i]; j < row[i + 1]; ++j) {
+                    if (static_cast<size_t>(col[j]) == i && val[j] != real()) {
+                        d[i] = 1 / val[j];
+                        break;
+                    }
+                }
+            }
+
+            vex::copy(d, dinv);
+        }
+
+        /// Applies the preconditioner.
+        void apply(const vex::vector<real> &r, vex::vector<real> &u) const {
+            u = dinv * r;
+        }
+    private:
+        vex::vector<real> dinv;
+};
+
+} // namespace solver
+
+} // namespace vex
+
+#endif
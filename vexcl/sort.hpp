@@ -0,0 +1,688 @@
+#ifndef VEXCL_SORT_HPP
+#define VEXCL_SORT_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/sort.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Radix sort of device vectors.
+ */
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+#include <vexcl/operations.hpp>
+#include <vexcl/vector.hpp>
+
+namespace vex {
+
+/// \cond INTERNAL
+namespace detail {
+
+// Number of key bits processed in a single pass of radix sort.
+const unsigned radix_digit_bits = 4;
+const unsigned radix_digits     = 1 << radix_digit_bits;
+
+template <size_t N> struct radix_bits_type;
+template <> struct radix_bits_type<1> { typedef cl_uchar  type; };
+template <> struct radix_bits_type<2> { typedef cl_ushort type; };
+template <> struct radix_bits_type<4> { typedef cl_uint   type; };
+template <> struct radix_bits_type<8> { typedef cl_ulong  type; };
+
+// Maps keys to unsigned integers with the same ordering. The OpenCL function
+// to_bits() should be defined for the key type.
+template <typename T, class Enable = void>
+struct radix_key;
+
+template <typename T>
+struct radix_key<T,
+    typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value>::type
+    >
+{
+    typedef typename radix_bits_type<sizeof(T)>::type bits_t;
+
+    static std::string transform() {
+        return "return x;";
+    }
+};
+
+template <typename T>
+struct radix_key<T,
+    typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value>::type
+    >
+{
+    typedef typename radix_bits_type<sizeof(T)>::type bits_t;
+
+    // Flip the sign bit.
+    static std::string transform() {
+        std::ostringstream s;
+        s << "return (bits_t)x ^ ((bits_t)1 << " << 8 * sizeof(T) - 1 << ");";
+        return s.str();
+    }
+};
+
+template <typename T>
+struct radix_key<T,
+    typename std::enable_if<std::is_floating_point<T>::value>::type
+    >
+{
+    typedef typename radix_bits_type<sizeof(T)>::type bits_t;
+
+    // Flip all bits of negative numbers, and the sign bit of the rest.
+    static std::string transform() {
+        std::ostringstream s;
+        s << "bits_t u = as_" << type_name<bits_t>() << "(x);\n"
+             "    return u ^ (-(u >> " << 8 * sizeof(T) - 1 << ") | "
+             "((bits_t)1 << " << 8 * sizeof(T) - 1 << "));";
+        return s.str();
+    }
+};
+
+template <typename K>
+void radix_key_preamble(std::ostream &source) {
+    typedef typename radix_key<K>::bits_t bits_t;
+
+    source <<
+        "typedef " << type_name<K>()      << " key_t;\n"
+        "typedef " << type_name<bits_t>() << " bits_t;\n"
+        "bits_t to_bits(key_t x) {\n"
+        "    " << radix_key<K>::transform() << "\n"
+        "}\n";
+}
+
+// Sorts each partition of the keys (and the values, if HasVals is set)
+// independently with LSD radix sort. Each pass computes digit counts for
+// every workgroup block, scans the counts on device, and scatters the
+// elements. The scatter is stable: each tile of a block is first sorted
+// locally by the current digit with a sequence of one-bit splits.
+template <typename K, typename V, bool HasVals>
+void radix_sort_partitions(vector<K> &keys, vector<V> &vals, unsigned passes) {
+    static kernel_cache count_cache;
+    static kernel_cache scan_cache;
+    static kernel_cache scatter_cache;
+
+    const std::vector<cl::CommandQueue> &queue = keys.queue_list();
+
+    for(unsigned d = 0; d < queue.size(); d++) {
+        cl::Context context = qctx(queue[d]);
+        cl::Device  device  = qdev(queue[d]);
+
+        auto count = count_cache.find(context());
+
+        if (count == count_cache.end()) {
+            std::ostringstream source;
+
+            source << standard_kernel_header(device);
+            radix_key_preamble<K>(source);
+
+            if (HasVals) source <<
+                "typedef " << type_name<V>() << " val_t;\n";
+
+            source <<
+                "#define RADIX_BITS " << radix_digit_bits << "\n"
+                "#define RADIX " << radix_digits << "\n"
+                "#define DIGIT(x) ((to_bits(x) >> shift) & (RADIX - 1))\n"
+                "kernel void vexcl_radix_count(\n"
+                "\t" << type_name<size_t>() << " n,\n"
+                "\t" << type_name<size_t>() << " block_size,\n"
+                "\tint shift,\n"
+                "\tglobal const key_t *keys,\n"
+                "\tglobal uint *counts,\n"
+                "\tlocal  uint *lcount\n"
+                "\t)\n"
+                "{\n"
+                "    size_t lid   = get_local_id(0);\n"
+                "    size_t wgs   = get_local_size(0);\n"
+                "    size_t grp   = get_group_id(0);\n"
+                "    size_t ngrp  = get_num_groups(0);\n"
+                "    size_t start = min(n, block_size * grp);\n"
+                "    size_t stop  = min(n, start + block_size);\n"
+                "    for(size_t i = lid; i < RADIX; i += wgs) lcount[i] = 0;\n"
+                "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "    for(size_t idx = start + lid; idx < stop; idx += wgs)\n"
+                "        atomic_inc(lcount + DIGIT(keys[idx]));\n"
+                "    barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "    for(size_t i = lid; i < RADIX; i += wgs)\n"
+                "        counts[i * ngrp + grp] = lcount[i];\n"
+                "}\n"
+                "kernel void vexcl_radix_scan(\n"
+                "\tuint n,\n"
+                "\tglobal uint *counts,\n"
+                "\tlocal  uint *shared\n"
+                "\t)\n"
+                "{\n"
+                "    size_t lid   = get_local_id(0);\n"
+                "    size_t wgs   = get_local_size(0);\n"
+                "    uint   carry = 0;\n"
+                "    for(size_t tile = 0; tile < n; tile += wgs) {\n"
+                "        size_t idx = tile + lid;\n"
+                "        uint   val = idx < n ? counts[idx] : 0;\n"
+                "        uint   sum = val;\n"
+                "        shared[lid] = sum;\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        for(size_t s = 1; s < wgs; s *= 2) {\n"
+                "            if (lid >= s) sum += shared[lid - s];\n"
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "            shared[lid] = sum;\n"
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        }\n"
+                "        if (idx < n) counts[idx] = carry + sum - val;\n"
+                "        carry += shared[wgs - 1];\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "    }\n"
+                "}\n"
+                "kernel void vexcl_radix_scatter(\n"
+                "\t" << type_name<size_t>() << " n,\n"
+                "\t" << type_name<size_t>() << " block_size,\n"
+                "\tint shift,\n"
+                "\tglobal const key_t *ikeys,\n"
+                "\tglobal key_t *okeys,\n";
+            if (HasVals) source <<
+                "\tglobal const val_t *ivals,\n"
+                "\tglobal val_t *ovals,\n"
+                "\tlocal  val_t *lval,\n";
+            source <<
+                "\tglobal const uint *offsets,\n"
+                "\tlocal  key_t *lkey,\n"
+                "\tlocal  uint *ldig,\n"
+                "\tlocal  uint *lscan,\n"
+                "\tlocal  uint *lradix\n"
+                "\t)\n"
+                "{\n"
+                "    size_t lid   = get_local_id(0);\n"
+                "    size_t wgs   = get_local_size(0);\n"
+                "    size_t grp   = get_group_id(0);\n"
+                "    size_t ngrp  = get_num_groups(0);\n"
+                "    size_t start = min(n, block_size * grp);\n"
+                "    size_t stop  = min(n, start + block_size);\n"
+                "    local uint *loffset = lradix;\n"
+                "    local uint *lstart  = lradix + RADIX;\n"
+                "    local uint *lend    = lradix + 2 * RADIX;\n"
+                "    for(size_t i = lid; i < RADIX; i += wgs)\n"
+                "        loffset[i] = offsets[i * ngrp + grp];\n"
+                "    for(size_t tile = start; tile < stop; tile += wgs) {\n"
+                "        size_t idx   = tile + lid;\n"
+                "        size_t valid = min(wgs, stop - tile);\n"
+                "        key_t  key   = ikeys[min(idx, stop - 1)];\n";
+            if (HasVals) source <<
+                "        val_t  val   = ivals[min(idx, stop - 1)];\n";
+            source <<
+                "        uint   dig   = idx < stop ? DIGIT(key) : RADIX - 1;\n"
+                "        for(int b = 0; b < RADIX_BITS; ++b) {\n"
+                "            uint flag = (dig >> b) & 1;\n"
+                "            uint sum  = !flag;\n"
+                "            lscan[lid] = sum;\n"
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "            for(size_t s = 1; s < wgs; s *= 2) {\n"
+                "                if (lid >= s) sum += lscan[lid - s];\n"
+                "                barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "                lscan[lid] = sum;\n"
+                "                barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "            }\n"
+                "            uint zeros  = lscan[wgs - 1];\n"
+                "            uint before = sum - !flag;\n"
+                "            size_t pos  = flag ? zeros + lid - before : before;\n"
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "            lkey[pos] = key;\n"
+                "            ldig[pos] = dig;\n";
+            if (HasVals) source <<
+                "            lval[pos] = val;\n";
+            source <<
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "            key = lkey[lid];\n"
+                "            dig = ldig[lid];\n";
+            if (HasVals) source <<
+                "            val = lval[lid];\n";
+            source <<
+                "        }\n"
+                "        for(size_t i = lid; i < RADIX; i += wgs) lstart[i] = lend[i] = 0;\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        if (lid < valid) {\n"
+                "            if (lid == 0 || ldig[lid - 1] != dig) lstart[dig] = lid;\n"
+                "            if (lid + 1 == valid || ldig[lid + 1] != dig) lend[dig] = lid + 1;\n"
+                "        }\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        if (lid < valid) {\n"
+                "            size_t dst = loffset[dig] + lid - lstart[dig];\n"
+                "            okeys[dst] = key;\n";
+            if (HasVals) source <<
+                "            ovals[dst] = val;\n";
+            source <<
+                "        }\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        for(size_t i = lid; i < RADIX; i += wgs) loffset[i] += lend[i] - lstart[i];\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "    }\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel count_krn  (program, "vexcl_radix_count");
+            cl::Kernel scan_krn   (program, "vexcl_radix_scan");
+            cl::Kernel scatter_krn(program, "vexcl_radix_scatter");
+
+            size_t wgs;
+            if (is_cpu(device)) {
+                wgs = 1;
+            } else {
+                wgs = std::min(
+                        kernel_workgroup_size(count_krn,   device),
+                        kernel_workgroup_size(scatter_krn, device)
+                        );
+
+                size_t smem = static_cast<size_t>(device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>())
+                            - static_cast<size_t>(scatter_krn.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device))
+                            - 3 * radix_digits * sizeof(cl_uint);
+                while(wgs * (sizeof(K) + (HasVals ? sizeof(V) : 0) + 2 * sizeof(cl_uint)) > smem)
+                    wgs /= 2;
+            }
+
+            count = count_cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(count_krn, wgs)
+                        )).first;
+
+            scan_cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(scan_krn, std::min<size_t>(
+                                wgs, kernel_workgroup_size(scan_krn, device)))
+                        ));
+
+            scatter_cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(scatter_krn, wgs)
+                        ));
+        }
+
+        size_t psize = keys.part_size(d);
+        if (!psize) continue;
+
+        auto scan    = scan_cache.find(context());
+        auto scatter = scatter_cache.find(context());
+
+        size_t w_size  = count->second.wgsize;
+        size_t ngroups = std::min(num_workgroups(device), (psize + w_size - 1) / w_size);
+        size_t block   = alignup((psize + ngroups - 1) / ngroups, w_size);
+        ngroups        = (psize + block - 1) / block;
+
+        cl_uint ncount = static_cast<cl_uint>(radix_digits * ngroups);
+
+        cl::Buffer counts(context, CL_MEM_READ_WRITE, ncount * sizeof(cl_uint));
+
+        cl::Buffer ikeys = keys(d);
+        cl::Buffer okeys(context, CL_MEM_READ_WRITE, psize * sizeof(K));
+
+        cl::Buffer ivals, ovals;
+        if (HasVals) {
+            ivals = vals(d);
+            ovals = cl::Buffer(context, CL_MEM_READ_WRITE, psize * sizeof(V));
+        }
+
+        for(unsigned p = 0; p < passes; ++p) {
+            cl_int shift = p * radix_digit_bits;
+
+            {
+                cl::Kernel &krn = count->second.kernel;
+
+                unsigned pos = 0;
+                krn.setArg(pos++, psize);
+                krn.setArg(pos++, block);
+                krn.setArg(pos++, shift);
+                krn.setArg(pos++, ikeys);
+                krn.setArg(pos++, counts);
+                krn.setArg(pos++, vex::Local(radix_digits * sizeof(cl_uint)));
+
+                queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                        ngroups * w_size, w_size);
+            }
+
+            {
+                cl::Kernel &krn = scan->second.kernel;
+                size_t wgs = scan->second.wgsize;
+
+                unsigned pos = 0;
+                krn.setArg(pos++, ncount);
+                krn.setArg(pos++, counts);
+                krn.setArg(pos++, vex::Local(wgs * sizeof(cl_uint)));
+
+                queue[d].enqueueNDRangeKernel(krn, cl::NullRange, wgs, wgs);
+            }
+
+            {
+                cl::Kernel &krn = scatter->second.kernel;
+
+                unsigned pos = 0;
+                krn.setArg(pos++, psize);
+                krn.setArg(pos++, block);
+                krn.setArg(pos++, shift);
+                krn.setArg(pos++, ikeys);
+                krn.setArg(pos++, okeys);
+                if (HasVals) {
+                    krn.setArg(pos++, ivals);
+                    krn.setArg(pos++, ovals);
+                    krn.setArg(pos++, vex::Local(w_size * sizeof(V)));
+                }
+                krn.setArg(pos++, counts);
+                krn.setArg(pos++, vex::Local(w_size * sizeof(K)));
+                krn.setArg(pos++, vex::Local(w_size * sizeof(cl_uint)));
+                krn.setArg(pos++, vex::Local(w_size * sizeof(cl_uint)));
+                krn.setArg(pos++, vex::Local(3 * radix_digits * sizeof(cl_uint)));
+
+                queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                        ngroups * w_size, w_size);
+            }
+
+            std::swap(ikeys, okeys);
+            if (HasVals) std::swap(ivals, ovals);
+        }
+
+        // After an odd number of passes the result is in the temporary buffer.
+        if (passes % 2) {
+            queue[d].enqueueCopyBuffer(ikeys, keys(d), 0, 0, psize * sizeof(K));
+            if (HasVals)
+                queue[d].enqueueCopyBuffer(ivals, vals(d), 0, 0, psize * sizeof(V));
+        }
+    }
+}
+
+// Finds split points in each of the sorted partitions, such that the
+// elements before the d-th split points of all partitions are exactly the
+// elements that belong to the first d partitions of the globally sorted
+// vector. The split key for each partition boundary is found by bisection
+// in the space of ordered key bits; the equal keys are taken from the
+// partitions in order, which keeps the sort stable.
+template <typename K>
+std::vector< std::vector<size_t> > radix_splitters(const vector<K> &keys) {
+    typedef typename radix_key<K>::bits_t bits_t;
+
+    static kernel_cache cache;
+
+    const std::vector<cl::CommandQueue> &queue = keys.queue_list();
+    const unsigned nq = queue.size();
+
+    std::vector<cl::Buffer> dquery(nq), dresult(nq);
+
+    for(unsigned d = 0; d < nq; d++) {
+        cl::Context context = qctx(queue[d]);
+        cl::Device  device  = qdev(queue[d]);
+
+        auto kernel = cache.find(context());
+
+        if (kernel == cache.end()) {
+            std::ostringstream source;
+
+            source << standard_kernel_header(device);
+            radix_key_preamble<K>(source);
+
+            source <<
+                "kernel void vexcl_radix_bound(\n"
+                "\t" << type_name<size_t>() << " n,\n"
+                "\tglobal const key_t *keys,\n"
+                "\tuint nq,\n"
+                "\tchar strict,\n"
+                "\tglobal const bits_t *query,\n"
+                "\tglobal " << type_name<size_t>() << " *result\n"
+                "\t)\n"
+                "{\n"
+                "    size_t i = get_global_id(0);\n"
+                "    if (i < nq) {\n"
+                "        bits_t q  = query[i];\n"
+                "        size_t lo = 0, hi = n;\n"
+                "        while(lo < hi) {\n"
+                "            size_t mid = lo + (hi - lo) / 2;\n"
+                "            bits_t v   = to_bits(keys[mid]);\n"
+                "            if (strict ? v < q : v <= q) lo = mid + 1; else hi = mid;\n"
+                "        }\n"
+                "        result[i] = lo;\n"
+                "    }\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel krn(program, "vexcl_radix_bound");
+            size_t wgs = kernel_workgroup_size(krn, device);
+
+            kernel = cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(krn, wgs)
+                        )).first;
+        }
+
+        if (keys.part_size(d)) {
+            dquery [d] = cl::Buffer(context, CL_MEM_READ_ONLY,  nq * sizeof(bits_t));
+            dresult[d] = cl::Buffer(context, CL_MEM_READ_WRITE, nq * sizeof(size_t));
+        }
+    }
+
+    // Number of keys in each partition that are less than (or not greater
+    // than) the given values.
+    auto bound = [&](const std::vector<bits_t> &q, bool strict)
+        -> std::vector< std::vector<size_t> >
+    {
+        std::vector< std::vector<size_t> > r(nq, std::vector<size_t>(q.size(), 0));
+
+        for(unsigned d = 0; d < nq; d++) {
+            if (!keys.part_size(d)) continue;
+
+            auto kernel = cache.find(qctx(queue[d])());
+
+            cl::Kernel &krn   = kernel->second.kernel;
+            size_t     w_size = kernel->second.wgsize;
+
+            queue[d].enqueueWriteBuffer(dquery[d], CL_FALSE, 0,
+                    q.size() * sizeof(bits_t), q.data());
+
+            unsigned pos = 0;
+            krn.setArg(pos++, keys.part_size(d));
+            krn.setArg(pos++, keys(d));
+            krn.setArg(pos++, static_cast<cl_uint>(q.size()));
+            krn.setArg(pos++, static_cast<char>(strict));
+            krn.setArg(pos++, dquery[d]);
+            krn.setArg(pos++, dresult[d]);
+
+            queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                    alignup(q.size(), w_size), w_size);
+
+            queue[d].enqueueReadBuffer(dresult[d], CL_FALSE, 0,
+                    q.size() * sizeof(size_t), r[d].data());
+        }
+
+        for(unsigned d = 0; d < nq; d++)
+            if (keys.part_size(d)) queue[d].finish();
+
+        return r;
+    };
+
+    // Bisection: for every inner partition boundary find the smallest key
+    // t such that there are at least part_start(d) keys not greater than t.
+    std::vector<bits_t> lo(nq - 1, 0);
+    std::vector<bits_t> hi(nq - 1, std::numeric_limits<bits_t>::max());
+
+    for(;;) {
+        std::vector<bits_t> mid(nq - 1);
+        bool done = true;
+
+        for(unsigned j = 0; j + 1 < nq; ++j) {
+            mid[j] = lo[j] + (hi[j] - lo[j]) / 2;
+            if (lo[j] < hi[j]) done = false;
+        }
+
+        if (done) break;
+
+        auto r = bound(mid, false);
+
+        for(unsigned j = 0; j + 1 < nq; ++j) {
+            if (lo[j] == hi[j]) continue;
+
+            size_t cnt = 0;
+            for(unsigned d = 0; d < nq; ++d) cnt += r[d][j];
+
+            if (cnt >= keys.part_start(j + 1))
+                hi[j] = mid[j];
+            else
+                lo[j] = mid[j] + 1;
+        }
+    }
+
+    auto lower = bound(lo, true);
+    auto upper = bound(lo, false);
+
+    std::vector< std::vector<size_t> > split(nq, std::vector<size_t>(nq + 1, 0));
+
+    for(unsigned j = 0; j + 1 < nq; ++j) {
+        size_t need = keys.part_start(j + 1);
+        for(unsigned d = 0; d < nq; ++d) need -= lower[d][j];
+
+        for(unsigned d = 0; d < nq; ++d) {
+            size_t take = std::min(need, upper[d][j] - lower[d][j]);
+            split[d][j + 1] = lower[d][j] + take;
+            need -= take;
+        }
+    }
+
+    for(unsigned d = 0; d < nq; ++d)
+        split[d][nq] = keys.part_size(d);
+
+    return split;
+}
+
+template <int Bits, typename K, typename V, bool HasVals>
+void radix_sort(vector<K> &keys, vector<V> &vals) {
+    typedef typename radix_key<K>::bits_t bits_t;
+
+    static_assert(Bits > 0 && Bits <= 8 * sizeof(bits_t),
+            "Wrong number of key bits in radix sort");
+
+    const unsigned passes = (Bits + radix_digit_bits - 1) / radix_digit_bits;
+
+    const std::vector<cl::CommandQueue> &queue = keys.queue_list();
+
+    precondition(!HasVals || (vals.size() == keys.size() && vals.nparts() == keys.nparts()),
+            "Keys and values should have same partitioning in sort_by_key");
+
+    radix_sort_partitions<K, V, HasVals>(keys, vals, passes);
+
+    unsigned nonempty = 0;
+    for(unsigned d = 0; d < queue.size(); d++)
+        if (keys.part_size(d)) ++nonempty;
+
+    if (nonempty < 2) return;
+
+    // Redistribute the sorted partitions so that each device holds its
+    // part of the globally sorted sequence, and sort them once more.
+    std::vector< std::vector<size_t> > split = radix_splitters(keys);
+
+    vector<K> tkeys(queue, keys.size());
+    vector<V> tvals;
+    if (HasVals) tvals.resize(queue, vals.size());
+
+    std::vector<size_t> offset(queue.size());
+    for(unsigned d = 0; d < queue.size(); d++)
+        offset[d] = keys.part_start(d);
+
+    for(unsigned e = 0; e < queue.size(); e++) {
+        for(unsigned d = 0; d < queue.size(); d++) {
+            size_t start = split[e][d];
+            size_t count = split[e][d + 1] - start;
+
+            if (!count) continue;
+
+            copy_buffer_to_vector(queue[e], keys(e), start, count, tkeys, offset[d]);
+            if (HasVals)
+                copy_buffer_to_vector(queue[e], vals(e), start, count, tvals, offset[d]);
+
+            offset[d] += count;
+        }
+    }
+
+    // The copies above run on the destination queues and read keys(e) and
+    // vals(e), which are overwritten below on queue[e].
+    for(unsigned d = 0; d < queue.size(); d++)
+        queue[d].finish();
+
+    keys = tkeys;
+    if (HasVals) vals = tvals;
+
+    radix_sort_partitions<K, V, HasVals>(keys, vals, passes);
+}
+
+} // namespace detail
+/// \endcond
+
+/// Sorts the vector in ascending order.
+/**
+ * Integral and floating point keys are supported. Each device partition is
+ * sorted with LSD radix sort. When the vector spans several devices, the
+ * sorted partitions are redistributed between devices according to exact
+ * splitters, and are sorted once again, so that the result is globally
+ * sorted.
+ *
+ * Bits is the number of least significant bits of the keys to sort by (for
+ * unsigned keys, this means the keys are less than 2^Bits). Narrow keys need
+ * fewer passes of radix sort:
+ * \code
+ * vex::sort(x);       // Sort by all bits of the keys.
+ * vex::sort<20>(cell); // Cell indices are less than 2^20.
+ * \endcode
+ */
+template <int Bits, typename K>
+void sort(vector<K> &keys) {
+    detail::radix_sort<Bits, K, K, false>(keys, keys);
+}
+
+/// Sorts the vector in ascending order.
+/**
+ * The overload is deliberately less specialized than vex::sort(vector<T>&)
+ * from vexcl/external/boost_compute.hpp, so that the Boost.Compute wrapper
+ * keeps working (and takes precedence) when both headers are included.
+ */
+template <class Keys>
+typename std::enable_if<
+    std::is_same<Keys, vector<typename Keys::value_type> >::value
+>::type
+sort(Keys &keys) {
+    sort<8 * sizeof(typename Keys::value_type)>(keys);
+}
+
+/// Sorts values by keys.
+/**
+ * Both keys and values are reordered, so that the keys are sorted in
+ * ascending order. The sort is stable. See sort() for the meaning of Bits.
+ */
+template <int Bits, typename K, typename V>
+void sort_by_key(vector<K> &keys, vector<V> &vals) {
+    detail::radix_sort<Bits, K, V, true>(keys, vals);
+}
+
+/// Sorts values by keys.
+template <typename K, typename V>
+void sort_by_key(vector<K> &keys, vector<V> &vals) {
+    sort_by_key<8 * sizeof(K)>(keys, vals);
+}
+
+} // namespace vex
+
+#endif
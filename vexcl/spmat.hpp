@@ -33,7 +33,10 @@ THE SOFTWARE.
 
 #include <vector>
 #include <set>
+#include <cmath>
 #include <unordered_map>
+#include <map>
+#include <sstream>
 #include <string>
 #include <memory>
 #include <algorithm>
@@ -41,12 +44,115 @@ THE SOFTWARE.
 #include <type_traits>
 
 #include <vexcl/vector.hpp>
+#include <vexcl/sort.hpp>
+#include <vexcl/scan.hpp>
+#include <vexcl/spmat/exchange.hpp>
 
 namespace vex {
 
-/// Sparse matrix in hybrid ELL-CSR format.
+/// Storage formats and SpMV kernels of a sparse matrix.
+enum spmat_format {
+    spmat_auto,         ///< Choose from row length statistics.
+    spmat_hybrid_ell,   ///< Hybrid ELL-CSR format, one work-item per row.
+    spmat_csr_scalar,   ///< CSR format, one work-item per row.
+    spmat_csr_vector,   ///< CSR format, several work-items per row.
+    spmat_csr_adaptive, ///< CSR format, work-group per block of rows.
+    spmat_sell          ///< SELL-C-sigma (sliced ELL) format.
+};
+
+/// Reordering methods for vex::reorder and reordering SpMat constructor.
+enum reorder_method {
+    /// Reverse Cuthill-McKee: reduces matrix bandwidth.
+    reorder_rcm,
+    /// Multilevel graph partitioning between devices (minimizes the number
+    /// of ghost values), followed by reverse Cuthill-McKee within each part.
+    reorder_graph
+};
+
 template <typename val_t, typename col_t = size_t, typename idx_t = size_t>
+class reorder;
+
+/// Methods of transposed sparse matrix-vector product (see vex::transp()).
+enum transpose_method {
+    transpose_cached,   ///< Transposed matrix is built on the device on first use and kept.
+    transpose_atomic    ///< Products are scattered with atomic additions.
+};
+
+namespace detail {
+
+/// Row length statistics of a (part of) sparse matrix.
+struct row_stats {
+    size_t rows;
+    size_t max_width;
+    double mean;
+    double stddev;
+
+    template <typename idx_t>
+    row_stats(const idx_t *row, size_t row_begin, size_t row_end)
+        : rows(row_end - row_begin), max_width(0), mean(0), stddev(0)
+    {
+        if (!rows) return;
+
+        double sum2 = 0;
+        for(size_t i = row_begin; i < row_end; ++i) {
+            size_t w = row[i + 1] - row[i];
+
+            max_width = std::max(max_width, w);
+            mean     += w;
+            sum2     += static_cast<double>(w) * w;
+        }
+
+        mean  /= rows;
+        stddev = std::sqrt(std::max(0.0, sum2 / rows - mean * mean));
+    }
+};
+
+/// Selects SpMV kernel for a matrix in CSR format.
+inline spmat_format choose_csr_kernel(const cl::Device &device, const row_stats &s) {
+    if (is_cpu(device)) return spmat_csr_scalar;
+
+    // A few very long rows would stall scalar and vector kernels.
+    if (s.max_width > 32 * std::max(s.mean, 1.0)) return spmat_csr_adaptive;
+
+    // Rows are long enough to keep several work-items busy.
+    if (s.mean >= 4) return spmat_csr_vector;
+
+    return spmat_csr_scalar;
+}
+
+/// Selects storage format for a matrix strip assigned to a device.
+inline spmat_format choose_spmat_format(const cl::Device &device, const row_stats &s) {
+    if (is_cpu(device)) return spmat_csr_scalar;
+
+    // Rows of similar lengths are best served by (hybrid) ELL.
+    if (s.stddev <= s.mean && s.max_width <= 16 * std::max(s.mean, 1.0))
+        return spmat_hybrid_ell;
+
+    // Short rows of varying lengths: sliced ELL pads each slice only to its
+    // own longest row.
+    if (s.mean < 16 && s.max_width <= 32 * std::max(s.mean, 1.0))
+        return spmat_sell;
+
+    return choose_csr_kernel(device, s);
+}
+
+} // namespace detail
+
+/// Sparse matrix in hybrid ELL-CSR or CSR format.
+/**
+ * val_t is the type of vectors the matrix is applied to. mat_t is the type
+ * matrix values are stored in on the compute devices; it defaults to val_t.
+ * Storing values in lower precision (e.g. SpMat<double, size_t, size_t,
+ * float>) halves the memory traffic of bandwidth-bound products while
+ * accumulation is still done in val_t.
+ */
+template <typename val_t, typename col_t = size_t, typename idx_t = size_t, typename mat_t = val_t>
 class SpMat {
+    static_assert(
+            std::is_same<val_t, mat_t>::value ||
+            (cl_vector_length<val_t>::value == 1 && cl_vector_length<mat_t>::value == 1),
+            "Mixed precision is only supported for scalar value types"
+            );
     public:
         typedef val_t value_type;
         typedef typename cl_scalar_of<val_t>::type scalar_type;
@@ -57,10 +163,15 @@ class SpMat {
         /// Constructor.
         /**
          * Constructs GPU representation of the matrix. Input matrix is in CSR
-         * format. GPU matrix utilizes ELL format and is split equally across
-         * all compute devices. When there are more than one device, secondary
-         * queue can be used to perform transfer of ghost values across GPU
-         * boundaries in parallel with computation kernel.
+         * format. The matrix is split equally across all compute devices.
+         * On GPUs, each strip is stored in hybrid ELL-CSR format when its
+         * rows are of similar lengths, in SELL-C-sigma format when rows are
+         * short but irregular, and in CSR format otherwise. CPUs use CSR
+         * format. When there are more than one device, secondary queue is
+         * used to perform transfer of ghost values across GPU boundaries in
+         * parallel with computation kernel. Ghost values are copied directly
+         * between devices that share OpenCL context, and through pinned host
+         * memory otherwise.
          * \param queue vector of queues. Each queue represents one
          *            compute device.
          * \param n   number of rows in the matrix.
@@ -68,48 +179,192 @@ class SpMat {
          * \param row row index into col and val vectors.
          * \param col column numbers of nonzero elements of the matrix.
          * \param val values of nonzero elements of the matrix.
+         * \param format storage format and SpMV kernel. By default, these
+         *            are selected for each device from row length
+         *            statistics of its strip of the matrix.
          */
         SpMat(const std::vector<cl::CommandQueue> &queue,
-              size_t n, size_t m, const idx_t *row, const col_t *col, const val_t *val
+              size_t n, size_t m, const idx_t *row, const col_t *col, const val_t *val,
+              spmat_format format = spmat_auto
               )
-            : queue(queue), part(partition(n, queue)),
-              event1(queue.size(), std::vector<cl::Event>(1)),
-              event2(queue.size(), std::vector<cl::Event>(1)),
-              mtx(queue.size()), exc(queue.size()),
+            : queue(queue), part(partition(n, queue)), col_part(partition(m, queue)),
+              mtx(queue.size()), fmt(queue.size(), spmat_auto), xchg(queue),
               nrows(n), ncols(m), nnz(row[n])
         {
-            auto col_part = partition(m, queue);
+            init(row, col, val, format);
+        }
 
-            // Create secondary queues.
-            for(auto q = queue.begin(); q != queue.end(); q++)
-                squeue.push_back(cl::CommandQueue(qctx(*q), qdev(*q)));
+        /// Constructor with reordering.
+        /**
+         * Reorders the square matrix with vex::reorder before constructing
+         * its GPU representation. The permutation is available with
+         * permutation(); vectors used with the matrix should be moved into
+         * the reordered space and allocated with row_partition() (the
+         * partitioning is uneven with vex::reorder_graph method).
+         * \param queue  vector of queues.
+         * \param n      number of rows (and columns) in the matrix.
+         * \param row    row index into col and val vectors.
+         * \param col    column numbers of nonzero elements of the matrix.
+         * \param val    values of nonzero elements of the matrix.
+         * \param method reordering method.
+         * \param format storage format and SpMV kernel.
+         */
+        SpMat(const std::vector<cl::CommandQueue> &queue,
+              size_t n, const idx_t *row, const col_t *col, const val_t *val,
+              reorder_method method, spmat_format format = spmat_auto
+              )
+            : ordering(new reorder<val_t, col_t, idx_t>(queue, n, row, col, val, method)),
+              queue(queue),
+              part(ordered().partition().part), col_part(ordered().partition().part),
+              mtx(queue.size()), fmt(queue.size(), spmat_auto), xchg(queue),
+              nrows(n), ncols(n), nnz(row[n])
+        {
+            init(ordered().row(), ordered().col(), ordered().val(), format);
 
-            std::vector<std::set<col_t>> ghost_cols = setup_exchange(col_part, row, col);
+            perm = ordered().permutation();
+            ordering.reset();
+        }
 
-            // Each device get it's own strip of the matrix.
-#ifdef _OPENMP
-#  pragma omp parallel for schedule(static,1)
-#endif
-            for(int d = 0; d < static_cast<int>(queue.size()); d++) {
-                if (part[d + 1] > part[d]) {
-                    cl::Device device = qdev(queue[d]);
+        /// Constructor with explicit partitioning.
+        /**
+         * Same as above, but rows of the matrix are split across devices
+         * according to row_part (see vex::nonzero_partitioning() and
+         * vex::reorder). Columns are split according to col_part, which
+         * defaults to row_part for square matrices. Vectors used with the
+         * matrix should be allocated with the same partitioning.
+         */
+        SpMat(const std::vector<cl::CommandQueue> &queue,
+              size_t n, size_t m, const idx_t *row, const col_t *col, const val_t *val,
+              const partitioning &row_part,
+              const partitioning &col_part = partitioning(),
+              spmat_format format = spmat_auto
+              )
+            : queue(queue), part(row_part.part),
+              col_part(col_part.part.empty() ?
+                      (n == m ? row_part.part : partition(m, queue)) :
+                      col_part.part),
+              mtx(queue.size()), fmt(queue.size(), spmat_auto), xchg(queue),
+              nrows(n), ncols(m), nnz(row[n])
+        {
+            precondition(
+                    part.size() == queue.size() + 1 && part.back() == n &&
+                    this->col_part.size() == queue.size() + 1 &&
+                    this->col_part.back() == m,
+                    "Partitioning does not match the matrix"
+                    );
+
+            init(row, col, val, format);
+        }
 
-                    if ( is_cpu(device) )
-                        mtx[d].reset(
-                                new SpMatCSR(queue[d], row, col, val,
-                                    part[d], part[d+1], col_part[d], col_part[d+1],
-                                    ghost_cols[d])
-                                );
-                    else
-                        mtx[d].reset(
-                                new SpMatHELL(queue[d], row, col, val,
-                                    part[d], part[d+1], col_part[d], col_part[d+1],
-                                    ghost_cols[d])
-                                );
-                }
-            }
+        /// Sparse matrix - sparse matrix product.
+        /**
+         * Computes A * B on the compute device; the operands and the result
+         * never leave the device. The product is computed row by row with
+         * expand-sort-compress algorithm in two phases: the symbolic phase
+         * finds sparsity pattern of the result, and the numeric phase
+         * computes its values. The result is stored in CSR format. When
+         * values of the operands change but their patterns stay the same,
+         * only the numeric phase has to be repeated (see update_product()).
+         * Both operands have to reside on the same single compute device.
+         */
+        SpMat(const SpMat &A, const SpMat &B)
+            : queue(A.queue), part(A.part), col_part(B.col_part),
+              mtx(A.queue.size()), fmt(A.queue.size(), spmat_csr_scalar),
+              xchg(A.queue), nnz_part(A.queue.size() + 1, 0),
+              nrows(A.nrows), ncols(B.ncols), nnz(0)
+        {
+            precondition(A.queue.size() == 1 && B.queue.size() == 1,
+                    "Sparse matrix product is only supported for single-device matrices");
+
+            precondition(qctx(A.queue[0])() == qctx(B.queue[0])(),
+                    "Sparse matrix product operands should share the context");
+
+            precondition(A.ncols == B.nrows,
+                    "Sparse matrix product operands have inconsistent sizes");
+
+            symbolic_product(A, B);
+            numeric_product(A, B);
         }
 
+        /// Assembles the matrix from (row, col, val) triplets on the compute device.
+        /**
+         * The triplets may come in any order, and values of duplicate
+         * entries are summed, as in finite element assembly. The triplets
+         * are sorted by (row, col) on the device, and the matrix is built
+         * in CSR format without leaving the device. The sorting permutation
+         * is kept, so that the matrix may be reassembled from new values of
+         * triplets with the same pattern with a single segmented sum (see
+         * reassemble()). The vectors have to reside on a single compute
+         * device.
+         * \param n   number of rows in the matrix.
+         * \param m   number of cols in the matrix.
+         * \param row row numbers of the triplets.
+         * \param col column numbers of the triplets.
+         * \param val values of the triplets.
+         */
+        SpMat(size_t n, size_t m,
+              const vex::vector<col_t> &row, const vex::vector<col_t> &col,
+              const vex::vector<val_t> &val)
+            : queue(val.queue_list()), part(partition(n, queue)), col_part(partition(m, queue)),
+              mtx(queue.size()), fmt(queue.size(), spmat_csr_scalar),
+              xchg(queue), nnz_part(queue.size() + 1, 0),
+              nrows(n), ncols(m), nnz(0)
+        {
+            precondition(queue.size() == 1,
+                    "Matrix assembly is only supported for single-device vectors");
+
+            precondition(row.size() == val.size() && col.size() == val.size(),
+                    "Triplet vectors have different sizes");
+
+            assemble(row, col, val);
+        }
+
+        /// Reassembles the matrix from new values of the triplets.
+        /**
+         * The matrix should have been assembled from triplets (see above),
+         * and row and column numbers of the triplets should not have
+         * changed since then. The nonzeros are computed as segmented sums
+         * of the values.
+         */
+        void reassemble(const vex::vector<val_t> &val) {
+            precondition(val.size() == asm_perm.size(),
+                    "Matrix was assembled from a different number of triplets");
+
+            if (val.size()) sum_triplets(val);
+
+            tloc.clear();
+            trem.clear();
+        }
+
+        /// Recomputes values of sparse matrix - sparse matrix product.
+        /**
+         * Only the numeric phase of the product is performed. The matrix
+         * should have been constructed as a product of A and B, and
+         * sparsity patterns of A and B should not have changed since then
+         * (e.g., only their values were replaced with update_values()).
+         */
+        void update_product(const SpMat &A, const SpMat &B) {
+            precondition(A.nrows == nrows && B.ncols == ncols && A.ncols == B.nrows,
+                    "Sparse matrix product operands have inconsistent sizes");
+
+            if (nrows) numeric_product(A, B);
+
+            tloc.clear();
+            trem.clear();
+        }
+
+        /// Row partitioning of the matrix.
+        partitioning row_partition() const { return partitioning(part); }
+
+        /// Permutation of the reordered matrix.
+        /**
+         * Row i of the matrix is row permutation()[i] of the original one.
+         * Empty unless the matrix was constructed with reordering.
+         */
+        const std::vector<size_t>& permutation() const { return perm; }
+
+        /// Column partitioning of the matrix.
+        partitioning col_partition() const { return partitioning(col_part); }
 
         /// Matrix-vector multiplication.
         /**
@@ -125,88 +380,202 @@ class SpMat {
         void mul(const vex::vector<val_t> &x, vex::vector<val_t> &y,
                  scalar_type alpha = 1, bool append = false) const
         {
-            using namespace detail;
+            start_remote(x, y);
 
-            static kernel_cache cache;
+            // Compute contribution from local part of the matrix.
+            for(unsigned d = 0; d < queue.size(); d++)
+                if (mtx[d]) mtx[d]->mul_local(x(d), y(d), alpha, append);
 
-            if (rx.size()) {
-                // Transfer remote parts of the input vector.
-                for(unsigned d = 0; d < queue.size(); d++) {
-                    cl::Context context = qctx(queue[d]);
-                    cl::Device  device  = qdev(queue[d]);
-
-                    auto gather = cache.find(context());
-
-                    if (gather == cache.end()) {
-                        std::ostringstream source;
-
-                        source << standard_kernel_header(device) <<
-                            "typedef " << type_name<val_t>() << " val_t;\n"
-                            "kernel void gather_vals_to_send(\n"
-                            "    " << type_name<size_t>() << " n,\n"
-                            "    global const val_t *vals,\n"
-                            "    global const " << type_name<col_t>() << " *cols_to_send,\n"
-                            "    global val_t *vals_to_send\n"
-                            "    )\n"
-                            "{\n"
-                            "    size_t i = get_global_id(0);\n"
-                            "    if (i < n) vals_to_send[i] = vals[cols_to_send[i]];\n"
-                            "}\n";
-
-                        auto program = build_sources(context, source.str());
-
-                        cl::Kernel krn(program, "gather_vals_to_send");
-                        size_t wgs = kernel_workgroup_size(krn, device);
-
-                        gather = cache.insert(std::make_pair(
-                                    context(), kernel_cache_entry(krn, wgs)
-                                    )).first;
-                    }
+            finish_remote(y, alpha);
+        }
 
-                    if (size_t ncols = cidx[d + 1] - cidx[d]) {
-                        size_t g_size = alignup(ncols, gather->second.wgsize);
+        /// \cond INTERNAL
 
-                        unsigned pos = 0;
-                        gather->second.kernel.setArg(pos++, ncols);
-                        gather->second.kernel.setArg(pos++, x(d));
-                        gather->second.kernel.setArg(pos++, exc[d].cols_to_send);
-                        gather->second.kernel.setArg(pos++, exc[d].vals_to_send);
+        // Starts exchange of ghost values of x. Remote part of the product is
+        // added to y with finish_remote(). This allows to compute the local
+        // part inside of another kernel (see vex::traits::local_transform).
+        void start_remote(const vex::vector<val_t> &x, const vex::vector<val_t> &y) const {
+            precondition(x.partition() == col_part && y.partition() == part,
+                    "Vector partitioning does not match the matrix");
 
-                        queue[d].enqueueNDRangeKernel(gather->second.kernel,
-                                cl::NullRange, g_size, gather->second.wgsize, 0, &event1[d][0]);
+            if (!xchg.active()) return;
 
-                        squeue[d].enqueueReadBuffer(exc[d].vals_to_send, CL_FALSE,
-                                0, ncols * sizeof(val_t), &rx[cidx[d]], &event1[d], &event2[d][0]
-                                );
-                    }
-                }
+            std::vector< std::vector<cl::Buffer> > xbuf(queue.size());
+            for(unsigned d = 0; d < queue.size(); d++)
+                xbuf[d].push_back(x(d));
+
+            xchg.start(xbuf, detail::spmm_arg(1, 1));
+        }
+
+        // Adds contribution from remote part of the matrix. Each device
+        // starts as soon as its own ghost values arrive.
+        void finish_remote(vex::vector<val_t> &y, scalar_type alpha) const {
+            if (!xchg.active()) return;
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                if (!xchg.ghosts(d)) continue;
+
+                xchg.finish(d, 1);
+
+                mtx[d]->mul_remote(xchg.values(d), y(d), alpha,
+                        xchg.received(d), xchg.remote_done(d));
             }
+        }
 
-            // Compute contribution from local part of the matrix.
-            for(unsigned d = 0; d < queue.size(); d++)
-                if (mtx[d]) mtx[d]->mul_local(x(d), y(d), alpha, append);
+        /// \endcond
 
-            // Compute contribution from remote part of the matrix.
-            if (rx.size()) {
-                for(unsigned d = 0; d < queue.size(); d++)
-                    if (cidx[d + 1] > cidx[d]) event2[d][0].wait();
+        /// Sparse matrix - multivector product.
+        /**
+         * Components of the multivector are stored in separate vectors. The
+         * matrix is read once for all of the components, and ghost values of
+         * all components are exchanged at once.
+         */
+        void mul(const std::vector<const vex::vector<val_t>*> &x,
+                 const std::vector<vex::vector<val_t>*> &y,
+                 scalar_type alpha = 1, bool append = false) const
+        {
+            precondition(x.size() == y.size(), "Inconsistent number of components");
+
+            const unsigned N = static_cast<unsigned>(x.size());
+
+            std::vector< std::vector<cl::Buffer> > xbuf(queue.size()), ybuf(queue.size());
+
+            for(unsigned k = 0; k < N; k++) {
+                precondition(
+                        x[k]->partition() == col_part && y[k]->partition() == part,
+                        "Vector partitioning does not match the matrix");
 
                 for(unsigned d = 0; d < queue.size(); d++) {
-                    cl::Context context = qctx(queue[d]);
+                    xbuf[d].push_back((*x[k])(d));
+                    ybuf[d].push_back((*y[k])(d));
+                }
+            }
 
-                    if (exc[d].cols_to_recv.size()) {
-                        for(size_t i = 0; i < exc[d].cols_to_recv.size(); i++)
-                            exc[d].vals_to_recv[i] = rx[exc[d].cols_to_recv[i]];
+            mul_multi(xbuf, detail::spmm_arg(N, 0), ybuf, detail::spmm_arg(N, 0), alpha, append);
+        }
 
-                        squeue[d].enqueueWriteBuffer(
-                                exc[d].rx, CL_FALSE, 0, bytes(exc[d].vals_to_recv),
-                                exc[d].vals_to_recv.data(), 0, &event2[d][0]
-                                );
+        /// Sparse matrix - multivector product.
+        /**
+         * Components of the multivector are interleaved: x is a vector of
+         * OpenCL vector types (e.g. cl_double4 for SpMat<double>).
+         */
+        template <typename V>
+        typename std::enable_if<
+            !std::is_same<V, val_t>::value &&
+            std::is_same<typename cl_scalar_of<V>::type, val_t>::value,
+            void
+        >::type
+        mul(const vex::vector<V> &x, vex::vector<V> &y,
+                 scalar_type alpha = 1, bool append = false) const
+        {
+            precondition(x.partition() == col_part && y.partition() == part,
+                    "Vector partitioning does not match the matrix");
 
-                        mtx[d]->mul_remote(exc[d].rx, y(d), alpha, event2[d]);
-                    }
+            detail::spmm_arg arg(cl_vector_length<V>::value, sizeof(V) / sizeof(val_t));
+
+            std::vector< std::vector<cl::Buffer> > xbuf(queue.size()), ybuf(queue.size());
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                xbuf[d].push_back(x(d));
+                ybuf[d].push_back(y(d));
+            }
+
+            mul_multi(xbuf, arg, ybuf, arg, alpha, append);
+        }
+
+        /// Replaces values of the matrix nonzeros.
+        /**
+         * The sparsity pattern of the matrix stays the same. val holds new
+         * values of the nonzeros in the order of the CSR arrays the matrix
+         * was constructed from. Each device receives its values with a
+         * single transfer, and a single kernel places them into the storage
+         * format (when the format keeps the input order, the values are
+         * written into the storage directly). The transposed matrix (see
+         * vex::transp()) is rebuilt on next use.
+         */
+        void update_values(const val_t *val) {
+            std::vector<cl::Event> written;
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                size_t n = nnz_part[d + 1] - nnz_part[d];
+                if (!mtx[d] || !n) continue;
+
+                written.push_back(cl::Event());
+                mtx[d]->update_values(queue[d], val + nnz_part[d], n, written.back());
+            }
+
+            // The values have to be read before the host array is released.
+            for(auto e = written.begin(); e != written.end(); ++e) e->wait();
+
+            tloc.clear();
+            trem.clear();
+        }
+
+        /// Transposed matrix-vector multiplication.
+        /**
+         * Computes \f$y = \alpha A^T x\f$ or \f$y += \alpha A^T x\f$ in
+         * parallel on all registered compute devices (see vex::transp()).
+         * Partitioning of x should match rows of the matrix, and
+         * partitioning of y should match its columns. Partial sums for
+         * ghost columns are sent back to the devices that own the columns.
+         * \param method transpose_cached builds transposed matrix on the
+         *               devices on first use and keeps it for subsequent
+         *               products; transpose_atomic needs no extra memory,
+         *               but scatters the products with atomic additions.
+         */
+        void mul_transposed(const vex::vector<val_t> &x, vex::vector<val_t> &y,
+                 scalar_type alpha = 1, bool append = false,
+                 transpose_method method = transpose_cached) const
+        {
+            static_assert(std::is_same<val_t, scalar_type>::value,
+                    "Transposed product is only supported for scalar matrices");
+
+            precondition(x.partition() == part && y.partition() == col_part,
+                    "Vector partitioning does not match the matrix");
+
+            const bool cached = (method == transpose_cached);
+
+            if (cached) build_transposed();
+
+            std::vector<cl::Event> ready(queue.size());
+
+            // Partial sums for ghost columns go first, so that their
+            // transfer may overlap with the local part of the product.
+            for(unsigned d = 0; d < queue.size(); d++) {
+                if (!xchg.ghosts(d)) continue;
+
+                const cl::Buffer &t = xchg.back_values(d);
+
+                if (cached) {
+                    trem[d]->template mul<assign::SET>(trem[d]->loc, x(d), t, alpha,
+                            xchg.back_free(d), &ready[d]);
+                } else {
+                    const std::vector<cl::Event> &busy = xchg.back_free(d);
+                    for(auto e = busy.begin(); e != busy.end(); ++e) e->wait();
+
+                    vector<val_t>(queue[d], t) = 0;
+                    scatter_transposed(d, true, x(d), t, alpha, &ready[d]);
+                }
+            }
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                if (col_part[d + 1] == col_part[d]) continue;
+
+                if (cached && tloc[d]) {
+                    tloc[d]->mul_local(x(d), y(d), alpha, append);
+                } else {
+                    if (!append) vector<val_t>(queue[d], y(d)) = 0;
+                    if (!cached && mtx[d]) scatter_transposed(d, false, x(d), y(d), alpha);
                 }
             }
+
+            if (xchg.active()) {
+                std::vector<cl::Buffer> ybuf(queue.size());
+                for(unsigned d = 0; d < queue.size(); d++)
+                    if (col_part[d + 1] > col_part[d]) ybuf[d] = y(d);
+
+                xchg.reverse(ybuf, ready);
+            }
         }
 
         /// Number of rows.
@@ -216,42 +585,120 @@ class SpMat {
         /// Number of non-zero entries.
         size_t nonzeros() const { return nnz;   }
 
+        /// Storage format used on the given device.
+        spmat_format format(unsigned d) const { return fmt[d]; }
+
+        /// \cond INTERNAL
+
+        // Inlined product computes one row per work-item. This is as fast as
+        // the specialized kernels for the HELL and scalar CSR formats only;
+        // other formats should keep their own kernels.
+        bool inline_is_efficient() const {
+            for(unsigned d = 0; d < queue.size(); d++)
+                if (mtx[d] && fmt[d] != spmat_hybrid_ell && fmt[d] != spmat_csr_scalar)
+                    return false;
+            return true;
+        }
+
+        /// \endcond
+
         static std::string inline_preamble(
-                const cl::Device &device, const std::string &prm_name,
+                const cl::Device&, const std::string &prm_name,
                 detail::kernel_generator_state_ptr)
         {
-            if (is_cpu(device))
-                return SpMatCSR::inline_preamble(prm_name);
-            else
-                return SpMatHELL::inline_preamble(prm_name);
+            return SpMatHELL::inline_preamble(prm_name);
         }
 
+        // Inlined product is the sum of the local part applied to x and of
+        // the remote part applied to ghost values of x (see inline_ghosts()).
         static std::string inline_expression(
-                const cl::Device &device, const std::string &prm_name,
+                const cl::Device&, const std::string &prm_name,
                 detail::kernel_generator_state_ptr)
         {
-            if (is_cpu(device))
-                return SpMatCSR::inline_expression(prm_name);
-            else
-                return SpMatHELL::inline_expression(prm_name);
+            return "(" + SpMatHELL::inline_expression(prm_name, prm_name)
+                + " + " + SpMatHELL::inline_expression(prm_name, prm_name + "_rem")
+                + ")";
         }
 
         static std::string inline_parameters(
-                const cl::Device &device, const std::string &prm_name,
+                const cl::Device&, const std::string &prm_name,
                 detail::kernel_generator_state_ptr)
         {
-            if (is_cpu(device))
-                return SpMatCSR::inline_parameters(prm_name);
-            else
-                return SpMatHELL::inline_parameters(prm_name);
+            return SpMatHELL::inline_parameters(prm_name)
+                + SpMatHELL::inline_parameters(prm_name + "_rem");
+        }
+
+        // Exchanges ghost values of x for a product inlined into a vector
+        // expression. Each device receives its own copy of the ghost values,
+        // so that the exchange buffers may be reused before the expression
+        // kernel is done. The copies are taken from a pool kept with the
+        // matrix; a copy is reused once the expression that held it is gone
+        // (queues are in-order, so the kernel that read it was enqueued
+        // before the next copy into it). Returns null when there are no
+        // ghosts.
+        std::shared_ptr< std::vector<cl::Buffer> >
+        inline_ghosts(const vex::vector<val_t> &x) const {
+            precondition(x.partition() == col_part,
+                    "Vector partitioning does not match the matrix");
+
+            std::shared_ptr< std::vector<cl::Buffer> > ghost;
+
+            if (!xchg.active()) return ghost;
+
+            for(auto p = ghost_pool.begin(); p != ghost_pool.end(); ++p)
+                if (p->unique()) { ghost = *p; break; }
+
+            if (!ghost) {
+                ghost = std::make_shared< std::vector<cl::Buffer> >(queue.size());
+
+                for(unsigned d = 0; d < queue.size(); d++)
+                    if (size_t n = xchg.ghosts(d))
+                        (*ghost)[d] = cl::Buffer(qctx(queue[d]),
+                                CL_MEM_READ_WRITE, n * sizeof(val_t));
+
+                ghost_pool.push_back(ghost);
+            }
+
+            std::vector< std::vector<cl::Buffer> > xbuf(queue.size());
+            for(unsigned d = 0; d < queue.size(); d++)
+                xbuf[d].push_back(x(d));
+
+            xchg.start(xbuf, detail::spmm_arg(1, 1));
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                size_t n = xchg.ghosts(d);
+                if (!n) continue;
+
+                xchg.finish(d, 1);
+
+                const std::vector<cl::Event> &wait = xchg.received(d);
+
+                queue[d].enqueueCopyBuffer(xchg.values(d), (*ghost)[d], 0, 0,
+                        n * sizeof(val_t), wait.empty() ? NULL : &wait,
+                        xchg.remote_done(d));
+            }
+
+            return ghost;
         }
 
         static void inline_arguments(cl::Kernel &kernel, unsigned device,
                 size_t /*index_offset*/, unsigned &position,
                 const SpMat &A, const vector<val_t> &x,
+                const std::shared_ptr< std::vector<cl::Buffer> > &ghost,
                 detail::kernel_generator_state_ptr)
         {
             A.mtx[device]->setArgs(kernel, device, position, x);
+
+            if (ghost && (*ghost)[device]()) {
+                A.mtx[device]->hell_args(kernel, position, true);
+                kernel.setArg(position++, (*ghost)[device]);
+            } else {
+                // Empty remote part.
+                kernel.setArg(position++, static_cast<size_t>(0));
+                kernel.setArg(position++, static_cast<size_t>(0));
+                for(int i = 0; i < 8; ++i)
+                    kernel.setArg(position++, static_cast<void*>(0));
+            }
         }
     private:
         template <typename T>
@@ -267,143 +714,280 @@ class SpMat {
 
             virtual void mul_remote(
                     const cl::Buffer &x, const cl::Buffer &y,
-                    scalar_type alpha, const std::vector<cl::Event> &event
+                    scalar_type alpha, const std::vector<cl::Event> &event,
+                    cl::Event *done
                     ) const = 0;
 
-            virtual void setArgs(cl::Kernel &kernel, unsigned device, unsigned &position, const vector<val_t> &x) const = 0;
+            virtual void mul_local_multi(
+                    const std::vector<cl::Buffer> &x, const detail::spmm_arg &xa,
+                    const std::vector<cl::Buffer> &y, const detail::spmm_arg &ya,
+                    scalar_type alpha, bool append
+                    ) const = 0;
+
+            virtual void mul_remote_multi(
+                    const cl::Buffer &x, const detail::spmm_arg &xa,
+                    const std::vector<cl::Buffer> &y, const detail::spmm_arg &ya,
+                    scalar_type alpha, const std::vector<cl::Event> &event,
+                    cl::Event *done
+                    ) const = 0;
+
+            // Local or remote part of the matrix as arguments of hybrid ELL
+            // code (see SpMatHELL::inline_preamble()).
+            virtual void hell_args(cl::Kernel &kernel, unsigned &position, bool remote) const = 0;
+
+            void setArgs(cl::Kernel &kernel, unsigned device, unsigned &position, const vector<val_t> &x) const {
+                hell_args(kernel, position, false);
+                kernel.setArg(position++, x(device));
+            }
+
+            // Value buffers of the format (at most four) and their sizes.
+            std::vector<cl::Buffer> val_buf;
+            std::vector<size_t>     val_size;
+
+            // Position of each strip nonzero (in the input order) in the
+            // value buffers, numbered through all of the buffers. Empty
+            // when the only buffer holds the values in the input order.
+            cl::Buffer val_perm;
+
+            // Staging buffer for new values.
+            mutable cl::Buffer val_new;
+
+            // Host copy of new values converted to mat_t (when it differs
+            // from val_t) for the direct write.
+            mutable std::vector<mat_t> val_host;
+
+            // Device copy of n input values converted to mat_t.
+            static cl::Buffer value_buffer(const cl::Context &ctx, const val_t *val, size_t n) {
+                if (std::is_same<val_t, mat_t>::value)
+                    return cl::Buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                            n * sizeof(mat_t), const_cast<val_t*>(val));
+
+                std::vector<mat_t> v(n);
+                for(size_t i = 0; i < n; ++i) v[i] = static_cast<mat_t>(val[i]);
+
+                return cl::Buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                        bytes(v), v.data());
+            }
+
+            void map_values(const cl::CommandQueue &queue,
+                    const std::vector<cl::Buffer> &buf, const std::vector<size_t> &size,
+                    const std::vector<idx_t> &perm)
+            {
+                val_buf  = buf;
+                val_size = size;
+
+                if (!perm.empty())
+                    val_perm = cl::Buffer(qctx(queue), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                            bytes(perm), const_cast<idx_t*>(perm.data()));
+            }
+
+            // Replaces values of n strip nonzeros. The values are written
+            // to the device with a single (non-blocking) transfer, which
+            // signals the written event.
+            void update_values(const cl::CommandQueue &queue,
+                    const val_t *val, size_t n, cl::Event &written) const
+            {
+                using namespace detail;
+
+                static kernel_cache cache;
+
+                if (!val_perm()) {
+                    if (!std::is_same<val_t, mat_t>::value) {
+                        val_host.resize(n);
+                        for(size_t i = 0; i < n; ++i)
+                            val_host[i] = static_cast<mat_t>(val[i]);
+
+                        queue.enqueueWriteBuffer(val_buf[0], CL_FALSE, 0,
+                                bytes(val_host), val_host.data(), 0, &written);
+                    } else {
+                        queue.enqueueWriteBuffer(val_buf[0], CL_FALSE, 0,
+                                n * sizeof(val_t), val, 0, &written);
+                    }
+                    return;
+                }
+
+                cl::Context context = qctx(queue);
+                cl::Device  device  = qdev(queue);
+
+                if (!val_new())
+                    val_new = cl::Buffer(context, CL_MEM_READ_WRITE, n * sizeof(val_t));
+
+                queue.enqueueWriteBuffer(val_new, CL_FALSE, 0,
+                        n * sizeof(val_t), val, 0, &written);
+
+                auto kernel = cache.find(context());
+
+                if (kernel == cache.end()) {
+                    std::ostringstream source;
+
+                    source << standard_kernel_header(device) <<
+                        "typedef " << type_name<val_t>() << " val_t;\n"
+                        "typedef " << type_name<mat_t>() << " mat_t;\n"
+                        "kernel void scatter_values(\n"
+                        "    " << type_name<size_t>() << " n,\n"
+                        "    global const val_t * val,\n"
+                        "    global const " << type_name<idx_t>() << " * perm";
+                    for(int b = 0; b < 4; ++b)
+                        source << ",\n"
+                        "    " << type_name<size_t>() << " n" << b << ",\n"
+                        "    global mat_t * dst" << b;
+                    source << "\n"
+                        "    )\n"
+                        "{\n"
+                        "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+                        "        size_t k = perm[i];\n"
+                        "        if (k < n0) { dst0[k] = val[i]; continue; } k -= n0;\n"
+                        "        if (k < n1) { dst1[k] = val[i]; continue; } k -= n1;\n"
+                        "        if (k < n2) { dst2[k] = val[i]; continue; } k -= n2;\n"
+                        "        dst3[k] = val[i];\n"
+                        "    }\n"
+                        "}\n";
+
+                    auto program = build_sources(context, source.str());
+
+                    cl::Kernel krn(program, "scatter_values");
+                    size_t     wgs = kernel_workgroup_size(krn, device);
+
+                    kernel = cache.insert(std::make_pair(
+                                context(), kernel_cache_entry(krn, wgs)
+                                )).first;
+                }
+
+                cl::Kernel krn    = kernel->second.kernel;
+                size_t     wgsize = kernel->second.wgsize;
+                size_t     g_size = num_workgroups(device) * wgsize;
+
+                unsigned pos = 0;
+                krn.setArg(pos++, n);
+                krn.setArg(pos++, val_new);
+                krn.setArg(pos++, val_perm);
+                for(unsigned b = 0; b < 4; ++b) {
+                    if (b < val_buf.size() && val_size[b]) {
+                        krn.setArg(pos++, val_size[b]);
+                        krn.setArg(pos++, val_buf[b]);
+                    } else {
+                        krn.setArg(pos++, size_t(0));
+                        krn.setArg(pos++, static_cast<void*>(0));
+                    }
+                }
+
+                queue.enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize);
+            }
 
             virtual ~sparse_matrix() {}
         };
 
 #include <vexcl/spmat/hybrid_ell.inl>
 #include <vexcl/spmat/csr.inl>
-
-        struct exdata {
-            std::vector<col_t> cols_to_recv;
-            mutable std::vector<val_t> vals_to_recv;
-
-            cl::Buffer cols_to_send;
-            cl::Buffer vals_to_send;
-            mutable cl::Buffer rx;
-        };
+#include <vexcl/spmat/sell.inl>
+#include <vexcl/spmat/transposed.inl>
+#include <vexcl/spmat/spgemm.inl>
+#include <vexcl/spmat/assemble.inl>
+
+        // Reordering helper; only kept while the matrix is constructed. The
+        // type is erased so that matrices with non-scalar values, which
+        // vex::reorder does not support, do not instantiate it.
+        std::shared_ptr<void> ordering;
+        std::vector<size_t> perm;
+
+        const reorder<val_t, col_t, idx_t>& ordered() const {
+            return *static_cast<const reorder<val_t, col_t, idx_t>*>(ordering.get());
+        }
 
         const std::vector<cl::CommandQueue> queue;
-        std::vector<cl::CommandQueue>       squeue;
         const std::vector<size_t>           part;
-
-        mutable std::vector<std::vector<cl::Event>> event1;
-        mutable std::vector<std::vector<cl::Event>> event2;
+        const std::vector<size_t>           col_part;
 
         std::vector< std::unique_ptr<sparse_matrix> > mtx;
+        std::vector<spmat_format> fmt;
 
-        std::vector<exdata> exc;
-        std::vector<size_t> cidx;
-        mutable std::vector<val_t> rx;
+        detail::ghost_exchange<val_t, col_t> xchg;
+
+        // Per-device copies of ghost values for inlined products.
+        mutable std::vector< std::shared_ptr< std::vector<cl::Buffer> > > ghost_pool;
+
+        // Range of nonzeros (in the input arrays) of each device.
+        std::vector<size_t> nnz_part;
 
         size_t nrows;
         size_t ncols;
         size_t nnz;
 
-        std::vector<std::set<col_t>> setup_exchange(
-                const std::vector<size_t> &col_part,
-                const idx_t *row, const col_t *col
-                )
+        void init(const idx_t *row, const col_t *col, const val_t *val,
+                spmat_format format)
         {
-            auto is_local = [col_part](size_t c, int device) {
-                return c >= col_part[device] && c < col_part[device + 1];
-            };
+            std::vector<std::set<col_t>> ghost_cols = xchg.setup(part, col_part, row, col);
 
-            std::vector<std::set<col_t>> ghost_cols(queue.size());
+            for(unsigned d = 0; d <= queue.size(); d++)
+                nnz_part.push_back(row[part[d]]);
 
-            if (queue.size() <= 1) return ghost_cols;
-
-            // Build sets of ghost points.
+            // Each device get it's own strip of the matrix.
 #ifdef _OPENMP
 #  pragma omp parallel for schedule(static,1)
 #endif
             for(int d = 0; d < static_cast<int>(queue.size()); d++) {
-                for(size_t i = part[d]; i < part[d + 1]; i++) {
-                    for(idx_t j = row[i]; j < row[i + 1]; j++) {
-                        if (!is_local(col[j], d)) {
-                            ghost_cols[d].insert(col[j]);
-                        }
-                    }
-                }
-            }
-
-            // Complete set of points to be exchanged between devices.
-            std::vector<col_t> cols_to_send;
-            {
-                std::set<col_t> cols_to_send_s;
-                for(unsigned d = 0; d < queue.size(); d++)
-                    cols_to_send_s.insert(ghost_cols[d].begin(), ghost_cols[d].end());
-
-                cols_to_send.insert(cols_to_send.begin(), cols_to_send_s.begin(), cols_to_send_s.end());
-            }
-
-            // Build local structures to facilitate exchange.
-            if (cols_to_send.size()) {
-#ifdef _OPENMP
-#  pragma omp parallel for schedule(static,1)
-#endif
-                for(int d = 0; d < static_cast<int>(queue.size()); d++) {
-                    if (size_t rcols = ghost_cols[d].size()) {
-                        exc[d].cols_to_recv.resize(rcols);
-                        exc[d].vals_to_recv.resize(rcols);
+                if (part[d + 1] > part[d]) {
+                    cl::Device device = qdev(queue[d]);
 
-                        exc[d].rx = cl::Buffer(qctx(queue[d]), CL_MEM_READ_ONLY, rcols * sizeof(val_t));
+                    fmt[d] = format;
+                    if (fmt[d] == spmat_auto)
+                        fmt[d] = detail::choose_spmat_format(device,
+                                detail::row_stats(row, part[d], part[d + 1]));
 
-                        for(size_t i = 0, j = 0; i < cols_to_send.size(); i++)
-                            if (ghost_cols[d].count(cols_to_send[i]))
-                                exc[d].cols_to_recv[j++] = static_cast<col_t>(i);
-                    }
+                    if (fmt[d] == spmat_hybrid_ell)
+                        mtx[d].reset(
+                                new SpMatHELL(queue[d], row, col, val,
+                                    part[d], part[d+1], col_part[d], col_part[d+1],
+                                    ghost_cols[d])
+                                );
+                    else if (fmt[d] == spmat_sell)
+                        mtx[d].reset(
+                                new SpMatSELL(queue[d], row, col, val,
+                                    part[d], part[d+1], col_part[d], col_part[d+1],
+                                    ghost_cols[d])
+                                );
+                    else
+                        mtx[d].reset(
+                                new SpMatCSR(queue[d], row, col, val,
+                                    part[d], part[d+1], col_part[d], col_part[d+1],
+                                    ghost_cols[d], format)
+                                );
                 }
+            }
+        }
 
-                rx.resize(cols_to_send.size());
-                cidx.resize(queue.size() + 1);
+        void mul_multi(
+                const std::vector< std::vector<cl::Buffer> > &x, const detail::spmm_arg &xa,
+                const std::vector< std::vector<cl::Buffer> > &y, const detail::spmm_arg &ya,
+                scalar_type alpha, bool append
+                ) const
+        {
+            if (xchg.active()) xchg.start(x, xa);
 
-                {
-                    auto beg = cols_to_send.begin();
-                    auto end = cols_to_send.end();
-                    for(unsigned d = 0; d <= queue.size(); d++) {
-                        cidx[d] = std::lower_bound(beg, end, static_cast<col_t>(col_part[d]))
-                                - cols_to_send.begin();
-                        beg = cols_to_send.begin() + cidx[d];
-                    }
-                }
+            for(unsigned d = 0; d < queue.size(); d++)
+                if (mtx[d]) mtx[d]->mul_local_multi(x[d], xa, y[d], ya, alpha, append);
 
+            if (xchg.active()) {
                 for(unsigned d = 0; d < queue.size(); d++) {
-                    if (size_t ncols = cidx[d + 1] - cidx[d]) {
-                        cl::Context context = qctx(queue[d]);
-
-                        exc[d].cols_to_send = cl::Buffer(
-                                context, CL_MEM_READ_ONLY, ncols * sizeof(col_t));
+                    if (!xchg.ghosts(d)) continue;
 
-                        exc[d].vals_to_send = cl::Buffer(
-                                context, CL_MEM_READ_WRITE, ncols * sizeof(val_t));
+                    xchg.finish(d, xa.N);
 
-                        for(size_t i = cidx[d]; i < cidx[d + 1]; i++)
-                            cols_to_send[i] -= static_cast<col_t>(col_part[d]);
-
-                        queue[d].enqueueWriteBuffer(
-                                exc[d].cols_to_send, CL_TRUE, 0, ncols * sizeof(col_t),
-                                &cols_to_send[cidx[d]]);
-                    }
+                    mtx[d]->mul_remote_multi(xchg.values(d), detail::spmm_arg(xa.N, xa.N),
+                            y[d], ya, alpha, xchg.received(d), xchg.remote_done(d));
                 }
             }
-
-            return ghost_cols;
         }
 };
 
 /// \cond INTERNAL
 
-template <typename val_t, typename col_t, typename idx_t>
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
 struct spmv
     : vector_expression< boost::proto::terminal< additive_vector_transform >::type >
 {
     typedef val_t                      value_type;
-    typedef SpMat<val_t, col_t, idx_t> mat;
+    typedef SpMat<val_t, col_t, idx_t, mat_t> mat;
     typedef vector<val_t>              vec;
 
     const mat &A;
@@ -419,29 +1003,75 @@ struct spmv
     }
 };
 
-template <typename val_t, typename col_t, typename idx_t>
-spmv< val_t, col_t, idx_t > operator*(const SpMat<val_t, col_t, idx_t> &A, const vector<val_t> &x)
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+spmv< val_t, col_t, idx_t, mat_t > operator*(const SpMat<val_t, col_t, idx_t, mat_t> &A, const vector<val_t> &x)
 {
-    return spmv<val_t, col_t, idx_t>(A, x);
+    return spmv<val_t, col_t, idx_t, mat_t>(A, x);
 }
 
 namespace traits {
 
-template <typename val_t, typename col_t, typename idx_t>
-struct is_scalable< spmv<val_t, col_t, idx_t> > : std::true_type {};
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+struct is_scalable< spmv<val_t, col_t, idx_t, mat_t> > : std::true_type {};
+
+} // namespace traits
+
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+struct transposed_spmat {
+    const SpMat<val_t, col_t, idx_t, mat_t> &A;
+    transpose_method method;
+
+    transposed_spmat(const SpMat<val_t, col_t, idx_t, mat_t> &A, transpose_method method)
+        : A(A), method(method) {}
+};
+
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+struct transposed_spmv
+    : vector_expression< boost::proto::terminal< additive_vector_transform >::type >
+{
+    typedef val_t                      value_type;
+    typedef SpMat<val_t, col_t, idx_t, mat_t> mat;
+    typedef vector<val_t>              vec;
+
+    const mat &A;
+    const vec &x;
+    transpose_method method;
+
+    typename cl_scalar_of<val_t>::type scale;
+
+    transposed_spmv(const transposed_spmat<val_t, col_t, idx_t, mat_t> &At, const vec &x)
+        : A(At.A), x(x), method(At.method), scale(1) {}
+
+    template<bool negate, bool append>
+    void apply(vec &y) const {
+        A.mul_transposed(x, y, negate ? -scale : scale, append, method);
+    }
+};
+
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+transposed_spmv< val_t, col_t, idx_t, mat_t > operator*(
+        const transposed_spmat<val_t, col_t, idx_t, mat_t> &At, const vector<val_t> &x)
+{
+    return transposed_spmv<val_t, col_t, idx_t, mat_t>(At, x);
+}
+
+namespace traits {
+
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+struct is_scalable< transposed_spmv<val_t, col_t, idx_t, mat_t> > : std::true_type {};
 
 } // namespace traits
 
 #ifdef VEXCL_MULTIVECTOR_HPP
 
-template <typename val_t, typename col_t, typename idx_t, class MV>
+template <typename val_t, typename col_t, typename idx_t, typename mat_t, class MV>
 struct multispmv
     : multivector_expression<
         boost::proto::terminal< additive_multivector_transform >::type
         >
 {
     typedef val_t                      value_type;
-    typedef SpMat<val_t, col_t, idx_t> mat;
+    typedef SpMat<val_t, col_t, idx_t, mat_t> mat;
 
     const mat &A;
     const MV  &x;
@@ -458,25 +1088,34 @@ struct multispmv
         void
     >::type
     apply(W &y) const {
-        for(size_t i = 0; i < traits::number_of_components<MV>::value; i++)
-            A.mul(x(i), y(i), negate ? -scale : scale, append);
+        const size_t N = traits::number_of_components<MV>::value;
+
+        std::vector<const vector<val_t>*> xp(N);
+        std::vector<vector<val_t>*>       yp(N);
+
+        for(size_t i = 0; i < N; i++) {
+            xp[i] = &x(i);
+            yp[i] = &y(i);
+        }
+
+        A.mul(xp, yp, negate ? -scale : scale, append);
     }
 };
 
-template <typename val_t, typename col_t, typename idx_t, class MV>
+template <typename val_t, typename col_t, typename idx_t, typename mat_t, class MV>
 typename std::enable_if<
     std::is_base_of<multivector_terminal_expression, MV>::value &&
     std::is_same<val_t, typename MV::sub_value_type>::value,
-    multispmv< val_t, col_t, idx_t, MV >
+    multispmv< val_t, col_t, idx_t, mat_t, MV >
 >::type
-operator*(const SpMat<val_t, col_t, idx_t> &A, const MV &x) {
-    return multispmv< val_t, col_t, idx_t, MV >(A, x);
+operator*(const SpMat<val_t, col_t, idx_t, mat_t> &A, const MV &x) {
+    return multispmv< val_t, col_t, idx_t, mat_t, MV >(A, x);
 }
 
 namespace traits {
 
-template <typename val_t, typename col_t, typename idx_t, class MV>
-struct is_scalable< multispmv<val_t, col_t, idx_t, MV> > : std::true_type {};
+template <typename val_t, typename col_t, typename idx_t, typename mat_t, class MV>
+struct is_scalable< multispmv<val_t, col_t, idx_t, mat_t, MV> > : std::true_type {};
 
 } // namespace traits
 
@@ -484,6 +1123,24 @@ struct is_scalable< multispmv<val_t, col_t, idx_t, MV> > : std::true_type {};
 
 /// \endcond
 
+/// Transposed sparse matrix.
+/**
+ * Allows to use transposed matrix-vector products in additive vector
+ * expressions without explicit transposition of the matrix:
+ * \code
+ * y = vex::transp(A) * x;
+ * z = b - vex::transp(A, vex::transpose_atomic) * x;
+ * \endcode
+ * See SpMat::mul_transposed() for the description of the methods.
+ */
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+transposed_spmat<val_t, col_t, idx_t, mat_t> transp(
+        const SpMat<val_t, col_t, idx_t, mat_t> &A,
+        transpose_method method = transpose_cached)
+{
+    return transposed_spmat<val_t, col_t, idx_t, mat_t>(A, method);
+}
+
 /// Weights device wrt to spmv performance.
 /**
  * Launches the following kernel on each device:
@@ -573,6 +1230,11 @@ inline double device_spmv_perf(const cl::CommandQueue &q) {
 } // namespace vex
 
 #include <vexcl/spmat/ccsr.hpp>
+#include <vexcl/spmat/dia.hpp>
+#include <vexcl/spmat/powers.hpp>
+#include <vexcl/spmat/bsr.hpp>
+#include <vexcl/spmat/partition.hpp>
+#include <vexcl/spmat/reorder.hpp>
 #include <vexcl/spmat/inline_spmv.hpp>
 
 #endif
@@ -0,0 +1,286 @@
+#ifndef VEXCL_SPMAT_ASSEMBLE_INL
+#define VEXCL_SPMAT_ASSEMBLE_INL
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+/**
+ * \file   vexcl/spmat/assemble.inl
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Assembly of a sparse matrix from triplets on the compute device.
+ */
+
+// Triplets are sorted by (row, col) key. Each unique key becomes a nonzero
+// of the matrix; its value is the sum over the segment of equal keys. The
+// sorting permutation and segment starts are kept, so that reassembly with
+// the same pattern only needs the segmented sum.
+
+// Permutation of the triplets into (row, col) order.
+vector<size_t> asm_perm;
+
+// Start of each nonzero segment in asm_perm (nnz + 1 elements).
+vector<size_t> asm_head;
+
+static std::string assemble_source(const cl::Device &device) {
+    std::ostringstream source;
+
+    source << standard_kernel_header(device) <<
+        "typedef " << type_name<val_t>()  << " val_t;\n"
+        "typedef " << type_name<mat_t>()  << " mat_t;\n"
+        "typedef " << type_name<col_t>()  << " col_t;\n"
+        "typedef " << type_name<idx_t>()  << " idx_t;\n"
+        "typedef " << type_name<size_t>() << " sz_t;\n"
+        "kernel void assemble_keys(\n"
+        "    sz_t n,\n"
+        "    ulong m,\n"
+        "    global const col_t * row,\n"
+        "    global const col_t * col,\n"
+        "    global ulong * key,\n"
+        "    global sz_t * perm\n"
+        "    )\n"
+        "{\n"
+        "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+        "        key[i]  = (ulong)row[i] * m + col[i];\n"
+        "        perm[i] = i;\n"
+        "    }\n"
+        "}\n"
+        "kernel void assemble_heads(\n"
+        "    sz_t n,\n"
+        "    global const ulong * key,\n"
+        "    global sz_t * flag\n"
+        "    )\n"
+        "{\n"
+        "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0))\n"
+        "        flag[i] = (i == 0 || key[i] != key[i - 1]);\n"
+        "}\n"
+        "kernel void assemble_pattern(\n"
+        "    sz_t n,\n"
+        "    ulong m,\n"
+        "    global const ulong * key,\n"
+        "    global const sz_t * flag,\n"
+        "    global const sz_t * pos,\n"
+        "    global sz_t * head,\n"
+        "    global col_t * col\n"
+        "    )\n"
+        "{\n"
+        "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+        "        if (flag[i]) {\n"
+        "            head[pos[i]] = i;\n"
+        "            col [pos[i]] = key[i] % m;\n"
+        "        }\n"
+        "    }\n"
+        "}\n"
+        "kernel void assemble_rows(\n"
+        "    sz_t n,\n"
+        "    sz_t nt,\n"
+        "    sz_t nnz,\n"
+        "    ulong m,\n"
+        "    global const ulong * key,\n"
+        "    global const sz_t * pos,\n"
+        "    global idx_t * ptr\n"
+        "    )\n"
+        "{\n"
+        "    for(size_t r = get_global_id(0); r <= n; r += get_global_size(0)) {\n"
+        "        ulong k = r * m;\n"
+        "        size_t lo = 0, hi = nt;\n"
+        "        while(lo < hi) {\n"
+        "            size_t mid = (lo + hi) / 2;\n"
+        "            if (key[mid] < k) lo = mid + 1; else hi = mid;\n"
+        "        }\n"
+        "        ptr[r] = lo < nt ? pos[lo] : nnz;\n"
+        "    }\n"
+        "}\n"
+        "kernel void assemble_values(\n"
+        "    sz_t nnz,\n"
+        "    global const sz_t * head,\n"
+        "    global const sz_t * perm,\n"
+        "    global const val_t * v,\n"
+        "    global mat_t * val\n"
+        "    )\n"
+        "{\n"
+        "    for(size_t i = get_global_id(0); i < nnz; i += get_global_size(0)) {\n"
+        "        val_t sum = 0;\n"
+        "        for(size_t j = head[i], e = head[i + 1]; j < e; ++j)\n"
+        "            sum += v[perm[j]];\n"
+        "        val[i] = sum;\n"
+        "    }\n"
+        "}\n";
+
+    return source.str();
+}
+
+enum assemble_stage {
+    assemble_keys, assemble_heads, assemble_pattern, assemble_rows, assemble_values
+};
+
+// Kernels of all stages are built at once for each context.
+static const detail::kernel_cache_entry& assemble_kernel(
+        const cl::CommandQueue &queue, assemble_stage stage)
+{
+    static detail::kernel_cache cache[5];
+
+    static const char *name[] = {
+        "assemble_keys", "assemble_heads", "assemble_pattern",
+        "assemble_rows", "assemble_values"
+    };
+
+    return detail::program_kernel(queue, cache, name, 5, stage, assemble_source);
+}
+
+// Sorts the triplets, finds the pattern of the matrix, and makes it the
+// local part of this matrix.
+void assemble(const vector<col_t> &row, const vector<col_t> &col, const vector<val_t> &val) {
+    const size_t    nt = val.size();
+    const cl_ulong  m  = ncols;
+
+    cl::Context context = qctx(queue[0]);
+
+    if (!nt) {
+        if (nrows) mtx[0].reset(new SpMatCSR(queue[0],
+                    std::vector<idx_t>(nrows + 1, 0), cl::Buffer(), cl::Buffer()));
+        return;
+    }
+
+    // Sort the triplets by (row, col) keys. Small matrices need fewer
+    // passes of radix sort.
+    vector<cl_ulong> key(queue, nt);
+    asm_perm.resize(queue, nt);
+
+    {
+        const detail::kernel_cache_entry &k = assemble_kernel(queue[0], assemble_keys);
+        cl::Kernel krn = k.kernel;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, nt);
+        krn.setArg(pos++, m);
+        krn.setArg(pos++, row(0));
+        krn.setArg(pos++, col(0));
+        krn.setArg(pos++, key(0));
+        krn.setArg(pos++, asm_perm(0));
+
+        launch_kernel(queue[0], k);
+
+        if (static_cast<double>(nrows) * ncols <= 4294967296.0)
+            sort_by_key<32>(key, asm_perm);
+        else
+            sort_by_key(key, asm_perm);
+    }
+
+    // Number each unique key.
+    vector<size_t> flag(queue, nt);
+    vector<size_t> upos(queue, nt);
+
+    {
+        const detail::kernel_cache_entry &k = assemble_kernel(queue[0], assemble_heads);
+        cl::Kernel krn = k.kernel;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, nt);
+        krn.setArg(pos++, key(0));
+        krn.setArg(pos++, flag(0));
+
+        launch_kernel(queue[0], k);
+
+        exclusive_scan(flag, upos);
+
+        nnz = static_cast<size_t>(upos[nt - 1]) + static_cast<size_t>(flag[nt - 1]);
+    }
+
+    nnz_part[1] = nnz;
+
+    // Segment starts and columns of the nonzeros.
+    asm_head.resize(queue, nnz + 1);
+    asm_head[nnz] = nt;
+
+    cl::Buffer dcol(context, CL_MEM_READ_WRITE, nnz * sizeof(col_t));
+    cl::Buffer dval(context, CL_MEM_READ_WRITE, nnz * sizeof(mat_t));
+
+    {
+        const detail::kernel_cache_entry &k = assemble_kernel(queue[0], assemble_pattern);
+        cl::Kernel krn = k.kernel;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, nt);
+        krn.setArg(pos++, m);
+        krn.setArg(pos++, key(0));
+        krn.setArg(pos++, flag(0));
+        krn.setArg(pos++, upos(0));
+        krn.setArg(pos++, asm_head(0));
+        krn.setArg(pos++, dcol);
+
+        launch_kernel(queue[0], k);
+    }
+
+    // Row index.
+    std::vector<idx_t> ptr(nrows + 1);
+
+    {
+        cl::Buffer dptr(context, CL_MEM_READ_WRITE, bytes(ptr));
+
+        const detail::kernel_cache_entry &k = assemble_kernel(queue[0], assemble_rows);
+        cl::Kernel krn = k.kernel;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, nrows);
+        krn.setArg(pos++, nt);
+        krn.setArg(pos++, nnz);
+        krn.setArg(pos++, m);
+        krn.setArg(pos++, key(0));
+        krn.setArg(pos++, upos(0));
+        krn.setArg(pos++, dptr);
+
+        launch_kernel(queue[0], k);
+
+        queue[0].enqueueReadBuffer(dptr, CL_TRUE, 0, bytes(ptr), ptr.data());
+    }
+
+    SpMatCSR *A = new SpMatCSR(queue[0], ptr, dcol, dval);
+    mtx[0].reset(A);
+    fmt[0] = A->loc.kernel;
+
+    sum_triplets(val);
+}
+
+// Sums values of the triplets into the nonzeros.
+void sum_triplets(const vector<val_t> &val) {
+    const SpMatCSR *A = static_cast<const SpMatCSR*>(mtx[0].get());
+
+    if (!A || !A->loc.nnz) return;
+
+    const detail::kernel_cache_entry &k = assemble_kernel(queue[0], assemble_values);
+    cl::Kernel krn = k.kernel;
+
+    unsigned pos = 0;
+    krn.setArg(pos++, nnz);
+    krn.setArg(pos++, asm_head(0));
+    krn.setArg(pos++, asm_perm(0));
+    krn.setArg(pos++, val(0));
+    krn.setArg(pos++, A->loc.val);
+
+    launch_kernel(queue[0], k);
+}
+
+#endif
@@ -0,0 +1,616 @@
+#ifndef VEXCL_SPMAT_BSR_HPP
+#define VEXCL_SPMAT_BSR_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/**
+ * \file   vexcl/spmat/bsr.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Sparse matrix in block CSR format.
+ */
+
+#include <vector>
+#include <set>
+#include <map>
+#include <unordered_map>
+#include <sstream>
+#include <memory>
+#include <type_traits>
+
+#include <vexcl/vector.hpp>
+#include <vexcl/spmat/exchange.hpp>
+
+namespace vex {
+
+/// Sparse matrix in block CSR (BSR) format.
+/**
+ * The matrix consists of dense B x B blocks, and each block is stored with a
+ * single column number. Input matrix is in block CSR format: row and col
+ * arrays describe the block structure of the matrix, and val array holds
+ * B * B values of each block in row-major order.
+ *
+ * Block rows are split across compute devices, ghost values are exchanged
+ * the same way as for vex::SpMat. The matrix may be multiplied by
+ * - vex::vector<val_t> of size B * m (block i occupies elements
+ *   [B * i, B * i + B) of the vector),
+ * - vex::vector of OpenCL vector type with B components (e.g. cl_double4
+ *   for SpMatBSR<double, 4>),
+ * - vex::multivector<val_t, B>.
+ *
+ * \code
+ * vex::SpMatBSR<double, 4> A(ctx, nb, nb, row.data(), col.data(), val.data());
+ *
+ * vex::vector<double> x(ctx, A.point_col_partition());
+ * vex::vector<double> y(ctx, A.point_row_partition());
+ * y = A * x;
+ *
+ * vex::vector<cl_double4> u(ctx, nb), v(ctx, nb);
+ * v = A * u;
+ * \endcode
+ */
+template <typename val_t, unsigned B, typename col_t = size_t, typename idx_t = size_t>
+class SpMatBSR {
+    static_assert(B > 0, "Block size should be positive");
+
+    public:
+        typedef val_t value_type;
+
+        /// Empty constructor.
+        SpMatBSR() : nrows(0), ncols(0), nnz(0) {}
+
+        /// Constructor.
+        /**
+         * Constructs GPU representation of the matrix. Block rows of the
+         * matrix are split equally across all compute devices.
+         * \param queue vector of queues. Each queue represents one
+         *            compute device.
+         * \param n   number of block rows in the matrix.
+         * \param m   number of block columns in the matrix.
+         * \param row row index into col vector.
+         * \param col block column numbers of nonzero blocks.
+         * \param val values of nonzero blocks (B * B values per block).
+         */
+        SpMatBSR(const std::vector<cl::CommandQueue> &queue,
+              size_t n, size_t m, const idx_t *row, const col_t *col, const val_t *val
+              )
+            : queue(queue), part(partition(n, queue)), col_part(partition(m, queue)),
+              mtx(queue.size()), xchg(queue), nrows(n), ncols(m), nnz(row[n])
+        {
+            init(row, col, val);
+        }
+
+        /// Constructor with explicit partitioning.
+        /**
+         * Same as above, but block rows of the matrix are split across
+         * devices according to row_part. Block columns are split according
+         * to col_part, which defaults to row_part for square matrices.
+         */
+        SpMatBSR(const std::vector<cl::CommandQueue> &queue,
+              size_t n, size_t m, const idx_t *row, const col_t *col, const val_t *val,
+              const partitioning &row_part,
+              const partitioning &col_part = partitioning()
+              )
+            : queue(queue), part(row_part.part),
+              col_part(col_part.part.empty() ?
+                      (n == m ? row_part.part : partition(m, queue)) :
+                      col_part.part),
+              mtx(queue.size()), xchg(queue), nrows(n), ncols(m), nnz(row[n])
+        {
+            precondition(
+                    part.size() == queue.size() + 1 && part.back() == n &&
+                    this->col_part.size() == queue.size() + 1 &&
+                    this->col_part.back() == m,
+                    "Partitioning does not match the matrix"
+                    );
+
+            init(row, col, val);
+        }
+
+        /// Partitioning of block rows.
+        partitioning row_partition() const { return partitioning(part); }
+
+        /// Partitioning of block columns.
+        partitioning col_partition() const { return partitioning(col_part); }
+
+        /// Partitioning of output vectors of scalar type.
+        partitioning point_row_partition() const { return partitioning(points(part)); }
+
+        /// Partitioning of input vectors of scalar type.
+        partitioning point_col_partition() const { return partitioning(points(col_part)); }
+
+        /// Matrix-vector multiplication.
+        /**
+         * x and y are vectors of scalar type. Each block occupies B
+         * consecutive elements, so the vectors should be partitioned
+         * accordingly (see point_col_partition() and point_row_partition()).
+         * \param x      input vector.
+         * \param y      output vector.
+         * \param alpha  coefficient in front of matrix-vector product
+         * \param append if set, matrix-vector product is appended to y.
+         *               Otherwise, y is replaced with matrix-vector product.
+         */
+        void mul(const vex::vector<val_t> &x, vex::vector<val_t> &y,
+                 val_t alpha = 1, bool append = false) const
+        {
+            precondition(
+                    x.partition() == points(col_part) && y.partition() == points(part),
+                    "Vector partitioning does not match the matrix");
+
+            detail::spmm_arg arg(B, B);
+            mul_blocks(buffers(x), arg, buffers(y), arg, alpha, append);
+        }
+
+        /// Matrix-vector multiplication.
+        /**
+         * x and y are vectors of OpenCL vector type with B components, one
+         * element per block.
+         */
+        template <typename V>
+        typename std::enable_if<
+            !std::is_same<V, val_t>::value &&
+            std::is_same<typename cl_scalar_of<V>::type, val_t>::value &&
+            cl_vector_length<V>::value == B,
+            void
+        >::type
+        mul(const vex::vector<V> &x, vex::vector<V> &y,
+                 val_t alpha = 1, bool append = false) const
+        {
+            precondition(x.partition() == col_part && y.partition() == part,
+                    "Vector partitioning does not match the matrix");
+
+            detail::spmm_arg arg(B, sizeof(V) / sizeof(val_t));
+            mul_blocks(buffers(x), arg, buffers(y), arg, alpha, append);
+        }
+
+        /// Matrix-vector multiplication.
+        /**
+         * Components of x and y are stored in B separate vectors, one
+         * element per block.
+         */
+        void mul(const std::vector<const vex::vector<val_t>*> &x,
+                 const std::vector<vex::vector<val_t>*> &y,
+                 val_t alpha = 1, bool append = false) const
+        {
+            precondition(x.size() == B && y.size() == B,
+                    "Number of components should be equal to the block size");
+
+            std::vector< std::vector<cl::Buffer> > xbuf(queue.size()), ybuf(queue.size());
+
+            for(unsigned k = 0; k < B; k++) {
+                precondition(
+                        x[k]->partition() == col_part && y[k]->partition() == part,
+                        "Vector partitioning does not match the matrix");
+
+                for(unsigned d = 0; d < queue.size(); d++) {
+                    xbuf[d].push_back((*x[k])(d));
+                    ybuf[d].push_back((*y[k])(d));
+                }
+            }
+
+            mul_blocks(xbuf, detail::spmm_arg(B, 0), ybuf, detail::spmm_arg(B, 0), alpha, append);
+        }
+
+        /// Number of rows.
+        size_t rows() const { return B * nrows; }
+        /// Number of columns.
+        size_t cols() const { return B * ncols; }
+        /// Number of non-zero entries.
+        size_t nonzeros() const { return B * B * nnz; }
+
+        /// Number of block rows.
+        size_t block_rows() const { return nrows; }
+        /// Number of block columns.
+        size_t block_cols() const { return ncols; }
+        /// Number of non-zero blocks.
+        size_t block_nonzeros() const { return nnz; }
+    private:
+        // Strip of block rows owned by a single device. Blocks with local
+        // columns and blocks with ghost columns are stored separately.
+        struct block_matrix {
+            cl::CommandQueue queue;
+            size_t n;
+
+            struct matrix_part {
+                size_t nnz;
+                cl::Buffer row;
+                cl::Buffer col;
+                cl::Buffer val;
+            } loc, rem;
+
+            block_matrix(
+                    const cl::CommandQueue &queue,
+                    const idx_t *row, const col_t *col, const val_t *val,
+                    size_t row_begin, size_t row_end, size_t col_begin, size_t col_end,
+                    const std::set<col_t> &ghost_cols
+                    )
+                : queue(queue), n(row_end - row_begin)
+            {
+                auto is_local = [col_begin, col_end](size_t c) {
+                    return c >= col_begin && c < col_end;
+                };
+
+                std::vector<idx_t> lrow, rrow;
+                std::vector<col_t> lcol, rcol;
+                std::vector<val_t> lval, rval;
+
+                lrow.reserve(n + 1);
+                lrow.push_back(0);
+
+                lcol.reserve(row[row_end] - row[row_begin]);
+                lval.reserve(B * B * (row[row_end] - row[row_begin]));
+
+                if (!ghost_cols.empty()) {
+                    rrow.reserve(n + 1);
+                    rrow.push_back(0);
+                }
+
+                // Renumber columns.
+                std::unordered_map<col_t, col_t> r2l(2 * ghost_cols.size());
+                size_t nghost = 0;
+                for(auto c = ghost_cols.begin(); c != ghost_cols.end(); ++c)
+                    r2l[*c] = static_cast<col_t>(nghost++);
+
+                for(size_t i = row_begin; i < row_end; ++i) {
+                    for(idx_t j = row[i]; j < row[i + 1]; j++) {
+                        const val_t *v = val + B * B * j;
+
+                        if (is_local(col[j])) {
+                            lcol.push_back(static_cast<col_t>(col[j] - col_begin));
+                            lval.insert(lval.end(), v, v + B * B);
+                        } else {
+                            assert(r2l.count(col[j]));
+                            rcol.push_back(r2l[col[j]]);
+                            rval.insert(rval.end(), v, v + B * B);
+                        }
+                    }
+
+                    lrow.push_back(static_cast<idx_t>(lcol.size()));
+                    if (!ghost_cols.empty())
+                        rrow.push_back(static_cast<idx_t>(rcol.size()));
+                }
+
+                copy(loc, lrow, lcol, lval);
+                copy(rem, rrow, rcol, rval);
+            }
+
+            void copy(matrix_part &part, const std::vector<idx_t> &row,
+                    const std::vector<col_t> &col, const std::vector<val_t> &val)
+            {
+                cl::Context ctx = qctx(queue);
+
+                part.nnz = col.size();
+
+                if (!part.nnz) return;
+
+                part.row = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(row), const_cast<idx_t*>(row.data()));
+                part.col = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(col), const_cast<col_t*>(col.data()));
+                part.val = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(val), const_cast<val_t*>(val.data()));
+            }
+
+            // One work-item per block row. Product of a block with a
+            // vector is unrolled, so that x values are loaded once per
+            // block, and B partial sums are kept in registers.
+            template <class OP>
+            void mul(
+                    const matrix_part &part,
+                    const std::vector<cl::Buffer> &in,  const detail::spmm_arg &ia,
+                    const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+                    val_t scale,
+                    const std::vector<cl::Event> &wait_for_it = std::vector<cl::Event>(),
+                    cl::Event *done = 0
+                    ) const
+            {
+                using namespace detail;
+
+                static std::map<std::pair<unsigned, unsigned>, kernel_cache> caches;
+
+                kernel_cache &cache = caches[std::make_pair(ia.key(), oa.key())];
+
+                cl::Context context = qctx(queue);
+                cl::Device  device  = qdev(queue);
+
+                auto kernel = cache.find(context());
+
+                if (kernel == cache.end()) {
+                    std::ostringstream source;
+
+                    source << standard_kernel_header(device) <<
+                        "typedef " << type_name<val_t>() << " val_t;\n"
+                        "typedef " << type_name<col_t>() << " col_t;\n"
+                        "kernel void bsr_spmv(\n"
+                        "    " << type_name<size_t>() << " n,\n"
+                        "    val_t scale,\n"
+                        "    global const " << type_name<idx_t>() << " * row,\n"
+                        "    global const col_t * col,\n"
+                        "    global const val_t * val"
+                        << ia.params("in", "val_t", true)
+                        << oa.params("out", "val_t", false) << "\n"
+                        "    )\n"
+                        "{\n"
+                        "    for (size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n";
+                    for(unsigned r = 0; r < B; ++r)
+                        source <<
+                        "        val_t sum" << r << " = 0;\n";
+                    source <<
+                        "        for(size_t j = row[i], e = row[i + 1]; j < e; ++j) {\n"
+                        "            col_t c = col[j];\n"
+                        "            global const val_t * v = val + j * " << B * B << ";\n";
+                    for(unsigned k = 0; k < B; ++k)
+                        source <<
+                        "            val_t x" << k << " = " << ia("in", k, "c") << ";\n";
+                    for(unsigned r = 0; r < B; ++r) {
+                        source <<
+                        "            sum" << r << " +=";
+                        for(unsigned k = 0; k < B; ++k)
+                            source << (k ? " + " : " ") << "v[" << r * B + k << "] * x" << k;
+                        source << ";\n";
+                    }
+                    source <<
+                        "        }\n";
+                    for(unsigned r = 0; r < B; ++r)
+                        source <<
+                        "        " << oa("out", r, "i") << " " << OP::string() << " scale * sum" << r << ";\n";
+                    source <<
+                        "    }\n"
+                        "}\n";
+
+                    auto program = build_sources(context, source.str());
+
+                    cl::Kernel krn(program, "bsr_spmv");
+                    size_t     wgs = kernel_workgroup_size(krn, device);
+
+                    kernel = cache.insert(std::make_pair(
+                                context(), kernel_cache_entry(krn, wgs)
+                                )).first;
+                }
+
+                cl::Kernel krn    = kernel->second.kernel;
+                size_t     wgsize = kernel->second.wgsize;
+                size_t     g_size = num_workgroups(device) * wgsize;
+
+                unsigned pos = 0;
+                krn.setArg(pos++, n);
+                krn.setArg(pos++, scale);
+                krn.setArg(pos++, part.row);
+                krn.setArg(pos++, part.col);
+                krn.setArg(pos++, part.val);
+                ia.set_args(krn, pos, in);
+                oa.set_args(krn, pos, out);
+
+                queue.enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize,
+                        wait_for_it.empty() ? NULL : &wait_for_it, done);
+            }
+
+            void mul_local(
+                    const std::vector<cl::Buffer> &in,  const detail::spmm_arg &ia,
+                    const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+                    val_t scale, bool append) const
+            {
+                if (append) {
+                    if (loc.nnz) mul<assign::ADD>(loc, in, ia, out, oa, scale);
+                } else {
+                    if (loc.nnz)
+                        mul<assign::SET>(loc, in, ia, out, oa, scale);
+                    else
+                        for(auto y = out.begin(); y != out.end(); ++y)
+                            vector<val_t>(queue, *y) = 0;
+                }
+            }
+
+            void mul_remote(
+                    const cl::Buffer &in, const detail::spmm_arg &ia,
+                    const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+                    val_t scale, const std::vector<cl::Event> &wait_for_it,
+                    cl::Event *done) const
+            {
+                if (rem.nnz)
+                    mul<assign::ADD>(rem, std::vector<cl::Buffer>(1, in), ia,
+                            out, oa, scale, wait_for_it, done);
+                else if (done)
+                    *done = cl::Event();
+            }
+        };
+
+        const std::vector<cl::CommandQueue> queue;
+        const std::vector<size_t>           part;
+        const std::vector<size_t>           col_part;
+
+        std::vector< std::unique_ptr<block_matrix> > mtx;
+
+        detail::ghost_exchange<val_t, col_t> xchg;
+
+        size_t nrows;
+        size_t ncols;
+        size_t nnz;
+
+        template <typename T>
+        static inline size_t bytes(const std::vector<T> &v) {
+            return v.size() * sizeof(T);
+        }
+
+        static std::vector<size_t> points(const std::vector<size_t> &p) {
+            std::vector<size_t> s(p);
+            for(auto i = s.begin(); i != s.end(); ++i) *i *= B;
+            return s;
+        }
+
+        template <typename T>
+        std::vector< std::vector<cl::Buffer> > buffers(const vex::vector<T> &x) const {
+            std::vector< std::vector<cl::Buffer> > buf(queue.size());
+            for(unsigned d = 0; d < queue.size(); d++)
+                buf[d].push_back(x(d));
+            return buf;
+        }
+
+        void init(const idx_t *row, const col_t *col, const val_t *val) {
+            std::vector<std::set<col_t>> ghost_cols = xchg.setup(part, col_part, row, col);
+
+            // Each device get it's own strip of the matrix.
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(static,1)
+#endif
+            for(int d = 0; d < static_cast<int>(queue.size()); d++) {
+                if (part[d + 1] > part[d])
+                    mtx[d].reset(
+                            new block_matrix(queue[d], row, col, val,
+                                part[d], part[d+1], col_part[d], col_part[d+1],
+                                ghost_cols[d])
+                            );
+            }
+        }
+
+        // Ghost exchange carries B values per block column.
+        void mul_blocks(
+                const std::vector< std::vector<cl::Buffer> > &x, const detail::spmm_arg &xa,
+                const std::vector< std::vector<cl::Buffer> > &y, const detail::spmm_arg &ya,
+                val_t alpha, bool append
+                ) const
+        {
+            if (xchg.active()) xchg.start(x, xa);
+
+            for(unsigned d = 0; d < queue.size(); d++)
+                if (mtx[d]) mtx[d]->mul_local(x[d], xa, y[d], ya, alpha, append);
+
+            if (xchg.active()) {
+                for(unsigned d = 0; d < queue.size(); d++) {
+                    if (!xchg.ghosts(d)) continue;
+
+                    xchg.finish(d, B);
+
+                    mtx[d]->mul_remote(xchg.values(d), detail::spmm_arg(B, B),
+                            y[d], ya, alpha, xchg.received(d), xchg.remote_done(d));
+                }
+            }
+        }
+};
+
+/// \cond INTERNAL
+
+template <typename val_t, unsigned B, typename col_t, typename idx_t, typename V>
+struct bsr_spmv
+    : vector_expression< boost::proto::terminal< additive_vector_transform >::type >
+{
+    // Type of the scaling factor; the vector itself may be interleaved.
+    typedef val_t                             value_type;
+    typedef SpMatBSR<val_t, B, col_t, idx_t>  mat;
+    typedef vector<V>                         vec;
+
+    const mat &A;
+    const vec &x;
+
+    val_t scale;
+
+    bsr_spmv(const mat &A, const vec &x) : A(A), x(x), scale(1) {}
+
+    template<bool negate, bool append>
+    void apply(vec &y) const {
+        A.mul(x, y, negate ? -scale : scale, append);
+    }
+};
+
+template <typename val_t, unsigned B, typename col_t, typename idx_t, typename V>
+typename std::enable_if<
+    std::is_same<V, val_t>::value || (
+        std::is_same<typename cl_scalar_of<V>::type, val_t>::value &&
+        cl_vector_length<V>::value == B
+        ),
+    bsr_spmv<val_t, B, col_t, idx_t, V>
+>::type
+operator*(const SpMatBSR<val_t, B, col_t, idx_t> &A, const vector<V> &x)
+{
+    return bsr_spmv<val_t, B, col_t, idx_t, V>(A, x);
+}
+
+namespace traits {
+
+template <typename val_t, unsigned B, typename col_t, typename idx_t, typename V>
+struct is_scalable< bsr_spmv<val_t, B, col_t, idx_t, V> > : std::true_type {};
+
+} // namespace traits
+
+#ifdef VEXCL_MULTIVECTOR_HPP
+
+template <typename val_t, unsigned B, typename col_t, typename idx_t, class MV>
+struct multi_bsr_spmv
+    : multivector_expression<
+        boost::proto::terminal< additive_multivector_transform >::type
+        >
+{
+    typedef val_t                             value_type;
+    typedef SpMatBSR<val_t, B, col_t, idx_t>  mat;
+
+    const mat &A;
+    const MV  &x;
+
+    val_t scale;
+
+    multi_bsr_spmv(const mat &A, const MV &x) : A(A), x(x), scale(1) {}
+
+    template <bool negate, bool append, class W>
+    typename std::enable_if<
+        std::is_base_of<multivector_terminal_expression, W>::value
+        && std::is_same<val_t, typename W::sub_value_type>::value
+        && traits::number_of_components<W>::value == B,
+        void
+    >::type
+    apply(W &y) const {
+        std::vector<const vector<val_t>*> xp(B);
+        std::vector<vector<val_t>*>       yp(B);
+
+        for(unsigned i = 0; i < B; i++) {
+            xp[i] = &x(i);
+            yp[i] = &y(i);
+        }
+
+        A.mul(xp, yp, negate ? -scale : scale, append);
+    }
+};
+
+template <typename val_t, unsigned B, typename col_t, typename idx_t, class MV>
+typename std::enable_if<
+    std::is_base_of<multivector_terminal_expression, MV>::value &&
+    std::is_same<val_t, typename MV::sub_value_type>::value &&
+    traits::number_of_components<MV>::value == B,
+    multi_bsr_spmv< val_t, B, col_t, idx_t, MV >
+>::type
+operator*(const SpMatBSR<val_t, B, col_t, idx_t> &A, const MV &x) {
+    return multi_bsr_spmv< val_t, B, col_t, idx_t, MV >(A, x);
+}
+
+namespace traits {
+
+template <typename val_t, unsigned B, typename col_t, typename idx_t, class MV>
+struct is_scalable< multi_bsr_spmv<val_t, B, col_t, idx_t, MV> > : std::true_type {};
+
+} // namespace traits
+
+#endif
+
+/// \endcond
+
+} // namespace vex
+
+#endif
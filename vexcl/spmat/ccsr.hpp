@@ -47,9 +47,12 @@ namespace vex {
  *     y[i] = sum;
  * }
  * \endcode
- * This format does not support multi-device computation, so it accepts single
- * queue at initialization. Vectors x and y should also be single-queued and
- * reside on the same device with matrix.
+ * The matrix is split by rows across the compute devices in the same way as
+ * vex::vector of size n. Each device holds its part of idx array and a copy
+ * of the (small) table of unique rows. Since the columns are relative to the
+ * diagonal, the rows of a device only reference elements of x that are at
+ * most lhalo positions before and rhalo positions after its own part. These
+ * halos are fetched from the neighbour devices before each product.
  */
 template <typename val_t, typename col_t = ptrdiff_t, typename idx_t = size_t>
 struct SpMatCCSR {
@@ -70,19 +73,87 @@ struct SpMatCCSR {
     SpMatCCSR(const cl::CommandQueue &queue, size_t n, size_t m,
             const idx_t *idx, const idx_t *row, const col_t *col, const val_t *val
             )
-        : queue(queue), n(n),
-          idx(qctx(queue), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(idx_t) * n,      const_cast<idx_t*>(idx)),
-          row(qctx(queue), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(idx_t) * (m+1),  const_cast<idx_t*>(row)),
-          col(qctx(queue), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(col_t) * row[m], const_cast<col_t*>(col)),
-          val(qctx(queue), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(val_t) * row[m], const_cast<val_t*>(val))
-    { }
-
-    cl::CommandQueue queue;
+        : queue(1, queue), n(n)
+    {
+        init(m, idx, row, col, val);
+    }
+
+    /// Constructor for CCSR format.
+    /**
+     * Constructs GPU representation of the CCSR matrix. The rows of the
+     * matrix are split across the given queues.
+     * \param queue vector of queues.
+     * \param n     number of rows in the matrix.
+     * \param m     number of unique rows in the matrix.
+     * \param idx   index into row vector.
+     * \param row   row index into col and val vectors.
+     * \param col   column positions of nonzero elements wrt to diagonal.
+     * \param val   values of nonzero elements of the matrix.
+     */
+    SpMatCCSR(const std::vector<cl::CommandQueue> &queue, size_t n, size_t m,
+            const idx_t *idx, const idx_t *row, const col_t *col, const val_t *val
+            )
+        : queue(queue), n(n)
+    {
+        init(m, idx, row, col, val);
+    }
+
+    std::vector<cl::CommandQueue> queue;
+    std::vector<size_t> part;
     size_t n;
-    cl::Buffer idx;
-    cl::Buffer row;
-    cl::Buffer col;
-    cl::Buffer val;
+
+    // Maximum distances from the diagonal to the left and to the right.
+    cl_long lhalo;
+    cl_long rhalo;
+
+    std::vector<cl::Buffer> idx;
+    std::vector<cl::Buffer> row;
+    std::vector<cl::Buffer> col;
+    std::vector<cl::Buffer> val;
+
+    /// \cond INTERNAL
+    detail::band_halo halo;
+    /// \endcond
+
+    private:
+        void init(size_t m,
+                const idx_t *idx_host, const idx_t *row_host,
+                const col_t *col_host, const val_t *val_host)
+        {
+            part = partition(n, queue);
+
+            idx.resize(queue.size());
+            row.resize(queue.size());
+            col.resize(queue.size());
+            val.resize(queue.size());
+
+            const size_t nnz = row_host[m];
+
+            lhalo = 0;
+            rhalo = 0;
+            for(size_t j = 0; j < nnz; ++j) {
+                lhalo = std::max<cl_long>(lhalo, -static_cast<cl_long>(col_host[j]));
+                rhalo = std::max<cl_long>(rhalo,  static_cast<cl_long>(col_host[j]));
+            }
+
+            halo = detail::band_halo(queue, part, lhalo, rhalo);
+
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                size_t np = part[d + 1] - part[d];
+                if (!np) continue;
+
+                cl::Context context = qctx(queue[d]);
+
+                idx[d] = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        sizeof(idx_t) * np, const_cast<idx_t*>(idx_host + part[d]));
+                row[d] = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        sizeof(idx_t) * (m + 1), const_cast<idx_t*>(row_host));
+                col[d] = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        sizeof(col_t) * nnz, const_cast<col_t*>(col_host));
+                val[d] = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        sizeof(val_t) * nnz, const_cast<val_t*>(val_host));
+            }
+        }
 };
 
 /// \cond INTERNAL
@@ -190,10 +261,18 @@ struct terminal_preamble< ccsr_product<val_t, col_t, idx_t, T> > {
           "\tglobal " << type_name<col_t>() << " * col,\n"
           "\tglobal " << type_name<val_t>() << " * val,\n"
           "\tglobal " << type_name<T>()     << " * vec,\n"
+          "\tglobal " << type_name<T>()     << " * halo,\n"
+          "\t" << type_name<size_t>() << " n,\n"
+          "\tlong lhalo,\n"
           "\t" << type_name<size_t>() << " i\n\t)\n{\n"
           "\t" << type_name<res_t>() << " sum = 0;\n"
-          "\tfor(size_t pos = idx[i], j = row[pos], end = row[pos+1]; j < end; ++j)\n"
-          "\t\tsum += val[j] * vec[i + col[j]];\n"
+          "\tfor(size_t pos = idx[i], j = row[pos], end = row[pos+1]; j < end; ++j) {\n"
+          "\t\tlong c = (long)i + col[j];\n"
+          "\t\tif (c >= 0 && c < (long)n)\n"
+          "\t\t\tsum += val[j] * vec[c];\n"
+          "\t\telse\n"
+          "\t\t\tsum += val[j] * halo[lhalo + (c < 0 ? c : c - (long)n)];\n"
+          "\t}\n"
           "\treturn sum;\n"
           "}\n";
         return s.str();
@@ -211,7 +290,10 @@ struct kernel_param_declaration< ccsr_product<val_t, col_t, idx_t, T> > {
           << ",\n\tglobal " << type_name<idx_t>() << " * " << prm_name << "_row"
           << ",\n\tglobal " << type_name<col_t>() << " * " << prm_name << "_col"
           << ",\n\tglobal " << type_name<val_t>() << " * " << prm_name << "_val"
-          << ",\n\tglobal " << type_name<T>()     << " * " << prm_name << "_vec";
+          << ",\n\tglobal " << type_name<T>()     << " * " << prm_name << "_vec"
+          << ",\n\tglobal " << type_name<T>()     << " * " << prm_name << "_halo"
+          << ",\n\t" << type_name<size_t>() << " " << prm_name << "_n"
+          << ",\n\tlong " << prm_name << "_lhalo";
 
         return s.str();
     }
@@ -229,7 +311,10 @@ struct partial_vector_expr< ccsr_product<val_t, col_t, idx_t, T> > {
           << prm_name << "_row, "
           << prm_name << "_col, "
           << prm_name << "_val, "
-          << prm_name << "_vec, idx)";
+          << prm_name << "_vec, "
+          << prm_name << "_halo, "
+          << prm_name << "_n, "
+          << prm_name << "_lhalo, idx)";
 
         return s.str();
     }
@@ -241,13 +326,20 @@ struct kernel_arg_setter< ccsr_product<val_t, col_t, idx_t, T> > {
             cl::Kernel &kernel, unsigned device, size_t/*index_offset*/,
             unsigned &position, detail::kernel_generator_state_ptr)
     {
-        assert(device == 0);
-
-        kernel.setArg(position++, term.A.idx);
-        kernel.setArg(position++, term.A.row);
-        kernel.setArg(position++, term.A.col);
-        kernel.setArg(position++, term.A.val);
+        kernel.setArg(position++, term.A.idx[device]);
+        kernel.setArg(position++, term.A.row[device]);
+        kernel.setArg(position++, term.A.col[device]);
+        kernel.setArg(position++, term.A.val[device]);
         kernel.setArg(position++, term.x(device));
+
+        cl::Buffer halo = term.A.halo.get(term.x, device, position);
+        if (halo())
+            kernel.setArg(position++, halo);
+        else
+            kernel.setArg(position++, static_cast<void*>(0));
+
+        kernel.setArg(position++, term.x.part_size(device));
+        kernel.setArg(position++, term.A.lhalo);
     }
 };
 
@@ -259,12 +351,12 @@ struct expression_properties< ccsr_product<val_t, col_t, idx_t, T> > {
             size_t &size
             )
     {
+        precondition(term.x.partition() == term.A.part,
+                "Vector partitioning does not match CCSR matrix");
+
         queue_list = term.x.queue_list();
         partition  = term.x.partition();
         size       = term.x.size();
-
-        assert(partition.size() == 2);
-        partition.back() = size;
     }
 };
 
@@ -35,18 +35,25 @@ struct SpMatCSR : public sparse_matrix {
     const cl::CommandQueue &queue;
     size_t n;
 
+    // Maximum number of nonzeros in a multi-row block of csr_adaptive kernel.
+    size_t block_nnz;
+
     struct matrix_part {
         size_t nnz;
+        spmat_format kernel;
+        size_t vw;      // Work-items per row in csr_vector kernel.
+        size_t nblocks; // Number of row blocks in csr_adaptive kernel.
         cl::Buffer row;
         cl::Buffer col;
         cl::Buffer val;
+        cl::Buffer block;
     } loc, rem;
 
     SpMatCSR(
             const cl::CommandQueue &queue,
             const idx_t *row, const col_t *col, const val_t *val,
             size_t row_begin, size_t row_end, size_t col_begin, size_t col_end,
-            std::set<col_t> ghost_cols
+            std::set<col_t> ghost_cols, spmat_format format = spmat_auto
             )
         : queue(queue), n(row_end - row_begin)
     {
@@ -56,6 +63,8 @@ struct SpMatCSR : public sparse_matrix {
 
         cl::Context ctx = qctx(queue);
 
+        block_nnz = max_block_nnz(qdev(queue));
+
         if (ghost_cols.empty()) {
             loc.nnz = row[row_end] - row[row_begin];
             rem.nnz = 0;
@@ -63,18 +72,24 @@ struct SpMatCSR : public sparse_matrix {
             if (loc.nnz) {
                 loc.row = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(idx_t) * (n + 1), const_cast<idx_t*>(row + row_begin));
                 loc.col = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(col_t) * loc.nnz, const_cast<col_t*>(col + row[row_begin]));
-                loc.val = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(val_t) * loc.nnz, const_cast<val_t*>(val + row[row_begin]));
+                loc.val = this->value_buffer(ctx, val + row[row_begin], loc.nnz);
+
+                if (row[row_begin]) vector<idx_t>(queue, loc.row) -= row[row_begin];
+
+                setup_kernel(loc, row + row_begin, format);
 
-                if (row_begin > 0) vector<idx_t>(queue, loc.row) -= row_begin;
+                // Values are stored in the input order.
+                this->map_values(queue, std::vector<cl::Buffer>(1, loc.val),
+                        std::vector<size_t>(1, loc.nnz), std::vector<idx_t>());
             }
         } else {
             std::vector<idx_t> lrow;
             std::vector<col_t> lcol;
-            std::vector<val_t> lval;
+            std::vector<mat_t> lval;
 
             std::vector<idx_t> rrow;
             std::vector<col_t> rcol;
-            std::vector<val_t> rval;
+            std::vector<mat_t> rval;
 
             lrow.reserve(n + 1);
             lrow.push_back(0);
@@ -100,11 +115,11 @@ struct SpMatCSR : public sparse_matrix {
                 for(idx_t j = row[i]; j < row[i + 1]; j++) {
                     if (is_local(col[j])) {
                         lcol.push_back(static_cast<col_t>(col[j] - col_begin));
-                        lval.push_back(val[j]);
+                        lval.push_back(static_cast<mat_t>(val[j]));
                     } else {
                         assert(r2l.count(col[j]));
                         rcol.push_back(r2l[col[j]]);
-                        rval.push_back(val[j]);
+                        rval.push_back(static_cast<mat_t>(val[j]));
                     }
                 }
 
@@ -114,12 +129,14 @@ struct SpMatCSR : public sparse_matrix {
 
 
             // Copy local part to the device.
-            if (lrow.back()) {
-                loc.nnz = lrow.back();
+            loc.nnz = lrow.back();
 
+            if (loc.nnz) {
                 loc.row = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(lrow), lrow.data());
                 loc.col = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(lcol), lcol.data());
-                loc.val = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(lval), lval.data());
+                loc.val = cl::Buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes(lval), lval.data());
+
+                setup_kernel(loc, lrow.data(), format);
             }
 
             // Copy remote part to the device.
@@ -128,8 +145,99 @@ struct SpMatCSR : public sparse_matrix {
 
                 rem.row = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(rrow), rrow.data());
                 rem.col = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(rcol), rcol.data());
-                rem.val = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(rval), rval.data());
+                rem.val = cl::Buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes(rval), rval.data());
+
+                setup_kernel(rem, rrow.data(), format);
             }
+
+            // Local values go first, remote ones follow.
+            std::vector<idx_t> perm;
+            perm.reserve(row[row_end] - row[row_begin]);
+
+            for(idx_t j = row[row_begin], l = 0, r = 0; j < row[row_end]; ++j)
+                perm.push_back(is_local(col[j]) ? l++ : static_cast<idx_t>(loc.nnz + r++));
+
+            std::vector<cl::Buffer> buf;
+            std::vector<size_t>     size;
+
+            buf.push_back(loc.val); size.push_back(loc.nnz);
+            buf.push_back(rem.val); size.push_back(rem.nnz);
+
+            this->map_values(queue, buf, size, perm);
+        }
+    }
+
+    // Matrix that already resides on the device (see transposed.inl and
+    // spgemm.inl). Host copy of the row index is needed for the choice of
+    // kernel.
+    SpMatCSR(
+            const cl::CommandQueue &queue, const std::vector<idx_t> &row,
+            const cl::Buffer &col, const cl::Buffer &val
+            )
+        : queue(queue), n(row.size() - 1)
+    {
+        block_nnz = max_block_nnz(qdev(queue));
+
+        loc.nnz = row.back();
+        rem.nnz = 0;
+
+        if (loc.nnz) {
+            loc.row = cl::Buffer(qctx(queue), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                    bytes(row), const_cast<idx_t*>(row.data()));
+            loc.col = col;
+            loc.val = val;
+
+            setup_kernel(loc, row.data(), spmat_auto);
+
+            this->map_values(queue, std::vector<cl::Buffer>(1, loc.val),
+                    std::vector<size_t>(1, loc.nnz), std::vector<idx_t>());
+        }
+    }
+
+    // Half of local memory is left for the kernel itself.
+    static size_t max_block_nnz(const cl::Device &device) {
+        return std::min<size_t>(1024,
+                static_cast<size_t>(device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>())
+                / (2 * sizeof(val_t)));
+    }
+
+    // Selects SpMV kernel for the matrix part (unless it is set by user),
+    // and prepares the data the kernel needs.
+    void setup_kernel(matrix_part &part, const idx_t *row, spmat_format format) {
+        detail::row_stats stats(row, 0, n);
+
+        part.kernel = format;
+        if (part.kernel != spmat_csr_scalar &&
+            part.kernel != spmat_csr_vector &&
+            part.kernel != spmat_csr_adaptive
+           )
+            part.kernel = detail::choose_csr_kernel(qdev(queue), stats);
+
+        part.vw = 2;
+        while(part.vw < 32 && part.vw < stats.mean) part.vw *= 2;
+
+        part.nblocks = 0;
+
+        if (part.kernel == spmat_csr_adaptive) {
+            // Rows are packed into blocks with at most block_nnz nonzeros.
+            // Rows longer than that get a block of their own.
+            std::vector<size_t> block;
+            block.reserve(n / 8 + 2);
+            block.push_back(0);
+
+            for(size_t i = 0; i < n; ) {
+                size_t first = i++;
+
+                if (static_cast<size_t>(row[i] - row[first]) <= block_nnz)
+                    while(i < n && static_cast<size_t>(row[i + 1] - row[first]) <= block_nnz)
+                        ++i;
+
+                block.push_back(i);
+            }
+
+            part.nblocks = block.size() - 1;
+            part.block = cl::Buffer(qctx(queue), CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                    bytes(block), block.data());
         }
     }
 
@@ -137,7 +245,28 @@ struct SpMatCSR : public sparse_matrix {
     void mul(
             const matrix_part &part,
             const cl::Buffer &in, const cl::Buffer &out, scalar_type scale,
-            const std::vector<cl::Event> &wait_for_it = std::vector<cl::Event>()
+            const std::vector<cl::Event> &wait_for_it = std::vector<cl::Event>(),
+            cl::Event *done = 0
+            ) const
+    {
+        switch(part.kernel) {
+            case spmat_csr_vector:
+                mul_vector<OP>(part, in, out, scale, wait_for_it, done);
+                break;
+            case spmat_csr_adaptive:
+                mul_adaptive<OP>(part, in, out, scale, wait_for_it, done);
+                break;
+            default:
+                mul_scalar<OP>(part, in, out, scale, wait_for_it, done);
+        }
+    }
+
+    // One work-item per row.
+    template <class OP>
+    void mul_scalar(
+            const matrix_part &part,
+            const cl::Buffer &in, const cl::Buffer &out, scalar_type scale,
+            const std::vector<cl::Event> &wait_for_it, cl::Event *done
             ) const
     {
         using namespace detail;
@@ -158,7 +287,7 @@ struct SpMatCSR : public sparse_matrix {
                 "    " << type_name<scalar_type>() << " scale,\n"
                 "    global const " << type_name<idx_t>() << " * row,\n"
                 "    global const " << type_name<col_t>() << " * col,\n"
-                "    global const " << type_name<val_t>() << " * val,\n"
+                "    global const " << type_name<mat_t>() << " * val,\n"
                 "    global const " << type_name<val_t>() << " * in,\n"
                 "    global       " << type_name<val_t>() << " * out\n"
                 "    )\n"
@@ -195,7 +324,288 @@ struct SpMatCSR : public sparse_matrix {
         krn.setArg(pos++, out);
 
         queue.enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize,
-                wait_for_it.empty() ? NULL : &wait_for_it);
+                wait_for_it.empty() ? NULL : &wait_for_it, done);
+    }
+
+    // A group of vw work-items per row, partial sums are reduced in local
+    // memory.
+    template <class OP>
+    void mul_vector(
+            const matrix_part &part,
+            const cl::Buffer &in, const cl::Buffer &out, scalar_type scale,
+            const std::vector<cl::Event> &wait_for_it, cl::Event *done
+            ) const
+    {
+        using namespace detail;
+
+        static kernel_cache cache;
+
+        cl::Context context = qctx(queue);
+        cl::Device  device  = qdev(queue);
+
+        auto kernel = cache.find(context());
+
+        if (kernel == cache.end()) {
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "kernel void csr_vector_spmv(\n"
+                "    " << type_name<size_t>() << " n,\n"
+                "    " << type_name<size_t>() << " vw,\n"
+                "    " << type_name<scalar_type>() << " scale,\n"
+                "    global const " << type_name<idx_t>() << " * row,\n"
+                "    global const " << type_name<col_t>() << " * col,\n"
+                "    global const " << type_name<mat_t>() << " * val,\n"
+                "    global const " << type_name<val_t>() << " * in,\n"
+                "    global       " << type_name<val_t>() << " * out,\n"
+                "    local        " << type_name<val_t>() << " * buf\n"
+                "    )\n"
+                "{\n"
+                "    size_t lid  = get_local_id(0);\n"
+                "    size_t lane = lid & (vw - 1);\n"
+                "    size_t rpg  = get_local_size(0) / vw;\n"
+                "    for(size_t base = get_group_id(0) * rpg; base < n; base += get_num_groups(0) * rpg) {\n"
+                "        size_t i = base + lid / vw;\n"
+                "        " << type_name<val_t>() << " sum = 0;\n"
+                "        if (i < n) {\n"
+                "            for(size_t j = row[i] + lane, e = row[i + 1]; j < e; j += vw)\n"
+                "                sum += val[j] * in[col[j]];\n"
+                "        }\n"
+                "        buf[lid] = sum;\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        for(size_t s = vw / 2; s > 0; s >>= 1) {\n"
+                "            if (lane < s) buf[lid] += buf[lid + s];\n"
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "        }\n"
+                "        if (lane == 0 && i < n) out[i] " << OP::string() << " scale * buf[lid];\n"
+                "    }\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel krn(program, "csr_vector_spmv");
+            size_t     wgs = kernel_workgroup_size(krn, device);
+
+            size_t smem = static_cast<size_t>(device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>())
+                        - static_cast<size_t>(krn.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device));
+            while(wgs * sizeof(val_t) > smem)
+                wgs /= 2;
+
+            kernel = cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(krn, wgs)
+                        )).first;
+        }
+
+        cl::Kernel krn    = kernel->second.kernel;
+        size_t     wgsize = std::max(kernel->second.wgsize, part.vw);
+        size_t     g_size = num_workgroups(device) * wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, n);
+        krn.setArg(pos++, part.vw);
+        krn.setArg(pos++, scale);
+        krn.setArg(pos++, part.row);
+        krn.setArg(pos++, part.col);
+        krn.setArg(pos++, part.val);
+        krn.setArg(pos++, in);
+        krn.setArg(pos++, out);
+        krn.setArg(pos++, vex::Local(wgsize * sizeof(val_t)));
+
+        queue.enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize,
+                wait_for_it.empty() ? NULL : &wait_for_it, done);
+    }
+
+    // CSR-adaptive: a work-group per block of rows. Blocks of short rows are
+    // streamed into local memory and reduced there row by row; a single long
+    // row is reduced by the whole work-group.
+    template <class OP>
+    void mul_adaptive(
+            const matrix_part &part,
+            const cl::Buffer &in, const cl::Buffer &out, scalar_type scale,
+            const std::vector<cl::Event> &wait_for_it, cl::Event *done
+            ) const
+    {
+        using namespace detail;
+
+        static kernel_cache cache;
+
+        cl::Context context = qctx(queue);
+        cl::Device  device  = qdev(queue);
+
+        auto kernel = cache.find(context());
+
+        if (kernel == cache.end()) {
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<val_t>() << " val_t;\n"
+                "typedef " << type_name<mat_t>() << " mat_t;\n"
+                "kernel void csr_adaptive_spmv(\n"
+                "    " << type_name<size_t>() << " nblocks,\n"
+                "    " << type_name<scalar_type>() << " scale,\n"
+                "    global const " << type_name<size_t>() << " * block,\n"
+                "    global const " << type_name<idx_t>() << " * row,\n"
+                "    global const " << type_name<col_t>() << " * col,\n"
+                "    global const mat_t * val,\n"
+                "    global const val_t * in,\n"
+                "    global       val_t * out,\n"
+                "    local        val_t * buf\n"
+                "    )\n"
+                "{\n"
+                "    size_t lid = get_local_id(0);\n"
+                "    size_t wgs = get_local_size(0);\n"
+                "    for(size_t b = get_group_id(0); b < nblocks; b += get_num_groups(0)) {\n"
+                "        size_t row_beg = block[b];\n"
+                "        size_t row_end = block[b + 1];\n"
+                "        size_t nz_beg  = row[row_beg];\n"
+                "        size_t nz_end  = row[row_end];\n"
+                "        if (row_end - row_beg > 1) {\n"
+                "            for(size_t j = nz_beg + lid; j < nz_end; j += wgs)\n"
+                "                buf[j - nz_beg] = val[j] * in[col[j]];\n"
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "            for(size_t i = row_beg + lid; i < row_end; i += wgs) {\n"
+                "                val_t sum = 0;\n"
+                "                for(size_t j = row[i], e = row[i + 1]; j < e; ++j)\n"
+                "                    sum += buf[j - nz_beg];\n"
+                "                out[i] " << OP::string() << " scale * sum;\n"
+                "            }\n"
+                "        } else {\n"
+                "            val_t sum = 0;\n"
+                "            for(size_t j = nz_beg + lid; j < nz_end; j += wgs)\n"
+                "                sum += val[j] * in[col[j]];\n"
+                "            buf[lid] = sum;\n"
+                "            barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "            for(size_t s = wgs / 2; s > 0; s >>= 1) {\n"
+                "                if (lid < s) buf[lid] += buf[lid + s];\n"
+                "                barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "            }\n"
+                "            if (lid == 0) out[row_beg] " << OP::string() << " scale * buf[0];\n"
+                "        }\n"
+                "        barrier(CLK_LOCAL_MEM_FENCE);\n"
+                "    }\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel krn(program, "csr_adaptive_spmv");
+            size_t     wgs = kernel_workgroup_size(krn, device);
+
+            size_t smem = static_cast<size_t>(device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>())
+                        - static_cast<size_t>(krn.getWorkGroupInfo<CL_KERNEL_LOCAL_MEM_SIZE>(device));
+            while(wgs * sizeof(val_t) > smem)
+                wgs /= 2;
+
+            kernel = cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(krn, wgs)
+                        )).first;
+        }
+
+        cl::Kernel krn    = kernel->second.kernel;
+        size_t     wgsize = kernel->second.wgsize;
+        size_t     g_size = std::min(num_workgroups(device), part.nblocks) * wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, part.nblocks);
+        krn.setArg(pos++, scale);
+        krn.setArg(pos++, part.block);
+        krn.setArg(pos++, part.row);
+        krn.setArg(pos++, part.col);
+        krn.setArg(pos++, part.val);
+        krn.setArg(pos++, in);
+        krn.setArg(pos++, out);
+        krn.setArg(pos++, vex::Local(std::max(wgsize, block_nnz) * sizeof(val_t)));
+
+        queue.enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize,
+                wait_for_it.empty() ? NULL : &wait_for_it, done);
+    }
+
+    // Multivector product uses one work-item per row; the arithmetic
+    // intensity grows with the number of vectors anyway.
+    template <class OP>
+    void mul_multi(
+            const matrix_part &part,
+            const std::vector<cl::Buffer> &in,  const detail::spmm_arg &ia,
+            const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+            scalar_type scale,
+            const std::vector<cl::Event> &wait_for_it = std::vector<cl::Event>(),
+            cl::Event *done = 0
+            ) const
+    {
+        using namespace detail;
+
+        static std::map<std::pair<unsigned, unsigned>, kernel_cache> caches;
+
+        kernel_cache &cache = caches[std::make_pair(ia.key(), oa.key())];
+
+        cl::Context context = qctx(queue);
+        cl::Device  device  = qdev(queue);
+
+        auto kernel = cache.find(context());
+
+        if (kernel == cache.end()) {
+            const unsigned N = ia.N;
+
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<val_t>() << " val_t;\n"
+                "typedef " << type_name<mat_t>() << " mat_t;\n"
+                "typedef " << type_name<col_t>() << " col_t;\n"
+                "kernel void csr_spmm(\n"
+                "    " << type_name<size_t>() << " n,\n"
+                "    " << type_name<scalar_type>() << " scale,\n"
+                "    global const " << type_name<idx_t>() << " * row,\n"
+                "    global const col_t * col,\n"
+                "    global const mat_t * val"
+                << ia.params("in", "val_t", true)
+                << oa.params("out", "val_t", false) << "\n"
+                "    )\n"
+                "{\n"
+                "    for (size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n";
+            for(unsigned m = 0; m < N; ++m)
+                source <<
+                "        val_t sum" << m << " = 0;\n";
+            source <<
+                "        for(size_t j = row[i], e = row[i + 1]; j < e; ++j) {\n"
+                "            col_t c = col[j];\n"
+                "            mat_t v = val[j];\n";
+            for(unsigned m = 0; m < N; ++m)
+                source <<
+                "            sum" << m << " += v * " << ia("in", m, "c") << ";\n";
+            source <<
+                "        }\n";
+            for(unsigned m = 0; m < N; ++m)
+                source <<
+                "        " << oa("out", m, "i") << " " << OP::string() << " scale * sum" << m << ";\n";
+            source <<
+                "    }\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel krn(program, "csr_spmm");
+            size_t     wgs = kernel_workgroup_size(krn, device);
+
+            kernel = cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(krn, wgs)
+                        )).first;
+        }
+
+        cl::Kernel krn    = kernel->second.kernel;
+        size_t     wgsize = kernel->second.wgsize;
+        size_t     g_size = num_workgroups(device) * wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, n);
+        krn.setArg(pos++, scale);
+        krn.setArg(pos++, part.row);
+        krn.setArg(pos++, part.col);
+        krn.setArg(pos++, part.val);
+        ia.set_args(krn, pos, in);
+        oa.set_args(krn, pos, out);
+
+        queue.enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize,
+                wait_for_it.empty() ? NULL : &wait_for_it, done);
     }
 
     void mul_local(const cl::Buffer &in, const cl::Buffer &out,
@@ -212,59 +622,64 @@ struct SpMatCSR : public sparse_matrix {
     }
 
     void mul_remote(const cl::Buffer &in, const cl::Buffer &out, scalar_type scale,
-            const std::vector<cl::Event> &wait_for_it) const
+            const std::vector<cl::Event> &wait_for_it, cl::Event *done) const
     {
-        if (rem.nnz) mul<assign::ADD>(rem, in, out, scale, wait_for_it);
-    }
-
-    static std::string inline_preamble(const std::string &prm_name) {
-        std::ostringstream s;
-
-        s << type_name<val_t>() <<
-          " csr_spmv_" << prm_name << "(\n"
-          "    global const " << type_name<idx_t>() << " * row,\n"
-          "    global const " << type_name<col_t>() << " * col,\n"
-          "    global const " << type_name<val_t>() << " * val,\n"
-          "    global const " << type_name<val_t>() << " * in,\n"
-          "    " << type_name<size_t>() << " i\n"
-          "    )\n"
-          "{\n"
-          "    " << type_name<val_t>() << " sum = 0;\n"
-          "    for(size_t j = row[i], e = row[i + 1]; j < e; ++j)\n"
-          "        sum += val[j] * in[col[j]];\n"
-          "    return sum;\n"
-          "}\n";
-
-        return s.str();
+        if (rem.nnz)
+            mul<assign::ADD>(rem, in, out, scale, wait_for_it, done);
+        else if (done)
+            *done = cl::Event();
     }
 
-    static std::string inline_expression(const std::string &prm_name) {
-        std::ostringstream s;
-        s << "csr_spmv_" << prm_name << "("
-          << prm_name << "_row, "
-          << prm_name << "_col, "
-          << prm_name << "_val, "
-          << prm_name << "_vec, idx)";
-
-        return s.str();
+    void mul_local_multi(
+            const std::vector<cl::Buffer> &in,  const detail::spmm_arg &ia,
+            const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+            scalar_type scale, bool append) const
+    {
+        if (append) {
+            if (loc.nnz) mul_multi<assign::ADD>(loc, in, ia, out, oa, scale);
+        } else {
+            if (loc.nnz)
+                mul_multi<assign::SET>(loc, in, ia, out, oa, scale);
+            else
+                for(auto y = out.begin(); y != out.end(); ++y)
+                    vector<val_t>(queue, *y) = 0;
+        }
     }
 
-    static std::string inline_parameters(const std::string &prm_name) {
-        std::ostringstream s;
-        s <<
-          ",\n\tglobal const " << type_name<idx_t>() << " * " << prm_name << "_row"
-          ",\n\tglobal const " << type_name<col_t>() << " * " << prm_name << "_col"
-          ",\n\tglobal const " << type_name<val_t>() << " * " << prm_name << "_val"
-          ",\n\tglobal const " << type_name<val_t>() << " * " << prm_name << "_vec";
-
-        return s.str();
+    void mul_remote_multi(
+            const cl::Buffer &in, const detail::spmm_arg &ia,
+            const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+            scalar_type scale, const std::vector<cl::Event> &wait_for_it,
+            cl::Event *done) const
+    {
+        if (rem.nnz)
+            mul_multi<assign::ADD>(rem, std::vector<cl::Buffer>(1, in), ia,
+                    out, oa, scale, wait_for_it, done);
+        else if (done)
+            *done = cl::Event();
     }
 
-    void setArgs(cl::Kernel &krn, unsigned device, unsigned &pos, const vector<val_t> &x) const {
-        krn.setArg(pos++, loc.row);
-        krn.setArg(pos++, loc.col);
-        krn.setArg(pos++, loc.val);
-        krn.setArg(pos++, x(device));
+    // Inline SpMV and transposed product use hybrid ELL code (see
+    // SpMatHELL::inline_preamble()); CSR matrix is passed as hybrid ELL
+    // matrix with empty ELL parts.
+    void hell_args(cl::Kernel &krn, unsigned &pos, bool remote) const {
+        const matrix_part &part = remote ? rem : loc;
+
+        krn.setArg(pos++, size_t(0));
+        krn.setArg(pos++, size_t(0));
+        krn.setArg(pos++, static_cast<void*>(0));
+        krn.setArg(pos++, static_cast<void*>(0));
+        krn.setArg(pos++, static_cast<void*>(0));
+        krn.setArg(pos++, static_cast<void*>(0));
+        if (part.nnz) {
+            krn.setArg(pos++, part.row);
+            krn.setArg(pos++, part.col);
+            krn.setArg(pos++, part.val);
+        } else {
+            krn.setArg(pos++, static_cast<void*>(0));
+            krn.setArg(pos++, static_cast<void*>(0));
+            krn.setArg(pos++, static_cast<void*>(0));
+        }
     }
 };
 
@@ -0,0 +1,343 @@
+#ifndef VEXCL_SPMAT_DIA_HPP
+#define VEXCL_SPMAT_DIA_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/spmat/dia.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Sparse matrix in DIA (diagonal) format.
+ */
+
+#include <vector>
+#include <algorithm>
+#include <sstream>
+#include <type_traits>
+
+#include <vexcl/vector.hpp>
+#include <vexcl/spmat/exchange.hpp>
+
+namespace vex {
+
+/// Sparse matrix in DIA format.
+/**
+ * Banded matrix stored as a set of dense diagonals. Diagonal k holds
+ * elements A(i, i + offset[k]), so that matrix-vector multiplication may be
+ * performed as follows:
+ * \code
+ * for(unsigned i = 0; i < n; i++) {
+ *     val_t sum = 0;
+ *     for(unsigned k = 0; k < ndiag; k++)
+ *         sum += diag[k * n + i] * x[i + offset[k]];
+ *     y[i] = sum;
+ * }
+ * \endcode
+ * No column indices are stored, and consecutive work-items read consecutive
+ * elements of both the diagonals and the input vector. Elements of the
+ * diagonals that fall outside of the matrix are zero.
+ *
+ * The matrix is split by rows across the compute devices in the same way as
+ * vex::vector of size n. Rows of a device reference input elements at most
+ * band width positions away from its own part, and these halos are fetched
+ * from the neighbour devices before each product.
+ */
+template <typename val_t, typename col_t = ptrdiff_t>
+struct SpMatDIA {
+    static_assert(std::is_signed<col_t>::value,
+            "Offset type for DIA format has to be signed.");
+
+    /// Constructor from a set of diagonals.
+    /**
+     * \param queue  vector of queues.
+     * \param n      number of rows (and columns) in the matrix.
+     * \param ndiag  number of diagonals.
+     * \param offset offsets of the diagonals wrt to the main diagonal.
+     * \param diag   values of the diagonals (ndiag * n elements, diagonal
+     *               k occupies elements [k * n, (k + 1) * n)).
+     */
+    SpMatDIA(const std::vector<cl::CommandQueue> &queue, size_t n,
+            size_t ndiag, const col_t *offset, const val_t *diag)
+        : queue(queue), n(n)
+    {
+        init(std::vector<col_t>(offset, offset + ndiag), diag);
+    }
+
+    /// Constructor from a matrix in CSR format.
+    /**
+     * Each distinct distance of nonzero elements to the main diagonal
+     * becomes a dense diagonal. Hence, the format only pays off for banded
+     * matrices with few diagonals.
+     * \param queue vector of queues.
+     * \param n     number of rows (and columns) in the matrix.
+     * \param row   row index into col and val vectors.
+     * \param col   column numbers of nonzero elements of the matrix.
+     * \param val   values of nonzero elements of the matrix.
+     */
+    template <typename idx_t, typename cidx_t>
+    SpMatDIA(const std::vector<cl::CommandQueue> &queue, size_t n,
+            const idx_t *row, const cidx_t *col, const val_t *val)
+        : queue(queue), n(n)
+    {
+        std::vector<col_t> offset;
+
+        for(size_t i = 0; i < n; ++i)
+            for(idx_t j = row[i]; j < row[i + 1]; ++j)
+                offset.push_back(static_cast<col_t>(col[j]) - static_cast<col_t>(i));
+
+        std::sort(offset.begin(), offset.end());
+        offset.erase(std::unique(offset.begin(), offset.end()), offset.end());
+
+        std::vector<val_t> diag(offset.size() * n, val_t());
+
+        for(size_t i = 0; i < n; ++i) {
+            for(idx_t j = row[i]; j < row[i + 1]; ++j) {
+                col_t o = static_cast<col_t>(col[j]) - static_cast<col_t>(i);
+                size_t k = std::lower_bound(offset.begin(), offset.end(), o) - offset.begin();
+                diag[k * n + i] += val[j];
+            }
+        }
+
+        init(offset, diag.data());
+    }
+
+    /// Number of rows (and columns).
+    size_t rows() const { return n; }
+
+    /// Number of stored diagonals.
+    size_t diagonals() const { return ndiag; }
+
+    /// \cond INTERNAL
+    std::vector<cl::CommandQueue> queue;
+    std::vector<size_t> part;
+    size_t n;
+    size_t ndiag;
+
+    std::vector<cl::Buffer> off;
+    std::vector<cl::Buffer> val;
+
+    detail::band_halo halo;
+    /// \endcond
+
+    private:
+        void init(const std::vector<col_t> &offset, const val_t *diag) {
+            part  = partition(n, queue);
+            ndiag = offset.size();
+
+            off.resize(queue.size());
+            val.resize(queue.size());
+
+            cl_long lhalo = 0;
+            cl_long rhalo = 0;
+            for(size_t k = 0; k < ndiag; ++k) {
+                lhalo = std::max<cl_long>(lhalo, -static_cast<cl_long>(offset[k]));
+                rhalo = std::max<cl_long>(rhalo,  static_cast<cl_long>(offset[k]));
+            }
+
+            halo = detail::band_halo(queue, part, lhalo, rhalo);
+
+            if (!ndiag) return;
+
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                size_t np = part[d + 1] - part[d];
+                if (!np) continue;
+
+                cl::Context context = qctx(queue[d]);
+
+                // Each device keeps its rows of every diagonal.
+                std::vector<val_t> v(ndiag * np);
+                for(size_t k = 0; k < ndiag; ++k)
+                    std::copy(diag + k * n + part[d], diag + k * n + part[d + 1],
+                            v.begin() + k * np);
+
+                off[d] = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        sizeof(col_t) * ndiag, const_cast<col_t*>(offset.data()));
+                val[d] = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        sizeof(val_t) * v.size(), v.data());
+            }
+        }
+};
+
+/// \cond INTERNAL
+struct dia_product_terminal {};
+
+typedef vector_expression<
+    typename boost::proto::terminal< dia_product_terminal >::type
+    > dia_product_terminal_expression;
+
+template <typename val_t, typename col_t, typename T>
+struct dia_product : public dia_product_terminal_expression
+{
+    typedef val_t value_type;
+    typedef SpMatDIA<val_t, col_t> matrix;
+
+    const matrix    &A;
+    const vector<T> &x;
+
+    dia_product(const matrix &A, const vector<T> &x) : A(A), x(x) {}
+};
+
+template <typename val_t, typename col_t, typename T>
+dia_product<val_t, col_t, T> operator*(
+        const SpMatDIA<val_t, col_t> &A,
+        const vector<T> &x)
+{
+    return dia_product<val_t, col_t, T>(A, x);
+}
+
+// Allow dia_product to participate in vector expressions:
+namespace traits {
+
+template <>
+struct is_vector_expr_terminal< dia_product_terminal > : std::true_type {};
+
+template <>
+struct proto_terminal_is_value< dia_product_terminal > : std::true_type {};
+
+template <typename val_t, typename col_t, typename T>
+struct terminal_preamble< dia_product<val_t, col_t, T> > {
+    static std::string get(const dia_product<val_t, col_t, T>&,
+            const cl::Device&, const std::string &prm_name,
+            detail::kernel_generator_state_ptr)
+    {
+        std::ostringstream s;
+
+        typedef decltype(val_t() * T()) res_t;
+
+        s << type_name<res_t>() <<
+          " dia_spmv_" << prm_name << "(\n"
+          "\t" << type_name<size_t>() << " ndiag,\n"
+          "\tglobal " << type_name<col_t>() << " * off,\n"
+          "\tglobal " << type_name<val_t>() << " * val,\n"
+          "\tglobal " << type_name<T>()     << " * vec,\n"
+          "\tglobal " << type_name<T>()     << " * halo,\n"
+          "\t" << type_name<size_t>() << " n,\n"
+          "\tlong lhalo,\n"
+          "\t" << type_name<size_t>() << " i\n\t)\n{\n"
+          "\t" << type_name<res_t>() << " sum = 0;\n"
+          "\tfor(size_t k = 0; k < ndiag; ++k, val += n) {\n"
+          "\t\tlong c = (long)i + off[k];\n"
+          "\t\tif (c >= 0 && c < (long)n)\n"
+          "\t\t\tsum += val[i] * vec[c];\n"
+          "\t\telse if (halo)\n"
+          "\t\t\tsum += val[i] * halo[lhalo + (c < 0 ? c : c - (long)n)];\n"
+          "\t}\n"
+          "\treturn sum;\n"
+          "}\n";
+        return s.str();
+    }
+};
+
+template <typename val_t, typename col_t, typename T>
+struct kernel_param_declaration< dia_product<val_t, col_t, T> > {
+    static std::string get(const dia_product<val_t, col_t, T>&,
+            const cl::Device&, const std::string &prm_name,
+            detail::kernel_generator_state_ptr)
+    {
+        std::ostringstream s;
+        s << ",\n\t" << type_name<size_t>() << " " << prm_name << "_ndiag"
+          << ",\n\tglobal " << type_name<col_t>() << " * " << prm_name << "_off"
+          << ",\n\tglobal " << type_name<val_t>() << " * " << prm_name << "_val"
+          << ",\n\tglobal " << type_name<T>()     << " * " << prm_name << "_vec"
+          << ",\n\tglobal " << type_name<T>()     << " * " << prm_name << "_halo"
+          << ",\n\t" << type_name<size_t>() << " " << prm_name << "_n"
+          << ",\n\tlong " << prm_name << "_lhalo";
+
+        return s.str();
+    }
+};
+
+template <typename val_t, typename col_t, typename T>
+struct partial_vector_expr< dia_product<val_t, col_t, T> > {
+    static std::string get(const dia_product<val_t, col_t, T>&,
+            const cl::Device&, const std::string &prm_name,
+            detail::kernel_generator_state_ptr)
+    {
+        std::ostringstream s;
+        s << "dia_spmv_" << prm_name << "("
+          << prm_name << "_ndiag, "
+          << prm_name << "_off, "
+          << prm_name << "_val, "
+          << prm_name << "_vec, "
+          << prm_name << "_halo, "
+          << prm_name << "_n, "
+          << prm_name << "_lhalo, idx)";
+
+        return s.str();
+    }
+};
+
+template <typename val_t, typename col_t, typename T>
+struct kernel_arg_setter< dia_product<val_t, col_t, T> > {
+    static void set(const dia_product<val_t, col_t, T> &term,
+            cl::Kernel &kernel, unsigned device, size_t/*index_offset*/,
+            unsigned &position, detail::kernel_generator_state_ptr)
+    {
+        kernel.setArg(position++, term.A.ndiag);
+
+        if (term.A.ndiag) {
+            kernel.setArg(position++, term.A.off[device]);
+            kernel.setArg(position++, term.A.val[device]);
+        } else {
+            kernel.setArg(position++, static_cast<void*>(0));
+            kernel.setArg(position++, static_cast<void*>(0));
+        }
+
+        kernel.setArg(position++, term.x(device));
+
+        cl::Buffer halo = term.A.halo.get(term.x, device, position);
+        if (halo())
+            kernel.setArg(position++, halo);
+        else
+            kernel.setArg(position++, static_cast<void*>(0));
+
+        kernel.setArg(position++, term.x.part_size(device));
+        kernel.setArg(position++, term.A.halo.left());
+    }
+};
+
+template <typename val_t, typename col_t, typename T>
+struct expression_properties< dia_product<val_t, col_t, T> > {
+    static void get(const dia_product<val_t, col_t, T> &term,
+            std::vector<cl::CommandQueue> &queue_list,
+            std::vector<size_t> &partition,
+            size_t &size
+            )
+    {
+        precondition(term.x.partition() == term.A.part,
+                "Vector partitioning does not match DIA matrix");
+
+        queue_list = term.x.queue_list();
+        partition  = term.x.partition();
+        size       = term.x.size();
+    }
+};
+
+} // namespace traits
+
+/// \endcond
+
+} // namespace vex
+
+#endif
@@ -0,0 +1,679 @@
+#ifndef VEXCL_SPMAT_EXCHANGE_HPP
+#define VEXCL_SPMAT_EXCHANGE_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/**
+ * \file   vexcl/spmat/exchange.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Exchange of ghost values between compute devices.
+ */
+
+#include <vector>
+#include <set>
+#include <map>
+#include <string>
+#include <sstream>
+#include <memory>
+
+#include <vexcl/vector.hpp>
+
+namespace vex {
+namespace detail {
+
+/// \cond INTERNAL
+
+/// Multi-component vector argument of a sparse matrix product.
+/**
+ * N components are either stored in separate buffers (stride == 0), or are
+ * interleaved in a single buffer with the given stride.
+ */
+struct spmm_arg {
+    unsigned N;
+    unsigned stride;
+
+    spmm_arg(unsigned N, unsigned stride) : N(N), stride(stride) {}
+
+    unsigned buffers() const { return stride ? 1 : N; }
+
+    unsigned key() const { return N * 64 + stride; }
+
+    /// Kernel parameters holding the argument.
+    std::string params(const std::string &name, const std::string &type, bool is_const) const {
+        std::ostringstream s;
+        for(unsigned b = 0; b < buffers(); ++b)
+            s << ",\n    global " << (is_const ? "const " : "") << type << " * " << name << b;
+        return s.str();
+    }
+
+    /// Element idx of k-th component.
+    std::string operator()(const std::string &name, unsigned k, const std::string &idx) const {
+        std::ostringstream s;
+        if (stride)
+            s << name << "0[(" << idx << ") * " << stride << " + " << k << "]";
+        else
+            s << name << k << "[" << idx << "]";
+        return s.str();
+    }
+
+    void set_args(cl::Kernel &krn, unsigned &pos, const std::vector<cl::Buffer> &buf) const {
+        for(unsigned b = 0; b < buffers(); ++b) krn.setArg(pos++, buf[b]);
+    }
+};
+
+// Exchange of ghost values for a distributed sparse matrix. Each device owns
+// a strip of rows of the matrix and a range of columns (elements of the
+// input vector). Columns of the strip that belong to other devices are ghost
+// columns. Their values are gathered on the owning devices and transfered to
+// the device that needs them. A separate queue is used for the transfers, so
+// they may overlap with the local part of the product. Ghost values are
+// copied directly between devices that share OpenCL context, and through
+// pinned host memory otherwise.
+//
+// Each column may carry several values (components of a multivector, or a
+// block of a block-sparse matrix). Ghost values of device d are stored in
+// values(d) interleaved: N values per column.
+template <typename val_t, typename col_t>
+class ghost_exchange {
+    public:
+        ghost_exchange() : exchange(false), width(1), back_ready(false) {}
+
+        ghost_exchange(const std::vector<cl::CommandQueue> &queue)
+            : queue(queue), event(queue.size(), std::vector<cl::Event>(1)),
+              exc(queue.size()), exchange(false), width(1), back_ready(false)
+        {
+            // Create secondary queues.
+            for(auto q = queue.begin(); q != queue.end(); q++)
+                squeue.push_back(cl::CommandQueue(qctx(*q), qdev(*q)));
+        }
+
+        // Finds ghost columns of each device (part holds row ranges of the
+        // devices, col_part holds their column ranges) and prepares buffers
+        // for transfer of their values.
+        template <typename idx_t>
+        std::vector<std::set<col_t>> setup(
+                const std::vector<size_t> &part,
+                const std::vector<size_t> &col_part,
+                const idx_t *row, const col_t *col
+                )
+        {
+            auto is_local = [col_part](size_t c, int device) {
+                return c >= col_part[device] && c < col_part[device + 1];
+            };
+
+            std::vector<std::set<col_t>> ghost_cols(queue.size());
+
+            if (queue.size() <= 1) return ghost_cols;
+
+            // Build sets of ghost points.
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(static,1)
+#endif
+            for(int d = 0; d < static_cast<int>(queue.size()); d++) {
+                for(size_t i = part[d]; i < part[d + 1]; i++) {
+                    for(idx_t j = row[i]; j < row[i + 1]; j++) {
+                        if (!is_local(col[j], d)) {
+                            ghost_cols[d].insert(col[j]);
+                        }
+                    }
+                }
+            }
+
+            setup(col_part, ghost_cols);
+
+            return ghost_cols;
+        }
+
+        // Prepares buffers for transfer of values of the given ghost columns
+        // of each device. Ghost values of a device are received in the order
+        // of its set.
+        void setup(const std::vector<size_t> &col_part,
+                const std::vector<std::set<col_t>> &ghost_cols)
+        {
+            if (queue.size() <= 1) return;
+
+            // Ghost columns of each device are sorted, hence they are grouped
+            // by owner. Each owner sends its values to each receiver as a
+            // contiguous chunk.
+            std::vector< std::vector<col_t> > cols_to_send(queue.size());
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                exc[d].rptr.resize(queue.size() + 1, 0);
+                exc[d].sptr.resize(queue.size() + 1, 0);
+            }
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                auto c = ghost_cols[d].begin();
+
+                for(unsigned s = 0; s < queue.size(); s++) {
+                    exc[d].rptr[s + 1] = exc[d].rptr[s];
+
+                    for(; c != ghost_cols[d].end() && static_cast<size_t>(*c) < col_part[s + 1]; ++c) {
+                        cols_to_send[s].push_back(static_cast<col_t>(*c - col_part[s]));
+                        ++exc[d].rptr[s + 1];
+                    }
+
+                    exc[s].sptr[d + 1] = cols_to_send[s].size();
+                }
+            }
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                cl::Context context = qctx(queue[d]);
+
+                if (size_t nrecv = exc[d].rptr.back()) {
+                    exchange = true;
+                    exc[d].rx = cl::Buffer(context, CL_MEM_READ_WRITE, nrecv * sizeof(val_t));
+                }
+
+                if (size_t nsend = cols_to_send[d].size()) {
+                    exc[d].cols_to_send = cl::Buffer(context, CL_MEM_READ_ONLY, nsend * sizeof(col_t));
+                    exc[d].vals_to_send = cl::Buffer(context, CL_MEM_READ_WRITE, nsend * sizeof(val_t));
+
+                    queue[d].enqueueWriteBuffer(exc[d].cols_to_send, CL_TRUE, 0,
+                            nsend * sizeof(col_t), cols_to_send[d].data());
+
+                    for(unsigned r = 0; r < queue.size(); r++) {
+                        if (exc[d].sptr[r + 1] > exc[d].sptr[r] && !same_context(d, r)) {
+                            exc[d].pinned.reset(new pinned_buffer(squeue[d], nsend));
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        // True if any device needs ghost values.
+        bool active() const {
+            return exchange;
+        }
+
+        // Number of ghost columns on device d.
+        size_t ghosts(unsigned d) const {
+            return exc[d].rptr.empty() ? 0 : exc[d].rptr.back();
+        }
+
+        // Gathers ghost values (N components per column) on their owners and
+        // starts transfers between devices that share a context.
+        void start(const std::vector< std::vector<cl::Buffer> > &x,
+                const spmm_arg &xa) const
+        {
+            static std::map<unsigned, kernel_cache> caches;
+
+            kernel_cache &cache = caches[xa.key()];
+
+            const unsigned N = xa.N;
+
+            reserve(N);
+
+            // Gather values to send on each device.
+            for(unsigned d = 0; d < queue.size(); d++) {
+                cl::Context context = qctx(queue[d]);
+                cl::Device  device  = qdev(queue[d]);
+
+                auto gather = cache.find(context());
+
+                if (gather == cache.end()) {
+                    std::ostringstream source;
+
+                    source << standard_kernel_header(device) <<
+                        "typedef " << type_name<val_t>() << " val_t;\n"
+                        "kernel void gather_vals_to_send(\n"
+                        "    " << type_name<size_t>() << " n,\n"
+                        "    global const " << type_name<col_t>() << " *cols_to_send,\n"
+                        "    global val_t *vals_to_send"
+                        << xa.params("vals", "val_t", true) << "\n"
+                        "    )\n"
+                        "{\n"
+                        "    size_t i = get_global_id(0);\n"
+                        "    if (i < n) {\n"
+                        "        size_t c = cols_to_send[i];\n";
+
+                    for(unsigned k = 0; k < N; k++)
+                        source <<
+                        "        vals_to_send[i * " << N << " + " << k << "] = "
+                        << xa("vals", k, "c") << ";\n";
+
+                    source <<
+                        "    }\n"
+                        "}\n";
+
+                    auto program = build_sources(context, source.str());
+
+                    cl::Kernel krn(program, "gather_vals_to_send");
+                    size_t wgs = kernel_workgroup_size(krn, device);
+
+                    gather = cache.insert(std::make_pair(
+                                context(), kernel_cache_entry(krn, wgs)
+                                )).first;
+                }
+
+                if (size_t ncols = exc[d].sptr.back()) {
+                    size_t g_size = alignup(ncols, gather->second.wgsize);
+
+                    // Values sent during previous multiplication should
+                    // be out of the staging buffers by now.
+                    for(auto e = exc[d].staged.begin(); e != exc[d].staged.end(); ++e)
+                        e->wait();
+                    exc[d].staged.clear();
+
+                    unsigned pos = 0;
+                    gather->second.kernel.setArg(pos++, ncols);
+                    gather->second.kernel.setArg(pos++, exc[d].cols_to_send);
+                    gather->second.kernel.setArg(pos++, exc[d].vals_to_send);
+                    xa.set_args(gather->second.kernel, pos, x[d]);
+
+                    queue[d].enqueueNDRangeKernel(gather->second.kernel,
+                            cl::NullRange, g_size, gather->second.wgsize,
+                            exc[d].sent.empty() ? NULL : &exc[d].sent, &event[d][0]);
+
+                    exc[d].sent.clear();
+
+                    if (exc[d].pinned) {
+                        squeue[d].enqueueReadBuffer(exc[d].vals_to_send, CL_FALSE,
+                                0, N * ncols * sizeof(val_t), exc[d].pinned->ptr,
+                                &event[d], &exc[d].pinned_ready);
+
+                        exc[d].sent.push_back(exc[d].pinned_ready);
+                    }
+                }
+            }
+
+            // Copy ghost values between devices sharing a context.
+            for(unsigned d = 0; d < queue.size(); d++) {
+                exc[d].received.clear();
+
+                for(unsigned s = 0; s < queue.size(); s++) {
+                    size_t n = exc[d].rptr[s + 1] - exc[d].rptr[s];
+                    if (!n || !same_context(d, s)) continue;
+
+                    std::vector<cl::Event> wait(1, event[s][0]);
+                    if (exc[d].remote_done()) wait.push_back(exc[d].remote_done);
+
+                    exc[d].received.push_back(cl::Event());
+
+                    squeue[d].enqueueCopyBuffer(exc[s].vals_to_send, exc[d].rx,
+                            N * exc[s].sptr[d] * sizeof(val_t),
+                            N * exc[d].rptr[s] * sizeof(val_t),
+                            N * n * sizeof(val_t), &wait, &exc[d].received.back());
+
+                    exc[s].sent.push_back(exc[d].received.back());
+                }
+            }
+        }
+
+        // Transfers ghost values to device d from owners in other contexts
+        // (through pinned host memory).
+        void finish(unsigned d, unsigned N) const {
+            for(unsigned s = 0; s < queue.size(); s++) {
+                size_t n = exc[d].rptr[s + 1] - exc[d].rptr[s];
+                if (!n || same_context(d, s)) continue;
+
+                exc[s].pinned_ready.wait();
+
+                std::vector<cl::Event> wait;
+                if (exc[d].remote_done()) wait.push_back(exc[d].remote_done);
+
+                exc[d].received.push_back(cl::Event());
+
+                squeue[d].enqueueWriteBuffer(exc[d].rx, CL_FALSE,
+                        N * exc[d].rptr[s] * sizeof(val_t), N * n * sizeof(val_t),
+                        exc[s].pinned->ptr + N * exc[s].sptr[d],
+                        wait.empty() ? NULL : &wait, &exc[d].received.back());
+
+                exc[s].staged.push_back(exc[d].received.back());
+            }
+        }
+
+        // Ghost values of device d.
+        const cl::Buffer& values(unsigned d) const {
+            return exc[d].rx;
+        }
+
+        // Transfers the remote kernel of device d has to wait for.
+        const std::vector<cl::Event>& received(unsigned d) const {
+            return exc[d].received;
+        }
+
+        // The remote kernel of device d should signal this event, so that
+        // the next exchange does not overwrite ghost values in use.
+        cl::Event* remote_done(unsigned d) const {
+            return &exc[d].remote_done;
+        }
+
+        // Partial sums of device d for its ghost columns, to be sent back
+        // to the owners with reverse(). Kernels writing the buffer have to
+        // wait for back_free(d).
+        const cl::Buffer& back_values(unsigned d) const {
+            reserve_back();
+            return exc[d].tx;
+        }
+
+        const std::vector<cl::Event>& back_free(unsigned d) const {
+            return exc[d].tx_read;
+        }
+
+        // Reverse exchange: sends partial sums for ghost columns to their
+        // owners and adds them to the owners' parts of y. ready[d] is
+        // signaled when back_values(d) is filled.
+        void reverse(const std::vector<cl::Buffer> &y,
+                const std::vector<cl::Event> &ready) const
+        {
+            static kernel_cache cache;
+
+            reserve_back();
+
+            // Kernels that filled the send buffers have waited for the
+            // transfers of the previous reverse exchange.
+            for(unsigned d = 0; d < queue.size(); d++) {
+                exc[d].tx_read.clear();
+                exc[d].acc_written.clear();
+            }
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                for(unsigned s = 0; s < queue.size(); s++) {
+                    size_t n = exc[d].rptr[s + 1] - exc[d].rptr[s];
+                    if (!n) continue;
+
+                    std::vector<cl::Event> wait;
+                    if (exc[s].acc_done()) wait.push_back(exc[s].acc_done);
+
+                    if (same_context(d, s)) {
+                        wait.push_back(ready[d]);
+
+                        exc[s].acc_written.push_back(cl::Event());
+
+                        squeue[s].enqueueCopyBuffer(exc[d].tx, exc[s].acc,
+                                exc[d].rptr[s] * sizeof(val_t),
+                                exc[s].sptr[d] * sizeof(val_t),
+                                n * sizeof(val_t), &wait, &exc[s].acc_written.back());
+
+                        exc[d].tx_read.push_back(exc[s].acc_written.back());
+                    } else {
+                        // Events of different contexts can not be mixed, so
+                        // these transfers are synchronous.
+                        std::vector<val_t> buf(n);
+                        std::vector<cl::Event> filled(1, ready[d]);
+
+                        squeue[d].enqueueReadBuffer(exc[d].tx, CL_TRUE,
+                                exc[d].rptr[s] * sizeof(val_t), n * sizeof(val_t),
+                                buf.data(), &filled);
+
+                        squeue[s].enqueueWriteBuffer(exc[s].acc, CL_TRUE,
+                                exc[s].sptr[d] * sizeof(val_t), n * sizeof(val_t),
+                                buf.data(), wait.empty() ? NULL : &wait);
+                    }
+                }
+            }
+
+            // Add received sums to y. Several devices may send values for
+            // the same column, so contribution of each sender is added by
+            // a separate kernel.
+            for(unsigned s = 0; s < queue.size(); s++) {
+                if (!exc[s].sptr.back()) continue;
+
+                cl::Context context = qctx(queue[s]);
+                cl::Device  device  = qdev(queue[s]);
+
+                auto kernel = cache.find(context());
+
+                if (kernel == cache.end()) {
+                    std::ostringstream source;
+
+                    source << standard_kernel_header(device) <<
+                        "kernel void add_ghost_sums(\n"
+                        "    " << type_name<size_t>() << " n,\n"
+                        "    " << type_name<size_t>() << " offset,\n"
+                        "    global const " << type_name<col_t>() << " *cols,\n"
+                        "    global const " << type_name<val_t>() << " *vals,\n"
+                        "    global " << type_name<val_t>() << " *y\n"
+                        "    )\n"
+                        "{\n"
+                        "    size_t i = get_global_id(0);\n"
+                        "    if (i < n) y[cols[offset + i]] += vals[offset + i];\n"
+                        "}\n";
+
+                    auto program = build_sources(context, source.str());
+
+                    cl::Kernel krn(program, "add_ghost_sums");
+                    size_t wgs = kernel_workgroup_size(krn, device);
+
+                    kernel = cache.insert(std::make_pair(
+                                context(), kernel_cache_entry(krn, wgs)
+                                )).first;
+                }
+
+                for(unsigned d = 0; d < queue.size(); d++) {
+                    size_t n = exc[s].sptr[d + 1] - exc[s].sptr[d];
+                    if (!n) continue;
+
+                    kernel->second.kernel.setArg(0, n);
+                    kernel->second.kernel.setArg(1, exc[s].sptr[d]);
+                    kernel->second.kernel.setArg(2, exc[s].cols_to_send);
+                    kernel->second.kernel.setArg(3, exc[s].acc);
+                    kernel->second.kernel.setArg(4, y[s]);
+
+                    queue[s].enqueueNDRangeKernel(kernel->second.kernel,
+                            cl::NullRange, alignup(n, kernel->second.wgsize),
+                            kernel->second.wgsize,
+                            exc[s].acc_written.empty() ? NULL : &exc[s].acc_written,
+                            &exc[s].acc_done);
+                }
+            }
+        }
+    private:
+        // Mapped buffer in host memory, used for transfer of ghost values
+        // between devices that do not share OpenCL context.
+        struct pinned_buffer {
+            cl::CommandQueue queue;
+            cl::Buffer       buf;
+            val_t           *ptr;
+
+            pinned_buffer(const cl::CommandQueue &q, size_t n)
+                : queue(q),
+                  buf(qctx(q), CL_MEM_READ_WRITE | CL_MEM_ALLOC_HOST_PTR, n * sizeof(val_t)),
+                  ptr(static_cast<val_t*>(queue.enqueueMapBuffer(buf, CL_TRUE,
+                                  CL_MAP_READ | CL_MAP_WRITE, 0, n * sizeof(val_t))))
+            {}
+
+            ~pinned_buffer() {
+                queue.enqueueUnmapMemObject(buf, ptr);
+                queue.finish();
+            }
+        };
+
+        struct exdata {
+            // Local values of x needed by other devices, grouped by receiving
+            // device (sptr holds the offsets).
+            std::vector<size_t> sptr;
+            cl::Buffer cols_to_send;
+            mutable cl::Buffer vals_to_send;
+            mutable std::unique_ptr<pinned_buffer> pinned;
+            mutable cl::Event pinned_ready;
+
+            // Ghost values, grouped by owning device (rptr holds the offsets).
+            std::vector<size_t> rptr;
+            mutable cl::Buffer rx;
+
+            // Transfers that read vals_to_send, and transfers that read the
+            // pinned buffer (these may belong to other contexts).
+            mutable std::vector<cl::Event> sent;
+            mutable std::vector<cl::Event> staged;
+
+            // Transfers that write to rx, and the remote kernel reading it.
+            mutable std::vector<cl::Event> received;
+            mutable cl::Event remote_done;
+
+            // Reverse exchange: partial sums for ghost columns (same layout
+            // as rx), and partial sums received from other devices (same
+            // layout as vals_to_send).
+            mutable cl::Buffer tx;
+            mutable cl::Buffer acc;
+
+            // Transfers that read tx and write acc, and the last kernel
+            // reading acc.
+            mutable std::vector<cl::Event> tx_read;
+            mutable std::vector<cl::Event> acc_written;
+            mutable cl::Event acc_done;
+        };
+
+        std::vector<cl::CommandQueue> queue;
+        std::vector<cl::CommandQueue> squeue;
+
+        mutable std::vector<std::vector<cl::Event>> event;
+
+        std::vector<exdata> exc;
+        bool exchange;
+        mutable unsigned width;
+        mutable bool back_ready;
+
+        // Makes sure exchange buffers can hold N components of ghost values.
+        void reserve(unsigned N) const {
+            if (N <= width) return;
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                cl::Context context = qctx(queue[d]);
+
+                // Transfers and kernels of an earlier exchange may still
+                // be using the buffers we are about to replace.
+                queue[d].finish();
+                squeue[d].finish();
+
+                exc[d].sent.clear();
+                exc[d].staged.clear();
+                exc[d].received.clear();
+
+                if (size_t nrecv = exc[d].rptr.back())
+                    exc[d].rx = cl::Buffer(context, CL_MEM_READ_WRITE, N * nrecv * sizeof(val_t));
+
+                if (size_t nsend = exc[d].sptr.back()) {
+                    exc[d].vals_to_send = cl::Buffer(context, CL_MEM_READ_WRITE, N * nsend * sizeof(val_t));
+
+                    if (exc[d].pinned)
+                        exc[d].pinned.reset(new pinned_buffer(squeue[d], N * nsend));
+                }
+            }
+
+            width = N;
+        }
+
+        // Buffers of the reverse exchange are allocated on first use.
+        void reserve_back() const {
+            if (back_ready || !exchange) return;
+
+            for(unsigned d = 0; d < queue.size(); d++) {
+                cl::Context context = qctx(queue[d]);
+
+                if (size_t nrecv = exc[d].rptr.back())
+                    exc[d].tx = cl::Buffer(context, CL_MEM_READ_WRITE, nrecv * sizeof(val_t));
+
+                if (size_t nsend = exc[d].sptr.back())
+                    exc[d].acc = cl::Buffer(context, CL_MEM_READ_WRITE, nsend * sizeof(val_t));
+            }
+
+            back_ready = true;
+        }
+
+        bool same_context(unsigned d1, unsigned d2) const {
+            return qctx(queue[d1])() == qctx(queue[d2])();
+        }
+};
+
+// Halos of a banded operator split by rows across devices (the rows match
+// partitioning of vectors). Rows of device d reference input elements at
+// most lhalo positions before and rhalo positions after its own part. The
+// halo values are read from the neighbour devices and written to a small
+// buffer on device d: left halo first, zeros outside of the vector.
+class band_halo {
+    public:
+        band_halo() : lhalo(0), rhalo(0) {}
+
+        band_halo(const std::vector<cl::CommandQueue> &queue,
+                const std::vector<size_t> &part, cl_long lhalo, cl_long rhalo)
+            : queue(queue), part(part), lhalo(lhalo), rhalo(rhalo),
+              buf(queue.size())
+        {}
+
+        cl_long left() const { return lhalo; }
+
+        // Halo of device d for input vector x. Returns NULL buffer if the
+        // device has no neighbours to reference.
+        //
+        // Each product term of a kernel passes its own slot (the position of
+        // the halo kernel argument), so that terms on different vectors do
+        // not share a buffer. A slot may be reused by a later kernel, since
+        // the blocking write is ordered after earlier kernels in the queue.
+        template <typename T>
+        cl::Buffer get(const vector<T> &x, unsigned d, unsigned slot) const {
+            const size_t n = part.back();
+            size_t beg = part[d], end = part[d + 1];
+
+            size_t lsize = d > 0 ? std::min<size_t>(beg, lhalo) : 0;
+            size_t rsize = d + 1 < queue.size() ? std::min<size_t>(end + rhalo, n) - end : 0;
+
+            if (!lsize && !rsize) return cl::Buffer();
+
+            std::vector<T> h(lhalo + rhalo, T());
+            size_t bytes = h.size() * sizeof(T);
+
+            if (lsize) x.read_data(beg - lsize, lsize, &h[lhalo - lsize], CL_TRUE);
+            if (rsize) x.read_data(end, rsize, &h[lhalo], CL_TRUE);
+
+            if (buf[d].size() <= slot) buf[d].resize(slot + 1);
+
+            scratch &b = buf[d][slot];
+
+            if (b.size < bytes) {
+                b.buf  = cl::Buffer(qctx(queue[d]), CL_MEM_READ_ONLY, bytes);
+                b.size = bytes;
+            }
+
+            queue[d].enqueueWriteBuffer(b.buf, CL_TRUE, 0, bytes, h.data());
+
+            return b.buf;
+        }
+    private:
+        std::vector<cl::CommandQueue> queue;
+        std::vector<size_t> part;
+
+        cl_long lhalo;
+        cl_long rhalo;
+
+        struct scratch {
+            cl::Buffer buf;
+            size_t     size;
+
+            scratch() : size(0) {}
+        };
+
+        mutable std::vector< std::vector<scratch> > buf;
+};
+
+/// \endcond
+
+} // namespace detail
+} // namespace vex
+
+#endif
@@ -138,17 +138,17 @@ struct SpMatHELL : public sparse_matrix {
         const col_t not_a_column = static_cast<col_t>(-1);
 
         std::vector<col_t> lell_col(pitch * loc.ell.width, not_a_column);
-        std::vector<val_t> lell_val(pitch * loc.ell.width, val_t());
+        std::vector<mat_t> lell_val(pitch * loc.ell.width, mat_t());
         std::vector<col_t> rell_col(pitch * rem.ell.width, not_a_column);
-        std::vector<val_t> rell_val(pitch * rem.ell.width, val_t());
+        std::vector<mat_t> rell_val(pitch * rem.ell.width, mat_t());
 
         std::vector<idx_t> lcsr_row;
         std::vector<col_t> lcsr_col;
-        std::vector<val_t> lcsr_val;
+        std::vector<mat_t> lcsr_val;
 
         std::vector<idx_t> rcsr_row;
         std::vector<col_t> rcsr_col;
-        std::vector<val_t> rcsr_val;
+        std::vector<mat_t> rcsr_val;
 
         lcsr_row.reserve(n + 1);
         lcsr_col.reserve(loc.csr.nnz);
@@ -161,27 +161,39 @@ struct SpMatHELL : public sparse_matrix {
         lcsr_row.push_back(0);
         rcsr_row.push_back(0);
 
+        // Position of each nonzero in the value buffers (see map_values()).
+        std::vector<idx_t> perm;
+        perm.reserve(row[row_end] - row[row_begin]);
+
+        const size_t lcsr_start = lell_val.size();
+        const size_t rell_start = lcsr_start + loc.csr.nnz;
+        const size_t rcsr_start = rell_start + rell_val.size();
+
         for(size_t i = row_begin, k = 0; i < row_end; ++i, ++k) {
             size_t lcnt = 0, rcnt = 0;
             for(idx_t j = row[i]; j < row[i + 1]; ++j) {
                 if (is_local(col[j])) {
                     if (lcnt < loc.ell.width) {
                         lell_col[k + pitch * lcnt] = static_cast<col_t>(col[j] - col_begin);
-                        lell_val[k + pitch * lcnt] = val[j];
+                        lell_val[k + pitch * lcnt] = static_cast<mat_t>(val[j]);
+                        perm.push_back(static_cast<idx_t>(k + pitch * lcnt));
                         ++lcnt;
                     } else {
+                        perm.push_back(static_cast<idx_t>(lcsr_start + lcsr_col.size()));
                         lcsr_col.push_back(static_cast<col_t>(col[j] - col_begin));
-                        lcsr_val.push_back(val[j]);
+                        lcsr_val.push_back(static_cast<mat_t>(val[j]));
                     }
                 } else {
                     assert(r2l.count(col[j]));
                     if (rcnt < rem.ell.width) {
                         rell_col[k + pitch * rcnt] = r2l[col[j]];
-                        rell_val[k + pitch * rcnt] = val[j];
+                        rell_val[k + pitch * rcnt] = static_cast<mat_t>(val[j]);
+                        perm.push_back(static_cast<idx_t>(rell_start + k + pitch * rcnt));
                         ++rcnt;
                     } else {
+                        perm.push_back(static_cast<idx_t>(rcsr_start + rcsr_col.size()));
                         rcsr_col.push_back(r2l[col[j]]);
-                        rcsr_val.push_back(val[j]);
+                        rcsr_val.push_back(static_cast<mat_t>(val[j]));
                     }
                 }
             }
@@ -195,32 +207,43 @@ struct SpMatHELL : public sparse_matrix {
 
         if (loc.ell.width) {
             loc.ell.col = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(lell_col), lell_col.data());
-            loc.ell.val = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(lell_val), lell_val.data());
+            loc.ell.val = cl::Buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes(lell_val), lell_val.data());
         }
 
         if (loc.csr.nnz) {
             loc.csr.row = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(lcsr_row), lcsr_row.data());
             loc.csr.col = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(lcsr_col), lcsr_col.data());
-            loc.csr.val = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(lcsr_val), lcsr_val.data());
+            loc.csr.val = cl::Buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes(lcsr_val), lcsr_val.data());
         }
 
         if (rem.ell.width) {
             rem.ell.col = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(rell_col), rell_col.data());
-            rem.ell.val = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(rell_val), rell_val.data());
+            rem.ell.val = cl::Buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes(rell_val), rell_val.data());
         }
 
         if (rem.csr.nnz) {
             rem.csr.row = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(rcsr_row), rcsr_row.data());
             rem.csr.col = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(rcsr_col), rcsr_col.data());
-            rem.csr.val = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(rcsr_val), rcsr_val.data());
+            rem.csr.val = cl::Buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes(rcsr_val), rcsr_val.data());
         }
+
+        std::vector<cl::Buffer> buf;
+        std::vector<size_t>     size;
+
+        buf.push_back(loc.ell.val); size.push_back(lell_val.size());
+        buf.push_back(loc.csr.val); size.push_back(lcsr_val.size());
+        buf.push_back(rem.ell.val); size.push_back(rell_val.size());
+        buf.push_back(rem.csr.val); size.push_back(rcsr_val.size());
+
+        this->map_values(queue, buf, size, perm);
     }
 
     template <class OP>
     void mul(
             const matrix_part &part,
             const cl::Buffer &in, const cl::Buffer &out, scalar_type scale,
-            const std::vector<cl::Event> &wait_for_it = std::vector<cl::Event>()
+            const std::vector<cl::Event> &wait_for_it = std::vector<cl::Event>(),
+            cl::Event *done = 0
             ) const
     {
         using namespace detail;
@@ -242,10 +265,10 @@ struct SpMatHELL : public sparse_matrix {
                 "    " << type_name<size_t>() << " ell_w,\n"
                 "    " << type_name<size_t>() << " ell_pitch,\n"
                 "    global const " << type_name<col_t>() << " * ell_col,\n"
-                "    global const " << type_name<val_t>() << " * ell_val,\n"
+                "    global const " << type_name<mat_t>() << " * ell_val,\n"
                 "    global const " << type_name<idx_t>() << " * csr_row,\n"
                 "    global const " << type_name<col_t>() << " * csr_col,\n"
-                "    global const " << type_name<val_t>() << " * csr_val,\n"
+                "    global const " << type_name<mat_t>() << " * csr_val,\n"
                 "    global const " << type_name<val_t>() << " * in,\n"
                 "    global       " << type_name<val_t>() << " * out\n"
                 "    )\n"
@@ -304,7 +327,7 @@ struct SpMatHELL : public sparse_matrix {
         krn.setArg(pos++, out);
 
         queue.enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize,
-                wait_for_it.empty() ? NULL : &wait_for_it);
+                wait_for_it.empty() ? NULL : &wait_for_it, done);
     }
 
     void mul_local(const cl::Buffer &in, const cl::Buffer &out,
@@ -317,9 +340,148 @@ struct SpMatHELL : public sparse_matrix {
     }
 
     void mul_remote(const cl::Buffer &in, const cl::Buffer &out, scalar_type scale,
-            const std::vector<cl::Event> &wait_for_it) const
+            const std::vector<cl::Event> &wait_for_it, cl::Event *done) const
+    {
+        mul<assign::ADD>(rem, in, out, scale, wait_for_it, done);
+    }
+
+    template <class OP>
+    void mul_multi(
+            const matrix_part &part,
+            const std::vector<cl::Buffer> &in,  const detail::spmm_arg &ia,
+            const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+            scalar_type scale,
+            const std::vector<cl::Event> &wait_for_it = std::vector<cl::Event>(),
+            cl::Event *done = 0
+            ) const
+    {
+        using namespace detail;
+
+        static std::map<std::pair<unsigned, unsigned>, kernel_cache> caches;
+
+        kernel_cache &cache = caches[std::make_pair(ia.key(), oa.key())];
+
+        cl::Context context = qctx(queue);
+        cl::Device  device  = qdev(queue);
+
+        auto kernel = cache.find(context());
+
+        if (kernel == cache.end()) {
+            const unsigned N = ia.N;
+
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<val_t>() << " val_t;\n"
+                "typedef " << type_name<mat_t>() << " mat_t;\n"
+                "typedef " << type_name<col_t>() << " col_t;\n"
+                "kernel void hybrid_ell_spmm(\n"
+                "    " << type_name<size_t>() << " n,\n"
+                "    " << type_name<scalar_type>()  << " scale,\n"
+                "    " << type_name<size_t>() << " ell_w,\n"
+                "    " << type_name<size_t>() << " ell_pitch,\n"
+                "    global const col_t * ell_col,\n"
+                "    global const mat_t * ell_val,\n"
+                "    global const " << type_name<idx_t>() << " * csr_row,\n"
+                "    global const col_t * csr_col,\n"
+                "    global const mat_t * csr_val"
+                << ia.params("in", "val_t", true)
+                << oa.params("out", "val_t", false) << "\n"
+                "    )\n"
+                "{\n"
+                "    for (size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n";
+            for(unsigned k = 0; k < N; ++k)
+                source <<
+                "        val_t sum" << k << " = 0;\n";
+            source <<
+                "        for(size_t j = 0; j < ell_w; ++j) {\n"
+                "            col_t c = ell_col[i + j * ell_pitch];\n"
+                "            if (c != (col_t)(-1)) {\n"
+                "                mat_t v = ell_val[i + j * ell_pitch];\n";
+            for(unsigned k = 0; k < N; ++k)
+                source <<
+                "                sum" << k << " += v * " << ia("in", k, "c") << ";\n";
+            source <<
+                "            }\n"
+                "        }\n"
+                "        if (csr_row) {\n"
+                "            for(size_t j = csr_row[i], e = csr_row[i + 1]; j < e; ++j) {\n"
+                "                col_t c = csr_col[j];\n"
+                "                mat_t v = csr_val[j];\n";
+            for(unsigned k = 0; k < N; ++k)
+                source <<
+                "                sum" << k << " += v * " << ia("in", k, "c") << ";\n";
+            source <<
+                "            }\n"
+                "        }\n";
+            for(unsigned k = 0; k < N; ++k)
+                source <<
+                "        " << oa("out", k, "i") << " " << OP::string() << " scale * sum" << k << ";\n";
+            source <<
+                "    }\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel krn(program, "hybrid_ell_spmm");
+            size_t     wgs = kernel_workgroup_size(krn, device);
+
+            kernel = cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(krn, wgs)
+                        )).first;
+        }
+
+        cl::Kernel krn    = kernel->second.kernel;
+        size_t     wgsize = kernel->second.wgsize;
+        size_t     g_size = num_workgroups(device) * wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, n);
+        krn.setArg(pos++, scale);
+        krn.setArg(pos++, part.ell.width);
+        krn.setArg(pos++, pitch);
+        if (part.ell.width) {
+            krn.setArg(pos++, part.ell.col);
+            krn.setArg(pos++, part.ell.val);
+        } else {
+            krn.setArg(pos++, static_cast<void*>(0));
+            krn.setArg(pos++, static_cast<void*>(0));
+        }
+        if (part.csr.nnz) {
+            krn.setArg(pos++, part.csr.row);
+            krn.setArg(pos++, part.csr.col);
+            krn.setArg(pos++, part.csr.val);
+        } else {
+            krn.setArg(pos++, static_cast<void*>(0));
+            krn.setArg(pos++, static_cast<void*>(0));
+            krn.setArg(pos++, static_cast<void*>(0));
+        }
+        ia.set_args(krn, pos, in);
+        oa.set_args(krn, pos, out);
+
+        queue.enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize,
+                wait_for_it.empty() ? NULL : &wait_for_it, done);
+    }
+
+    void mul_local_multi(
+            const std::vector<cl::Buffer> &in,  const detail::spmm_arg &ia,
+            const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+            scalar_type scale, bool append) const
     {
-        mul<assign::ADD>(rem, in, out, scale, wait_for_it);
+        if (append)
+            mul_multi<assign::ADD>(loc, in, ia, out, oa, scale);
+        else
+            mul_multi<assign::SET>(loc, in, ia, out, oa, scale);
+    }
+
+    void mul_remote_multi(
+            const cl::Buffer &in, const detail::spmm_arg &ia,
+            const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+            scalar_type scale, const std::vector<cl::Event> &wait_for_it,
+            cl::Event *done) const
+    {
+        mul_multi<assign::ADD>(rem, std::vector<cl::Buffer>(1, in), ia,
+                out, oa, scale, wait_for_it, done);
     }
 
     static std::string inline_preamble(const std::string &prm_name) {
@@ -330,10 +492,12 @@ struct SpMatHELL : public sparse_matrix {
           "    " << type_name<size_t>() << " ell_w,\n"
           "    " << type_name<size_t>() << " ell_pitch,\n"
           "    global const " << type_name<col_t>() << " * ell_col,\n"
-          "    global const " << type_name<val_t>() << " * ell_val,\n"
+          "    global const " << type_name<mat_t>() << " * ell_val,\n"
+          "    global const " << type_name<size_t>() << " * sell_ptr,\n"
+          "    global const " << type_name<size_t>() << " * sell_pos,\n"
           "    global const " << type_name<idx_t>() << " * csr_row,\n"
           "    global const " << type_name<col_t>() << " * csr_col,\n"
-          "    global const " << type_name<val_t>() << " * csr_val,\n"
+          "    global const " << type_name<mat_t>() << " * csr_val,\n"
           "    global const " << type_name<val_t>() << " * in,\n"
           "    " << type_name<size_t>() << " i\n"
           "    )\n"
@@ -344,6 +508,15 @@ struct SpMatHELL : public sparse_matrix {
           "        if (c != ("<< type_name<col_t>() << ")(-1))\n"
           "            sum += ell_val[i + j * ell_pitch] * in[c];\n"
           "    }\n"
+          "    if (sell_ptr) {\n"
+          "        size_t k = sell_pos[i];\n"
+          "        size_t s = k / ell_pitch;\n"
+          "        for(size_t j = sell_ptr[s] + k % ell_pitch, e = sell_ptr[s + 1]; j < e; j += ell_pitch) {\n"
+          "            " << type_name<col_t>() << " c = ell_col[j];\n"
+          "            if (c != ("<< type_name<col_t>() << ")(-1))\n"
+          "                sum += ell_val[j] * in[c];\n"
+          "        }\n"
+          "    }\n"
           "    if (csr_row) {\n"
           "        for(size_t j = csr_row[i], e = csr_row[i + 1]; j < e; ++j)\n"
           "            sum += csr_val[j] * in[csr_col[j]];\n"
@@ -354,17 +527,23 @@ struct SpMatHELL : public sparse_matrix {
         return s.str();
     }
 
-    static std::string inline_expression(const std::string &prm_name) {
+    // Call of the function defined by inline_preamble(prm_name) with the
+    // arguments declared by inline_parameters(arg_name).
+    static std::string inline_expression(const std::string &prm_name,
+            const std::string &arg_name)
+    {
         std::ostringstream s;
         s << "hell_spmv_" << prm_name << "("
-          << prm_name << "_ell_w, "
-          << prm_name << "_ell_pitch, "
-          << prm_name << "_ell_col, "
-          << prm_name << "_ell_val, "
-          << prm_name << "_csr_row, "
-          << prm_name << "_csr_col, "
-          << prm_name << "_csr_val, "
-          << prm_name << "_vec, idx)";
+          << arg_name << "_ell_w, "
+          << arg_name << "_ell_pitch, "
+          << arg_name << "_ell_col, "
+          << arg_name << "_ell_val, "
+          << arg_name << "_sell_ptr, "
+          << arg_name << "_sell_pos, "
+          << arg_name << "_csr_row, "
+          << arg_name << "_csr_col, "
+          << arg_name << "_csr_val, "
+          << arg_name << "_vec, idx)";
 
         return s.str();
     }
@@ -375,35 +554,41 @@ struct SpMatHELL : public sparse_matrix {
           ",\n\t" << type_name<size_t>() << " " << prm_name << "_ell_w"
           ",\n\t" << type_name<size_t>() << " " << prm_name << "_ell_pitch"
           ",\n\tglobal const " << type_name<col_t>() << " * " << prm_name << "_ell_col"
-          ",\n\tglobal const " << type_name<val_t>() << " * " << prm_name << "_ell_val"
+          ",\n\tglobal const " << type_name<mat_t>() << " * " << prm_name << "_ell_val"
+          ",\n\tglobal const " << type_name<size_t>() << " * " << prm_name << "_sell_ptr"
+          ",\n\tglobal const " << type_name<size_t>() << " * " << prm_name << "_sell_pos"
           ",\n\tglobal const " << type_name<idx_t>() << " * " << prm_name << "_csr_row"
           ",\n\tglobal const " << type_name<col_t>() << " * " << prm_name << "_csr_col"
-          ",\n\tglobal const " << type_name<val_t>() << " * " << prm_name << "_csr_val"
+          ",\n\tglobal const " << type_name<mat_t>() << " * " << prm_name << "_csr_val"
           ",\n\tglobal const " << type_name<val_t>() << " * " << prm_name << "_vec";
 
         return s.str();
     }
 
-    void setArgs(cl::Kernel &krn, unsigned device, unsigned &pos, const vector<val_t> &x) const {
-        krn.setArg(pos++, loc.ell.width);
+    // Local or remote part of the matrix as arguments of inline_preamble().
+    void hell_args(cl::Kernel &krn, unsigned &pos, bool remote) const {
+        const matrix_part &part = remote ? rem : loc;
+
+        krn.setArg(pos++, part.ell.width);
         krn.setArg(pos++, pitch);
-        if (loc.ell.width) {
-            krn.setArg(pos++, loc.ell.col);
-            krn.setArg(pos++, loc.ell.val);
+        if (part.ell.width) {
+            krn.setArg(pos++, part.ell.col);
+            krn.setArg(pos++, part.ell.val);
         } else {
             krn.setArg(pos++, static_cast<void*>(0));
             krn.setArg(pos++, static_cast<void*>(0));
         }
-        if (loc.csr.nnz) {
-            krn.setArg(pos++, loc.csr.row);
-            krn.setArg(pos++, loc.csr.col);
-            krn.setArg(pos++, loc.csr.val);
+        krn.setArg(pos++, static_cast<void*>(0));
+        krn.setArg(pos++, static_cast<void*>(0));
+        if (part.csr.nnz) {
+            krn.setArg(pos++, part.csr.row);
+            krn.setArg(pos++, part.csr.col);
+            krn.setArg(pos++, part.csr.val);
         } else {
             krn.setArg(pos++, static_cast<void*>(0));
             krn.setArg(pos++, static_cast<void*>(0));
             krn.setArg(pos++, static_cast<void*>(0));
         }
-        krn.setArg(pos++, x(device));
     }
 };
 
@@ -40,15 +40,24 @@ typedef vector_expression<
     typename boost::proto::terminal< inline_spmv_terminal >::type
     > inline_spmv_terminal_expression;
 
-template <typename val_t, typename col_t, typename idx_t>
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
 struct inline_spmv : inline_spmv_terminal_expression {
-    typedef spmv<val_t, col_t, idx_t> Base;
+    typedef spmv<val_t, col_t, idx_t, mat_t> Base;
     typedef val_t value_type;
 
     const typename Base::mat &A;
     const typename Base::vec &x;
 
+    // Ghost values of x (one buffer per device). Null when the remote part
+    // of the product is computed outside of the expression. Holding the
+    // pointer keeps the matrix from reusing the buffers.
+    std::shared_ptr< std::vector<cl::Buffer> > ghost;
+
     inline_spmv(const Base &base) : A(base.A), x(base.x) {}
+
+    inline_spmv(const Base &base,
+            const std::shared_ptr< std::vector<cl::Buffer> > &ghost)
+        : A(base.A), x(base.x), ghost(ghost) {}
 };
 /// \endcond
 
@@ -56,8 +65,9 @@ struct inline_spmv : inline_spmv_terminal_expression {
 /**
  * When applied to a matrix-vector product, the product becomes inlineable.
  * That is, it may be used in any vector expression (not just additive
- * expression). This is only possible in single-device contexts, so user has to
- * guarantee that.
+ * expression). In multi-device contexts ghost values of the input vector are
+ * exchanged when the product is inlined, so the expression should be
+ * evaluated right away.
  *
  * Example:
  * \code
@@ -65,12 +75,10 @@ struct inline_spmv : inline_spmv_terminal_expression {
  * eps = sum( fabs(f - vex::make_inline(A * x)) );
  * \endcode
  */
-template <typename val_t, typename col_t, typename idx_t>
-inline_spmv<val_t, col_t, idx_t>
-make_inline(const spmv<val_t, col_t, idx_t> &base) {
-    precondition(base.x.nparts() == 1, "Can not inline multi-device SpMV operation.");
-
-    return inline_spmv<val_t, col_t, idx_t>(base);
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+inline_spmv<val_t, col_t, idx_t, mat_t>
+make_inline(const spmv<val_t, col_t, idx_t, mat_t> &base) {
+    return inline_spmv<val_t, col_t, idx_t, mat_t>(base, base.A.inline_ghosts(base.x));
 }
 
 #ifdef VEXCL_MULTIVECTOR_HPP
@@ -81,9 +89,9 @@ typedef multivector_expression<
     typename boost::proto::terminal< mv_inline_spmv_terminal >::type
     > mv_inline_spmv_terminal_expression;
 
-template <typename val_t, typename col_t, typename idx_t, class MV>
+template <typename val_t, typename col_t, typename idx_t, typename mat_t, class MV>
 struct mv_inline_spmv : mv_inline_spmv_terminal_expression {
-    typedef multispmv<val_t, col_t, idx_t, MV> Base;
+    typedef multispmv<val_t, col_t, idx_t, mat_t, MV> Base;
     const typename Base::mat &A;
     const MV                 &x;
 
@@ -104,12 +112,12 @@ struct mv_inline_spmv : mv_inline_spmv_terminal_expression {
  * eps = sum( fabs(f - vex::make_inline(A * x)) );
  * \endcode
  */
-template <typename val_t, typename col_t, typename idx_t, class MV>
-mv_inline_spmv<val_t, col_t, idx_t, MV>
-make_inline(const multispmv<val_t, col_t, idx_t, MV> &base) {
+template <typename val_t, typename col_t, typename idx_t, typename mat_t, class MV>
+mv_inline_spmv<val_t, col_t, idx_t, mat_t, MV>
+make_inline(const multispmv<val_t, col_t, idx_t, mat_t, MV> &base) {
     precondition(base.x(0).nparts() == 1, "Can not inline multi-device SpMV operation.");
 
-    return mv_inline_spmv<val_t, col_t, idx_t, MV>(base);
+    return mv_inline_spmv<val_t, col_t, idx_t, mat_t, MV>(base);
 }
 #endif
 
@@ -134,73 +142,109 @@ struct proto_terminal_is_value< mv_inline_spmv_terminal >
     : std::true_type
 { };
 
-template <size_t I, typename val_t, typename col_t, typename idx_t, typename MV>
-struct component< I, mv_inline_spmv<val_t, col_t, idx_t, MV> > {
-    typedef inline_spmv<val_t, col_t, idx_t> type;
+template <size_t I, typename val_t, typename col_t, typename idx_t, typename mat_t, typename MV>
+struct component< I, mv_inline_spmv<val_t, col_t, idx_t, mat_t, MV> > {
+    typedef inline_spmv<val_t, col_t, idx_t, mat_t> type;
 };
 #endif
 
-template <typename val_t, typename col_t, typename idx_t>
-struct terminal_preamble< inline_spmv<val_t, col_t, idx_t> > {
-    static std::string get(const inline_spmv<val_t, col_t, idx_t>&,
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+struct terminal_preamble< inline_spmv<val_t, col_t, idx_t, mat_t> > {
+    static std::string get(const inline_spmv<val_t, col_t, idx_t, mat_t>&,
             const cl::Device &device, const std::string &prm_name,
             detail::kernel_generator_state_ptr state)
     {
-        return SpMat<val_t, col_t, idx_t>::inline_preamble(device, prm_name, state);
+        return SpMat<val_t, col_t, idx_t, mat_t>::inline_preamble(device, prm_name, state);
     }
 };
 
-template <typename val_t, typename col_t, typename idx_t>
-struct kernel_param_declaration< inline_spmv<val_t, col_t, idx_t> > {
-    static std::string get(const inline_spmv<val_t, col_t, idx_t>&,
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+struct kernel_param_declaration< inline_spmv<val_t, col_t, idx_t, mat_t> > {
+    static std::string get(const inline_spmv<val_t, col_t, idx_t, mat_t>&,
             const cl::Device &device, const std::string &prm_name,
             detail::kernel_generator_state_ptr state)
     {
-        return SpMat<val_t, col_t, idx_t>::inline_parameters(device, prm_name, state);
+        return SpMat<val_t, col_t, idx_t, mat_t>::inline_parameters(device, prm_name, state);
     }
 };
 
-template <typename val_t, typename col_t, typename idx_t>
-struct partial_vector_expr< inline_spmv<val_t, col_t, idx_t> > {
-    static std::string get(const inline_spmv<val_t, col_t, idx_t>&,
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+struct partial_vector_expr< inline_spmv<val_t, col_t, idx_t, mat_t> > {
+    static std::string get(const inline_spmv<val_t, col_t, idx_t, mat_t>&,
             const cl::Device &device, const std::string &prm_name,
             detail::kernel_generator_state_ptr state)
     {
-        return SpMat<val_t, col_t, idx_t>::inline_expression(device, prm_name, state);
+        return SpMat<val_t, col_t, idx_t, mat_t>::inline_expression(device, prm_name, state);
     }
 };
 
-template <typename val_t, typename col_t, typename idx_t>
-struct kernel_arg_setter< inline_spmv<val_t, col_t, idx_t> > {
-    static void set(const inline_spmv<val_t, col_t, idx_t> &term,
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+struct kernel_arg_setter< inline_spmv<val_t, col_t, idx_t, mat_t> > {
+    static void set(const inline_spmv<val_t, col_t, idx_t, mat_t> &term,
             cl::Kernel &kernel, unsigned device, size_t index_offset,
             unsigned &position, detail::kernel_generator_state_ptr state)
     {
-        SpMat<val_t, col_t, idx_t>::inline_arguments(
+        SpMat<val_t, col_t, idx_t, mat_t>::inline_arguments(
                 kernel, device, index_offset, position,
-                term.A, term.x, state
+                term.A, term.x, term.ghost, state
                 );
     }
 };
 
-template <typename val_t, typename col_t, typename idx_t>
-struct expression_properties< inline_spmv<val_t, col_t, idx_t> > {
-    static void get(const inline_spmv<val_t, col_t, idx_t> &term,
+// Local part of a matrix-vector product may be computed inside of a vector
+// expression kernel; remote part is added afterwards.
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+struct local_transform< spmv<val_t, col_t, idx_t, mat_t> > : std::true_type {
+    typedef spmv<val_t, col_t, idx_t, mat_t> term_type;
+    typedef typename cl_scalar_of<val_t>::type scalar_type;
+
+    typedef typename boost::proto::result_of::make_expr<
+                boost::proto::tag::multiplies, vector_domain,
+                scalar_type, inline_spmv<val_t, col_t, idx_t, mat_t>
+            >::type type;
+
+    static type get(const term_type &t) {
+        return boost::proto::make_expr<boost::proto::tag::multiplies, vector_domain>(
+                t.scale, inline_spmv<val_t, col_t, idx_t, mat_t>(t));
+    }
+
+    static const void* owner(const term_type &t) {
+        return t.x.nparts() > 1 ? &t.A : 0;
+    }
+
+    static bool fusable(const term_type &t) {
+        return t.A.inline_is_efficient();
+    }
+
+    static void start(const term_type &t, const vector<val_t> &y) {
+        t.A.start_remote(t.x, y);
+    }
+
+    static void finish(const term_type &t, vector<val_t> &y, bool negate) {
+        t.A.finish_remote(y, negate ? -t.scale : t.scale);
+    }
+};
+
+template <typename val_t, typename col_t, typename idx_t, typename mat_t>
+struct expression_properties< inline_spmv<val_t, col_t, idx_t, mat_t> > {
+    static void get(const inline_spmv<val_t, col_t, idx_t, mat_t> &term,
             std::vector<cl::CommandQueue> &queue_list,
             std::vector<size_t> &partition,
             size_t &size
             )
     {
-        expression_properties< vector<val_t> >::get(term.x, queue_list, partition, size);
+        queue_list = term.x.queue_list();
+        partition  = term.A.row_partition().part;
+        size       = term.A.rows();
     }
 };
 
 } // namespace traits
 
 #ifdef VEXCL_MULTIVECTOR_HPP
-template <size_t I, typename val_t, typename col_t, typename idx_t, typename MV>
-inline_spmv<val_t, col_t, idx_t>
-get(const mv_inline_spmv<val_t, col_t, idx_t, MV> &t) {
+template <size_t I, typename val_t, typename col_t, typename idx_t, typename mat_t, typename MV>
+inline_spmv<val_t, col_t, idx_t, mat_t>
+get(const mv_inline_spmv<val_t, col_t, idx_t, mat_t, MV> &t) {
     return make_inline(t.A * t.x(I));
 }
 #endif
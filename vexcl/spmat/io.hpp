@@ -0,0 +1,507 @@
+#ifndef VEXCL_SPMAT_IO_HPP
+#define VEXCL_SPMAT_IO_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/**
+ * \file   vexcl/spmat/io.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Reading sparse matrices from files.
+ */
+
+#include <vector>
+#include <string>
+#include <sstream>
+#include <fstream>
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstdint>
+#include <type_traits>
+
+#ifdef _OPENMP
+#  include <omp.h>
+#endif
+
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
+
+#include <vexcl/util.hpp>
+
+namespace vex {
+
+/// Sparse matrix in CSR format read from a file.
+/**
+ * Supported file formats are MatrixMarket coordinate format (real, integer,
+ * or pattern matrices with general, symmetric, or skew-symmetric structure)
+ * and binary CSR format (see vex::write_binary_csr()). The file is mapped
+ * into memory and is parsed in parallel with OpenMP. Arrays of a binary file
+ * are used in place when their types match the template parameters;
+ * otherwise, as with MatrixMarket files, the only host copy of the matrix is
+ * held by the reader. The arrays are meant to be passed to vex::SpMat
+ * constructor, which reads each device strip directly from them:
+ * \code
+ * vex::spmat_reader<double> f("A.mtx");
+ * vex::SpMat<double> A(ctx, f.rows(), f.cols(), f.row(), f.col(), f.val());
+ * \endcode
+ */
+template <typename val_t, typename col_t = size_t, typename idx_t = size_t>
+class spmat_reader {
+    public:
+        /// Reads the matrix from file.
+        /**
+         * The format is detected from the file contents: MatrixMarket files
+         * start with the "%%MatrixMarket" banner.
+         */
+        explicit spmat_reader(const std::string &fname)
+            : n(0), m(0), nnz(0), row_ptr(0), col_ptr(0), val_ptr(0)
+        {
+            using namespace boost::interprocess;
+
+            file_mapping  file(fname.c_str(), read_only);
+            mapped_region map(file, read_only);
+
+            const char *beg = static_cast<const char*>(map.get_address());
+            const char *end = beg + map.get_size();
+
+            static const char banner[] = "%%MatrixMarket";
+            const size_t blen = sizeof(banner) - 1;
+
+            if (static_cast<size_t>(end - beg) >= blen && std::equal(banner, banner + blen, beg)) {
+                read_matrix_market(beg, end);
+            } else if (read_binary(beg, end)) {
+                // Arrays point into the mapped file.
+                region.swap(map);
+            }
+        }
+
+        /// Number of rows.
+        size_t rows() const { return n; }
+
+        /// Number of columns.
+        size_t cols() const { return m; }
+
+        /// Number of nonzeros.
+        size_t nonzeros() const { return nnz; }
+
+        /// Row index into col() and val() arrays.
+        const idx_t* row() const { return row_ptr; }
+
+        /// Column numbers of nonzero elements.
+        const col_t* col() const { return col_ptr; }
+
+        /// Values of nonzero elements.
+        const val_t* val() const { return val_ptr; }
+    private:
+        boost::interprocess::mapped_region region;
+
+        size_t n, m, nnz;
+
+        std::vector<idx_t> row_buf;
+        std::vector<col_t> col_buf;
+        std::vector<val_t> val_buf;
+
+        const idx_t *row_ptr;
+        const col_t *col_ptr;
+        const val_t *val_ptr;
+
+        // Number of chunks the file is split into for parallel parsing.
+        static int num_chunks() {
+#ifdef _OPENMP
+            return 4 * omp_get_max_threads();
+#else
+            return 1;
+#endif
+        }
+
+        static void to_lower(std::string &s) {
+            std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+        }
+
+        static bool is_blank(char c) {
+            return c == ' ' || c == '\t' || c == '\r';
+        }
+
+        static void skip_blanks(const char *&p, const char *end) {
+            while(p < end && is_blank(*p)) ++p;
+        }
+
+        static void next_line(const char *&p, const char *end) {
+            while(p < end && *p != '\n') ++p;
+            if (p < end) ++p;
+        }
+
+        static size_t parse_index(const char *&p, const char *end) {
+            skip_blanks(p, end);
+
+            precondition(p < end && *p >= '0' && *p <= '9', "Malformed MatrixMarket entry");
+
+            size_t v = 0;
+            for(; p < end && *p >= '0' && *p <= '9'; ++p)
+                v = v * 10 + (*p - '0');
+
+            return v;
+        }
+
+        // The mapped file is not null-terminated, so the token is copied
+        // before conversion.
+        static double parse_real(const char *&p, const char *end) {
+            skip_blanks(p, end);
+
+            char buf[64];
+            size_t len = 0;
+
+            for(; p < end && len + 1 < sizeof(buf) && !is_blank(*p) && *p != '\n'; ++p)
+                buf[len++] = *p;
+            buf[len] = 0;
+
+            char *tail;
+            double v = std::strtod(buf, &tail);
+
+            precondition(len && *tail == 0, "Malformed MatrixMarket entry");
+
+            return v;
+        }
+
+        struct mm_header {
+            bool pattern;
+            bool symmetric;
+            bool skew;
+        };
+
+        // Parses entries of [p, end) and passes each of them (0-based row,
+        // column and value) to f. Mirrored entries of symmetric matrices are
+        // passed as well.
+        template <class Func>
+        void parse_entries(const mm_header &h, const char *p, const char *end, Func &&f) const {
+            while(p < end) {
+                skip_blanks(p, end);
+
+                if (p == end) break;
+
+                if (*p == '\n' || *p == '%') {
+                    next_line(p, end);
+                    continue;
+                }
+
+                size_t i = parse_index(p, end);
+                size_t j = parse_index(p, end);
+                double v = h.pattern ? 1.0 : parse_real(p, end);
+
+                precondition(i >= 1 && i <= n && j >= 1 && j <= m,
+                        "MatrixMarket entry is out of range");
+
+                f(i - 1, j - 1, v);
+
+                if (h.symmetric && i != j) f(j - 1, i - 1, h.skew ? -v : v);
+
+                next_line(p, end);
+            }
+        }
+
+        void read_matrix_market(const char *beg, const char *end) {
+            const char *p = beg;
+
+            // Banner.
+            mm_header h;
+            {
+                const char *e = p;
+                next_line(e, end);
+
+                std::string object, format, field, symmetry;
+                std::istringstream banner(std::string(p, e));
+                banner >> object >> object >> format >> field >> symmetry;
+
+                to_lower(object);
+                to_lower(format);
+                to_lower(field);
+                to_lower(symmetry);
+
+                precondition(object == "matrix" && format == "coordinate",
+                        "Only sparse (coordinate) MatrixMarket matrices are supported");
+
+                precondition(field == "real" || field == "double" ||
+                        field == "integer" || field == "pattern",
+                        "Unsupported MatrixMarket field type");
+
+                precondition(symmetry == "general" || symmetry == "symmetric" ||
+                        symmetry == "skew-symmetric",
+                        "Unsupported MatrixMarket symmetry type");
+
+                h.pattern   = (field == "pattern");
+                h.symmetric = (symmetry != "general");
+                h.skew      = (symmetry == "skew-symmetric");
+
+                p = e;
+            }
+
+            // Comments and size line.
+            for(;;) {
+                skip_blanks(p, end);
+                precondition(p < end, "MatrixMarket file has no size line");
+
+                if (*p == '%' || *p == '\n') {
+                    next_line(p, end);
+                } else {
+                    n = parse_index(p, end);
+                    m = parse_index(p, end);
+                    parse_index(p, end);
+                    next_line(p, end);
+                    break;
+                }
+            }
+
+            // Chunks of entries start at line boundaries.
+            const int nchunks = num_chunks();
+            const size_t len  = end - p;
+
+            std::vector<const char*> chunk(nchunks + 1, end);
+            chunk[0] = p;
+            for(int k = 1; k < nchunks; ++k) {
+                const char *c = std::max(chunk[k - 1], p + k * (len / nchunks));
+                if (c > p && c[-1] != '\n') next_line(c, end);
+                chunk[k] = c;
+            }
+
+            // Count entries in each chunk. Exceptions may not leave
+            // parallel region, so parse errors are reported afterwards.
+            std::vector<size_t>      start(nchunks + 1, 0);
+            std::vector<std::string> error(nchunks);
+
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic)
+#endif
+            for(int k = 0; k < nchunks; ++k) {
+                size_t cnt = 0;
+                try {
+                    parse_entries(h, chunk[k], chunk[k + 1],
+                            [&cnt](size_t, size_t, double) { ++cnt; });
+                } catch(const std::exception &e) {
+                    error[k] = e.what();
+                }
+                start[k + 1] = cnt;
+            }
+
+            for(int k = 0; k < nchunks; ++k)
+                if (!error[k].empty()) throw std::runtime_error(error[k]);
+
+            std::partial_sum(start.begin(), start.end(), start.begin());
+            nnz = start.back();
+
+            // Read entries in the order they appear in the file (the chunks
+            // are known to be well-formed at this point). Row
+            // numbers are kept in row_buf until the entries are sorted.
+            std::vector<idx_t> rows(nnz);
+            col_buf.resize(nnz);
+            val_buf.resize(nnz);
+
+#ifdef _OPENMP
+#  pragma omp parallel for schedule(dynamic)
+#endif
+            for(int k = 0; k < nchunks; ++k) {
+                size_t pos = start[k];
+                parse_entries(h, chunk[k], chunk[k + 1],
+                        [&](size_t i, size_t j, double v) {
+                            rows[pos]    = static_cast<idx_t>(i);
+                            col_buf[pos] = static_cast<col_t>(j);
+                            val_buf[pos] = static_cast<val_t>(v);
+                            ++pos;
+                        });
+            }
+
+            // Row index.
+            row_buf.assign(n + 1, 0);
+            for(size_t j = 0; j < nnz; ++j) ++row_buf[rows[j] + 1];
+            std::partial_sum(row_buf.begin(), row_buf.end(), row_buf.begin());
+
+            // Move entries to their rows in place: each swap puts at least
+            // one entry into its final row.
+            if (!std::is_sorted(rows.begin(), rows.end())) {
+                std::vector<idx_t> next(row_buf.begin(), row_buf.end() - 1);
+
+                for(size_t i = 0; i < n; ++i) {
+                    while(next[i] < row_buf[i + 1]) {
+                        size_t j = next[i];
+                        size_t r = rows[j];
+
+                        if (r == i) {
+                            ++next[i];
+                        } else {
+                            size_t k = next[r]++;
+                            std::swap(rows[j],    rows[k]);
+                            std::swap(col_buf[j], col_buf[k]);
+                            std::swap(val_buf[j], val_buf[k]);
+                        }
+                    }
+                }
+            }
+
+            std::vector<idx_t>().swap(rows);
+
+            // Sort columns within each row.
+#ifdef _OPENMP
+#  pragma omp parallel
+#endif
+            {
+                std::vector< std::pair<col_t, val_t> > buf;
+
+#ifdef _OPENMP
+#  pragma omp for schedule(dynamic, 1024)
+#endif
+                for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(n); ++i) {
+                    size_t b = row_buf[i], e = row_buf[i + 1];
+
+                    if (std::is_sorted(col_buf.begin() + b, col_buf.begin() + e))
+                        continue;
+
+                    buf.clear();
+                    for(size_t j = b; j < e; ++j)
+                        buf.push_back(std::make_pair(col_buf[j], val_buf[j]));
+
+                    std::sort(buf.begin(), buf.end(), [](
+                                const std::pair<col_t, val_t> &a,
+                                const std::pair<col_t, val_t> &b)
+                            { return a.first < b.first; });
+
+                    for(size_t j = b; j < e; ++j) {
+                        col_buf[j] = buf[j - b].first;
+                        val_buf[j] = buf[j - b].second;
+                    }
+                }
+            }
+
+            row_ptr = row_buf.data();
+            col_ptr = col_buf.data();
+            val_ptr = val_buf.data();
+        }
+
+        // Copies (with conversion) array of a binary file.
+        template <typename T, typename S>
+        static void convert(const S *src, size_t size, std::vector<T> &dst) {
+            dst.resize(size);
+
+#ifdef _OPENMP
+#  pragma omp parallel for
+#endif
+            for(ptrdiff_t i = 0; i < static_cast<ptrdiff_t>(size); ++i)
+                dst[i] = static_cast<T>(src[i]);
+        }
+
+        // Returns true when any of the arrays is used in place.
+        bool read_binary(const char *beg, const char *end) {
+            const size_t size = end - beg;
+
+            precondition(size >= 3 * sizeof(std::uint64_t), "Unknown sparse matrix file format");
+
+            const std::uint64_t *hdr = reinterpret_cast<const std::uint64_t*>(beg);
+
+            n   = static_cast<size_t>(hdr[0]);
+            m   = static_cast<size_t>(hdr[1]);
+            nnz = static_cast<size_t>(hdr[2]);
+
+            precondition(size == sizeof(std::uint64_t) * (3 + n + 1 + nnz) + sizeof(double) * nnz,
+                    "Unknown sparse matrix file format");
+
+            const std::uint64_t *row = hdr + 3;
+            const std::uint64_t *col = row + n + 1;
+            const double        *val = reinterpret_cast<const double*>(col + nnz);
+
+            bool in_place = false;
+
+            if (std::is_integral<idx_t>::value && sizeof(idx_t) == sizeof(std::uint64_t)) {
+                row_ptr = reinterpret_cast<const idx_t*>(row);
+                in_place = true;
+            } else {
+                convert(row, n + 1, row_buf);
+                row_ptr = row_buf.data();
+            }
+
+            if (std::is_integral<col_t>::value && sizeof(col_t) == sizeof(std::uint64_t)) {
+                col_ptr = reinterpret_cast<const col_t*>(col);
+                in_place = true;
+            } else {
+                convert(col, nnz, col_buf);
+                col_ptr = col_buf.data();
+            }
+
+            if (std::is_same<val_t, double>::value) {
+                val_ptr = reinterpret_cast<const val_t*>(val);
+                in_place = true;
+            } else {
+                convert(val, nnz, val_buf);
+                val_ptr = val_buf.data();
+            }
+
+            return in_place;
+        }
+};
+
+/// Writes sparse matrix in binary CSR format.
+/**
+ * The file holds number of rows, number of columns, and number of nonzeros
+ * as 64-bit unsigned integers, followed by row index (n + 1 64-bit unsigned
+ * integers), column numbers (64-bit unsigned integers), and values (double
+ * precision numbers). The file may be read with vex::spmat_reader.
+ */
+template <typename idx_t, typename col_t, typename val_t>
+void write_binary_csr(const std::string &fname, size_t n, size_t m,
+        const idx_t *row, const col_t *col, const val_t *val)
+{
+    std::ofstream f(fname.c_str(), std::ios::binary);
+    precondition(f.good(), "Failed to open file for writing");
+
+    const size_t nnz = row[n];
+
+    std::uint64_t hdr[] = {n, m, nnz};
+    f.write(reinterpret_cast<const char*>(hdr), sizeof(hdr));
+
+    // Arrays are converted in blocks to avoid a full copy.
+    std::vector<std::uint64_t> ibuf;
+    std::vector<double>        vbuf;
+    const size_t block = 65536;
+
+    for(size_t i = 0; i <= n; i += block) {
+        ibuf.assign(row + i, row + std::min(n + 1, i + block));
+        f.write(reinterpret_cast<const char*>(ibuf.data()), ibuf.size() * sizeof(std::uint64_t));
+    }
+
+    for(size_t i = 0; i < nnz; i += block) {
+        ibuf.assign(col + i, col + std::min(nnz, i + block));
+        f.write(reinterpret_cast<const char*>(ibuf.data()), ibuf.size() * sizeof(std::uint64_t));
+    }
+
+    for(size_t i = 0; i < nnz; i += block) {
+        vbuf.assign(val + i, val + std::min(nnz, i + block));
+        f.write(reinterpret_cast<const char*>(vbuf.data()), vbuf.size() * sizeof(double));
+    }
+
+    precondition(f.good(), "Failed to write sparse matrix");
+}
+
+} // namespace vex
+
+#endif
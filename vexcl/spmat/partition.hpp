@@ -0,0 +1,438 @@
+#ifndef VEXCL_SPMAT_PARTITION_HPP
+#define VEXCL_SPMAT_PARTITION_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/**
+ * \file   vexcl/spmat/partition.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Partitioning of sparse matrices across compute devices.
+ */
+
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <cmath>
+
+#include <vexcl/vector.hpp>
+
+namespace vex {
+
+/// Row partitioning that balances nonzeros across devices.
+/**
+ * Each device gets a contiguous strip of rows with the number of nonzeros
+ * proportional to the device weight (see vex::set_partitioning()). Vectors
+ * used with the matrix should be allocated with the same partitioning:
+ * \code
+ * auto p = vex::nonzero_partitioning(ctx, n, row.data());
+ * vex::SpMat<double>  A(ctx, n, n, row.data(), col.data(), val.data(), p);
+ * vex::vector<double> x(ctx, p), y(ctx, p);
+ * \endcode
+ */
+template <typename idx_t>
+partitioning nonzero_partitioning(
+        const std::vector<cl::CommandQueue> &queue, size_t n, const idx_t *row)
+{
+    std::vector<double> w = device_weights(queue);
+
+    std::vector<double> cumsum(1, 0);
+    for(auto v = w.begin(); v != w.end(); ++v)
+        cumsum.push_back(cumsum.back() + *v);
+
+    std::vector<size_t> part(1, 0);
+    for(unsigned d = 1; d < queue.size(); ++d) {
+        double target = static_cast<double>(row[n] - row[0]) * cumsum[d] / cumsum.back();
+
+        size_t i = std::lower_bound(row, row + n + 1,
+                static_cast<idx_t>(row[0] + target)) - row;
+
+        part.push_back(std::max(part.back(), std::min(i, n)));
+    }
+    part.push_back(n);
+
+    return partitioning(part);
+}
+
+/// \cond INTERNAL
+namespace detail {
+
+// Adjacency graph of A + A^T without diagonal and duplicate edges.
+template <typename col_t, typename idx_t>
+void symmetric_adjacency(size_t n, const idx_t *row, const col_t *col,
+        std::vector<size_t> &ptr, std::vector<size_t> &adj)
+{
+    ptr.assign(n + 1, 0);
+
+    for(size_t i = 0; i < n; ++i)
+        for(idx_t j = row[i]; j < row[i + 1]; ++j) {
+            size_t c = col[j];
+            if (c == i) continue;
+            ++ptr[i + 1];
+            ++ptr[c + 1];
+        }
+
+    std::partial_sum(ptr.begin(), ptr.end(), ptr.begin());
+
+    adj.resize(ptr.back());
+    {
+        std::vector<size_t> pos(ptr.begin(), ptr.end() - 1);
+
+        for(size_t i = 0; i < n; ++i)
+            for(idx_t j = row[i]; j < row[i + 1]; ++j) {
+                size_t c = col[j];
+                if (c == i) continue;
+                adj[pos[i]++] = c;
+                adj[pos[c]++] = i;
+            }
+    }
+
+    size_t head = 0;
+    for(size_t i = 0, beg = 0; i < n; ++i) {
+        size_t end = ptr[i + 1];
+
+        std::sort(adj.begin() + beg, adj.begin() + end);
+        size_t uend = std::unique(adj.begin() + beg, adj.begin() + end) - adj.begin();
+
+        ptr[i] = head;
+        for(size_t j = beg; j < uend; ++j) adj[head++] = adj[j];
+
+        beg = end;
+    }
+    ptr[n] = head;
+    adj.resize(head);
+}
+
+// Multilevel graph partitioner (recursive bisection with heavy edge matching
+// coarsening and greedy boundary refinement).
+struct graph_partitioner {
+    struct graph {
+        std::vector<size_t> ptr;
+        std::vector<size_t> adj;
+        std::vector<size_t> ewgt;
+        std::vector<size_t> vwgt;
+
+        size_t size() const { return vwgt.size(); }
+
+        size_t weight() const {
+            return std::accumulate(vwgt.begin(), vwgt.end(), size_t(0));
+        }
+    };
+
+    // Returns device number for each vertex of the graph. Vertices are
+    // weighted, and the total weight is split proportionally to the device
+    // weights, while edge cut is kept small.
+    static std::vector<unsigned> apply(const graph &g, const std::vector<double> &dev_weight) {
+        std::vector<unsigned> part(g.size(), 0);
+        std::vector<size_t>   nodes(g.size());
+
+        for(size_t i = 0; i < g.size(); ++i) nodes[i] = i;
+
+        recurse(g, nodes, dev_weight, 0, static_cast<unsigned>(dev_weight.size()), part);
+
+        return part;
+    }
+
+    static void recurse(const graph &g, const std::vector<size_t> &nodes,
+            const std::vector<double> &w, unsigned beg, unsigned end,
+            std::vector<unsigned> &part)
+    {
+        if (end - beg == 1 || g.size() == 0) {
+            for(auto v = nodes.begin(); v != nodes.end(); ++v) part[*v] = beg;
+            return;
+        }
+
+        unsigned mid = (beg + end) / 2;
+
+        double w0 = std::accumulate(w.begin() + beg, w.begin() + mid, 0.0);
+        double w1 = std::accumulate(w.begin() + mid, w.begin() + end, 0.0);
+
+        std::vector<char> side = bisect(g, w0 / (w0 + w1));
+
+        for(int s = 0; s < 2; ++s) {
+            graph sub;
+            std::vector<size_t> sub_nodes;
+
+            induced(g, side, s, sub, sub_nodes);
+
+            for(auto v = sub_nodes.begin(); v != sub_nodes.end(); ++v)
+                *v = nodes[*v];
+
+            if (s == 0)
+                recurse(sub, sub_nodes, w, beg, mid, part);
+            else
+                recurse(sub, sub_nodes, w, mid, end, part);
+        }
+    }
+
+    // Subgraph induced by vertices of the given side. sub_nodes holds the
+    // original numbers of its vertices.
+    static void induced(const graph &g, const std::vector<char> &side, char s,
+            graph &sub, std::vector<size_t> &sub_nodes)
+    {
+        const size_t npos = static_cast<size_t>(-1);
+
+        std::vector<size_t> idx(g.size(), npos);
+
+        for(size_t i = 0; i < g.size(); ++i)
+            if (side[i] == s) {
+                idx[i] = sub_nodes.size();
+                sub_nodes.push_back(i);
+            }
+
+        sub.ptr.push_back(0);
+        for(auto i = sub_nodes.begin(); i != sub_nodes.end(); ++i) {
+            for(size_t j = g.ptr[*i]; j < g.ptr[*i + 1]; ++j) {
+                if (idx[g.adj[j]] == npos) continue;
+                sub.adj.push_back(idx[g.adj[j]]);
+                sub.ewgt.push_back(g.ewgt[j]);
+            }
+            sub.ptr.push_back(sub.adj.size());
+            sub.vwgt.push_back(g.vwgt[*i]);
+        }
+    }
+
+    // Heavy edge matching. Returns false if the graph does not shrink enough.
+    static bool coarsen(const graph &g, graph &c, std::vector<size_t> &cmap) {
+        const size_t n    = g.size();
+        const size_t npos = static_cast<size_t>(-1);
+
+        cmap.assign(n, npos);
+
+        // Visit vertices with fewer neighbours first, so that they have a
+        // chance to get matched.
+        std::vector<size_t> order(n);
+        for(size_t i = 0; i < n; ++i) order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+                return g.ptr[a + 1] - g.ptr[a] < g.ptr[b + 1] - g.ptr[b];
+                });
+
+        std::vector<size_t> first, second;
+        for(auto v = order.begin(); v != order.end(); ++v) {
+            if (cmap[*v] != npos) continue;
+
+            size_t best = *v, best_w = 0;
+            for(size_t j = g.ptr[*v]; j < g.ptr[*v + 1]; ++j) {
+                size_t u = g.adj[j];
+                if (cmap[u] == npos && u != *v && g.ewgt[j] > best_w) {
+                    best   = u;
+                    best_w = g.ewgt[j];
+                }
+            }
+
+            cmap[*v] = cmap[best] = first.size();
+            first.push_back(*v);
+            second.push_back(best);
+        }
+
+        const size_t nc = first.size();
+        if (nc > 0.9 * n) return false;
+
+        std::vector<size_t> marker(nc, npos);
+
+        c.ptr.assign(1, 0);
+        c.adj.clear();
+        c.ewgt.clear();
+        c.vwgt.assign(nc, 0);
+
+        for(size_t cv = 0; cv < nc; ++cv) {
+            size_t row_beg = c.adj.size();
+
+            for(int k = 0; k < 2; ++k) {
+                size_t v = k ? second[cv] : first[cv];
+                if (k && v == first[cv]) break;
+
+                c.vwgt[cv] += g.vwgt[v];
+
+                for(size_t j = g.ptr[v]; j < g.ptr[v + 1]; ++j) {
+                    size_t cu = cmap[g.adj[j]];
+                    if (cu == cv) continue;
+
+                    if (marker[cu] == npos || marker[cu] < row_beg) {
+                        marker[cu] = c.adj.size();
+                        c.adj.push_back(cu);
+                        c.ewgt.push_back(g.ewgt[j]);
+                    } else {
+                        c.ewgt[marker[cu]] += g.ewgt[j];
+                    }
+                }
+            }
+
+            c.ptr.push_back(c.adj.size());
+        }
+
+        return true;
+    }
+
+    // Splits the graph in two parts; part 0 gets given fraction of the total
+    // vertex weight.
+    static std::vector<char> bisect(const graph &g, double frac) {
+        graph c;
+        std::vector<size_t> cmap;
+
+        std::vector<char> side;
+
+        if (g.size() > 64 && coarsen(g, c, cmap)) {
+            std::vector<char> cside = bisect(c, frac);
+
+            side.resize(g.size());
+            for(size_t i = 0; i < g.size(); ++i) side[i] = cside[cmap[i]];
+        } else {
+            side = grow(g, frac);
+        }
+
+        refine(g, side, frac);
+        return side;
+    }
+
+    // Initial bisection by breadth-first graph growing. Several seeds are
+    // tried, and the one giving the smallest cut is kept.
+    static std::vector<char> grow(const graph &g, double frac) {
+        const size_t n      = g.size();
+        const size_t target = static_cast<size_t>(frac * g.weight());
+
+        std::vector<char> best;
+        size_t best_cut = static_cast<size_t>(-1);
+
+        for(size_t seed = 0, ntries = std::min<size_t>(n, 4); seed < ntries; ++seed) {
+            std::vector<char> side(n, 1);
+            std::vector<size_t> queue;
+            queue.reserve(n);
+
+            size_t w = 0;
+            for(size_t start = seed * (n / ntries), k = 0; w < target && k < n; ++k) {
+                size_t s = (start + k) % n;
+                if (!side[s]) continue;
+
+                // New connected component.
+                side[s] = 0;
+                w += g.vwgt[s];
+                queue.assign(1, s);
+
+                for(size_t q = 0; q < queue.size() && w < target; ++q) {
+                    size_t v = queue[q];
+                    for(size_t j = g.ptr[v]; j < g.ptr[v + 1] && w < target; ++j) {
+                        size_t u = g.adj[j];
+                        if (!side[u]) continue;
+
+                        side[u] = 0;
+                        w += g.vwgt[u];
+                        queue.push_back(u);
+                    }
+                }
+            }
+
+            size_t cut = edge_cut(g, side);
+            if (cut < best_cut) {
+                best_cut = cut;
+                best.swap(side);
+            }
+        }
+
+        return best;
+    }
+
+    static size_t edge_cut(const graph &g, const std::vector<char> &side) {
+        size_t cut = 0;
+        for(size_t i = 0; i < g.size(); ++i)
+            for(size_t j = g.ptr[i]; j < g.ptr[i + 1]; ++j)
+                if (side[i] != side[g.adj[j]]) cut += g.ewgt[j];
+        return cut / 2;
+    }
+
+    // Greedy boundary refinement: vertices are moved to the other side when
+    // that reduces the edge cut and keeps the parts balanced (or improves
+    // the balance without increasing the cut).
+    static void refine(const graph &g, std::vector<char> &side, double frac) {
+        const size_t n     = g.size();
+        const double total = static_cast<double>(g.weight());
+
+        size_t max_vw = 0;
+        for(size_t i = 0; i < n; ++i) max_vw = std::max(max_vw, g.vwgt[i]);
+
+        const double target = frac * total;
+        const double tol    = 0.03 * total + max_vw;
+
+        double w0 = 0;
+        for(size_t i = 0; i < n; ++i) if (!side[i]) w0 += g.vwgt[i];
+
+        for(int pass = 0; pass < 8; ++pass) {
+            bool moved = false;
+
+            for(size_t i = 0; i < n; ++i) {
+                long ext = 0, in = 0;
+                for(size_t j = g.ptr[i]; j < g.ptr[i + 1]; ++j)
+                    if (side[g.adj[j]] == side[i])
+                        in  += static_cast<long>(g.ewgt[j]);
+                    else
+                        ext += static_cast<long>(g.ewgt[j]);
+
+                if (ext == 0) continue;
+
+                double nw0  = side[i] ? w0 + g.vwgt[i] : w0 - g.vwgt[i];
+                double dev  = std::fabs(w0  - target);
+                double ndev = std::fabs(nw0 - target);
+
+                if (
+                        (ext >  in && (ndev <= tol || ndev < dev)) ||
+                        (ext == in && ndev < dev) ||
+                        (dev > tol && ndev < dev)
+                   )
+                {
+                    side[i] = !side[i];
+                    w0 = nw0;
+                    moved = true;
+                }
+            }
+
+            if (!moved) break;
+        }
+    }
+};
+
+// Partitions graph of the matrix between devices. Vertices are weighted
+// with the number of nonzeros in the corresponding rows.
+template <typename col_t, typename idx_t>
+std::vector<unsigned> graph_partition(
+        const std::vector<cl::CommandQueue> &queue,
+        size_t n, const idx_t *row, const col_t *col)
+{
+    graph_partitioner::graph g;
+
+    symmetric_adjacency(n, row, col, g.ptr, g.adj);
+
+    g.ewgt.assign(g.adj.size(), 1);
+    g.vwgt.resize(n);
+    for(size_t i = 0; i < n; ++i) g.vwgt[i] = row[i + 1] - row[i] + 1;
+
+    return graph_partitioner::apply(g, device_weights(queue));
+}
+
+} // namespace detail
+/// \endcond
+
+} // namespace vex
+
+#endif
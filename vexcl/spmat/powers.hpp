@@ -0,0 +1,351 @@
+#ifndef VEXCL_SPMAT_POWERS_HPP
+#define VEXCL_SPMAT_POWERS_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+/**
+ * \file   vexcl/spmat/powers.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Communication-avoiding matrix powers kernel.
+ */
+
+#include <vector>
+#include <array>
+#include <set>
+#include <algorithm>
+#include <sstream>
+
+#include <vexcl/vector.hpp>
+#include <vexcl/spmat/exchange.hpp>
+
+namespace vex {
+
+template <typename T, size_t N> class multivector;
+
+/// Matrix powers kernel.
+/**
+ * Computes the sequence [x, Ax, A^2 x, ..., A^s x] needed by s-step Krylov
+ * methods. A plain sequence of products with multi-device vex::SpMat
+ * exchanges ghost values (and synchronizes the devices) once per power.
+ * Here each device keeps s levels of neighbours of its rows: level 1 holds
+ * columns referenced by its own rows and owned by other devices, level k
+ * holds columns referenced by level k - 1 that are not in previous levels.
+ * Input vector values on all levels are fetched in a single exchange
+ * (with the same device-to-device transfers as vex::SpMat uses).
+ * Then each device computes power k on its own rows and levels up to
+ * s - k, so that no further communication is needed. The boundary rows are
+ * thus computed redundantly by several devices.
+ *
+ * The approach pays off for matrices with local connectivity (e.g. mesh
+ * based discretizations), where the levels stay thin.
+ *
+ * Usage:
+ * \code
+ * vex::SpMatPowers<double> A(ctx, n, row.data(), col.data(), val.data(), 4);
+ * vex::multivector<double, 5> y(ctx, n);
+ * A(x, y); // y(k) = A^k x, k = 0..4.
+ * \endcode
+ */
+template <typename val_t, typename col_t = size_t, typename idx_t = size_t>
+class SpMatPowers {
+    public:
+        /// Constructor.
+        /**
+         * \param queue vector of queues. Each queue represents one
+         *            compute device.
+         * \param n   number of rows (and columns) in the matrix.
+         * \param row row index into col and val vectors.
+         * \param col column numbers of nonzero elements of the matrix.
+         * \param val values of nonzero elements of the matrix.
+         * \param s   maximum power to compute.
+         */
+        SpMatPowers(const std::vector<cl::CommandQueue> &queue, size_t n,
+                const idx_t *row, const col_t *col, const val_t *val,
+                unsigned s
+                )
+            : queue(queue), part(partition(n, queue)), n(n), s(s),
+              level(queue.size()), mrow(queue.size()), mcol(queue.size()),
+              mval(queue.size()), wbuf(queue.size()), xchg(queue),
+              gperm(queue.size())
+        {
+            std::vector<ptrdiff_t> lid(n, -1);
+
+            std::vector< std::set<col_t> >    ghost_cols(queue.size());
+            std::vector< std::vector<col_t> > ghost_lid(queue.size());
+
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                size_t beg = part[d], end = part[d + 1];
+                if (beg == end) continue;
+
+                // Own rows come first in local numbering, followed by the
+                // levels of neighbours.
+                std::vector<size_t> ord;
+                for(size_t i = beg; i < end; ++i) {
+                    lid[i] = static_cast<ptrdiff_t>(i - beg);
+                    ord.push_back(i);
+                }
+
+                level[d].push_back(ord.size());
+
+                for(unsigned k = 1; k <= s; ++k) {
+                    size_t lbeg = k > 1 ? level[d][k - 2] : 0;
+                    size_t lend = level[d][k - 1];
+
+                    for(size_t i = lbeg; i < lend; ++i) {
+                        for(idx_t j = row[ord[i]]; j < row[ord[i] + 1]; ++j) {
+                            size_t c = static_cast<size_t>(col[j]);
+                            if (lid[c] < 0) {
+                                lid[c] = 0;
+                                ord.push_back(c);
+                            }
+                        }
+                    }
+
+                    std::sort(ord.begin() + lend, ord.end());
+
+                    for(size_t i = lend; i < ord.size(); ++i)
+                        lid[ord[i]] = static_cast<ptrdiff_t>(i);
+
+                    level[d].push_back(ord.size());
+                }
+
+                for(auto i = ord.begin() + level[d][0]; i != ord.end(); ++i)
+                    ghost_cols[d].insert(static_cast<col_t>(*i));
+
+                // Ghost values arrive sorted by column; this is where they
+                // go in the local numbering.
+                for(auto c = ghost_cols[d].begin(); c != ghost_cols[d].end(); ++c)
+                    ghost_lid[d].push_back(static_cast<col_t>(lid[*c]));
+
+                // Local matrix for own rows and levels 1..s-1.
+                size_t nrows = s ? level[d][s - 1] : 0;
+
+                std::vector<idx_t> r;
+                std::vector<col_t> c;
+                std::vector<val_t> v;
+
+                r.reserve(nrows + 1);
+                r.push_back(0);
+
+                for(size_t i = 0; i < nrows; ++i) {
+                    for(idx_t j = row[ord[i]]; j < row[ord[i] + 1]; ++j) {
+                        c.push_back(static_cast<col_t>(lid[col[j]]));
+                        v.push_back(val[j]);
+                    }
+                    r.push_back(static_cast<idx_t>(c.size()));
+                }
+
+                cl::Context context = qctx(queue[d]);
+
+                mrow[d] = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                        r.size() * sizeof(idx_t), r.data());
+
+                if (!c.empty()) {
+                    mcol[d] = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                            c.size() * sizeof(col_t), c.data());
+                    mval[d] = cl::Buffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                            v.size() * sizeof(val_t), v.data());
+                }
+
+                for(int k = 0; k < 2; ++k)
+                    wbuf[d][k] = cl::Buffer(context, CL_MEM_READ_WRITE,
+                            ord.size() * sizeof(val_t));
+
+                for(auto i = ord.begin(); i != ord.end(); ++i) lid[*i] = -1;
+            }
+
+            xchg.setup(part, ghost_cols);
+
+            for(unsigned d = 0; d < queue.size(); ++d)
+                if (!ghost_lid[d].empty())
+                    gperm[d] = cl::Buffer(qctx(queue[d]),
+                            CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR,
+                            ghost_lid[d].size() * sizeof(col_t), ghost_lid[d].data());
+        }
+
+        /// Number of rows (and columns).
+        size_t rows() const { return n; }
+
+        /// Maximum power the kernel was set up for.
+        unsigned depth() const { return s; }
+
+        /// Computes y(k) = A^k x for k = 0, ..., N - 1.
+        /** N - 1 should not exceed depth(). */
+        template <size_t N>
+        void operator()(const vex::vector<val_t> &x, vex::multivector<val_t, N> &y) const {
+            precondition(N - 1 <= s, "Power exceeds depth of SpMatPowers");
+            precondition(x.partition() == part && y(0).partition() == part,
+                    "Vector partitioning does not match SpMatPowers");
+
+            y(0) = x;
+
+            if (N == 1) return;
+
+            // The only communication.
+            if (xchg.active()) {
+                std::vector< std::vector<cl::Buffer> > xbuf(queue.size());
+                for(unsigned d = 0; d < queue.size(); d++)
+                    xbuf[d].push_back(x(d));
+
+                xchg.start(xbuf, detail::spmm_arg(1, 1));
+            }
+
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                size_t np = part[d + 1] - part[d];
+                if (!np) continue;
+
+                queue[d].enqueueCopyBuffer(x(d), wbuf[d][0], 0, 0, np * sizeof(val_t));
+
+                // Put received ghost values into their places in the local
+                // numbering.
+                if (size_t ng = xchg.ghosts(d)) {
+                    xchg.finish(d, 1);
+
+                    const detail::kernel_cache_entry &k = kernel(queue[d], powers_ghosts);
+                    const std::vector<cl::Event> &wait = xchg.received(d);
+
+                    cl::Kernel krn = k.kernel;
+
+                    unsigned pos = 0;
+                    krn.setArg(pos++, ng);
+                    krn.setArg(pos++, gperm[d]);
+                    krn.setArg(pos++, xchg.values(d));
+                    krn.setArg(pos++, wbuf[d][0]);
+
+                    queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                            alignup(ng, k.wgsize), k.wgsize,
+                            wait.empty() ? NULL : &wait, xchg.remote_done(d));
+                }
+            }
+
+            for(unsigned d = 0; d < queue.size(); ++d) {
+                size_t np = part[d + 1] - part[d];
+                if (!np) continue;
+
+                cl::Device device = qdev(queue[d]);
+                const detail::kernel_cache_entry &k = kernel(queue[d], powers_step);
+
+                cl::Kernel krn = k.kernel;
+                size_t g_size = num_workgroups(device) * k.wgsize;
+
+                for(unsigned p = 1; p < N; ++p) {
+                    // Power p is needed on own rows and levels 1..N-1-p.
+                    size_t nrows = level[d][N - 1 - p];
+
+                    unsigned pos = 0;
+                    krn.setArg(pos++, nrows);
+                    krn.setArg(pos++, np);
+                    krn.setArg(pos++, mrow[d]);
+                    if (mcol[d]()) {
+                        krn.setArg(pos++, mcol[d]);
+                        krn.setArg(pos++, mval[d]);
+                    } else {
+                        krn.setArg(pos++, static_cast<void*>(0));
+                        krn.setArg(pos++, static_cast<void*>(0));
+                    }
+                    krn.setArg(pos++, wbuf[d][(p - 1) % 2]);
+                    krn.setArg(pos++, wbuf[d][p % 2]);
+                    krn.setArg(pos++, y(p)(d));
+
+                    queue[d].enqueueNDRangeKernel(krn, cl::NullRange, g_size, k.wgsize);
+                }
+            }
+        }
+    private:
+        std::vector<cl::CommandQueue> queue;
+        std::vector<size_t> part;
+        size_t   n;
+        unsigned s;
+
+        // Ends of own rows and neighbour levels in local numbering.
+        std::vector< std::vector<size_t> > level;
+
+        std::vector<cl::Buffer> mrow, mcol, mval;
+        std::vector< std::array<cl::Buffer, 2> > wbuf;
+
+        // Exchange of ghost values on all levels, and their positions in the
+        // local numbering (in the order they are received).
+        detail::ghost_exchange<val_t, col_t> xchg;
+        std::vector<cl::Buffer> gperm;
+
+        enum stage { powers_ghosts, powers_step };
+
+        static std::string kernel_source(const cl::Device &device) {
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<val_t>() << " val_t;\n"
+                "typedef " << type_name<col_t>() << " col_t;\n"
+                "typedef " << type_name<idx_t>() << " idx_t;\n"
+                "kernel void matrix_powers_ghosts(\n"
+                "    " << type_name<size_t>() << " n,\n"
+                "    global const col_t * perm,\n"
+                "    global const val_t * ghost,\n"
+                "    global val_t * w\n"
+                "    )\n"
+                "{\n"
+                "    size_t i = get_global_id(0);\n"
+                "    if (i < n) w[perm[i]] = ghost[i];\n"
+                "}\n"
+                "kernel void matrix_powers_step(\n"
+                "    " << type_name<size_t>() << " n,\n"
+                "    " << type_name<size_t>() << " nown,\n"
+                "    global const idx_t * row,\n"
+                "    global const col_t * col,\n"
+                "    global const val_t * val,\n"
+                "    global const val_t * x,\n"
+                "    global val_t * w,\n"
+                "    global val_t * y\n"
+                "    )\n"
+                "{\n"
+                "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+                "        val_t sum = 0;\n"
+                "        for(size_t j = row[i], e = row[i + 1]; j < e; ++j)\n"
+                "            sum += val[j] * x[col[j]];\n"
+                "        w[i] = sum;\n"
+                "        if (i < nown) y[i] = sum;\n"
+                "    }\n"
+                "}\n";
+
+            return source.str();
+        }
+
+        // Both kernels are built at once for each context.
+        static const detail::kernel_cache_entry& kernel(
+                const cl::CommandQueue &q, stage k)
+        {
+            static detail::kernel_cache cache[2];
+
+            static const char *name[] = {
+                "matrix_powers_ghosts", "matrix_powers_step"
+            };
+
+            return detail::program_kernel(q, cache, name, 2, k, kernel_source);
+        }
+};
+
+} // namespace vex
+
+#endif
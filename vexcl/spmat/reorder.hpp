@@ -0,0 +1,333 @@
+#ifndef VEXCL_SPMAT_REORDER_HPP
+#define VEXCL_SPMAT_REORDER_HPP
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/**
+ * \file   vexcl/spmat/reorder.hpp
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Bandwidth-reducing reordering of sparse matrices.
+ */
+
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <type_traits>
+
+#include <vexcl/spmat/partition.hpp>
+
+namespace vex {
+
+/// \cond INTERNAL
+namespace detail {
+
+// Reverse Cuthill-McKee ordering of a square matrix. The structure of the
+// matrix is symmetrized before ordering. Returns the permutation: row i of
+// the reordered matrix is row perm[i] of the original one.
+template <typename col_t, typename idx_t>
+std::vector<size_t> rcm(size_t n, const idx_t *row, const col_t *col) {
+    std::vector<size_t> ptr, adj;
+    symmetric_adjacency(n, row, col, ptr, adj);
+
+    auto degree = [&](size_t i) { return ptr[i + 1] - ptr[i]; };
+
+    std::vector<size_t> perm;
+    perm.reserve(n);
+
+    std::vector<char>   visited(n, false);
+    std::vector<size_t> level(n);
+
+    // Breadth-first search from root. Returns nodes of the component in
+    // Cuthill-McKee order; level[] holds their distances from root.
+    std::vector<char> seen(n, false);
+    auto bfs = [&](size_t root, std::vector<size_t> &order) {
+        order.clear();
+        order.push_back(root);
+        seen[root]  = true;
+        level[root] = 0;
+
+        std::vector<size_t> nbr;
+        for(size_t k = 0; k < order.size(); ++k) {
+            size_t i = order[k];
+
+            nbr.clear();
+            for(size_t j = ptr[i]; j < ptr[i + 1]; ++j)
+                if (!seen[adj[j]]) {
+                    seen[adj[j]] = true;
+                    nbr.push_back(adj[j]);
+                }
+
+            std::stable_sort(nbr.begin(), nbr.end(),
+                    [&](size_t a, size_t b) { return degree(a) < degree(b); });
+
+            for(auto v = nbr.begin(); v != nbr.end(); ++v) {
+                level[*v] = level[i] + 1;
+                order.push_back(*v);
+            }
+        }
+
+        for(auto v = order.begin(); v != order.end(); ++v) seen[*v] = false;
+    };
+
+    std::vector<size_t> order;
+    for(size_t s = 0; s < n; ++s) {
+        if (visited[s]) continue;
+
+        // Find pseudo-peripheral node of the component: the last level of a
+        // breadth-first search is searched for a node of minimum degree,
+        // until eccentricity stops growing.
+        size_t root = s;
+        bfs(root, order);
+
+        for(size_t ecc = level[order.back()], iter = 0; iter < 8; ++iter) {
+            size_t cand = order.back();
+            for(auto v = order.rbegin(); v != order.rend() && level[*v] == ecc; ++v)
+                if (degree(*v) < degree(cand)) cand = *v;
+
+            bfs(cand, order);
+
+            if (level[order.back()] <= ecc) {
+                bfs(root, order);
+                break;
+            }
+
+            root = cand;
+            ecc  = level[order.back()];
+        }
+
+        for(auto v = order.begin(); v != order.end(); ++v) {
+            visited[*v] = true;
+            perm.push_back(*v);
+        }
+    }
+
+    std::reverse(perm.begin(), perm.end());
+    return perm;
+}
+
+} // namespace detail
+/// \endcond
+
+/// Bandwidth-reducing reordering of a sparse matrix.
+/**
+ * Reduces bandwidth of a square sparse matrix, which improves reuse of x in
+ * matrix-vector products and shrinks the sets of ghost values exchanged
+ * between devices. The reordered matrix is kept in host memory in CSR format
+ * and may be used to construct vex::SpMat. Vectors are moved into and out of
+ * the reordered space on the compute devices:
+ * \code
+ * vex::reorder<double> R(ctx, n, row.data(), col.data(), val.data());
+ * vex::SpMat<double> A(ctx, n, n, R.row(), R.col(), R.val(), R.partition());
+ *
+ * vex::vector<double> X(ctx, R.partition()), Y(ctx, R.partition());
+ *
+ * X = R.forward(x);  // x is in original order.
+ * Y = A * X;
+ * y = R.inverse(Y);  // y is in original order.
+ * \endcode
+ * With vex::reorder_graph method the devices get unequal number of rows, so
+ * the matrix and the vectors in reordered space have to use R.partition().
+ * SpMat may also be reordered on construction (see SpMat::permutation()).
+ * Default template parameters are given in the declaration in
+ * vexcl/spmat.hpp.
+ */
+template <typename val_t, typename col_t, typename idx_t>
+class reorder {
+    static_assert(std::is_arithmetic<val_t>::value,
+            "Only scalar value types are supported.");
+
+    public:
+        /// Matrix layout statistics.
+        struct stats {
+            /// Maximum distance of a nonzero from diagonal.
+            size_t bandwidth;
+            /// Total number of ghost columns over all devices.
+            size_t ghosts;
+        };
+
+        /// Constructor.
+        /**
+         * Computes the ordering and reorders the matrix.
+         * \param queue vector of queues. Vectors used with the reordered
+         *              matrix should be allocated on these queues.
+         * \param n     number of rows (and columns) in the matrix.
+         * \param row   row index into col and val vectors.
+         * \param col   column numbers of nonzero elements of the matrix.
+         * \param val   values of nonzero elements of the matrix.
+         * \param method reordering method.
+         */
+        reorder(const std::vector<cl::CommandQueue> &queue,
+                size_t n, const idx_t *row, const col_t *col, const val_t *val,
+                reorder_method method = reorder_rcm
+               )
+            : queue(queue), n(n), perm(detail::rcm(n, row, col)), inv(n)
+        {
+            if (method == reorder_graph && queue.size() > 1) {
+                std::vector<unsigned> dev = detail::graph_partition(queue, n, row, col);
+
+                std::stable_sort(perm.begin(), perm.end(), [&](size_t a, size_t b) {
+                        return dev[a] < dev[b];
+                        });
+
+                std::vector<size_t> p(queue.size() + 1, 0);
+                for(size_t i = 0; i < n; ++i) ++p[dev[i] + 1];
+                std::partial_sum(p.begin(), p.end(), p.begin());
+
+                part = partitioning(p);
+            } else {
+                part = partitioning(vex::partition(n, queue));
+            }
+
+            for(size_t i = 0; i < n; ++i) inv[perm[i]] = i;
+
+            // Reorder the matrix.
+            r.reserve(n + 1);
+            c.reserve(row[n]);
+            v.reserve(row[n]);
+
+            r.push_back(0);
+
+            std::vector< std::pair<col_t, val_t> > buf;
+            for(size_t i = 0; i < n; ++i) {
+                size_t k = perm[i];
+
+                buf.clear();
+                for(idx_t j = row[k]; j < row[k + 1]; ++j)
+                    buf.push_back(std::make_pair(static_cast<col_t>(inv[col[j]]), val[j]));
+
+                std::sort(buf.begin(), buf.end(),
+                        [](const std::pair<col_t, val_t> &a, const std::pair<col_t, val_t> &b) {
+                            return a.first < b.first;
+                        });
+
+                for(auto e = buf.begin(); e != buf.end(); ++e) {
+                    c.push_back(e->first);
+                    v.push_back(e->second);
+                }
+
+                r.push_back(static_cast<idx_t>(c.size()));
+            }
+
+            before = get_stats(vex::partition(n, queue), row, col);
+            after  = get_stats(part.part, r.data(), c.data());
+        }
+
+        /// Permutation: row i of reordered matrix is row permutation()[i] of the original.
+        const std::vector<size_t>& permutation() const { return perm; }
+
+        /// Partitioning of the reordered matrix and vectors across devices.
+        const partitioning& partition() const { return part; }
+
+        /// Row index of the reordered matrix.
+        const idx_t* row() const { return r.data(); }
+        /// Column numbers of the reordered matrix.
+        const col_t* col() const { return c.data(); }
+        /// Values of the reordered matrix.
+        const val_t* val() const { return v.data(); }
+
+        /// Number of rows (and columns).
+        size_t rows() const { return n; }
+        /// Number of non-zero entries.
+        size_t nonzeros() const { return v.size(); }
+
+        /// Layout statistics of the original matrix.
+        const stats& original() const { return before; }
+        /// Layout statistics of the reordered matrix.
+        const stats& reordered() const { return after; }
+
+        /// Moves vector from original into reordered space.
+        spmv<val_t, size_t, size_t, val_t> forward(const vector<val_t> &x) const {
+            if (!P) permutation_matrices();
+            return (*P) * x;
+        }
+
+        /// Moves vector from reordered into original space.
+        spmv<val_t, size_t, size_t, val_t> inverse(const vector<val_t> &x) const {
+            if (!P) permutation_matrices();
+            return (*Pt) * x;
+        }
+    private:
+        std::vector<cl::CommandQueue> queue;
+
+        size_t n;
+
+        std::vector<size_t> perm;
+        std::vector<size_t> inv;
+
+        std::vector<idx_t> r;
+        std::vector<col_t> c;
+        std::vector<val_t> v;
+
+        partitioning part;
+
+        stats before, after;
+
+        mutable std::unique_ptr< SpMat<val_t, size_t, size_t> > P, Pt;
+
+        // Permutation matrices are only built when vectors are moved
+        // between the spaces.
+        void permutation_matrices() const {
+            std::vector<size_t> prow(n + 1);
+            std::vector<val_t>  ones(n, static_cast<val_t>(1));
+
+            for(size_t i = 0; i <= n; ++i) prow[i] = i;
+
+            partitioning orig(vex::partition(n, queue));
+
+            P .reset(new SpMat<val_t, size_t, size_t>(queue, n, n,
+                        prow.data(), perm.data(), ones.data(), part, orig));
+            Pt.reset(new SpMat<val_t, size_t, size_t>(queue, n, n,
+                        prow.data(), inv.data(), ones.data(), orig, part));
+        }
+
+        template <typename I, typename C>
+        stats get_stats(const std::vector<size_t> &bounds, const I *row, const C *col) const {
+            stats s = {0, 0};
+
+            for(unsigned d = 0; d + 1 < bounds.size(); ++d) {
+                std::vector<size_t> ghost;
+
+                for(size_t i = bounds[d]; i < bounds[d + 1]; ++i) {
+                    for(I j = row[i]; j < row[i + 1]; ++j) {
+                        size_t k = col[j];
+
+                        s.bandwidth = std::max(s.bandwidth, k > i ? k - i : i - k);
+
+                        if (k < bounds[d] || k >= bounds[d + 1]) ghost.push_back(k);
+                    }
+                }
+
+                std::sort(ghost.begin(), ghost.end());
+                s.ghosts += std::unique(ghost.begin(), ghost.end()) - ghost.begin();
+            }
+
+            return s;
+        }
+};
+
+} // namespace vex
+
+#endif
@@ -0,0 +1,456 @@
+#ifndef VEXCL_SPMAT_SELL_INL
+#define VEXCL_SPMAT_SELL_INL
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/**
+ * \file   vexcl/spmat/sell.inl
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  OpenCL sparse matrix in SELL-C-sigma format.
+ */
+
+struct SpMatSELL : public sparse_matrix {
+    // Slice height (C).
+    static const size_t chunk = 32;
+
+    // Window (in rows) within which rows are sorted by length (sigma).
+    static const size_t sigma = 8 * chunk;
+
+    const cl::CommandQueue &queue;
+    size_t n, nslices;
+
+    struct matrix_part {
+        size_t     nnz;
+        cl::Buffer ptr;  // Start of each slice in col and val.
+        cl::Buffer row;  // Row stored at each position of a slice.
+        cl::Buffer pos;  // Position of each row (inverse of row).
+        cl::Buffer col;
+        cl::Buffer val;
+        size_t     size; // Size of col and val (with padding).
+    } loc, rem;
+
+    SpMatSELL(
+            const cl::CommandQueue &queue,
+            const idx_t *row, const col_t *col, const val_t *val,
+            size_t row_begin, size_t row_end, size_t col_begin, size_t col_end,
+            std::set<col_t> ghost_cols
+            )
+        : queue(queue), n(row_end - row_begin), nslices((n + chunk - 1) / chunk)
+    {
+        auto is_local = [col_begin, col_end](size_t c) {
+            return c >= col_begin && c < col_end;
+        };
+
+        // Renumber columns.
+        std::unordered_map<col_t, col_t> r2l(2 * ghost_cols.size());
+        size_t nghost = 0;
+        for(auto c = ghost_cols.begin(); c != ghost_cols.end(); ++c)
+            r2l[*c] = static_cast<col_t>(nghost++);
+
+        // Split the strip into local and remote parts.
+        std::vector<idx_t> lrow, rrow;
+        std::vector<col_t> lcol, rcol;
+        std::vector<mat_t> lval, rval;
+
+        lrow.reserve(n + 1);
+        lrow.push_back(0);
+
+        lcol.reserve(row[row_end] - row[row_begin]);
+        lval.reserve(row[row_end] - row[row_begin]);
+
+        if (!ghost_cols.empty()) {
+            rrow.reserve(n + 1);
+            rrow.push_back(0);
+        }
+
+        for(size_t i = row_begin; i < row_end; ++i) {
+            for(idx_t j = row[i]; j < row[i + 1]; j++) {
+                if (is_local(col[j])) {
+                    lcol.push_back(static_cast<col_t>(col[j] - col_begin));
+                    lval.push_back(static_cast<mat_t>(val[j]));
+                } else {
+                    assert(r2l.count(col[j]));
+                    rcol.push_back(r2l[col[j]]);
+                    rval.push_back(static_cast<mat_t>(val[j]));
+                }
+            }
+
+            lrow.push_back(static_cast<idx_t>(lcol.size()));
+            if (!ghost_cols.empty())
+                rrow.push_back(static_cast<idx_t>(rcol.size()));
+        }
+
+        std::vector<idx_t> lpos, rpos;
+
+        convert(loc, lrow, lcol, lval, lpos);
+
+        if (ghost_cols.empty())
+            rem.nnz = 0;
+        else
+            convert(rem, rrow, rcol, rval, rpos);
+
+        // Position of each nonzero in the value buffers (see map_values()).
+        std::vector<idx_t> perm;
+        perm.reserve(row[row_end] - row[row_begin]);
+
+        for(idx_t j = row[row_begin], l = 0, r = 0; j < row[row_end]; ++j)
+            perm.push_back(is_local(col[j]) ? lpos[l++] : static_cast<idx_t>(loc.size + rpos[r++]));
+
+        std::vector<cl::Buffer> buf;
+        std::vector<size_t>     size;
+
+        buf.push_back(loc.val); size.push_back(loc.nnz ? loc.size : 0);
+        buf.push_back(rem.val); size.push_back(rem.nnz ? rem.size : 0);
+
+        this->map_values(queue, buf, size, perm);
+    }
+
+    // Converts CSR part of the matrix to SELL-C-sigma format and copies it
+    // to the device. dest receives position of each nonzero in the format.
+    void convert(matrix_part &part,
+            const std::vector<idx_t> &row,
+            const std::vector<col_t> &col,
+            const std::vector<mat_t> &val,
+            std::vector<idx_t> &dest
+            )
+    {
+        part.nnz  = row.back();
+        part.size = 0;
+        if (!part.nnz) return;
+
+        const col_t not_a_column = static_cast<col_t>(-1);
+        const size_t npos = nslices * chunk;
+
+        auto width = [&](size_t i) -> size_t {
+            return i < n ? row[i + 1] - row[i] : 0;
+        };
+
+        // Sort rows by length inside each sigma-window. Positions past the
+        // end of the matrix are padding.
+        std::vector<size_t> perm(npos);
+        for(size_t i = 0; i < npos; ++i) perm[i] = i;
+
+        for(size_t w = 0; w < npos; w += sigma)
+            std::stable_sort(perm.begin() + w, perm.begin() + std::min(w + sigma, npos),
+                    [&](size_t a, size_t b) { return width(a) > width(b); });
+
+        // Each slice is padded to its longest row.
+        std::vector<size_t> ptr(nslices + 1, 0);
+        for(size_t s = 0; s < nslices; ++s) {
+            size_t w = 0;
+            for(size_t k = s * chunk; k < (s + 1) * chunk; ++k)
+                w = std::max(w, width(perm[k]));
+
+            ptr[s + 1] = ptr[s] + w * chunk;
+        }
+
+        std::vector<col_t> scol(ptr.back(), not_a_column);
+        std::vector<mat_t> sval(ptr.back(), mat_t());
+        std::vector<size_t> pos(n);
+        dest.resize(part.nnz);
+
+        for(size_t k = 0; k < npos; ++k) {
+            size_t i = perm[k];
+            if (i >= n) continue;
+
+            pos[i] = k;
+
+            size_t s = k / chunk;
+            size_t l = k % chunk;
+
+            for(size_t j = row[i], p = ptr[s] + l; j < static_cast<size_t>(row[i + 1]); ++j, p += chunk) {
+                scol[p] = col[j];
+                sval[p] = val[j];
+                dest[j] = static_cast<idx_t>(p);
+            }
+        }
+
+        part.size = sval.size();
+
+        cl::Context ctx = qctx(queue);
+
+        part.ptr = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(ptr),  ptr.data());
+        part.row = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(perm), perm.data());
+        part.pos = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(pos),  pos.data());
+        part.col = cl::Buffer(ctx, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(scol), scol.data());
+        part.val = cl::Buffer(ctx, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes(sval), sval.data());
+    }
+
+    template <class OP>
+    void mul(
+            const matrix_part &part,
+            const cl::Buffer &in, const cl::Buffer &out, scalar_type scale,
+            const std::vector<cl::Event> &wait_for_it = std::vector<cl::Event>(),
+            cl::Event *done = 0
+            ) const
+    {
+        using namespace detail;
+
+        static kernel_cache cache;
+
+        cl::Context context = qctx(queue);
+        cl::Device  device  = qdev(queue);
+
+        auto kernel = cache.find(context());
+
+        if (kernel == cache.end()) {
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "kernel void sell_spmv(\n"
+                "    " << type_name<size_t>() << " n,\n"
+                "    " << type_name<size_t>() << " npos,\n"
+                "    " << type_name<size_t>() << " chunk,\n"
+                "    " << type_name<scalar_type>() << " scale,\n"
+                "    global const " << type_name<size_t>() << " * ptr,\n"
+                "    global const " << type_name<size_t>() << " * row,\n"
+                "    global const " << type_name<col_t>() << " * col,\n"
+                "    global const " << type_name<mat_t>() << " * val,\n"
+                "    global const " << type_name<val_t>() << " * in,\n"
+                "    global       " << type_name<val_t>() << " * out\n"
+                "    )\n"
+                "{\n"
+                "    for (size_t k = get_global_id(0); k < npos; k += get_global_size(0)) {\n"
+                "        size_t i = row[k];\n"
+                "        if (i >= n) continue;\n"
+                "        size_t s = k / chunk;\n"
+                "        size_t e = ptr[s + 1];\n"
+                "        " << type_name<val_t>() << " sum = 0;\n"
+                "        for(size_t j = ptr[s] + k % chunk; j < e; j += chunk) {\n"
+                "            " << type_name<col_t>() << " c = col[j];\n"
+                "            if (c != (" << type_name<col_t>() << ")(-1))\n"
+                "                sum += val[j] * in[c];\n"
+                "        }\n"
+                "        out[i] " << OP::string() << " scale * sum;\n"
+                "    }\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel krn(program, "sell_spmv");
+            size_t     wgs = kernel_workgroup_size(krn, device);
+
+            kernel = cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(krn, wgs)
+                        )).first;
+        }
+
+        cl::Kernel krn    = kernel->second.kernel;
+        size_t     wgsize = kernel->second.wgsize;
+        size_t     g_size = num_workgroups(device) * wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, n);
+        krn.setArg(pos++, nslices * chunk);
+        krn.setArg(pos++, size_t(chunk));
+        krn.setArg(pos++, scale);
+        krn.setArg(pos++, part.ptr);
+        krn.setArg(pos++, part.row);
+        krn.setArg(pos++, part.col);
+        krn.setArg(pos++, part.val);
+        krn.setArg(pos++, in);
+        krn.setArg(pos++, out);
+
+        queue.enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize,
+                wait_for_it.empty() ? NULL : &wait_for_it, done);
+    }
+
+    template <class OP>
+    void mul_multi(
+            const matrix_part &part,
+            const std::vector<cl::Buffer> &in,  const detail::spmm_arg &ia,
+            const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+            scalar_type scale,
+            const std::vector<cl::Event> &wait_for_it = std::vector<cl::Event>(),
+            cl::Event *done = 0
+            ) const
+    {
+        using namespace detail;
+
+        static std::map<std::pair<unsigned, unsigned>, kernel_cache> caches;
+
+        kernel_cache &cache = caches[std::make_pair(ia.key(), oa.key())];
+
+        cl::Context context = qctx(queue);
+        cl::Device  device  = qdev(queue);
+
+        auto kernel = cache.find(context());
+
+        if (kernel == cache.end()) {
+            const unsigned N = ia.N;
+
+            std::ostringstream source;
+
+            source << standard_kernel_header(device) <<
+                "typedef " << type_name<val_t>() << " val_t;\n"
+                "typedef " << type_name<mat_t>() << " mat_t;\n"
+                "typedef " << type_name<col_t>() << " col_t;\n"
+                "kernel void sell_spmm(\n"
+                "    " << type_name<size_t>() << " n,\n"
+                "    " << type_name<size_t>() << " npos,\n"
+                "    " << type_name<size_t>() << " chunk,\n"
+                "    " << type_name<scalar_type>() << " scale,\n"
+                "    global const " << type_name<size_t>() << " * ptr,\n"
+                "    global const " << type_name<size_t>() << " * row,\n"
+                "    global const col_t * col,\n"
+                "    global const mat_t * val"
+                << ia.params("in", "val_t", true)
+                << oa.params("out", "val_t", false) << "\n"
+                "    )\n"
+                "{\n"
+                "    for (size_t k = get_global_id(0); k < npos; k += get_global_size(0)) {\n"
+                "        size_t i = row[k];\n"
+                "        if (i >= n) continue;\n"
+                "        size_t s = k / chunk;\n"
+                "        size_t e = ptr[s + 1];\n";
+            for(unsigned m = 0; m < N; ++m)
+                source <<
+                "        val_t sum" << m << " = 0;\n";
+            source <<
+                "        for(size_t j = ptr[s] + k % chunk; j < e; j += chunk) {\n"
+                "            col_t c = col[j];\n"
+                "            if (c != (col_t)(-1)) {\n"
+                "                mat_t v = val[j];\n";
+            for(unsigned m = 0; m < N; ++m)
+                source <<
+                "                sum" << m << " += v * " << ia("in", m, "c") << ";\n";
+            source <<
+                "            }\n"
+                "        }\n";
+            for(unsigned m = 0; m < N; ++m)
+                source <<
+                "        " << oa("out", m, "i") << " " << OP::string() << " scale * sum" << m << ";\n";
+            source <<
+                "    }\n"
+                "}\n";
+
+            auto program = build_sources(context, source.str());
+
+            cl::Kernel krn(program, "sell_spmm");
+            size_t     wgs = kernel_workgroup_size(krn, device);
+
+            kernel = cache.insert(std::make_pair(
+                        context(), kernel_cache_entry(krn, wgs)
+                        )).first;
+        }
+
+        cl::Kernel krn    = kernel->second.kernel;
+        size_t     wgsize = kernel->second.wgsize;
+        size_t     g_size = num_workgroups(device) * wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, n);
+        krn.setArg(pos++, nslices * chunk);
+        krn.setArg(pos++, size_t(chunk));
+        krn.setArg(pos++, scale);
+        krn.setArg(pos++, part.ptr);
+        krn.setArg(pos++, part.row);
+        krn.setArg(pos++, part.col);
+        krn.setArg(pos++, part.val);
+        ia.set_args(krn, pos, in);
+        oa.set_args(krn, pos, out);
+
+        queue.enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize,
+                wait_for_it.empty() ? NULL : &wait_for_it, done);
+    }
+
+    void mul_local(const cl::Buffer &in, const cl::Buffer &out,
+            scalar_type scale, bool append) const
+    {
+        if (append) {
+            if (loc.nnz) mul<assign::ADD>(loc, in, out, scale);
+        } else {
+            if (loc.nnz)
+                mul<assign::SET>(loc, in, out, scale);
+            else
+                vector<val_t>(queue, out) = 0;
+        }
+    }
+
+    void mul_remote(const cl::Buffer &in, const cl::Buffer &out, scalar_type scale,
+            const std::vector<cl::Event> &wait_for_it, cl::Event *done) const
+    {
+        if (rem.nnz)
+            mul<assign::ADD>(rem, in, out, scale, wait_for_it, done);
+        else if (done)
+            *done = cl::Event();
+    }
+
+    void mul_local_multi(
+            const std::vector<cl::Buffer> &in,  const detail::spmm_arg &ia,
+            const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+            scalar_type scale, bool append) const
+    {
+        if (append) {
+            if (loc.nnz) mul_multi<assign::ADD>(loc, in, ia, out, oa, scale);
+        } else {
+            if (loc.nnz)
+                mul_multi<assign::SET>(loc, in, ia, out, oa, scale);
+            else
+                for(auto y = out.begin(); y != out.end(); ++y)
+                    vector<val_t>(queue, *y) = 0;
+        }
+    }
+
+    void mul_remote_multi(
+            const cl::Buffer &in, const detail::spmm_arg &ia,
+            const std::vector<cl::Buffer> &out, const detail::spmm_arg &oa,
+            scalar_type scale, const std::vector<cl::Event> &wait_for_it,
+            cl::Event *done) const
+    {
+        if (rem.nnz)
+            mul_multi<assign::ADD>(rem, std::vector<cl::Buffer>(1, in), ia,
+                    out, oa, scale, wait_for_it, done);
+        else if (done)
+            *done = cl::Event();
+    }
+
+    // Inline SpMV and transposed product use hybrid ELL code (see
+    // SpMatHELL::inline_preamble()), which understands sliced ELL part.
+    // Slice height is passed as ELL pitch.
+    void hell_args(cl::Kernel &krn, unsigned &pos, bool remote) const {
+        const matrix_part &part = remote ? rem : loc;
+
+        krn.setArg(pos++, size_t(0));
+        krn.setArg(pos++, size_t(chunk));
+        if (part.nnz) {
+            krn.setArg(pos++, part.col);
+            krn.setArg(pos++, part.val);
+            krn.setArg(pos++, part.ptr);
+            krn.setArg(pos++, part.pos);
+        } else {
+            krn.setArg(pos++, static_cast<void*>(0));
+            krn.setArg(pos++, static_cast<void*>(0));
+            krn.setArg(pos++, static_cast<void*>(0));
+            krn.setArg(pos++, static_cast<void*>(0));
+        }
+        krn.setArg(pos++, static_cast<void*>(0));
+        krn.setArg(pos++, static_cast<void*>(0));
+        krn.setArg(pos++, static_cast<void*>(0));
+    }
+};
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef VEXCL_SPMAT_SPGEMM_INL
+#define VEXCL_SPMAT_SPGEMM_INL
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+
+/**
+ * \file   vexcl/spmat/spgemm.inl
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Sparse matrix - sparse matrix product.
+ */
+
+// The product C = A * B is computed row by row with expand-sort-compress
+// algorithm. Rows of A and B are walked through hybrid ELL arguments (see
+// transposed.inl), so that operands may be stored in any format. The result
+// is kept in CSR format with sorted columns, which lets the numeric phase
+// find position of each product term with binary search and reuse the
+// pattern when values of the operands change.
+
+static std::string spgemm_source(const cl::Device &device) {
+    std::ostringstream source;
+
+    source << standard_kernel_header(device) <<
+        "typedef " << type_name<val_t>() << " val_t;\n"
+        "typedef " << type_name<mat_t>() << " mat_t;\n"
+        "typedef " << type_name<col_t>() << " col_t;\n"
+        "typedef " << type_name<idx_t>() << " idx_t;\n"
+        "kernel void spgemm_bound(\n"
+        "    " << type_name<size_t>() << " n,\n"
+        << hell_parameters("A_") << hell_parameters("B_") <<
+        "    global idx_t * bound\n"
+        "    )\n"
+        "{\n"
+        "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+        "        size_t w = 0;\n"
+        << hell_row("col_t k = c;\n" + hell_row("++w;", "B_", "k"), "A_") <<
+        "        bound[i] = w;\n"
+        "    }\n"
+        "}\n"
+        "kernel void spgemm_expand(\n"
+        "    " << type_name<size_t>() << " n,\n"
+        << hell_parameters("A_") << hell_parameters("B_") <<
+        "    global const idx_t * ptr,\n"
+        "    global col_t * tmp,\n"
+        "    global idx_t * cnt\n"
+        "    )\n"
+        "{\n"
+        "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+        "        size_t beg = ptr[i], end = beg;\n"
+        << hell_row("col_t k = c;\n" + hell_row("tmp[end++] = c;", "B_", "k"), "A_") <<
+        "        for(size_t j = beg + 1; j < end; ++j) {\n"
+        "            col_t c = tmp[j];\n"
+        "            size_t k = j;\n"
+        "            for(; k > beg && tmp[k - 1] > c; --k) tmp[k] = tmp[k - 1];\n"
+        "            tmp[k] = c;\n"
+        "        }\n"
+        "        size_t w = 0;\n"
+        "        for(size_t j = beg; j < end; ++j)\n"
+        "            if (w == 0 || tmp[j] != tmp[beg + w - 1]) tmp[beg + w++] = tmp[j];\n"
+        "        cnt[i] = w;\n"
+        "    }\n"
+        "}\n"
+        "kernel void spgemm_compact(\n"
+        "    " << type_name<size_t>() << " n,\n"
+        "    global const idx_t * ptr,\n"
+        "    global const col_t * tmp,\n"
+        "    global const idx_t * C_row,\n"
+        "    global col_t * C_col\n"
+        "    )\n"
+        "{\n"
+        "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+        "        size_t beg = C_row[i], end = C_row[i + 1];\n"
+        "        global const col_t * src = tmp + ptr[i];\n"
+        "        for(size_t j = beg; j < end; ++j) C_col[j] = src[j - beg];\n"
+        "    }\n"
+        "}\n"
+        "kernel void spgemm_numeric(\n"
+        "    " << type_name<size_t>() << " n,\n"
+        << hell_parameters("A_") << hell_parameters("B_") <<
+        "    global const idx_t * C_row,\n"
+        "    global const col_t * C_col,\n"
+        "    global mat_t * C_val\n"
+        "    )\n"
+        "{\n"
+        "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+        "        size_t beg = C_row[i], end = C_row[i + 1];\n"
+        "        for(size_t j = beg; j < end; ++j) C_val[j] = 0;\n"
+        << hell_row("col_t k = c; val_t a = v;\n" + hell_row(
+                    "size_t lo = beg, hi = end;\n"
+                    "while(lo < hi) {\n"
+                    "    size_t mid = (lo + hi) / 2;\n"
+                    "    if (C_col[mid] < c) lo = mid + 1; else hi = mid;\n"
+                    "}\n"
+                    "C_val[lo] += a * v;", "B_", "k"), "A_") <<
+        "    }\n"
+        "}\n";
+
+    return source.str();
+}
+
+enum spgemm_stage {
+    spgemm_bound, spgemm_expand, spgemm_compact, spgemm_numeric
+};
+
+// Kernels of all stages are built at once for each context.
+static const detail::kernel_cache_entry& spgemm_kernel(
+        const cl::CommandQueue &queue, spgemm_stage stage)
+{
+    static detail::kernel_cache cache[4];
+
+    static const char *name[] = {
+        "spgemm_bound", "spgemm_expand", "spgemm_compact", "spgemm_numeric"
+    };
+
+    return detail::program_kernel(queue, cache, name, 4, stage, spgemm_source);
+}
+
+static void launch_kernel(const cl::CommandQueue &queue, const detail::kernel_cache_entry &k) {
+    queue.enqueueNDRangeKernel(k.kernel, cl::NullRange,
+            num_workgroups(qdev(queue)) * k.wgsize, k.wgsize);
+}
+
+// Symbolic phase: finds sparsity pattern of A * B and makes it the local
+// part of this matrix. Each row of A is expanded into the (unsorted) list
+// of columns of the corresponding rows of B, the list is sorted, and
+// duplicates are removed.
+void symbolic_product(const SpMat &A, const SpMat &B) {
+    const size_t n = nrows;
+
+    if (!n) return;
+
+    cl::Context context = qctx(queue[0]);
+
+    std::vector<idx_t> row(n + 1, 0);
+    cl::Buffer col, val;
+
+    if (A.mtx[0] && B.mtx[0]) {
+        // Upper bound of each row width.
+        std::vector<idx_t> cnt(n);
+        cl::Buffer dcnt(context, CL_MEM_READ_WRITE, bytes(cnt));
+
+        {
+            const detail::kernel_cache_entry &k = spgemm_kernel(queue[0], spgemm_bound);
+            cl::Kernel krn = k.kernel;
+
+            unsigned pos = 0;
+            krn.setArg(pos++, n);
+            A.mtx[0]->hell_args(krn, pos, false);
+            B.mtx[0]->hell_args(krn, pos, false);
+            krn.setArg(pos++, dcnt);
+
+            launch_kernel(queue[0], k);
+        }
+
+        queue[0].enqueueReadBuffer(dcnt, CL_TRUE, 0, bytes(cnt), cnt.data());
+
+        std::vector<idx_t> ptr(n + 1);
+        ptr[0] = 0;
+        for(size_t i = 0; i < n; ++i) ptr[i + 1] = ptr[i] + cnt[i];
+
+        if (ptr[n]) {
+            // Expand, sort, and compress each row.
+            cl::Buffer dptr(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(ptr), ptr.data());
+            cl::Buffer dtmp(context, CL_MEM_READ_WRITE, ptr[n] * sizeof(col_t));
+
+            {
+                const detail::kernel_cache_entry &k = spgemm_kernel(queue[0], spgemm_expand);
+                cl::Kernel krn = k.kernel;
+
+                unsigned pos = 0;
+                krn.setArg(pos++, n);
+                A.mtx[0]->hell_args(krn, pos, false);
+                B.mtx[0]->hell_args(krn, pos, false);
+                krn.setArg(pos++, dptr);
+                krn.setArg(pos++, dtmp);
+                krn.setArg(pos++, dcnt);
+
+                launch_kernel(queue[0], k);
+            }
+
+            queue[0].enqueueReadBuffer(dcnt, CL_TRUE, 0, bytes(cnt), cnt.data());
+
+            for(size_t i = 0; i < n; ++i) row[i + 1] = row[i] + cnt[i];
+
+            col = cl::Buffer(context, CL_MEM_READ_WRITE, row[n] * sizeof(col_t));
+            val = cl::Buffer(context, CL_MEM_READ_WRITE, row[n] * sizeof(mat_t));
+
+            cl::Buffer drow(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(row), row.data());
+
+            {
+                const detail::kernel_cache_entry &k = spgemm_kernel(queue[0], spgemm_compact);
+                cl::Kernel krn = k.kernel;
+
+                unsigned pos = 0;
+                krn.setArg(pos++, n);
+                krn.setArg(pos++, dptr);
+                krn.setArg(pos++, dtmp);
+                krn.setArg(pos++, drow);
+                krn.setArg(pos++, col);
+
+                launch_kernel(queue[0], k);
+            }
+
+            // Temporary buffers are released after the kernel is done.
+            queue[0].finish();
+        }
+    }
+
+    nnz = row[n];
+    nnz_part[1] = nnz;
+
+    SpMatCSR *C = new SpMatCSR(queue[0], row, col, val);
+    mtx[0].reset(C);
+    fmt[0] = C->loc.nnz ? C->loc.kernel : spmat_csr_scalar;
+}
+
+// Numeric phase: computes values of A * B for the pattern found by
+// symbolic_product(). One work-item per row accumulates the product terms
+// in order, so the result is deterministic.
+void numeric_product(const SpMat &A, const SpMat &B) {
+    const SpMatCSR *C = static_cast<const SpMatCSR*>(mtx[0].get());
+
+    if (!C || !C->loc.nnz) return;
+
+    const detail::kernel_cache_entry &k = spgemm_kernel(queue[0], spgemm_numeric);
+    cl::Kernel krn = k.kernel;
+
+    unsigned pos = 0;
+    krn.setArg(pos++, nrows);
+    A.mtx[0]->hell_args(krn, pos, false);
+    B.mtx[0]->hell_args(krn, pos, false);
+    krn.setArg(pos++, C->loc.row);
+    krn.setArg(pos++, C->loc.col);
+    krn.setArg(pos++, C->loc.val);
+
+    launch_kernel(queue[0], k);
+}
+
+#endif
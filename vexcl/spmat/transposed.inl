@@ -0,0 +1,363 @@
+#ifndef VEXCL_SPMAT_TRANSPOSED_INL
+#define VEXCL_SPMAT_TRANSPOSED_INL
+
+/*
+The MIT License
+
+Copyright (c) 2012-2013 Denis Demidov <ddemidov@ksu.ru>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+/**
+ * \file   vexcl/spmat/transposed.inl
+ * \author Denis Demidov <ddemidov@ksu.ru>
+ * \brief  Transposed product of a sparse matrix.
+ */
+
+// Both methods of transposed product walk rows of local and remote parts of
+// the matrix through hybrid ELL arguments (see SpMatHELL::inline_preamble()),
+// so that each storage format may be transposed.
+
+// Transposed local and remote parts of each device (built on first use of
+// transpose_cached method).
+mutable std::vector< std::unique_ptr<SpMatCSR> > tloc;
+mutable std::vector< std::unique_ptr<SpMatCSR> > trem;
+
+// Parameters of a matrix part. Prefix p allows to pass several matrices to
+// the same kernel (see spgemm.inl).
+static std::string hell_parameters(const std::string &p = "") {
+    std::ostringstream s;
+    s <<
+        "    " << type_name<size_t>() << " " << p << "ell_w,\n"
+        "    " << type_name<size_t>() << " " << p << "ell_pitch,\n"
+        "    global const col_t * " << p << "ell_col,\n"
+        "    global const mat_t * " << p << "ell_val,\n"
+        "    global const " << type_name<size_t>() << " * " << p << "sell_ptr,\n"
+        "    global const " << type_name<size_t>() << " * " << p << "sell_pos,\n"
+        "    global const " << type_name<idx_t>() << " * " << p << "csr_row,\n"
+        "    global const col_t * " << p << "csr_col,\n"
+        "    global const mat_t * " << p << "csr_val,\n";
+    return s.str();
+}
+
+// Applies body to each nonzero (column c, value v) of row i of the matrix
+// with parameter prefix p.
+static std::string hell_row(const std::string &body,
+        const std::string &p = "", const std::string &i = "i")
+{
+    std::ostringstream s;
+    s <<
+        "        for(size_t " << p << "j = 0; " << p << "j < " << p << "ell_w; ++" << p << "j) {\n"
+        "            col_t c = " << p << "ell_col[" << i << " + " << p << "j * " << p << "ell_pitch];\n"
+        "            if (c != (col_t)(-1)) {\n"
+        "                mat_t v = " << p << "ell_val[" << i << " + " << p << "j * " << p << "ell_pitch];\n"
+        "                " << body << "\n"
+        "            }\n"
+        "        }\n"
+        "        if (" << p << "sell_ptr) {\n"
+        "            size_t " << p << "sp = " << p << "sell_pos[" << i << "];\n"
+        "            size_t " << p << "sl = " << p << "sp / " << p << "ell_pitch;\n"
+        "            for(size_t " << p << "j = " << p << "sell_ptr[" << p << "sl] + " << p << "sp % " << p << "ell_pitch, "
+                            << p << "e = " << p << "sell_ptr[" << p << "sl + 1]; " << p << "j < " << p << "e; " << p << "j += " << p << "ell_pitch) {\n"
+        "                col_t c = " << p << "ell_col[" << p << "j];\n"
+        "                if (c != (col_t)(-1)) {\n"
+        "                    mat_t v = " << p << "ell_val[" << p << "j];\n"
+        "                    " << body << "\n"
+        "                }\n"
+        "            }\n"
+        "        }\n"
+        "        if (" << p << "csr_row) {\n"
+        "            for(size_t " << p << "j = " << p << "csr_row[" << i << "], " << p << "e = " << p << "csr_row[" << i << " + 1]; " << p << "j < " << p << "e; ++" << p << "j) {\n"
+        "                col_t c = " << p << "csr_col[" << p << "j];\n"
+        "                mat_t v = " << p << "csr_val[" << p << "j];\n"
+        "                " << body << "\n"
+        "            }\n"
+        "        }\n";
+    return s.str();
+}
+
+// Atomic addition for val_t. Floating point values are updated with
+// compare-and-swap loop on their bit representation.
+static std::string atomic_add_function() {
+    const bool wide = sizeof(val_t) == 8;
+
+    std::ostringstream s;
+
+    if (wide) s << "#pragma OPENCL EXTENSION cl_khr_int64_base_atomics : enable\n";
+
+    s << "void atomic_add_val(global val_t * p, val_t v) {\n";
+
+    if (std::is_floating_point<val_t>::value) {
+        const char *bits = wide ? "ulong" : "uint";
+
+        s <<
+            "    union { val_t f; " << bits << " i; } a, b;\n"
+            "    do {\n"
+            "        a.f = *(volatile global val_t *)p;\n"
+            "        b.f = a.f + v;\n"
+            "    } while (" << (wide ? "atom_cmpxchg" : "atomic_cmpxchg")
+            << "((volatile global " << bits << " *)p, a.i, b.i) != a.i);\n";
+    } else {
+        s << "    " << (wide ? "atom_add" : "atomic_add") << "(p, v);\n";
+    }
+
+    s << "}\n";
+
+    return s.str();
+}
+
+// Scatters alpha * A^T x for local or remote part of device d into y with
+// atomic additions.
+void scatter_transposed(unsigned d, bool remote,
+        const cl::Buffer &x, const cl::Buffer &y, scalar_type alpha,
+        cl::Event *done = 0) const
+{
+    using namespace detail;
+
+    static kernel_cache cache;
+
+    cl::Context context = qctx(queue[d]);
+    cl::Device  device  = qdev(queue[d]);
+
+    auto kernel = cache.find(context());
+
+    if (kernel == cache.end()) {
+        std::ostringstream source;
+
+        source << standard_kernel_header(device) <<
+            "typedef " << type_name<val_t>() << " val_t;\n"
+            "typedef " << type_name<mat_t>() << " mat_t;\n"
+            "typedef " << type_name<col_t>() << " col_t;\n"
+            << atomic_add_function() <<
+            "kernel void hell_spmv_t(\n"
+            "    " << type_name<size_t>() << " n,\n"
+            "    val_t scale,\n"
+            << hell_parameters() <<
+            "    global const val_t * x,\n"
+            "    global val_t * y\n"
+            "    )\n"
+            "{\n"
+            "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+            "        val_t xi = scale * x[i];\n"
+            << hell_row("atomic_add_val(y + c, v * xi);") <<
+            "    }\n"
+            "}\n";
+
+        auto program = build_sources(context, source.str());
+
+        cl::Kernel krn(program, "hell_spmv_t");
+        size_t     wgs = kernel_workgroup_size(krn, device);
+
+        kernel = cache.insert(std::make_pair(
+                    context(), kernel_cache_entry(krn, wgs)
+                    )).first;
+    }
+
+    cl::Kernel krn    = kernel->second.kernel;
+    size_t     wgsize = kernel->second.wgsize;
+    size_t     g_size = num_workgroups(device) * wgsize;
+
+    unsigned pos = 0;
+    krn.setArg(pos++, part[d + 1] - part[d]);
+    krn.setArg(pos++, alpha);
+    mtx[d]->hell_args(krn, pos, remote);
+    krn.setArg(pos++, x);
+    krn.setArg(pos++, y);
+
+    queue[d].enqueueNDRangeKernel(krn, cl::NullRange, g_size, wgsize, NULL, done);
+}
+
+// Builds transpose of local or remote part of device d in CSR format on the
+// device. m is the number of local or ghost columns. Nonzeros are counted
+// and placed into rows of the transposed matrix with atomic operations, so
+// each row is sorted afterwards to make the product deterministic.
+SpMatCSR* transpose_part(unsigned d, bool remote, size_t m) const {
+    using namespace detail;
+
+    static kernel_cache count_cache, fill_cache, sort_cache;
+
+    if (!m) return 0;
+
+    cl::Context context = qctx(queue[d]);
+    cl::Device  device  = qdev(queue[d]);
+
+    auto count = count_cache.find(context());
+
+    if (count == count_cache.end()) {
+        std::ostringstream source;
+
+        source << standard_kernel_header(device) <<
+            "typedef " << type_name<val_t>() << " val_t;\n"
+            "typedef " << type_name<mat_t>() << " mat_t;\n"
+            "typedef " << type_name<col_t>() << " col_t;\n"
+            "typedef " << type_name<idx_t>() << " idx_t;\n"
+            "kernel void hell_count_t(\n"
+            "    " << type_name<size_t>() << " n,\n"
+            << hell_parameters() <<
+            "    global uint * cnt\n"
+            "    )\n"
+            "{\n"
+            "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+            << hell_row("atomic_inc(cnt + c);") <<
+            "    }\n"
+            "}\n"
+            "kernel void hell_fill_t(\n"
+            "    " << type_name<size_t>() << " n,\n"
+            << hell_parameters() <<
+            "    global uint * pos,\n"
+            "    global col_t * tcol,\n"
+            "    global mat_t * tval\n"
+            "    )\n"
+            "{\n"
+            "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+            << hell_row("uint k = atomic_inc(pos + c); tcol[k] = i; tval[k] = v;") <<
+            "    }\n"
+            "}\n"
+            "kernel void csr_sort_rows(\n"
+            "    " << type_name<size_t>() << " n,\n"
+            "    global const idx_t * row,\n"
+            "    global col_t * col,\n"
+            "    global mat_t * val\n"
+            "    )\n"
+            "{\n"
+            "    for(size_t i = get_global_id(0); i < n; i += get_global_size(0)) {\n"
+            "        size_t beg = row[i], end = row[i + 1];\n"
+            "        for(size_t j = beg + 1; j < end; ++j) {\n"
+            "            col_t c = col[j];\n"
+            "            mat_t v = val[j];\n"
+            "            size_t k = j;\n"
+            "            for(; k > beg && col[k - 1] > c; --k) {\n"
+            "                col[k] = col[k - 1];\n"
+            "                val[k] = val[k - 1];\n"
+            "            }\n"
+            "            col[k] = c;\n"
+            "            val[k] = v;\n"
+            "        }\n"
+            "    }\n"
+            "}\n";
+
+        auto program = build_sources(context, source.str());
+
+        cl::Kernel count_krn(program, "hell_count_t");
+        cl::Kernel fill_krn (program, "hell_fill_t");
+        cl::Kernel sort_krn (program, "csr_sort_rows");
+
+        count = count_cache.insert(std::make_pair(context(),
+                    kernel_cache_entry(count_krn, kernel_workgroup_size(count_krn, device))
+                    )).first;
+
+        fill_cache.insert(std::make_pair(context(),
+                    kernel_cache_entry(fill_krn, kernel_workgroup_size(fill_krn, device))));
+
+        sort_cache.insert(std::make_pair(context(),
+                    kernel_cache_entry(sort_krn, kernel_workgroup_size(sort_krn, device))));
+    }
+
+    auto fill = fill_cache.find(context());
+    auto sort = sort_cache.find(context());
+
+    const size_t n = part[d + 1] - part[d];
+
+    // Count nonzeros in each column.
+    std::vector<cl_uint> cnt(m, 0);
+    cl::Buffer dcnt(context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR, bytes(cnt), cnt.data());
+
+    {
+        cl::Kernel krn = count->second.kernel;
+        size_t wgsize  = count->second.wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, n);
+        mtx[d]->hell_args(krn, pos, remote);
+        krn.setArg(pos++, dcnt);
+
+        queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                num_workgroups(device) * wgsize, wgsize);
+    }
+
+    queue[d].enqueueReadBuffer(dcnt, CL_TRUE, 0, bytes(cnt), cnt.data());
+
+    std::vector<idx_t> row(m + 1);
+    row[0] = 0;
+    for(size_t i = 0; i < m; ++i)
+        row[i + 1] = row[i] + static_cast<idx_t>(cnt[i]);
+
+    const size_t nnz = row[m];
+    if (!nnz) return 0;
+
+    // Place nonzeros into rows of the transposed matrix.
+    for(size_t i = 0; i < m; ++i) cnt[i] = static_cast<cl_uint>(row[i]);
+    queue[d].enqueueWriteBuffer(dcnt, CL_FALSE, 0, bytes(cnt), cnt.data());
+
+    cl::Buffer drow(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, bytes(row), row.data());
+    cl::Buffer dcol(context, CL_MEM_READ_WRITE, nnz * sizeof(col_t));
+    cl::Buffer dval(context, CL_MEM_READ_WRITE, nnz * sizeof(mat_t));
+
+    {
+        cl::Kernel krn = fill->second.kernel;
+        size_t wgsize  = fill->second.wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, n);
+        mtx[d]->hell_args(krn, pos, remote);
+        krn.setArg(pos++, dcnt);
+        krn.setArg(pos++, dcol);
+        krn.setArg(pos++, dval);
+
+        queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                num_workgroups(device) * wgsize, wgsize);
+    }
+
+    {
+        cl::Kernel krn = sort->second.kernel;
+        size_t wgsize  = sort->second.wgsize;
+
+        unsigned pos = 0;
+        krn.setArg(pos++, m);
+        krn.setArg(pos++, drow);
+        krn.setArg(pos++, dcol);
+        krn.setArg(pos++, dval);
+
+        queue[d].enqueueNDRangeKernel(krn, cl::NullRange,
+                num_workgroups(device) * wgsize, wgsize);
+    }
+
+    // Host copy of cnt has to outlive the non-blocking write.
+    queue[d].finish();
+
+    return new SpMatCSR(queue[d], row, dcol, dval);
+}
+
+void build_transposed() const {
+    if (!tloc.empty()) return;
+
+    tloc.resize(queue.size());
+    trem.resize(queue.size());
+
+    for(unsigned d = 0; d < queue.size(); d++) {
+        if (!mtx[d]) continue;
+
+        tloc[d].reset(transpose_part(d, false, col_part[d + 1] - col_part[d]));
+        trem[d].reset(transpose_part(d, true, xchg.ghosts(d)));
+    }
+}
+
+#endif
@@ -316,6 +316,24 @@ class stencil : private stencil_base<T> {
          */
         void convolve(const vex::vector<T> &x, vex::vector<T> &y,
                 T alpha = 0, T beta = 1) const;
+
+        /// \cond INTERNAL
+
+        // Convolution inlined into a vector expression (see
+        // vex::traits::local_transform). Halos should be exchanged with
+        // start_remote() before the kernel is launched.
+        static std::string inline_preamble(const std::string &prm_name);
+        static std::string inline_parameters(const std::string &prm_name);
+        static std::string inline_expression(const std::string &prm_name);
+
+        void inline_arguments(cl::Kernel &krn, unsigned device, unsigned &pos,
+                const vex::vector<T> &x) const;
+
+        void start_remote(const vex::vector<T> &x) const {
+            Base::exchange_halos(x);
+        }
+
+        /// \endcond
     private:
         typedef stencil_base<T> Base;
 
@@ -579,6 +597,202 @@ void stencil<T>::convolve(const vex::vector<T> &x, vex::vector<T> &y,
     }
 }
 
+template <typename T>
+std::string stencil<T>::inline_preamble(const std::string &prm_name) {
+    std::ostringstream s;
+
+    s << type_name<T>() << " stencil_conv_" << prm_name << "(\n"
+         "    " << type_name<size_t>() << " n,\n"
+         "    char has_left, char has_right,\n"
+         "    int lhalo, int rhalo,\n"
+         "    global const " << type_name<T>() << " *s,\n"
+         "    global const " << type_name<T>() << " *xloc,\n"
+         "    global const " << type_name<T>() << " *xrem,\n"
+         "    " << type_name<size_t>() << " idx\n"
+         "    )\n"
+         "{\n"
+         "    " << type_name<T>() << " sum = 0;\n"
+         "    for(int j = -lhalo; j <= rhalo; j++) {\n"
+         "        long g_id = (long)idx + j;\n"
+         "        " << type_name<T>() << " x;\n"
+         "        if (g_id >= 0 && g_id < n)\n"
+         "            x = xloc[g_id];\n"
+         "        else if (g_id < 0)\n"
+         "            x = has_left ? ((lhalo + g_id >= 0) ? xrem[lhalo + g_id] : 0) : xloc[0];\n"
+         "        else\n"
+         "            x = has_right ? ((g_id < n + rhalo) ? xrem[lhalo + g_id - n] : 0) : xloc[n - 1];\n"
+         "        sum += s[lhalo + j] * x;\n"
+         "    }\n"
+         "    return sum;\n"
+         "}\n";
+
+    return s.str();
+}
+
+template <typename T>
+std::string stencil<T>::inline_parameters(const std::string &prm_name) {
+    std::ostringstream s;
+
+    s << ",\n\t" << type_name<size_t>() << " " << prm_name << "_n"
+         ",\n\tchar " << prm_name << "_has_left"
+         ",\n\tchar " << prm_name << "_has_right"
+         ",\n\tint " << prm_name << "_lhalo"
+         ",\n\tint " << prm_name << "_rhalo"
+         ",\n\tglobal const " << type_name<T>() << " * " << prm_name << "_s"
+         ",\n\tglobal const " << type_name<T>() << " * " << prm_name << "_xloc"
+         ",\n\tglobal const " << type_name<T>() << " * " << prm_name << "_xrem";
+
+    return s.str();
+}
+
+template <typename T>
+std::string stencil<T>::inline_expression(const std::string &prm_name) {
+    std::ostringstream s;
+
+    s << "stencil_conv_" << prm_name << "("
+      << prm_name << "_n, "
+      << prm_name << "_has_left, "
+      << prm_name << "_has_right, "
+      << prm_name << "_lhalo, "
+      << prm_name << "_rhalo, "
+      << prm_name << "_s, "
+      << prm_name << "_xloc, "
+      << prm_name << "_xrem, idx)";
+
+    return s.str();
+}
+
+template <typename T>
+void stencil<T>::inline_arguments(cl::Kernel &krn, unsigned device, unsigned &pos,
+        const vex::vector<T> &x) const
+{
+    char has_left  = device > 0;
+    char has_right = device + 1 < queue.size();
+
+    krn.setArg(pos++, x.part_size(device));
+    krn.setArg(pos++, has_left);
+    krn.setArg(pos++, has_right);
+    krn.setArg(pos++, lhalo);
+    krn.setArg(pos++, rhalo);
+    krn.setArg(pos++, s[device]);
+    krn.setArg(pos++, x(device));
+    krn.setArg(pos++, dbuf[device]);
+}
+
+/// \cond INTERNAL
+
+struct inline_conv_terminal {};
+
+typedef vector_expression<
+    typename boost::proto::terminal< inline_conv_terminal >::type
+    > inline_conv_terminal_expression;
+
+template <typename T>
+struct inline_conv : inline_conv_terminal_expression {
+    typedef T value_type;
+
+    const stencil<T> &s;
+    const vector<T>  &x;
+
+    inline_conv(const stencil<T> &s, const vector<T> &x) : s(s), x(x) {}
+};
+
+namespace traits {
+
+template <>
+struct is_vector_expr_terminal< inline_conv_terminal > : std::true_type {};
+
+template <>
+struct proto_terminal_is_value< inline_conv_terminal > : std::true_type {};
+
+template <typename T>
+struct terminal_preamble< inline_conv<T> > {
+    static std::string get(const inline_conv<T>&,
+            const cl::Device&, const std::string &prm_name,
+            detail::kernel_generator_state_ptr)
+    {
+        return stencil<T>::inline_preamble(prm_name);
+    }
+};
+
+template <typename T>
+struct kernel_param_declaration< inline_conv<T> > {
+    static std::string get(const inline_conv<T>&,
+            const cl::Device&, const std::string &prm_name,
+            detail::kernel_generator_state_ptr)
+    {
+        return stencil<T>::inline_parameters(prm_name);
+    }
+};
+
+template <typename T>
+struct partial_vector_expr< inline_conv<T> > {
+    static std::string get(const inline_conv<T>&,
+            const cl::Device&, const std::string &prm_name,
+            detail::kernel_generator_state_ptr)
+    {
+        return stencil<T>::inline_expression(prm_name);
+    }
+};
+
+template <typename T>
+struct kernel_arg_setter< inline_conv<T> > {
+    static void set(const inline_conv<T> &term,
+            cl::Kernel &kernel, unsigned device, size_t/*index_offset*/,
+            unsigned &position, detail::kernel_generator_state_ptr)
+    {
+        term.s.inline_arguments(kernel, device, position, term.x);
+    }
+};
+
+template <typename T>
+struct expression_properties< inline_conv<T> > {
+    static void get(const inline_conv<T> &term,
+            std::vector<cl::CommandQueue> &queue_list,
+            std::vector<size_t> &partition,
+            size_t &size
+            )
+    {
+        expression_properties< vector<T> >::get(term.x, queue_list, partition, size);
+    }
+};
+
+// Stencil convolution may be computed inside of a vector expression kernel
+// once the halos are exchanged.
+template <typename T>
+struct local_transform< conv< stencil<T>, vector<T> > > : std::true_type {
+    typedef conv< stencil<T>, vector<T> > term_type;
+
+    typedef typename boost::proto::result_of::make_expr<
+                boost::proto::tag::multiplies, vector_domain,
+                T, inline_conv<T>
+            >::type type;
+
+    static type get(const term_type &t) {
+        return boost::proto::make_expr<boost::proto::tag::multiplies, vector_domain>(
+                t.scale, inline_conv<T>(t.s, t.x));
+    }
+
+    static const void* owner(const term_type &t) {
+        return t.x.nparts() > 1 ? &t.s : 0;
+    }
+
+    static bool fusable(const term_type&) { return true; }
+
+    static void start(const term_type &t, const vector<T> &y) {
+        precondition(t.x.partition() == y.partition(),
+                "Vector partitioning does not match");
+
+        t.s.start_remote(t.x);
+    }
+
+    static void finish(const term_type&, vector<T>&, bool) {}
+};
+
+} // namespace traits
+
+/// \endcond
+
 template <typename T>
 conv< stencil<T>, vector<T> >
 operator*( const stencil<T> &s, const vector<T> &x ) {
@@ -96,6 +96,8 @@ struct partitioning_scheme {
 
     static std::vector<size_t> get(size_t n, const std::vector<cl::CommandQueue> &queue);
 
+    static std::vector<double> weights(const std::vector<cl::CommandQueue> &queue);
+
     private:
         static bool is_set;
         static weight_function weight;
@@ -109,7 +111,7 @@ template <bool dummy>
 std::map<cl_device_id, double> partitioning_scheme<dummy>::device_weight;
 
 template <bool dummy>
-std::vector<size_t> partitioning_scheme<dummy>::get(size_t n,
+std::vector<double> partitioning_scheme<dummy>::weights(
         const std::vector<cl::CommandQueue> &queue)
 {
     if (!is_set) {
@@ -117,26 +119,40 @@ std::vector<size_t> partitioning_scheme<dummy>::get(size_t n,
         is_set = true;
     }
 
+    std::vector<double> w;
+    w.reserve(queue.size());
+
+    for(auto q = queue.begin(); q != queue.end(); q++) {
+        cl::Device  device  = qdev(*q);
+
+        auto dw = device_weight.find(device());
+
+        w.push_back( (dw == device_weight.end()) ?
+                (device_weight[device()] = weight(*q)) :
+                dw->second
+                );
+    }
+
+    return w;
+}
+
+template <bool dummy>
+std::vector<size_t> partitioning_scheme<dummy>::get(size_t n,
+        const std::vector<cl::CommandQueue> &queue)
+{
     std::vector<size_t> part;
     part.reserve(queue.size() + 1);
     part.push_back(0);
 
     if (queue.size() > 1) {
+        std::vector<double> w = weights(queue);
+
         std::vector<double> cumsum;
         cumsum.reserve(queue.size() + 1);
         cumsum.push_back(0);
 
-        for(auto q = queue.begin(); q != queue.end(); q++) {
-            cl::Device  device  = qdev(*q);
-
-            auto dw = device_weight.find(device());
-
-            double w = (dw == device_weight.end()) ?
-                (device_weight[device()] = weight(*q)) :
-                dw->second;
-
-            cumsum.push_back(cumsum.back() + w);
-        }
+        for(auto v = w.begin(); v != w.end(); v++)
+            cumsum.push_back(cumsum.back() + *v);
 
         for(unsigned d = 1; d < queue.size(); d++)
             part.push_back(
@@ -174,6 +190,29 @@ inline std::vector<size_t> partition(size_t n,
     return partitioning_scheme<>::get(n, queue);
 }
 
+/// Relative weights of compute devices used by the partitioning scheme.
+inline std::vector<double> device_weights(
+        const std::vector<cl::CommandQueue> &queue)
+{
+    return partitioning_scheme<>::weights(queue);
+}
+
+/// Explicit partitioning of a vector across compute devices.
+/**
+ * part[d] is the index of the first element stored on device d, and
+ * part.back() is the vector size. Used to allocate vectors that have to
+ * share non-default partitioning with a sparse matrix.
+ */
+struct partitioning {
+    std::vector<size_t> part;
+
+    partitioning() {}
+    explicit partitioning(std::vector<size_t> part) : part(std::move(part)) {}
+
+    /// Size of the partitioned vector.
+    size_t size() const { return part.empty() ? 0 : part.back(); }
+};
+
 /// \cond INTERNAL
 
 //--- Vector Type -----------------------------------------------------------
@@ -396,6 +435,19 @@ class vector : public vector_terminal_expression {
             if (size) allocate_buffers(flags, host);
         }
 
+        /// Copy host data to the new buffer, use explicit partitioning.
+        vector(const std::vector<cl::CommandQueue> &queue,
+                const partitioning &p, const T *host = 0,
+                cl_mem_flags flags = CL_MEM_READ_WRITE
+              ) : queue(queue), part(p.part),
+                  buf(queue.size()), event(queue.size())
+        {
+            precondition(part.size() == queue.size() + 1,
+                    "Partitioning does not match the number of devices");
+
+            if (size()) allocate_buffers(flags, host);
+        }
+
 #ifndef VEXCL_NO_STATIC_CONTEXT_CONSTRUCTORS
         /// Copy host data to the new buffer, use static context.
         vector(size_t size, const T *host,
@@ -746,8 +798,12 @@ class vector : public vector_terminal_expression {
             const vector&
         >::type
         operator=(const Expr &expr) {
-            *this  = detail::extract_vector_expressions()( expr );
-            *this += detail::extract_additive_vector_transforms()( expr );
+            detail::assign_mixed_expression<assign::SET>(*this,
+                    detail::extract_vector_expressions()( expr ),
+                    detail::simplify_additive_transform()(
+                        detail::extract_additive_vector_transforms()( expr )
+                        )
+                    );
 
             return *this;
         }
@@ -765,8 +821,12 @@ class vector : public vector_terminal_expression {
             const vector&
         >::type
         operator+=(const Expr &expr) {
-            *this += detail::extract_vector_expressions()( expr );
-            *this += detail::extract_additive_vector_transforms()( expr );
+            detail::assign_mixed_expression<assign::ADD>(*this,
+                    detail::extract_vector_expressions()( expr ),
+                    detail::simplify_additive_transform()(
+                        detail::extract_additive_vector_transforms()( expr )
+                        )
+                    );
 
             return *this;
         }
@@ -784,8 +844,12 @@ class vector : public vector_terminal_expression {
             const vector&
         >::type
         operator-=(const Expr &expr) {
-            *this -= detail::extract_vector_expressions()( expr );
-            *this -= detail::extract_additive_vector_transforms()( expr );
+            detail::assign_mixed_expression<assign::SUB>(*this,
+                    detail::extract_vector_expressions()( expr ),
+                    detail::simplify_additive_transform()(
+                        detail::extract_additive_vector_transforms()( expr )
+                        )
+                    );
 
             return *this;
         }
@@ -962,6 +1026,52 @@ void copy(const T *hv, vex::vector<T> &dv, cl_bool blocking = CL_TRUE) {
 
 /// \cond INTERNAL
 
+namespace detail {
+
+// Copies size elements of a buffer that resides on the device of queue q
+// into the (possibly multi-device) vector dst, starting at dst_offset.
+// Partitions that share OpenCL context with the source buffer are copied
+// directly on the device; the rest are sent through the host.
+template <typename T>
+void copy_buffer_to_vector(
+        const cl::CommandQueue &q, const cl::Buffer &src, size_t src_offset,
+        size_t size, vector<T> &dst, size_t dst_offset
+        )
+{
+    if (!size) return;
+
+    const std::vector<cl::CommandQueue> &queue = dst.queue_list();
+
+    cl_context src_ctx = qctx(q)();
+    std::vector<T> hbuf;
+
+    q.finish();
+
+    for(unsigned d = 0; d < queue.size(); d++) {
+        size_t start = std::max(dst_offset,        dst.part_start(d));
+        size_t stop  = std::min(dst_offset + size, dst.part_start(d + 1));
+
+        if (stop <= start) continue;
+
+        size_t src_pos = src_offset + start - dst_offset;
+        size_t dst_pos = start - dst.part_start(d);
+        size_t count   = stop - start;
+
+        if (qctx(queue[d])() == src_ctx) {
+            queue[d].enqueueCopyBuffer(src, dst(d),
+                    src_pos * sizeof(T), dst_pos * sizeof(T), count * sizeof(T));
+        } else {
+            hbuf.resize(count);
+            q.enqueueReadBuffer(src, CL_TRUE,
+                    src_pos * sizeof(T), count * sizeof(T), hbuf.data());
+            queue[d].enqueueWriteBuffer(dst(d), CL_TRUE,
+                    dst_pos * sizeof(T), count * sizeof(T), hbuf.data());
+        }
+    }
+}
+
+} // namespace detail
+
 template<class Iterator, class Enable = void>
 struct stored_on_device : std::false_type {};
 
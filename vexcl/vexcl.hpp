@@ -40,7 +40,13 @@ THE SOFTWARE.
 #include <vexcl/temporary.hpp>
 #include <vexcl/multivector.hpp>
 #include <vexcl/reductor.hpp>
+#include <vexcl/reduce_by_key.hpp>
+#include <vexcl/scan.hpp>
+#include <vexcl/sort.hpp>
+#include <vexcl/copy_if.hpp>
+#include <vexcl/histogram.hpp>
 #include <vexcl/spmat.hpp>
+#include <vexcl/solver.hpp>
 #include <vexcl/stencil.hpp>
 #include <vexcl/gather.hpp>
 #include <vexcl/random.hpp>